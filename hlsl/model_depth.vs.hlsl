@@ -0,0 +1,9 @@
+#include "shader.hlsli"
+
+
+void main(sVSModelDepth vin, out float4 cpos : SV_POSITION)
+{
+	float4 pos = float4(vin.pos.xyz * g_posScale.xyz + g_posBias.xyz, 1);
+	float4 wpos = mul(pos, g_world);
+	cpos = mul(wpos, g_viewProj);
+}
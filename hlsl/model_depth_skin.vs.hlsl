@@ -0,0 +1,15 @@
+#include "shader.hlsli"
+
+
+void main(sVSModelDepthSkin vin, out float4 cpos : SV_POSITION)
+{
+	float4x4 w0 = g_skin[vin.jidx[0]] * vin.jwgt[0];
+	float4x4 w1 = g_skin[vin.jidx[1]] * vin.jwgt[1];
+	float4x4 w2 = g_skin[vin.jidx[2]] * vin.jwgt[2];
+	float4x4 w3 = g_skin[vin.jidx[3]] * vin.jwgt[3];
+	float4x4 world = w0 + w1 + w2 + w3;
+
+	float4 pos = float4(vin.pos.xyz * g_posScale.xyz + g_posBias.xyz, 1);
+	float4 wpos = mul(pos, world);
+	cpos = mul(wpos, g_viewProj);
+}
@@ -1,8 +1,9 @@
 #include "shader.hlsli"
 
 
-void main(sVSModel vin, out sPSModel vout)
+void main(sVSModelPacked vinPacked, out sPSModel vout)
 {
+	sVSModel vin = decode_vtx(vinPacked);
 	float4x4 w0 = g_skin[vin.jidx[0]] * vin.jwgt[0];
 	float4x4 w1 = g_skin[vin.jidx[1]] * vin.jwgt[1];
 	float4x4 w2 = g_skin[vin.jidx[2]] * vin.jwgt[2];
@@ -1,8 +1,9 @@
 #include "shader.hlsli"
 
 
-void main(sVSModel vin, out sPSModel vout)
+void main(sVSModelPacked vinPacked, out sPSModel vout)
 {
+	sVSModel vin = decode_vtx(vinPacked);
 	float4 pos = float4(vin.pos.xyz, 1);
 	float4 wpos = mul(pos, g_world);
 	float4 cpos = mul(wpos, g_viewProj);
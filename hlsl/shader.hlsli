@@ -10,18 +10,41 @@ struct sPSSimple{
 	float4 clr : COLOR0;
 };
 
-struct sVSModel {
-	float3 pos : POSITION;
-	float3 nrm : NORMAL;
+// sModelVtxPacked, see decode_vtx
+struct sVSModelPacked {
+	float4 pos : POSITION;
+	float2 nrm : NORMAL;
 	float2 uv : TEXCOORD;
-	float4 tgt : TANGENT;
-	float3 bitgt : BITANGENT;
+	float2 tgt : TANGENT;
 	float2 uv1 : TEXCOORD1;
-	float3 clr : COLOR;
-	int4   jidx : BLENDINDEX;
+	float4 clr : COLOR;
+	uint4  jidx : BLENDINDEX;
 	float4 jwgt : BLENDWEIGHT;
 };
 
+// Position-only streams of the depth passes, see sModelVtxDepth
+struct sVSModelDepth {
+	float4 pos : POSITION;
+};
+
+struct sVSModelDepthSkin {
+	float4 pos : POSITION;
+	uint4  jidx : BLENDINDEX;
+	float4 jwgt : BLENDWEIGHT;
+};
+
+struct sVSModel {
+	float3 pos;
+	float3 nrm;
+	float2 uv;
+	float4 tgt;
+	float3 bitgt;
+	float2 uv1;
+	float3 clr;
+	int4   jidx;
+	float4 jwgt;
+};
+
 struct sPSModel {
 	float4 cpos : SV_POSITION;
 	float4 wpos : POSITION;
@@ -47,6 +70,8 @@ cbuffer Camera : register(b0) {
 
 cbuffer Mesh : register(b1) {
 	float4x4 g_world;
+	float4   g_posScale;
+	float4   g_posBias;
 };
 
 cbuffer TestMtl : register(b2) {
@@ -86,3 +111,25 @@ SamplerState g_meshMaskSmp : register(s3);
 static const float g_gamma = 2.2;
 
 #define PI 3.14159265
+
+float3 oct_decode(float2 e) {
+	float3 v = float3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = saturate(-v.z);
+	v.xy += v.xy >= 0.0 ? -t : t;
+	return normalize(v);
+}
+
+sVSModel decode_vtx(sVSModelPacked vin) {
+	sVSModel vtx;
+	vtx.pos = vin.pos.xyz * g_posScale.xyz + g_posBias.xyz;
+	vtx.nrm = oct_decode(vin.nrm);
+	vtx.uv = vin.uv;
+	float flip = vin.pos.w > 0.5 ? 1.0 : -1.0;
+	vtx.tgt = float4(oct_decode(vin.tgt), flip);
+	vtx.bitgt = cross(vtx.nrm, vtx.tgt.xyz) * flip;
+	vtx.uv1 = vin.uv1;
+	vtx.clr = vin.clr.rgb;
+	vtx.jidx = (int4)vin.jidx;
+	vtx.jwgt = vin.jwgt;
+	return vtx;
+}
@@ -50,7 +50,8 @@ public:
 public:
 	~cChannel();
 
-	void eval(DirectX::XMVECTOR& vec, float frame) const;
+	// fastSlerp picks nVM::quat_slerp_fast over nVM::quat_slerp for E_EXPR_QLINEAR
+	void eval(nVM::V4& vec, float frame, bool fastSlerp = true) const;
 private:
 
 	void find_keyframe(int comp, float frame, sKeyframe const*& pKfrA, sKeyframe const*& pKfrB) const;
@@ -89,7 +90,7 @@ public:
 	~cAnimation();
 	void init(cAnimationData const& animData, cRigData const& rigData);
 
-	void eval(cRig& rig, float frame) const;
+	void eval(cRig& rig, float frame, bool fastSlerp = true) const;
 
 	float get_last_frame() const {
 		return mpAnimData->mLastFrame;
@@ -1,3 +1,4 @@
+#include "vmath.hpp"
 #include "math.hpp"
 #include "common.hpp"
 #include "camera.hpp"
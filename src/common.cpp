@@ -1,23 +1,38 @@
 #include "common.hpp"
 
 #include <cstdarg>
+#include <cstdio>
 #include <functional>
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
 #include <Windows.h>
 
+static void dbg_out(char const* msg) {
+	::OutputDebugStringA(msg);
+}
+#else
+static void dbg_out(char const* msg) {
+	::fputs(msg, stderr);
+}
+#endif
+
 void dbg_msg1(cstr format) {
-	::OutputDebugStringA(format);
+	dbg_out(format);
 }
 
 void dbg_msg(cstr format, ...) {
 	 char msg[1024];
 	 va_list va;
 	 va_start(va, format);
+#ifdef _MSC_VER
 	 ::vsprintf_s(msg, format, va);
+#else
+	 ::vsnprintf(msg, sizeof(msg), format, va);
+#endif
 	 va_end(va);
-	 ::OutputDebugStringA(msg);
+	 dbg_out(msg);
 }
 
 // See http://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
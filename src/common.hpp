@@ -1,6 +1,10 @@
 #include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cassert>
 #include <algorithm>
 #include <type_traits>
+#include <stdexcept>
 
 template <std::size_t N> struct type_of_lenght_helper { typedef char type[N]; };
 template <typename T, std::size_t Size> typename type_of_lenght_helper<Size>::type& lenghtof_for_static_arrays_helper(T(&)[Size]);
@@ -117,13 +121,25 @@ struct com_ptr {
 	}
 };
 
+#ifdef _MSC_VER
+#	define ALIGN(n) __declspec(align(n))
+#else
+#	define ALIGN(n) __attribute__((aligned(n)))
+
+inline void* _aligned_malloc(size_t size, size_t align) {
+	void* p = nullptr;
+	return ::posix_memalign(&p, align, size) == 0 ? p : nullptr;
+}
+inline void _aligned_free(void* p) { ::free(p); }
+#endif
+
 template <int A> struct aligned;
-template <> struct __declspec(align(1)) aligned < 1 > {};
-template <> struct __declspec(align(2)) aligned < 2 > {};
-template <> struct __declspec(align(4)) aligned < 4 > {};
-template <> struct __declspec(align(8)) aligned < 8 > {};
-template <> struct __declspec(align(16)) aligned < 16 > {};
-template <> struct __declspec(align(32)) aligned < 32 > {};
+template <> struct ALIGN(1) aligned < 1 > {};
+template <> struct ALIGN(2) aligned < 2 > {};
+template <> struct ALIGN(4) aligned < 4 > {};
+template <> struct ALIGN(8) aligned < 8 > {};
+template <> struct ALIGN(16) aligned < 16 > {};
+template <> struct ALIGN(32) aligned < 32 > {};
 
 template <int size, int align>
 union aligned_type {
@@ -166,15 +182,18 @@ public:
 	T& get() { return *reinterpret_cast<T*>(&mData); }
 	T const& get() const { return *reinterpret_cast<T const*>(&mData); }
 
-	operator T const& () const { return Get(); }
+	operator T const& () const { return get(); }
 };
 
 
-struct sD3DException : public std::exception {
+struct sD3DException : public std::runtime_error {
 	long hr;
-	sD3DException(long hr, char const* const msg) : std::exception(msg), hr(hr) {}
+	sD3DException(long hr, char const* const msg) : std::runtime_error(msg), hr(hr) {}
 };
 
 
 void dbg_msg1(cstr format);
 void dbg_msg(cstr format, ...);
+
+// Logs and fails the enclosing bool loader
+#define CHECK_SCHEMA(x, msg, ...) do { if (!(x)) { dbg_msg(msg, ##__VA_ARGS__); return false; } } while(0)
@@ -0,0 +1,123 @@
+#include <d3d11.h>
+
+#include <algorithm>
+
+#include "common.hpp"
+#include "range_alloc.hpp"
+#include "geom_arena.hpp"
+
+cGeomArena::sPool* cGeomArena::find_vtx_pool(uint32_t vtxSize) {
+	for (auto& pool : mVtxPools) {
+		if (pool.mElemSize == vtxSize) return &pool;
+	}
+	for (auto& pool : mVtxPools) {
+		if (pool.mElemSize == 0) {
+			pool.mElemSize = vtxSize;
+			return &pool;
+		}
+	}
+	return nullptr;
+}
+
+cGeomArena::sPool* cGeomArena::find_idx_pool(uint32_t idxSize) {
+	switch (idxSize) {
+	case sizeof(uint16_t): mIdxPools[0].mElemSize = idxSize; return &mIdxPools[0];
+	case sizeof(uint32_t): mIdxPools[1].mElemSize = idxSize; return &mIdxPools[1];
+	}
+	return nullptr;
+}
+
+bool cGeomArena::alloc_vtx(ID3D11DeviceContext* pCtx, void const* pVtx, uint32_t vtxNum, uint32_t vtxSize, uint32_t& offset) {
+	sPool* pPool = find_vtx_pool(vtxSize);
+	if (!pPool) {
+		dbg_msg("geom arena: too many vertex formats\n");
+		return false;
+	}
+	return alloc(pCtx, *pPool, pVtx, vtxNum, D3D11_BIND_VERTEX_BUFFER, VTX_POOL_MIN, offset);
+}
+
+bool cGeomArena::alloc_idx(ID3D11DeviceContext* pCtx, void const* pIdx, uint32_t idxNum, uint32_t idxSize, uint32_t& offset) {
+	sPool* pPool = find_idx_pool(idxSize);
+	if (!pPool) {
+		dbg_msg("geom arena: bad index size %u\n", idxSize);
+		return false;
+	}
+	return alloc(pCtx, *pPool, pIdx, idxNum, D3D11_BIND_INDEX_BUFFER, IDX_POOL_MIN, offset);
+}
+
+void cGeomArena::free_vtx(uint32_t offset, uint32_t vtxNum, uint32_t vtxSize) {
+	sPool* pPool = find_vtx_pool(vtxSize);
+	if (pPool) {
+		pPool->mAlloc.free(offset, vtxNum);
+	}
+}
+
+void cGeomArena::free_idx(uint32_t offset, uint32_t idxNum, uint32_t idxSize) {
+	sPool* pPool = find_idx_pool(idxSize);
+	if (pPool) {
+		pPool->mAlloc.free(offset, idxNum);
+	}
+}
+
+bool cGeomArena::alloc(ID3D11DeviceContext* pCtx, sPool& pool, void const* pData, uint32_t num, D3D11_BIND_FLAG bind, uint32_t minNum, uint32_t& offset) {
+	if (num == 0) return false;
+	if (!pool.mAlloc.alloc(num, offset)) {
+		uint64_t size = pool.mAlloc.get_size();
+		uint64_t newNum = std::max({ size * 2, size + num, (uint64_t)minNum });
+		// Keep the byte size addressable by a D3D11 buffer
+		newNum = std::min(newNum, (uint64_t)UINT32_MAX / pool.mElemSize);
+		if (newNum < size + num || !grow(pCtx, pool, (uint32_t)newNum, bind)) {
+			dbg_msg("geom arena: can't fit %u elements of %u bytes\n", num, pool.mElemSize);
+			return false;
+		}
+		if (!pool.mAlloc.alloc(num, offset)) return false;
+	}
+
+	D3D11_BOX box = {};
+	box.left = offset * pool.mElemSize;
+	box.right = (offset + num) * pool.mElemSize;
+	box.bottom = 1;
+	box.back = 1;
+	pCtx->UpdateSubresource(pool.mpBuf, 0, &box, pData, 0, 0);
+	return true;
+}
+
+bool cGeomArena::grow(ID3D11DeviceContext* pCtx, sPool& pool, uint32_t newNum, D3D11_BIND_FLAG bind) {
+	auto desc = D3D11_BUFFER_DESC();
+	desc.ByteWidth = newNum * pool.mElemSize;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = bind;
+
+	com_ptr<ID3D11Buffer> pBuf;
+	HRESULT hr = mpDev->CreateBuffer(&desc, nullptr, pBuf.pp());
+	if (!SUCCEEDED(hr)) {
+		dbg_msg("geom arena: CreateBuffer of %u bytes failed: 0x%X\n", desc.ByteWidth, (uint32_t)hr);
+		return false;
+	}
+
+	if (pool.mpBuf) {
+		pCtx->CopySubresourceRegion(pBuf, 0, 0, 0, 0, pool.mpBuf, 0, nullptr);
+	}
+	pool.mpBuf = std::move(pBuf);
+	pool.mAlloc.grow(newNum);
+	dbg_msg("geom arena: %u byte elements grown to %u\n", pool.mElemSize, newNum);
+	return true;
+}
+
+void cGeomArena::set_vtx(ID3D11DeviceContext* pCtx, uint32_t slot, uint32_t vtxSize) const {
+	for (auto const& pool : mVtxPools) {
+		if (pool.mElemSize == vtxSize) {
+			UINT offset = 0;
+			pCtx->IASetVertexBuffers(slot, 1, &pool.mpBuf.p, &pool.mElemSize, &offset);
+			return;
+		}
+	}
+}
+
+void cGeomArena::set_idx(ID3D11DeviceContext* pCtx, uint32_t idxSize) const {
+	if (idxSize == sizeof(uint32_t)) {
+		pCtx->IASetIndexBuffer(mIdxPools[1].mpBuf, DXGI_FORMAT_R32_UINT, 0);
+	} else {
+		pCtx->IASetIndexBuffer(mIdxPools[0].mpBuf, DXGI_FORMAT_R16_UINT, 0);
+	}
+}
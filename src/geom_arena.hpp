@@ -0,0 +1,47 @@
+// Shared buffers the immutable model geometry is sub-allocated from: one vertex
+// buffer per vertex size and one index buffer per index size. Models of the same
+// formats draw from the same buffers, their offsets are in elements and go into
+// the DrawIndexed base vertex and start index. A full pool is moved into a larger
+// buffer on the GPU, offsets stay valid but the buffers must be set again.
+class cGeomArena : noncopyable {
+	struct sPool {
+		com_ptr<ID3D11Buffer> mpBuf;
+		cRangeAlloc mAlloc;
+		// 0 while unused
+		uint32_t mElemSize = 0;
+	};
+
+	enum { VTX_POOL_MAX = 4 };
+	// Initial pool sizes in elements
+	enum : uint32_t {
+		VTX_POOL_MIN = 256 * 1024,
+		IDX_POOL_MIN = 1024 * 1024,
+	};
+
+	ID3D11Device* mpDev;
+	sPool mVtxPools[VTX_POOL_MAX];
+	// 16 and 32-bit
+	sPool mIdxPools[2];
+
+public:
+	static cGeomArena& get();
+
+	cGeomArena(ID3D11Device* pDev) : mpDev(pDev) {}
+
+	// Copies the elements into the pool of their size and returns the first one in
+	// offset, fails if there are none or the pool can't grow to fit them
+	bool alloc_vtx(ID3D11DeviceContext* pCtx, void const* pVtx, uint32_t vtxNum, uint32_t vtxSize, uint32_t& offset);
+	bool alloc_idx(ID3D11DeviceContext* pCtx, void const* pIdx, uint32_t idxNum, uint32_t idxSize, uint32_t& offset);
+	void free_vtx(uint32_t offset, uint32_t vtxNum, uint32_t vtxSize);
+	void free_idx(uint32_t offset, uint32_t idxNum, uint32_t idxSize);
+
+	void set_vtx(ID3D11DeviceContext* pCtx, uint32_t slot, uint32_t vtxSize) const;
+	void set_idx(ID3D11DeviceContext* pCtx, uint32_t idxSize) const;
+
+protected:
+	sPool* find_vtx_pool(uint32_t vtxSize);
+	sPool* find_idx_pool(uint32_t idxSize);
+	bool alloc(ID3D11DeviceContext* pCtx, sPool& pool, void const* pData, uint32_t num, D3D11_BIND_FLAG bind, uint32_t minNum, uint32_t& offset);
+	// Moves the pool contents into a buffer of newNum elements, the pool is kept on failure
+	bool grow(ID3D11DeviceContext* pCtx, sPool& pool, uint32_t newNum, D3D11_BIND_FLAG bind);
+};
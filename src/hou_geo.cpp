@@ -1,461 +1,1170 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "vmath.hpp"
 #include "math.hpp"
 #include "common.hpp"
 #include "hou_geo.hpp"
+#include "thread_pool.hpp"
 
-#include "json_helpers.hpp"
+#include "json_stream.hpp"
 
-using nJsonHelpers::Document;
-using nJsonHelpers::Value;
-using nJsonHelpers::Size;
+static double now_sec() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-class cLoaderImpl {
-	cHouGeoLoader& mOwner;
-public:
-	cLoaderImpl(cHouGeoLoader& loader) : mOwner(loader) {}
+// Numeric array of a captured section that goes straight into its destination,
+// parsed in chunks on all threads once every section is read
+struct sDeferredNumbers {
+	char const* pBeg;
+	char const* pEnd;
+	void* pDst;
+	bool isFloat;
+	size_t count;
+	std::string name;
+};
 
-	bool operator()(Value const& doc) {
-		CHECK_SCHEMA(doc.IsArray(), "doc is not array\n");
+// Polygons in file order, triangulated once the topology and P are known
+struct sPrimBatch {
+	// Per primitive: first vertex in vtx and the vertex count, 0 for dropped primitives
+	std::vector<int32_t> start;
+	std::vector<int32_t> num;
+	std::vector<int32_t> vtx;
+	int droppedType = 0;
+	int droppedOpen = 0;
+	int droppedSmall = 0;
+};
 
-		auto arrSize = doc.Size();
-		for (Size i = 0; i < arrSize; i += 2) {
-			cstr key;
-			Value const* pVal = nullptr;
-			bool gotKV = get_key_value(doc, i, key, pVal);
-			CHECK_SCHEMA(gotKV, "unable to get key-value pair");
+// Part of the file captured by the scan and decoded on its own
+struct sSection {
+	enum eKind {
+		E_KIND_ATTRIB,
+		E_KIND_TOPOLOGY,
+		E_KIND_PRIMS,
+	};
+
+	eKind kind;
+	std::string name;
+	cHouGeoAttrib* pAttr = nullptr;
+	int count = 0;
+	cJsonStream js;
+	sPrimBatch prims;
+	std::vector<sDeferredNumbers> arrays;
+	double time = 0.0;
+	bool ok = false;
+};
 
-			if (cstr("fileversion").equals(key)) {
-				CHECK_SCHEMA(pVal->IsString(), "version is not a string\n");
-				dbg_msg("hou geo version: %s\n", pVal->GetString());
+// Streams the file once; attribute tuples, vertex indices and primitives are
+// decoded straight into their final arrays. Houdini writes the counts before
+// the blocks that use them, so the arrays are allocated up front.
+// With a thread pool the scan only captures the text of every attribute, the
+// topology and every primitive run, which are then decoded in parallel.
+class cLoaderImpl {
+	cHouGeoLoader& mOwner;
+	cJsonStream& mJs;
+	std::vector<int32_t> mPrimVtx;
+	sPrimBatch mPrims;
+	bool mPrimsFound = false;
+	// Attribute names to load, all when null; topology and primitives are skipped
+	cstr const* mpNames = nullptr;
+	int mNamesNum = 0;
+	// Parallel load: sections captured by the scan, arrays deferred by a section
+	std::vector<std::unique_ptr<sSection>>* mpSections = nullptr;
+	std::vector<sDeferredNumbers>* mpDeferred = nullptr;
+
+	struct sEarScratch {
+		std::vector<int> idx;
+		std::vector<float> pos;
+		std::vector<float> uv;
+	};
+
+	// Text of a section's numeric arrays, split into pieces of about this size
+	static const size_t NUMBERS_CHUNK = 256 * 1024;
+public:
+	cLoaderImpl(cHouGeoLoader& loader, cJsonStream& js) : mOwner(loader), mJs(js) {}
+	cLoaderImpl(cHouGeoLoader& loader, cJsonStream& js, cstr const* pNames, int namesNum)
+		: mOwner(loader), mJs(js), mpNames(pNames), mNamesNum(namesNum) {}
+
+	void set_sections(std::vector<std::unique_ptr<sSection>>* pSections) { mpSections = pSections; }
+
+	bool operator()() {
+		return read_kv([&](cstr key) {
+			if (key.equals("fileversion")) {
+				std::string ver;
+				CHECK_SCHEMA(read_str(ver), "version is not a string\n");
+				dbg_msg("hou geo version: %s\n", ver.c_str());
+				return true;
 			}
-			else if (cstr("pointcount").equals(key)) {
-				CHECK_SCHEMA(pVal->IsNumber(), "pointcount is not a number\n");
-				mOwner.mPointCount = pVal->GetInt();
+			else if (key.equals("pointcount")) {
+				CHECK_SCHEMA(read_int(mOwner.mPointCount), "pointcount is not a number\n");
+				return true;
 			}
-			else if (cstr("vertexcount").equals(key)) {
-				CHECK_SCHEMA(pVal->IsNumber(), "vertexcount is not a number\n");
-				mOwner.mVertexCount = pVal->GetInt();
+			else if (key.equals("vertexcount")) {
+				CHECK_SCHEMA(read_int(mOwner.mVertexCount), "vertexcount is not a number\n");
+				return true;
 			}
-			else if (cstr("primitivecount").equals(key)) {
-				CHECK_SCHEMA(pVal->IsNumber(), "primitivecount is not a number\n");
-				mOwner.mPrimitiveCount = pVal->GetInt();
+			else if (key.equals("primitivecount")) {
+				CHECK_SCHEMA(read_int(mOwner.mPrimitiveCount), "primitivecount is not a number\n");
+				return true;
 			}
-			else if (cstr("attributes").equals(key)) {
-				CHECK_SCHEMA(pVal->IsArray(), "attributes is not an array\n");
-				if (!load_attribs(*pVal)) { return false; }
+			else if (key.equals("attributes")) {
+				return load_attribs();
 			}
-			else if (cstr("primitivegroups").equals(key)) {
-				CHECK_SCHEMA(pVal->IsArray(), "primitivegroups is not an array\n");
-				if (!load_primitive_groups(*pVal)) { return false; }
+			else if (mpNames) {
+				return mJs.skip_value();
 			}
-			else if (cstr("topology").equals(key)) {
-				CHECK_SCHEMA(pVal->IsArray(), "topology is not an array\n");
-				if (!load_topology(*pVal)) { return false; }
+			else if (key.equals("primitivegroups")) {
+				return load_primitive_groups();
 			}
-			else if (cstr("primitives").equals(key)) {
-				CHECK_SCHEMA(pVal->IsArray(), "primitives is not an array\n");
-				if (!load_primitives(*pVal)) { return false; }
+			else if (key.equals("topology")) {
+				if (mpSections) {
+					return capture_section(sSection::E_KIND_TOPOLOGY, "topology", 0);
+				}
+				return load_topology();
 			}
-			else {
-				dbg_msg("hou geo: unknown key <%s>\n", key);
+			else if (key.equals("primitives")) {
+				return load_primitives();
 			}
-		}
+			dbg_msg("hou geo: unknown key <%s>\n", key.p);
+			return mJs.skip_value();
+		});
+	}
 
+	// Decodes the captured sections and triangulates, after the scan
+	bool finish(cThreadPool* pPool) {
+		if (mpSections && !run_sections(*pPool)) { return false; }
+		double t0 = now_sec();
+		if (!finish_prims(pPool)) { return false; }
+		mOwner.mLoadTimes.triangulate = now_sec() - t0;
 		return true;
 	}
 
 protected:
 
-	bool load_attribs(Value const& doc) {
-		auto arrSize = doc.Size();
-		for (Size i = 0; i < arrSize; i += 2) {
-			cstr key;
-			Value const* pVal = nullptr;
-			bool gotKV = get_key_value(doc, i, key, pVal);
-			CHECK_SCHEMA(gotKV, "unable to get key-value pair");
-
-			if (cstr("pointattributes").equals(key)) {
-				CHECK_SCHEMA(pVal->IsArray(), "attributes is not an array\n");
-				if (!load_point_attribs(*pVal)) { return false; }
-			}
-			else {
-				dbg_msg("hou geo: unknown key <%s> in attributes array\n", key);
-			}
-		}
+	bool capture_section(sSection::eKind kind, cstr name, int count) {
+		auto pSec = std::make_unique<sSection>();
+		pSec->kind = kind;
+		pSec->name = name.p;
+		pSec->count = count;
+		CHECK_SCHEMA(mJs.capture_value(pSec->js), "unable to read %s\n", name.p);
+		mpSections->push_back(std::move(pSec));
 		return true;
 	}
 
-	bool load_primitive_groups(Value const& doc) {
-		auto arrSize = doc.Size();
+	bool run_sections(cThreadPool& pool) {
+		auto& sections = *mpSections;
+		double t0 = now_sec();
+		pool.parallel_for((uint32_t)sections.size(), 1, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; ++i) {
+				run_section(*sections[i]);
+			}
+		});
+		double t1 = now_sec();
+		mOwner.mLoadTimes.sections = t1 - t0;
 
-		mOwner.mpGroups = std::make_unique<cHouGeoGroup[]>(arrSize);
-		mOwner.mGroupsCount = arrSize;
+		for (auto const& pSec : sections) {
+			if (!pSec->ok) { return false; }
+		}
+		if (!parse_deferred(pool)) { return false; }
+		mOwner.mLoadTimes.arrays = now_sec() - t1;
 
-		for (Size i = 0; i < arrSize; ++i) {
-			auto const& grp = doc[i];
-			CHECK_SCHEMA(grp.IsArray(), "group is not an array\n");
-			if (!load_primitive_group(grp, mOwner.mpGroups[i])) {
-				dbg_msg("error loading primitive group %u\n", i);
+		for (auto& pSec : sections) {
+			if (pSec->kind == sSection::E_KIND_PRIMS) {
+				append_prims(pSec->prims);
 			}
+			mOwner.mLoadTimes.sectionTimes.push_back({ pSec->name, pSec->time });
+			pSec->js.close();
 		}
 		return true;
 	}
 
-	bool load_primitive_group(Value const& doc, cHouGeoGroup& group) {
-		auto const& descr = doc[0u];
-		CHECK_SCHEMA(descr.IsArray(), "group's description is not an array\n");
-
-		bool nameFound = get_value_str(descr, "name", group.mName);
-		CHECK_SCHEMA(nameFound, "unable to find groups's name\n");
-
-		auto const& data = doc[1];
-		CHECK_SCHEMA(descr.IsArray(), "group's data is not an array\n");
+	void run_section(sSection& sec) {
+		double t0 = now_sec();
+		cLoaderImpl sub(mOwner, sec.js);
+		sub.mpDeferred = &sec.arrays;
+		cJsonStream& js = sec.js;
+		switch (sec.kind) {
+		case sSection::E_KIND_ATTRIB:
+			sec.ok = js.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN) && sub.load_attrib(*sec.pAttr, sec.count)
+				&& js.expect(cJsonStream::E_TOKEN_ARRAY_END);
+			if (!sec.pAttr->mName.empty()) {
+				sec.name += " " + sec.pAttr->mName;
+			}
+			break;
+		case sSection::E_KIND_TOPOLOGY:
+			sec.ok = sub.load_topology();
+			break;
+		case sSection::E_KIND_PRIMS:
+			sec.ok = js.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN) && sub.load_primitive_type()
+				&& js.expect(cJsonStream::E_TOKEN_ARRAY_END);
+			sec.prims = std::move(sub.mPrims);
+			break;
+		}
+		if (!sec.ok) {
+			dbg_msg("hou geo: unable to read %s at offset %u\n", sec.name.c_str(), (uint32_t)js.get_offset());
+		}
+		sec.time = now_sec() - t0;
+	}
 
-		auto const* pSel = get_value(data, "selection");
-		CHECK_SCHEMA(pSel, "unable to find groups's data selection\n");
+	// All deferred arrays are split into chunks at number boundaries. The chunks are
+	// counted first, so that each one knows where its numbers go, then parsed.
+	bool parse_deferred(cThreadPool& pool) {
+		struct sChunk {
+			sSection* pSec;
+			sDeferredNumbers const* pArr;
+			char const* pBeg;
+			char const* pEnd;
+			size_t first;
+			size_t count;
+			double time;
+		};
+		std::vector<sChunk> chunks;
+		for (auto& pSec : *mpSections) {
+			for (auto const& arr : pSec->arrays) {
+				char const* p = arr.pBeg;
+				do {
+					char const* pEnd = cJsonStream::find_split(std::min(p + NUMBERS_CHUNK, arr.pEnd), arr.pEnd);
+					chunks.push_back({ pSec.get(), &arr, p, pEnd, 0, 0, 0.0 });
+					p = pEnd;
+				} while (p < arr.pEnd);
+			}
+		}
+		if (chunks.empty()) { return true; }
 
-		auto const* pUnord = get_value(*pSel, "unordered");
-		if (pUnord) {
-			CHECK_SCHEMA(pUnord->IsArray(), "group's data  unordered is not an array\n");
-			return load_primitive_group_unordered(*pUnord, group);
+		pool.parallel_for((uint32_t)chunks.size(), 1, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; ++i) {
+				double t0 = now_sec();
+				chunks[i].count = cJsonStream::count_numbers(chunks[i].pBeg, chunks[i].pEnd);
+				chunks[i].time = now_sec() - t0;
+			}
+		});
+
+		size_t first = 0;
+		for (size_t i = 0; i < chunks.size(); ++i) {
+			auto& chunk = chunks[i];
+			chunk.first = first;
+			first += chunk.count;
+			bool last = i + 1 == chunks.size() || chunks[i + 1].pArr != chunk.pArr;
+			if (last) {
+				CHECK_SCHEMA(first == chunk.pArr->count, "<%s> count and element count differ\n", chunk.pArr->name.c_str());
+				first = 0;
+			}
 		}
 
-		dbg_msg("unable to load unknown primitive group <%s>\n", group.mName.c_str());
+		std::atomic<bool> ok(true);
+		pool.parallel_for((uint32_t)chunks.size(), 1, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; ++i) {
+				auto& chunk = chunks[i];
+				double t0 = now_sec();
+				auto const& arr = *chunk.pArr;
+				int64_t n = arr.isFloat
+					? cJsonStream::parse_numbers(chunk.pBeg, chunk.pEnd, reinterpret_cast<float*>(arr.pDst) + chunk.first, chunk.count)
+					: cJsonStream::parse_numbers(chunk.pBeg, chunk.pEnd, reinterpret_cast<int32_t*>(arr.pDst) + chunk.first, chunk.count);
+				if (n != (int64_t)chunk.count) {
+					ok = false;
+				}
+				chunk.time += now_sec() - t0;
+			}
+		});
+		CHECK_SCHEMA(ok, "bad number in a numeric array\n");
 
-		return false;
+		for (auto const& chunk : chunks) {
+			chunk.pSec->time += chunk.time;
+		}
+		return true;
 	}
 
-	bool load_primitive_group_unordered(Value const& doc, cHouGeoGroup& group) {
-		auto const* pRle = get_value(doc, "boolRLE");
-		if (pRle) {
-			auto const& rle = *pRle;
-			CHECK_SCHEMA(rle.IsArray(), "boolRLE field is not an array\n");
-
-			auto arrSize = rle.Size();
+	// In a captured section the array is only located, see parse_deferred.
+	// Called after its E_TOKEN_ARRAY_BEGIN, returns false when not deferred.
+	bool defer_numbers(void* pDst, bool isFloat, size_t count, std::string const& name) {
+		if (!mpDeferred || !mJs.is_memory()) { return false; }
+		sDeferredNumbers arr;
+		if (!mJs.skip_numbers(arr.pBeg, arr.pEnd)) { return false; }
+		arr.pDst = pDst;
+		arr.isFloat = isFloat;
+		arr.count = count;
+		arr.name = name;
+		mpDeferred->push_back(std::move(arr));
+		return true;
+	}
 
-			std::vector<cHouGeoGroup::sInterval> intervals;
-			intervals.reserve(arrSize / 2);
+	bool load_attribs() {
+		return read_kv([&](cstr key) {
+			if (key.equals("pointattributes")) {
+				return load_attrib_class("point", mOwner.mPointCount, mOwner.mpPointAttribs, mOwner.mPointAttribCount);
+			}
+			else if (key.equals("vertexattributes")) {
+				return load_attrib_class("vertex", mOwner.mVertexCount, mOwner.mpVertexAttribs, mOwner.mVertexAttribCount);
+			}
+			else if (key.equals("primitiveattributes")) {
+				return load_attrib_class("primitive", mOwner.mPrimitiveCount, mOwner.mpPrimAttribs, mOwner.mPrimAttribCount);
+			}
+			else if (key.equals("globalattributes")) {
+				int detailCount = 1;
+				return load_attrib_class("global", detailCount, mOwner.mpDetailAttribs, mOwner.mDetailAttribCount);
+			}
+			dbg_msg("hou geo: unknown key <%s> in attributes array\n", key.p);
+			return mJs.skip_value();
+		});
+	}
 
-			int cur = 0;
-			bool state = false;
+	bool load_primitive_groups() {
+		CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "primitivegroups is not an array\n");
 
-			for (Size i = 0; i < arrSize;) {
-				int n = rle[i++].GetInt();
-				bool s = rle[i++].GetBool_();
+		std::vector<cHouGeoGroup> groups;
+		while (mJs.next() != cJsonStream::E_TOKEN_ARRAY_END) {
+			CHECK_SCHEMA(mJs.get_token() == cJsonStream::E_TOKEN_ARRAY_BEGIN, "group is not an array\n");
+			groups.emplace_back();
+			if (!load_primitive_group(groups.back())) { return false; }
+			CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_END), "wrong group array size\n");
+		}
 
-				if (s && s != state) {
-					cHouGeoGroup::sInterval in = { cur, cur + n };
-					intervals.push_back(in);
-				}
-				cur += n;
-				state = s;
-			}
+		mOwner.mGroupsCount = (int)groups.size();
+		mOwner.mpGroups = std::make_unique<cHouGeoGroup[]>(groups.size());
+		for (size_t i = 0; i < groups.size(); ++i) {
+			mOwner.mpGroups[i] = std::move(groups[i]);
+		}
+		return true;
+	}
 
-			auto pIntervals = std::make_unique<cHouGeoGroup::sInterval[]>(intervals.size());
-			for (size_t i = 0; i < intervals.size(); ++i) {
-				pIntervals.get()[i] = intervals[i];
+	bool load_primitive_group(cHouGeoGroup& group) {
+		bool descrOk = read_kv([&](cstr key) {
+			if (key.equals("name")) {
+				CHECK_SCHEMA(read_str(group.mName), "group's name is not a string\n");
+				return true;
 			}
-			group.mpIntervals = std::move(pIntervals);
-			group.mIntervalsCount = (int)intervals.size();
-
-			return true;
+			return mJs.skip_value();
+		});
+		CHECK_SCHEMA(descrOk, "group's description is not an array\n");
+		CHECK_SCHEMA(!group.mName.empty(), "unable to find groups's name\n");
+
+		bool loaded = false;
+		bool dataOk = read_kv([&](cstr key) {
+			if (!key.equals("selection")) { return mJs.skip_value(); }
+			return read_kv([&](cstr selKey) {
+				if (!selKey.equals("unordered")) { return mJs.skip_value(); }
+				return read_kv([&](cstr encKey) {
+					if (encKey.equals("boolRLE")) {
+						loaded = true;
+						return load_primitive_group_rle(group);
+					}
+					dbg_msg("unable to load unordered primitive group with unknown encoding <%s>\n", encKey.p);
+					return mJs.skip_value();
+				});
+			});
+		});
+		CHECK_SCHEMA(dataOk, "unable to read group's <%s> data\n", group.mName.c_str());
+
+		if (!loaded) {
+			dbg_msg("unable to load unknown primitive group <%s>\n", group.mName.c_str());
 		}
-
-		dbg_msg("unable to load unordered primitive group with unknown encoding\n");
-		return false;
+		return true;
 	}
 
-	bool load_point_attrib(Value const& doc, cHouGeoAttrib& attr) {
-		auto const& descr = doc[0u];
-		CHECK_SCHEMA(descr.IsArray(), "attribute's descr is not an array\n");
-		auto const& data = doc[1];
-		CHECK_SCHEMA(data.IsArray(), "attribute's data is not an array\n");
+	bool load_primitive_group_rle(cHouGeoGroup& group) {
+		CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "boolRLE field is not an array\n");
 
-		cstr name;
-		bool nameFound = get_value_str(descr, "name", name);
-		CHECK_SCHEMA(nameFound, "unable to find attribute's name\n");
+		std::vector<cHouGeoGroup::sInterval> intervals;
 
-		cstr type;
-		bool typeFound = get_value_str(descr, "type", type);
-		CHECK_SCHEMA(typeFound, "unable to find attribute's type\n");
+		int cur = 0;
+		bool state = false;
 
-		if (!cstr("numeric").equals(type)) {
-			dbg_msg("hou geo: unknown type <%s> for attribute <%s>\n", type, name);
-			return false;
-		}
+		while (mJs.next() != cJsonStream::E_TOKEN_ARRAY_END) {
+			CHECK_SCHEMA(mJs.get_token() == cJsonStream::E_TOKEN_NUMBER, "boolRLE count is not a number\n");
+			int n = mJs.get_int();
+			auto tk = mJs.next();
+			CHECK_SCHEMA(tk == cJsonStream::E_TOKEN_TRUE || tk == cJsonStream::E_TOKEN_FALSE, "boolRLE state is not a bool\n");
+			bool s = mJs.get_bool();
 
-		auto const* pValues = get_value(data, "values");
-		CHECK_SCHEMA(pValues, "unable to find attribute's <%s> values\n", name);
-		CHECK_SCHEMA(pValues->IsArray(), "attribute's values is not an array\n");
+			if (s && s != state) {
+				cHouGeoGroup::sInterval in = { cur, cur + n };
+				intervals.push_back(in);
+			}
+			cur += n;
+			state = s;
+		}
 
-		auto valArrSize = pValues->Size();
+		auto pIntervals = std::make_unique<cHouGeoGroup::sInterval[]>(intervals.size());
+		for (size_t i = 0; i < intervals.size(); ++i) {
+			pIntervals.get()[i] = intervals[i];
+		}
+		group.mpIntervals = std::move(pIntervals);
+		group.mIntervalsCount = (int)intervals.size();
 
-		int attribSize = 0;
-		cstr attribStorage;
-		Value const* tuples = nullptr;
+		return true;
+	}
 
-		for (Size i = 0; i < valArrSize; i += 2) {
-			cstr key;
-			Value const* pVal = nullptr;
-			bool gotKV = get_key_value((*pValues), i, key, pVal);
-			CHECK_SCHEMA(gotKV, "unable to get key-value pair");
+	bool load_attrib(cHouGeoAttrib& attr, int count) {
+		std::string name;
+		std::string type;
+		bool descrOk = read_kv([&](cstr key) {
+			if (key.equals("name")) { return read_str(name); }
+			if (key.equals("type")) { return read_str(type); }
+			return mJs.skip_value();
+		});
+		CHECK_SCHEMA(descrOk, "attribute's descr is not an array\n");
+		CHECK_SCHEMA(!name.empty(), "unable to find attribute's name\n");
+		CHECK_SCHEMA(!type.empty(), "unable to find attribute's type\n");
+
+		const bool numeric = cstr("numeric").equals(type.c_str());
+		if (!numeric) {
+			dbg_msg("hou geo: unknown type <%s> for attribute <%s>\n", type.c_str(), name.c_str());
+		}
+		const bool wanted = numeric && is_wanted(name.c_str());
+
+		bool valuesFound = false;
+		bool dataOk = read_kv([&](cstr key) {
+			if (!wanted || !key.equals("values")) { return mJs.skip_value(); }
+			valuesFound = true;
+			return load_attrib_values(attr, name, count);
+		});
+		CHECK_SCHEMA(dataOk, "unable to read attribute's <%s> data\n", name.c_str());
+		if (wanted && !valuesFound) {
+			dbg_msg("unable to find attribute's <%s> values\n", name.c_str());
+		}
+		return true;
+	}
 
-			if (cstr("size").equals(key)) {
-				CHECK_SCHEMA(pVal->IsNumber(), "size is not a number\n");
-				attribSize = pVal->GetInt();
+	// Encoding parameters that precede the attribute's data
+	struct sAttribLayout {
+		int count = 0;
+		int size = 0;
+		std::string storage;
+		std::vector<int32_t> packing;
+		int pageSize = 0;
+		std::vector<std::vector<uint8_t>> constPages;
+	};
+
+	bool load_attrib_values(cHouGeoAttrib& attr, std::string const& name, int count) {
+		sAttribLayout layout;
+		layout.count = count;
+
+		return read_kv([&](cstr key) {
+			if (key.equals("size")) {
+				CHECK_SCHEMA(read_int(layout.size), "size is not a number\n");
+				// The values are read and indexed with int counts
+				CHECK_SCHEMA((size_t)layout.count * (size_t)std::max(layout.size, 0) <= (size_t)INT_MAX,
+					"attrib <%s> has too many values: %d x %d\n", name.c_str(), layout.count, layout.size);
+				return true;
+			}
+			else if (key.equals("storage")) {
+				CHECK_SCHEMA(read_str(layout.storage), "storage is not a string\n");
+				return true;
+			}
+			else if (key.equals("packing")) {
+				CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "packing is not an array\n");
+				CHECK_SCHEMA(mJs.read_numbers(layout.packing) > 0, "packing is not a number array\n");
+				return true;
+			}
+			else if (key.equals("pagesize")) {
+				CHECK_SCHEMA(read_int(layout.pageSize), "pagesize is not a number\n");
+				return true;
 			}
-			else if (cstr("storage").equals(key)) {
-				CHECK_SCHEMA(pVal->IsString(), "storage is not a string\n");
-				attribStorage = pVal->GetString();
+			else if (key.equals("constantpageflags")) {
+				return load_const_page_flags(layout);
 			}
-			else if (cstr("tuples").equals(key)) {
-				CHECK_SCHEMA(pVal->IsArray(), "tuples is not an array\n");
-				tuples = pVal;
+			else if (key.equals("tuples")) {
+				if (!init_attrib(attr, name, layout)) { return mJs.skip_value(); }
+				return load_attrib_tuples(attr, name);
 			}
-			else {
-				dbg_msg("hou geo: unknown key <%s> in attribute's values array\n", key);
+			else if (key.equals("arrays")) {
+				if (!init_attrib(attr, name, layout)) { return mJs.skip_value(); }
+				return attr.mType == cHouGeoAttrib::E_TYPE_fpreal32
+					? load_attrib_arrays(reinterpret_cast<float*>(attr.mpData.get()), name, layout)
+					: load_attrib_arrays(reinterpret_cast<int32_t*>(attr.mpData.get()), name, layout);
+			}
+			else if (key.equals("rawpagedata")) {
+				if (!init_attrib(attr, name, layout)) { return mJs.skip_value(); }
+				return attr.mType == cHouGeoAttrib::E_TYPE_fpreal32
+					? load_attrib_pages(reinterpret_cast<float*>(attr.mpData.get()), name, layout)
+					: load_attrib_pages(reinterpret_cast<int32_t*>(attr.mpData.get()), name, layout);
+			}
+			else if (key.equals("defaults")) {
+				return mJs.skip_value();
+			}
+			dbg_msg("hou geo: unknown key <%s> in attribute's values array\n", key.p);
+			return mJs.skip_value();
+		});
+	}
+
+	// One bool array per packing subvector, one flag per page
+	bool load_const_page_flags(sAttribLayout& layout) {
+		CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "constantpageflags is not an array\n");
+		while (mJs.next() != cJsonStream::E_TOKEN_ARRAY_END) {
+			CHECK_SCHEMA(mJs.get_token() == cJsonStream::E_TOKEN_ARRAY_BEGIN, "constantpageflags entry is not an array\n");
+			layout.constPages.emplace_back();
+			auto& flags = layout.constPages.back();
+			for (auto tk = mJs.next(); tk != cJsonStream::E_TOKEN_ARRAY_END; tk = mJs.next()) {
+				CHECK_SCHEMA(tk == cJsonStream::E_TOKEN_TRUE || tk == cJsonStream::E_TOKEN_FALSE || tk == cJsonStream::E_TOKEN_NUMBER,
+					"constant page flag is not a bool\n");
+				flags.push_back(tk == cJsonStream::E_TOKEN_NUMBER ? mJs.get_int() != 0 : mJs.get_bool());
 			}
 		}
+		return true;
+	}
 
-		if (!tuples)
+	// Returns false when the storage is not supported and the data should be skipped
+	bool init_attrib(cHouGeoAttrib& attr, std::string const& name, sAttribLayout const& layout) {
+		if (layout.size <= 0) {
+			dbg_msg("attribute's <%s> size must precede its data\n", name.c_str());
 			return false;
-		
-		int attribCount = tuples->Size();
-
-		attr.init(name, attribStorage, attribSize, attribCount);
-
-		auto const atype = attr.mType;
-		if (atype == cHouGeoAttrib::E_TYPE_unknown) {
-			dbg_msg("unknown attrib storage type <%s>\n", attribStorage);
+		}
+		attr.init(name.c_str(), layout.storage.c_str(), layout.size, layout.count);
+		if (attr.mType == cHouGeoAttrib::E_TYPE_unknown) {
+			dbg_msg("unknown attrib storage type <%s>\n", layout.storage.c_str());
+			attr.mAttribCount = 0;
 			return false;
 		}
+		return true;
+	}
 
-		float* faval;
-		int32_t* iaval;
-		for (int i = 0; i < attribCount; ++i) {
-			auto const& a = (*tuples)[i];
-			CHECK_SCHEMA(a.IsArray(), "attrib value is not an array\n");
-			CHECK_SCHEMA(a.Size() == attribSize, "attrib value size is wrong\n");
+	bool load_attrib_tuples(cHouGeoAttrib& attr, std::string const& name) {
+		const int attribSize = attr.mAttribSize;
+		const int attribCount = attr.mAttribCount;
+		auto const atype = attr.mType;
 
+		CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "tuples is not an array\n");
+		// Tuples are flattened, only the total is checked
+		if (defer_numbers(attr.mpData.get(), atype == cHouGeoAttrib::E_TYPE_fpreal32, (size_t)attribCount * attribSize, "attrib " + name)) {
+			return true;
+		}
+		int i = 0;
+		for (; mJs.next() != cJsonStream::E_TOKEN_ARRAY_END; ++i) {
+			CHECK_SCHEMA(mJs.get_token() == cJsonStream::E_TOKEN_ARRAY_BEGIN, "attrib value is not an array\n");
+			CHECK_SCHEMA(i < attribCount, "attrib <%s> has more values than elements\n", name.c_str());
+
+			int n = -1;
 			switch (atype) {
-			case cHouGeoAttrib::E_TYPE_fpreal32: 
-				faval = attr.get_float_val(i);
-				for (int j = 0; j < attribSize; ++j) {
-					CHECK_SCHEMA(a[j].IsNumber(), "attrib value is not a number\n");
-					faval[j] = (float)a[j].GetDouble();
-				}
+			case cHouGeoAttrib::E_TYPE_fpreal32:
+				n = mJs.read_numbers(attr.get_float_val(i), attribSize);
 				break;
 			case cHouGeoAttrib::E_TYPE_int32:
-				iaval = attr.get_int32_val(i);
-				for (int j = 0; j < attribSize; ++j) {
-					CHECK_SCHEMA(a[j].IsNumber(), "attrib value is not a number\n");
-					iaval[j] = a[j].GetInt();
-				}
+				n = mJs.read_numbers(attr.get_int32_val(i), attribSize);
+				break;
+			default:
 				break;
 			}
+			CHECK_SCHEMA(n == attribSize, "attrib value size is wrong\n");
 		}
+		CHECK_SCHEMA(i == attribCount, "attrib <%s> count and element count differ\n", name.c_str());
 
 		return true;
 	}
 
-	bool load_point_attribs(Value const& doc) {
-		auto arrSize = doc.Size();
-		
-		mOwner.mpPointAttribs = std::make_unique<cHouGeoAttrib[]>(arrSize);
-		mOwner.mPointAttribCount = arrSize;
-
-		for (Size i = 0; i < arrSize; ++i) {
-			auto const& val = doc[i];
-			CHECK_SCHEMA(doc.IsArray(), "attribute %d is not an array\n", i);
-			load_point_attrib(val, mOwner.mpPointAttribs[i]);
+	// One array per component; size 1 goes straight into the attribute
+	template <typename T>
+	bool load_attrib_arrays(T* pData, std::string const& name, sAttribLayout const& layout) {
+		const int size = layout.size;
+		const int count = layout.count;
+
+		CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "arrays is not an array\n");
+		std::vector<T> comp(size > 1 ? count : 0);
+		int c = 0;
+		for (; mJs.next() != cJsonStream::E_TOKEN_ARRAY_END; ++c) {
+			CHECK_SCHEMA(mJs.get_token() == cJsonStream::E_TOKEN_ARRAY_BEGIN, "attrib <%s> component is not an array\n", name.c_str());
+			CHECK_SCHEMA(c < size, "attrib <%s> has too many component arrays\n", name.c_str());
+			if (size == 1) {
+				if (defer_numbers(pData, std::is_same<T, float>::value, count, "attrib " + name)) { continue; }
+				CHECK_SCHEMA(mJs.read_numbers(pData, count) == count, "attrib <%s> count and element count differ\n", name.c_str());
+				continue;
+			}
+			CHECK_SCHEMA(mJs.read_numbers(comp.data(), count) == count, "attrib <%s> count and element count differ\n", name.c_str());
+			for (int i = 0; i < count; ++i) {
+				pData[(size_t)i * size + c] = comp[i];
+			}
 		}
-
+		CHECK_SCHEMA(c == size, "attrib <%s> has too few component arrays\n", name.c_str());
 		return true;
 	}
 
+	// Pages of pagesize elements, each split into the packing subvectors. A constant
+	// page stores a single subvector value. With one subvector and no constant pages
+	// the data is already interleaved and is read straight into the attribute.
+	template <typename T>
+	bool load_attrib_pages(T* pData, std::string const& name, sAttribLayout const& layout) {
+		const int size = layout.size;
+		const int count = layout.count;
+		const int pageSize = layout.pageSize;
+		CHECK_SCHEMA(pageSize > 0, "attrib <%s> has rawpagedata without pagesize\n", name.c_str());
+
+		std::vector<int32_t> packing = layout.packing;
+		if (packing.empty()) {
+			packing.push_back(size);
+		}
+		int packedSize = 0;
+		for (int32_t sv : packing) {
+			CHECK_SCHEMA(sv > 0, "attrib <%s> has bad packing\n", name.c_str());
+			packedSize += sv;
+		}
+		CHECK_SCHEMA(packedSize == size, "attrib <%s> packing and size differ\n", name.c_str());
+
+		auto isConst = [&](size_t sv, int page) {
+			return sv < layout.constPages.size() && page < (int)layout.constPages[sv].size() && layout.constPages[sv][page];
+		};
+
+		const size_t elemNum = (size_t)count * size;
+		const int pagesNum = (int)(((size_t)count + pageSize - 1) / pageSize);
+		size_t total = 0;
+		bool anyConst = false;
+		for (int page = 0; page < pagesNum; ++page) {
+			const int len = std::min(pageSize, count - page * pageSize);
+			for (size_t sv = 0; sv < packing.size(); ++sv) {
+				const bool cst = isConst(sv, page);
+				anyConst = anyConst || cst;
+				total += cst ? packing[sv] : (size_t)len * packing[sv];
+			}
+		}
 
-	bool load_topology(Value const& doc) {
-		auto const* pPointref = get_value(doc, "pointref");
-		CHECK_SCHEMA(pPointref, "missing pointref from topology\n");
-		CHECK_SCHEMA(pPointref->IsArray(), "topology's pointref is not an array\n");
+		CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "rawpagedata is not an array\n");
+		if (packing.size() == 1 && !anyConst) {
+			if (defer_numbers(pData, std::is_same<T, float>::value, elemNum, "attrib " + name)) { return true; }
+			CHECK_SCHEMA(mJs.read_numbers(pData, (int)elemNum) == (int)elemNum, "attrib <%s> rawpagedata size is wrong\n", name.c_str());
+			return true;
+		}
 
-		auto const* pIndices = get_value(*pPointref, "indices");
-		CHECK_SCHEMA(pIndices, "missing indices from topology's pointref\n");
-		CHECK_SCHEMA(pIndices->IsArray(), "topology's indices is not an array\n");
+		// Constant pages store less than the attribute holds
+		CHECK_SCHEMA(total <= elemNum, "attrib <%s> rawpagedata is larger than the attribute\n", name.c_str());
+		std::vector<T> raw(total);
+		CHECK_SCHEMA(mJs.read_numbers(raw.data(), (int)total) == (int)total, "attrib <%s> rawpagedata size is wrong\n", name.c_str());
+
+		T const* pSrc = raw.data();
+		for (int page = 0; page < pagesNum; ++page) {
+			const int first = page * pageSize;
+			const int len = std::min(pageSize, count - first);
+			int comp0 = 0;
+			for (size_t sv = 0; sv < packing.size(); ++sv) {
+				const int svSize = packing[sv];
+				const bool cst = isConst(sv, page);
+				for (int i = 0; i < len; ++i) {
+					T const* pVal = pSrc + (cst ? 0 : (size_t)i * svSize);
+					T* pDst = pData + (size_t)(first + i) * size + comp0;
+					for (int c = 0; c < svSize; ++c) {
+						pDst[c] = pVal[c];
+					}
+				}
+				pSrc += cst ? svSize : (size_t)len * svSize;
+				comp0 += svSize;
+			}
+		}
+		return true;
+	}
 
-		auto arrSize = pIndices->Size();
-		CHECK_SCHEMA(arrSize == mOwner.mVertexCount, "vertex count and indices count differ\n");
+	bool load_attrib_class(cstr cls, int count, std::unique_ptr<cHouGeoAttrib[]>& pAttribs, int& attribCount) {
+		CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "%sattributes is not an array\n", cls.p);
+		CHECK_SCHEMA(count > 0, "%s count must precede attributes\n", cls.p);
 
-		auto vmap = std::make_unique<int32_t[]>(arrSize);
-		int32_t* pVmap = vmap.get();
-		for (Size i = 0; i < arrSize; ++i) {
-			pVmap[i] = (*pIndices)[i].GetInt();
+		if (mpSections) {
+			const size_t first = mpSections->size();
+			int num = 0;
+			for (; mJs.peek() != cJsonStream::E_TOKEN_ARRAY_END; ++num) {
+				std::string name = std::string(cls.p) + " attrib";
+				if (!capture_section(sSection::E_KIND_ATTRIB, name.c_str(), count)) { return false; }
+			}
+			mJs.next();
+			attribCount = num;
+			pAttribs = std::make_unique<cHouGeoAttrib[]>(num);
+			for (int i = 0; i < num; ++i) {
+				(*mpSections)[first + i]->pAttr = &pAttribs[i];
+			}
+			return true;
 		}
 
-		mOwner.mpVertexMap = std::move(vmap);
+		std::vector<cHouGeoAttrib> attribs;
+		while (mJs.next() != cJsonStream::E_TOKEN_ARRAY_END) {
+			CHECK_SCHEMA(mJs.get_token() == cJsonStream::E_TOKEN_ARRAY_BEGIN, "%s attribute %d is not an array\n", cls.p, (int)attribs.size());
+			attribs.emplace_back();
+			if (!load_attrib(attribs.back(), count)) { return false; }
+			CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_END), "wrong attribute array size\n");
+		}
 
+		attribCount = (int)attribs.size();
+		pAttribs = std::make_unique<cHouGeoAttrib[]>(attribs.size());
+		for (size_t i = 0; i < attribs.size(); ++i) {
+			pAttribs[i] = std::move(attribs[i]);
+		}
 		return true;
 	}
 
-	bool load_primitives(Value const& doc) {
-		auto primTypes = doc.Size();
 
-		mOwner.mPoly.reserve(mOwner.mPrimitiveCount);
+	bool load_topology() {
+		bool indicesFound = false;
+		bool ok = read_kv([&](cstr key) {
+			if (!key.equals("pointref")) { return mJs.skip_value(); }
+			return read_kv([&](cstr refKey) {
+				if (!refKey.equals("indices")) { return mJs.skip_value(); }
+				CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "topology's indices is not an array\n");
 
-		for (Size pt = 0; pt < primTypes; ++pt) {
-			auto const& primType = doc[pt];
-			CHECK_SCHEMA(primType.IsArray(), "prim type %u is not an array\n", pt);
-			CHECK_SCHEMA(primType.Size() == 2, "wrong prim type size\n");
+				const int vtxCount = mOwner.mVertexCount;
+				auto vmap = std::make_unique<int32_t[]>(vtxCount);
+				if (!defer_numbers(vmap.get(), false, vtxCount, "topology indices")) {
+					int n = mJs.read_numbers(vmap.get(), vtxCount);
+					CHECK_SCHEMA(n == vtxCount, "vertex count and indices count differ\n");
+				}
 
-			load_primitive_type(primType);
-		}
+				mOwner.mpVertexMap = std::move(vmap);
+				indicesFound = true;
+				return true;
+			});
+		});
+		CHECK_SCHEMA(ok, "unable to read topology\n");
+		CHECK_SCHEMA(indicesFound, "missing indices from topology's pointref\n");
+		return true;
+	}
 
-		CHECK_SCHEMA(mOwner.mPoly.size() == mOwner.mPrimitiveCount, "primitive number mismatch\n");
+	bool load_primitives() {
+		CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "primitives is not an array\n");
+		mPrimsFound = true;
 
+		if (mpSections) {
+			for (int pt = 0; mJs.peek() != cJsonStream::E_TOKEN_ARRAY_END; ++pt) {
+				std::string name = "prim run " + std::to_string(pt);
+				if (!capture_section(sSection::E_KIND_PRIMS, name.c_str(), 0)) { return false; }
+			}
+			mJs.next();
+			return true;
+		}
+
+		mPrims.start.reserve(mOwner.mPrimitiveCount);
+		mPrims.num.reserve(mOwner.mPrimitiveCount);
+		mPrims.vtx.reserve(mOwner.mVertexCount);
+		for (int pt = 0; mJs.next() != cJsonStream::E_TOKEN_ARRAY_END; ++pt) {
+			CHECK_SCHEMA(mJs.get_token() == cJsonStream::E_TOKEN_ARRAY_BEGIN, "prim type %d is not an array\n", pt);
+			if (!load_primitive_type()) { return false; }
+			CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_END), "wrong prim type size\n");
+		}
 		return true;
 	}
 
+	void append_prims(sPrimBatch const& batch) {
+		const int32_t base = (int32_t)mPrims.vtx.size();
+		for (int32_t start : batch.start) {
+			mPrims.start.push_back(base + start);
+		}
+		mPrims.num.insert(mPrims.num.end(), batch.num.begin(), batch.num.end());
+		mPrims.vtx.insert(mPrims.vtx.end(), batch.vtx.begin(), batch.vtx.end());
+		mPrims.droppedType += batch.droppedType;
+		mPrims.droppedOpen += batch.droppedOpen;
+		mPrims.droppedSmall += batch.droppedSmall;
+	}
 
-	bool load_primitive_type(Value const& doc) {
-		auto const& decl = doc[0u];
-		CHECK_SCHEMA(decl.IsArray(), "prim decl is not an array\n");
-
-		auto const& data = doc[1];
-		CHECK_SCHEMA(data.IsArray(), "prim data is not an array\n");
-		auto dataArrSize = data.Size();
+	// Every polygon of n vertices gives n - 2 triangles, so the output offsets are
+	// known up front and the polygons are triangulated in parallel.
+	bool finish_prims(cThreadPool* pPool) {
+		if (!mPrimsFound) { return true; }
+
+		auto const& prims = mPrims;
+		const int primNum = (int)prims.num.size();
+		CHECK_SCHEMA(primNum == mOwner.mPrimitiveCount, "primitive number mismatch\n");
+
+		auto& polys = mOwner.mPoly;
+		polys.assign(primNum, sHouGeoPrimPoly());
+		size_t triNum = 0;
+		for (int i = 0; i < primNum; ++i) {
+			if (prims.num[i] < 3) { continue; }
+			polys[i].triStart = (int)triNum;
+			polys[i].triCount = prims.num[i] - 2;
+			polys[i].valid = true;
+			triNum += polys[i].triCount;
+		}
+		mOwner.mTriVtx.resize(triNum * 3);
 
-		cstr type;
-		bool typeFound = get_value_str(decl, "type", type);
-		CHECK_SCHEMA(typeFound, "unable to find prim type\n");
+		if (mOwner.mVertexCount > 0) {
+			mOwner.mpVertexPrim = std::make_unique<int32_t[]>(mOwner.mVertexCount);
+			std::fill_n(mOwner.mpVertexPrim.get(), mOwner.mVertexCount, -1);
+		}
 
-		if (!cstr("run").equals(type)) {
-			dbg_msg("unknow prim type %s\n", type);
-			load_primitives_invalid(dataArrSize);
-			return false;
+		cHouGeoAttrib const* pPos = nullptr;
+		for (int i = 0; i < mOwner.mPointAttribCount; ++i) {
+			auto const& attr = mOwner.mpPointAttribs[i];
+			if (attr.mName == "P" && attr.mType == cHouGeoAttrib::E_TYPE_fpreal32 && attr.mAttribSize >= 3 && attr.mAttribCount > 0) {
+				pPos = &attr;
+			}
+		}
+		if (!pPos) {
+			dbg_msg1("hou geo: no P, polygons are fan-triangulated\n");
 		}
 
-		cstr runtype;
-		bool runtypeFound = get_value_str(decl, "runtype", runtype);
-		CHECK_SCHEMA(runtypeFound, "unable to find prim runtype\n");
+		auto triangulateRange = [&](uint32_t begin, uint32_t end) {
+			sEarScratch scratch;
+			int32_t* pVtxPrim = mOwner.mpVertexPrim.get();
+			for (uint32_t i = begin; i < end; ++i) {
+				auto const& poly = polys[i];
+				if (!poly.valid) { continue; }
+				int32_t const* pVtx = &prims.vtx[prims.start[i]];
+				const int vtxNum = prims.num[i];
+				for (int k = 0; k < vtxNum; ++k) {
+					pVtxPrim[pVtx[k]] = (int32_t)i;
+				}
+				int32_t* pOut = &mOwner.mTriVtx[(size_t)poly.triStart * 3];
+				if (vtxNum == 3) {
+					pOut[0] = pVtx[0];
+					pOut[1] = pVtx[1];
+					pOut[2] = pVtx[2];
+				}
+				else {
+					triangulate(pVtx, vtxNum, pPos, scratch, pOut);
+				}
+			}
+		};
+		if (pPool) {
+			pPool->parallel_for((uint32_t)primNum, 1024, triangulateRange);
+		}
+		else {
+			triangulateRange(0, (uint32_t)primNum);
+		}
 
-		if (!cstr("Poly").equals(runtype)) {
-			dbg_msg("unknow prim runtype %s\n", runtype);
-			load_primitives_invalid(dataArrSize);
-			return false;
+		mOwner.mDroppedPrimCount = prims.droppedType + prims.droppedOpen + prims.droppedSmall;
+		if (mOwner.mDroppedPrimCount > 0) {
+			dbg_msg("hou geo: dropped %d primitives: %d of unsupported type, %d open, %d with less than 3 vertices\n",
+				mOwner.mDroppedPrimCount, prims.droppedType, prims.droppedOpen, prims.droppedSmall);
 		}
+		return true;
+	}
 
-		auto const* pVarying = get_value(decl, "varyingfields");
-		CHECK_SCHEMA(pVarying, "unable to find prim varyingfields description\n");
-		CHECK_SCHEMA(pVarying->IsArray(), "prim varyingfields value is not an array\n");
 
-		Size verVertex = 0;
-		bool vertexFound = false;
-		for (Size i = 0; i < pVarying->Size(); ++i) {
-			auto const& val = (*pVarying)[i];
-			if (val.IsString() && cstr("vertex").equals(val.GetString())) {
-				verVertex = i;
-				vertexFound = true;
-				break;
+	bool load_primitive_type() {
+		std::string type;
+		std::string runtype;
+		int vertexField = -1;
+		int closedField = -1;
+		bool closed = true;
+		bool declOk = read_kv([&](cstr key) {
+			if (key.equals("type")) { return read_str(type); }
+			if (key.equals("runtype")) { return read_str(runtype); }
+			if (key.equals("varyingfields")) {
+				CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "prim varyingfields value is not an array\n");
+				for (int i = 0; mJs.next() != cJsonStream::E_TOKEN_ARRAY_END; ++i) {
+					if (mJs.get_token() != cJsonStream::E_TOKEN_STRING) { continue; }
+					if (mJs.get_str().equals("vertex")) {
+						vertexField = i;
+					} else if (mJs.get_str().equals("closed")) {
+						closedField = i;
+					}
+				}
+				return true;
+			}
+			if (key.equals("uniformfields")) {
+				return read_kv([&](cstr fieldKey) {
+					if (!fieldKey.equals("closed")) { return mJs.skip_value(); }
+					return read_bool(closed);
+				});
 			}
+			return mJs.skip_value();
+		});
+		CHECK_SCHEMA(declOk, "prim decl is not an array\n");
+		CHECK_SCHEMA(!type.empty(), "unable to find prim type\n");
+
+		const bool isRun = cstr("run").equals(type.c_str());
+		if (!isRun) {
+			if (cstr("Poly").equals(type.c_str())) {
+				return load_primitive_single_poly();
+			}
+			// Single primitive of another type
+			add_dropped(mPrims.droppedType);
+			return mJs.skip_value();
 		}
 
-		if (!vertexFound) {
+		bool supported = false;
+		if (!cstr("Poly").equals(runtype.c_str())) {
+			dbg_msg("unknow prim runtype %s\n", runtype.c_str());
+		}
+		else if (vertexField < 0) {
 			dbg_msg1("unable to find primitive vertex field position\n");
-			load_primitives_invalid(dataArrSize);
-			return false;
+		}
+		else {
+			supported = true;
 		}
 
-		for (Size i = 0; i < dataArrSize; ++i) {
-			auto const& val = data[i];
-			if (val.IsArray() && val.Size() > verVertex) {
-				auto const& vert = val[verVertex];
-				if (vert.IsArray() && vert.Size() == 3) {
-					sHouGeoPrimPoly poly;
-					for (int j = 0; j < 3; ++j) {
-						poly.v[j] = vert[j].GetInt();
-					}
-					poly.valid = true;
-					mOwner.mPoly.push_back(poly);
+		CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "prim data is not an array\n");
+		if (!supported) {
+			return load_primitives_invalid();
+		}
+
+		while (mJs.next() != cJsonStream::E_TOKEN_ARRAY_END) {
+			CHECK_SCHEMA(mJs.get_token() == cJsonStream::E_TOKEN_ARRAY_BEGIN, "prim is not an array\n");
+			mPrimVtx.clear();
+			bool primClosed = closed;
+			for (int field = 0; mJs.peek() != cJsonStream::E_TOKEN_ARRAY_END; ++field) {
+				if (field == vertexField) {
+					CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "prim vertex field is not an array\n");
+					CHECK_SCHEMA(mJs.read_numbers(mPrimVtx) >= 0, "prim vertex is not a number\n");
+				}
+				else if (field == closedField) {
+					CHECK_SCHEMA(read_bool(primClosed), "prim closed field is not a bool\n");
 				}
 				else {
-					dbg_msg("polygon with %u vertices\n", vert.Size());
-					mOwner.mPoly.emplace_back();
-					continue;
+					CHECK_SCHEMA(mJs.skip_value(), "unable to read prim field\n");
 				}
 			}
+			mJs.next();
+			add_poly(primClosed);
 		}
 
 		return true;
 	}
 
-	void load_primitives_invalid(Size size) {
-		for (Size i = 0; i < size; ++i) {
-			mOwner.mPoly.emplace_back();
+	// ["vertex", [...], "closed", true]
+	bool load_primitive_single_poly() {
+		mPrimVtx.clear();
+		bool closed = true;
+		bool ok = read_kv([&](cstr key) {
+			if (key.equals("vertex")) {
+				CHECK_SCHEMA(mJs.expect(cJsonStream::E_TOKEN_ARRAY_BEGIN), "prim vertex field is not an array\n");
+				return mJs.read_numbers(mPrimVtx) >= 0;
+			}
+			if (key.equals("closed")) { return read_bool(closed); }
+			return mJs.skip_value();
+		});
+		CHECK_SCHEMA(ok, "unable to read Poly primitive\n");
+		add_poly(closed);
+		return true;
+	}
+
+	// Keeps mPrimVtx for finish_prims
+	void add_poly(bool closed) {
+		const int vtxNum = (int)mPrimVtx.size();
+		bool inRange = true;
+		for (int32_t vtx : mPrimVtx) {
+			inRange = inRange && vtx >= 0 && vtx < mOwner.mVertexCount;
+		}
+
+		if (!closed) {
+			add_dropped(mPrims.droppedOpen);
+		}
+		else if (vtxNum < 3 || !inRange) {
+			add_dropped(mPrims.droppedSmall);
+		}
+		else {
+			mPrims.start.push_back((int32_t)mPrims.vtx.size());
+			mPrims.num.push_back(vtxNum);
+			mPrims.vtx.insert(mPrims.vtx.end(), mPrimVtx.begin(), mPrimVtx.end());
 		}
 	}
 
-protected:
+	void add_dropped(int& counter) {
+		++counter;
+		mPrims.start.push_back((int32_t)mPrims.vtx.size());
+		mPrims.num.push_back(0);
+	}
 
-	Size find_key(Value const& doc, cstr key) {
-		auto arrSize = doc.Size();
-		for (Size i = 0; i < arrSize;) {
-			auto const& val = doc[i++];
-			CHECK_SCHEMA(val.IsString(), "value is not key string\n");
-			auto k = val.GetString();
-			if (key.equals(k)) {
-				return i;
+	// Ear clipping in the polygon's dominant plane. Triangles keep the polygon's
+	// winding. Degenerate or self-intersecting polygons fall back to a fan.
+	// Writes exactly vtxNum - 2 triangles.
+	void triangulate(int32_t const* pVtx, int vtxNum, cHouGeoAttrib const* pPos, sEarScratch& scratch, int32_t* pOut) const {
+		auto& earIdx = scratch.idx;
+		auto& earPos = scratch.pos;
+		auto& earUV = scratch.uv;
+
+		auto fan = [&](int const* pIdx, int num) {
+			for (int i = 1; i + 1 < num; ++i) {
+				*pOut++ = pVtx[pIdx[0]];
+				*pOut++ = pVtx[pIdx[i]];
+				*pOut++ = pVtx[pIdx[i + 1]];
 			}
-			else {
-				i++;
+		};
+
+		earIdx.resize(vtxNum);
+		for (int i = 0; i < vtxNum; ++i) {
+			earIdx[i] = i;
+		}
+
+		auto const* vmap = mOwner.mpVertexMap.get();
+		if (!pPos || !vmap) {
+			fan(earIdx.data(), vtxNum);
+			return;
+		}
+
+		earPos.resize(vtxNum * 3);
+		for (int i = 0; i < vtxNum; ++i) {
+			int pnt = vmap[pVtx[i]];
+			float const* p = pnt >= 0 && pnt < pPos->mAttribCount ? pPos->get_float_val(pnt) : nullptr;
+			for (int j = 0; j < 3; ++j) {
+				earPos[i * 3 + j] = p ? p[j] : 0.0f;
 			}
 		}
-		return -1;
+
+		// Newell normal
+		float nrm[3] = { 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < vtxNum; ++i) {
+			float const* a = &earPos[i * 3];
+			float const* b = &earPos[((i + 1) % vtxNum) * 3];
+			nrm[0] += (a[1] - b[1]) * (a[2] + b[2]);
+			nrm[1] += (a[2] - b[2]) * (a[0] + b[0]);
+			nrm[2] += (a[0] - b[0]) * (a[1] + b[1]);
+		}
+		int axis = 0;
+		for (int j = 1; j < 3; ++j) {
+			if (::fabsf(nrm[j]) > ::fabsf(nrm[axis])) { axis = j; }
+		}
+		if (nrm[axis] == 0.0f) {
+			fan(earIdx.data(), vtxNum);
+			return;
+		}
+
+		// Cyclic projection keeps the sign of the area equal to the sign of nrm[axis],
+		// u is flipped so that the polygon is counter-clockwise in 2D
+		const int ua = (axis + 1) % 3;
+		const int va = (axis + 2) % 3;
+		const float flip = nrm[axis] < 0.0f ? -1.0f : 1.0f;
+		earUV.resize(vtxNum * 2);
+		for (int i = 0; i < vtxNum; ++i) {
+			earUV[i * 2] = earPos[i * 3 + ua] * flip;
+			earUV[i * 2 + 1] = earPos[i * 3 + va];
+		}
+
+		auto cross = [&](int a, int b, int c) {
+			float const* pa = &earUV[a * 2];
+			float const* pb = &earUV[b * 2];
+			float const* pc = &earUV[c * 2];
+			return (pb[0] - pa[0]) * (pc[1] - pa[1]) - (pb[1] - pa[1]) * (pc[0] - pa[0]);
+		};
+
+		int num = vtxNum;
+		while (num > 3) {
+			bool clipped = false;
+			for (int i = 0; i < num; ++i) {
+				int a = earIdx[(i + num - 1) % num];
+				int b = earIdx[i];
+				int c = earIdx[(i + 1) % num];
+				if (cross(a, b, c) <= 0.0f) { continue; }
+
+				bool ear = true;
+				for (int k = 0; k < num && ear; ++k) {
+					int p = earIdx[k];
+					if (p == a || p == b || p == c) { continue; }
+					ear = !(cross(a, b, p) >= 0.0f && cross(b, c, p) >= 0.0f && cross(c, a, p) >= 0.0f);
+				}
+				if (!ear) { continue; }
+
+				*pOut++ = pVtx[a];
+				*pOut++ = pVtx[b];
+				*pOut++ = pVtx[c];
+				earIdx.erase(earIdx.begin() + i);
+				--num;
+				clipped = true;
+				break;
+			}
+			if (!clipped) {
+				fan(earIdx.data(), num);
+				return;
+			}
+		}
+		fan(earIdx.data(), num);
+	}
+
+	// Skips the rest of the prim data array, adding an invalid poly per element
+	bool load_primitives_invalid() {
+		while (mJs.peek() != cJsonStream::E_TOKEN_ARRAY_END) {
+			CHECK_SCHEMA(mJs.skip_value(), "unable to read prim\n");
+			add_dropped(mPrims.droppedType);
+		}
+		mJs.next();
+		return true;
+	}
+
+protected:
+
+	bool is_wanted(cstr name) const {
+		if (!mpNames) { return true; }
+		for (int i = 0; i < mNamesNum; ++i) {
+			if (name.equals(mpNames[i])) { return true; }
+		}
+		return false;
 	}
 
-	Value const* get_value(Value const& doc, cstr key) {
-		auto keyI = find_key(doc, key);
-		if (keyI == -1) { return nullptr; }
-		return &doc[keyI];
+	// Houdini writes maps as flat [key, value, ...] arrays, objects are accepted too.
+	// func is called with each key and must consume the value.
+	template <typename TFunc>
+	bool read_kv(TFunc func) {
+		auto tk = mJs.next();
+		CHECK_SCHEMA(tk == cJsonStream::E_TOKEN_ARRAY_BEGIN || tk == cJsonStream::E_TOKEN_OBJECT_BEGIN, "key-value array expected\n");
+		for (;;) {
+			tk = mJs.next();
+			if (mJs.is_end()) { return true; }
+			CHECK_SCHEMA(tk == cJsonStream::E_TOKEN_STRING, "key is not a string\n");
+			std::string key = mJs.get_str().p;
+			if (!func(cstr(key.c_str()))) { return false; }
+		}
 	}
 
-	bool get_value_str(Value const& doc, cstr key, cstr& res) {
-		auto val = get_value(doc, key);
-		if (!val) { return false; }
-		if (!val->IsString()) { return false; }
-		res = val->GetString();
+	bool read_int(int& val) {
+		if (mJs.next() != cJsonStream::E_TOKEN_NUMBER) { return false; }
+		val = mJs.get_int();
 		return true;
 	}
 
-	bool get_value_str(Value const& doc, cstr key, std::string& res) {
-		cstr str;
-		if (get_value_str(doc, key, str)) {
-			res = str;
+	bool read_bool(bool& val) {
+		auto tk = mJs.next();
+		if (tk == cJsonStream::E_TOKEN_NUMBER) {
+			val = mJs.get_int() != 0;
 			return true;
 		}
-		return false;
+		if (tk != cJsonStream::E_TOKEN_TRUE && tk != cJsonStream::E_TOKEN_FALSE) { return false; }
+		val = mJs.get_bool();
+		return true;
 	}
 
-	bool get_key_value(Value const& doc, Size idx, cstr& key, Value const*& pVal) {
-		CHECK_SCHEMA(idx + 1 < doc.Size(), "wrong size of key-value array\n");
-		auto const& k = doc[idx];
-		CHECK_SCHEMA(k.IsString(), "key is not a string\n");
-		key = k.GetString();
-		pVal = &doc[idx + 1];
+	bool read_str(std::string& str) {
+		if (mJs.next() != cJsonStream::E_TOKEN_STRING) { return false; }
+		str = mJs.get_str().p;
 		return true;
 	}
 };
 
 
-bool cHouGeoLoader::load(cstr filepath) {
-	cLoaderImpl loader(*this);
-	if (!nJsonHelpers::load_file(filepath, loader)) {
+bool cHouGeoLoader::load(cstr filepath, cThreadPool* pPool) {
+	const double t0 = now_sec();
+	mLoadTimes = sHouGeoLoadTimes();
+
+	// Sections point into the file text, so it's mapped whole
+	cJsonStream js;
+	if (!js.open(filepath, pPool != nullptr)) {
+		return false;
+	}
+	// Binary files are bulk-copied by the scan already
+	std::vector<std::unique_ptr<sSection>> sections;
+	cLoaderImpl loader(*this, js);
+	if (pPool && !js.is_binary()) {
+		loader.set_sections(&sections);
+	}
+	if (!loader()) {
+		dbg_msg("hou geo: error loading <%s> at offset %u\n", filepath.p, (uint32_t)js.get_offset());
+		return false;
+	}
+	mLoadTimes.scan = now_sec() - t0;
+
+	if (!loader.finish(pPool)) {
+		dbg_msg("hou geo: error loading <%s>\n", filepath.p);
 		return false;
 	}
 
 	check_nonempty_groups();
+	mLoadTimes.total = now_sec() - t0;
+
+	auto const& t = mLoadTimes;
+	dbg_msg("hou geo: <%s> loaded in %.1f ms: scan %.1f, sections %.1f, arrays %.1f, triangulate %.1f\n", filepath.p,
+		t.total * 1e3, t.scan * 1e3, t.sections * 1e3, t.arrays * 1e3, t.triangulate * 1e3);
+	for (auto const& sec : t.sectionTimes) {
+		dbg_msg("  %s: %.1f ms\n", sec.name.c_str(), sec.time * 1e3);
+	}
+	return true;
+}
+
+bool cHouGeoLoader::load_attribs(cstr filepath, cstr const* pNames, int namesNum) {
+	cJsonStream js;
+	if (!js.open(filepath)) {
+		return false;
+	}
+	cLoaderImpl loader(*this, js, pNames, namesNum);
+	if (!loader()) {
+		dbg_msg("hou geo: error loading attributes of <%s> at offset %u\n", filepath.p, (uint32_t)js.get_offset());
+		return false;
+	}
 	return true;
 }
 
@@ -488,6 +1197,142 @@ void cHouGeoLoader::check_nonempty_groups() {
 }
 
 
+cHouGeoAttrib const* cHouGeoLoader::find_attrib(cstr name, cHouGeoAttrib::eType type, eAttribClass* pClass) const {
+	struct sClassAttribs {
+		cHouGeoAttrib const* pAttribs;
+		int count;
+		eAttribClass cls;
+	};
+	const sClassAttribs classes[] = {
+		{ mpVertexAttribs.get(), mVertexAttribCount, E_CLASS_VERTEX },
+		{ mpPointAttribs.get(), mPointAttribCount, E_CLASS_POINT },
+		{ mpPrimAttribs.get(), mPrimAttribCount, E_CLASS_PRIM },
+		{ mpDetailAttribs.get(), mDetailAttribCount, E_CLASS_DETAIL },
+	};
+	for (auto const& ca : classes) {
+		for (int i = 0; i < ca.count; ++i) {
+			auto const& attr = ca.pAttribs[i];
+			if (attr.mType == type && attr.mAttribCount > 0 && name.equals(attr.mName.c_str())) {
+				if (pClass) { *pClass = ca.cls; }
+				return &attr;
+			}
+		}
+	}
+	return nullptr;
+}
+
+int cHouGeoLoader::get_elem_index(sHouGeoWeldVtx const& w, eAttribClass cls) {
+	switch (cls) {
+	case E_CLASS_VERTEX: return w.vertex;
+	case E_CLASS_PRIM: return w.prim;
+	case E_CLASS_DETAIL: return 0;
+	default: return w.point;
+	}
+}
+
+void cHouGeoLoader::weld(std::vector<int32_t>& vtxToWeld, std::vector<sHouGeoWeldVtx>& welded) const {
+	auto const* vmap = mpVertexMap.get();
+	auto const* vprim = mpVertexPrim.get();
+	vtxToWeld.assign(mVertexCount, -1);
+	welded.clear();
+
+	// Byte slices of the attributes that can split a point
+	struct sKeyAttr {
+		uint8_t const* pData;
+		size_t stride;
+		bool perVertex;
+	};
+	std::vector<sKeyAttr> keyAttrs;
+	auto addKeyAttrs = [&](cHouGeoAttrib const* pAttribs, int count, bool perVertex) {
+		for (int i = 0; i < count; ++i) {
+			auto const& attr = pAttribs[i];
+			if (attr.mType == cHouGeoAttrib::E_TYPE_unknown || attr.mAttribCount == 0) { continue; }
+			keyAttrs.push_back({ attr.mpData.get(), (size_t)attr.mAttribSize * 4, perVertex });
+		}
+	};
+	addKeyAttrs(mpVertexAttribs.get(), mVertexAttribCount, true);
+	if (vprim) {
+		addKeyAttrs(mpPrimAttribs.get(), mPrimAttribCount, false);
+	}
+
+	if (!vmap) { return; }
+
+	if (keyAttrs.empty()) {
+		welded.resize(mPointCount);
+		for (int i = 0; i < mPointCount; ++i) {
+			welded[i] = { i, -1, -1 };
+		}
+		for (int i = 0; i < mVertexCount; ++i) {
+			vtxToWeld[i] = vmap[i];
+		}
+		return;
+	}
+
+	auto keyElem = [&](sKeyAttr const& ka, int vtx) {
+		return ka.perVertex ? vtx : vprim[vtx];
+	};
+
+	auto keyHash = [&](int vtx) {
+		uint64_t h = 14695981039346656037ULL;
+		auto mix = [&](uint8_t const* p, size_t size) {
+			for (size_t i = 0; i < size; ++i) {
+				h = (h ^ p[i]) * 1099511628211ULL;
+			}
+		};
+		mix(reinterpret_cast<uint8_t const*>(&vmap[vtx]), sizeof(int32_t));
+		for (auto const& ka : keyAttrs) {
+			int elem = keyElem(ka, vtx);
+			if (elem >= 0) {
+				mix(ka.pData + elem * ka.stride, ka.stride);
+			}
+		}
+		return h;
+	};
+
+	auto keyEqual = [&](int a, int b) {
+		if (vmap[a] != vmap[b]) { return false; }
+		for (auto const& ka : keyAttrs) {
+			int ea = keyElem(ka, a);
+			int eb = keyElem(ka, b);
+			if (ea < 0 || eb < 0) {
+				if (ea != eb) { return false; }
+				continue;
+			}
+			if (::memcmp(ka.pData + ea * ka.stride, ka.pData + eb * ka.stride, ka.stride) != 0) { return false; }
+		}
+		return true;
+	};
+
+	// Open addressing, the table holds output indices
+	size_t tableSize = 16;
+	while (tableSize < (size_t)mVertexCount * 2) {
+		tableSize *= 2;
+	}
+	const size_t mask = tableSize - 1;
+	std::vector<int32_t> table(tableSize, -1);
+	welded.reserve(mPointCount);
+
+	for (int vtx = 0; vtx < mVertexCount; ++vtx) {
+		if (vprim && vprim[vtx] < 0) { continue; }
+
+		size_t slot = (size_t)keyHash(vtx) & mask;
+		int32_t idx = -1;
+		for (; table[slot] >= 0; slot = (slot + 1) & mask) {
+			if (keyEqual(welded[table[slot]].vertex, vtx)) {
+				idx = table[slot];
+				break;
+			}
+		}
+		if (idx < 0) {
+			idx = (int32_t)welded.size();
+			table[slot] = idx;
+			welded.push_back({ vmap[vtx], vtx, vprim ? vprim[vtx] : -1 });
+		}
+		vtxToWeld[vtx] = idx;
+	}
+}
+
+
 void cHouGeoAttrib::init(cstr name, cstr type, int attribSize, int count) {
 	mName = name;
 
@@ -496,10 +1341,11 @@ void cHouGeoAttrib::init(cstr name, cstr type, int attribSize, int count) {
 
 	size_t elemSize = 1;
 
-	if (type.equals("fpreal32")) { 
+	// Other widths are converted on load
+	if (type.equals("fpreal32") || type.equals("fpreal16") || type.equals("fpreal64")) {
 		mType = E_TYPE_fpreal32; 
 		elemSize = sizeof(float);
-	} else if (type.equals("int32")) { 
+	} else if (type.equals("int32") || type.equals("int8") || type.equals("int16") || type.equals("int64") || type.equals("uint8")) {
 		mType = E_TYPE_int32; 
 		elemSize = sizeof(int32_t);
 	}
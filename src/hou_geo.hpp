@@ -1,3 +1,4 @@
+class cThreadPool;
 
 class cHouGeoAttrib {
 public:
@@ -17,16 +18,16 @@ public:
 	void init(cstr name, cstr type, int attribSize, int count);
 
 	float* get_float_val(int idx) {
-		return &reinterpret_cast<float*>(mpData.get())[idx * mAttribSize];
+		return &reinterpret_cast<float*>(mpData.get())[(size_t)idx * mAttribSize];
 	}
 	int32_t* get_int32_val(int idx) {
-		return &reinterpret_cast<int32_t*>(mpData.get())[idx * mAttribSize];
+		return &reinterpret_cast<int32_t*>(mpData.get())[(size_t)idx * mAttribSize];
 	}
 	float const* get_float_val(int idx) const {
-		return &reinterpret_cast<float const*>(mpData.get())[idx * mAttribSize];
+		return &reinterpret_cast<float const*>(mpData.get())[(size_t)idx * mAttribSize];
 	}
 	int32_t const* get_int32_val(int idx) const {
-		return &reinterpret_cast<int32_t const*>(mpData.get())[idx * mAttribSize];
+		return &reinterpret_cast<int32_t const*>(mpData.get())[(size_t)idx * mAttribSize];
 	}
 };
 
@@ -45,11 +46,36 @@ public:
 	bool mEmpty = true;
 };
 
+// Closed polygon, triangulated on load into cHouGeoLoader::mTriVtx
 struct sHouGeoPrimPoly {
-	int v[3];
+	int triStart = 0;
+	int triCount = 0;
 	bool valid = false;
 };
 
+// Output vertex of cHouGeoLoader::weld: the elements to read each attribute class from
+struct sHouGeoWeldVtx {
+	int32_t point;
+	int32_t vertex;
+	int32_t prim;
+};
+
+// Wall times of the load steps in seconds. Sections are decoded only by a load
+// with a thread pool; their times are per thread and include their chunked arrays.
+struct sHouGeoLoadTimes {
+	struct sSection {
+		std::string name;
+		double time;
+	};
+
+	double scan = 0.0;
+	double sections = 0.0;
+	double arrays = 0.0;
+	double triangulate = 0.0;
+	double total = 0.0;
+	std::vector<sSection> sectionTimes;
+};
+
 class cHouGeoLoader {
 public:
 	int mPointCount = 0;
@@ -58,13 +84,48 @@ public:
 	int mGroupsCount = 0;
 	int mNonemptyGroups = 0;
 	int mPointAttribCount = 0;
+	int mVertexAttribCount = 0;
+	int mPrimAttribCount = 0;
+	int mDetailAttribCount = 0;
 
 	std::unique_ptr<cHouGeoAttrib[]> mpPointAttribs;
+	std::unique_ptr<cHouGeoAttrib[]> mpVertexAttribs;
+	std::unique_ptr<cHouGeoAttrib[]> mpPrimAttribs;
+	std::unique_ptr<cHouGeoAttrib[]> mpDetailAttribs;
 	std::unique_ptr<cHouGeoGroup[]> mpGroups;
 	std::unique_ptr<int32_t[]> mpVertexMap;
+	// Primitive of each vertex, -1 for dropped primitives
+	std::unique_ptr<int32_t[]> mpVertexPrim;
 	std::vector<sHouGeoPrimPoly> mPoly;
+	// Vertex numbers (indices into mpVertexMap), 3 per triangle
+	std::vector<int32_t> mTriVtx;
+	// Primitives without triangles: not a closed polygon, or fewer than 3 vertices
+	int mDroppedPrimCount = 0;
+	sHouGeoLoadTimes mLoadTimes;
 public:
-	bool load(cstr filepath);
+	enum eAttribClass {
+		E_CLASS_POINT,
+		E_CLASS_VERTEX,
+		E_CLASS_PRIM,
+		E_CLASS_DETAIL,
+	};
+
+	// With a pool the attributes, the topology and every primitive run of a text
+	// file are decoded in parallel; triangulation is parallel for all files.
+	bool load(cstr filepath, cThreadPool* pPool = nullptr);
+	// Loads the counts and the named numeric attributes only, for per-frame
+	// data of a sequence whose topology comes from another file.
+	bool load_attribs(cstr filepath, cstr const* pNames, int namesNum);
+
+	// Houdini precedence: vertex, point, primitive, detail. Returns nullptr if not found.
+	cHouGeoAttrib const* find_attrib(cstr name, cHouGeoAttrib::eType type, eAttribClass* pClass) const;
+
+	// Merges vertices that share the point and all vertex and primitive attribute
+	// values. vtxToWeld gets the output index of every vertex. Without vertex and
+	// primitive attributes the output is the point list.
+	void weld(std::vector<int32_t>& vtxToWeld, std::vector<sHouGeoWeldVtx>& welded) const;
+	// Element of an attribute of the class for the welded vertex, -1 if it has none
+	static int get_elem_index(sHouGeoWeldVtx const& w, eAttribClass cls);
 
 protected:
 
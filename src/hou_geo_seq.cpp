@@ -0,0 +1,218 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "hou_geo.hpp"
+#include "hou_geo_seq.hpp"
+
+#include <cstdio>
+
+std::string cHouGeoSeqReader::get_frame_path(cstr pattern, int frame) {
+	std::string path;
+	char const* p = pattern.p;
+	while (*p) {
+		if (p[0] == '$' && p[1] == 'F') {
+			p += 2;
+			int width = 0;
+			while (*p >= '0' && *p <= '9') {
+				width = width * 10 + (*p - '0');
+				++p;
+			}
+			char buf[32];
+			::snprintf(buf, sizeof(buf), "%0*d", width, frame);
+			path += buf;
+		} else {
+			path += *p++;
+		}
+	}
+	return path;
+}
+
+bool cHouGeoSeqReader::open(cstr pattern, int first, int last, cHouGeoLoader const& topo, size_t memBudget, int prefetch) {
+	close();
+	if (last < first) {
+		dbg_msg("hou geo seq: empty frame range %d-%d\n", first, last);
+		return false;
+	}
+
+	mPattern = pattern.p;
+	mFirst = first;
+	mLast = last;
+	mPointCount = topo.mPointCount;
+	mVertexCount = topo.mVertexCount;
+	mPrimitiveCount = topo.mPrimitiveCount;
+	std::vector<int32_t> vtxToWeld;
+	topo.weld(vtxToWeld, mWelded);
+
+	mMemBudget = memBudget;
+	mPrefetch = std::max(prefetch, 0);
+	mFrameBytes = 0;
+
+	const int count = last - first + 1;
+	mCache.assign(count, nullptr);
+	mFailed.assign(count, false);
+	mCacheBytes = 0;
+	mWant = -1;
+	mQuit = false;
+
+	mThread = std::thread([this]() { reader_loop(); });
+	return true;
+}
+
+void cHouGeoSeqReader::close() {
+	if (mThread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mQuit = true;
+		}
+		mWakeCV.notify_all();
+		mThread.join();
+	}
+	mCache.clear();
+	mFailed.clear();
+	mCacheBytes = 0;
+	mWelded.clear();
+}
+
+cHouGeoSeqReader::FramePtr cHouGeoSeqReader::get_frame(int frame, bool wait) {
+	if (!is_open()) { return nullptr; }
+
+	frame = wrap_frame(frame);
+	const int i = frame - mFirst;
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	if (mWant != frame) {
+		mWant = frame;
+		evict_outside_window();
+		mWakeCV.notify_one();
+	}
+	if (wait) {
+		mReadyCV.wait(lock, [&]() { return mCache[i] || mFailed[i]; });
+	}
+	return mCache[i];
+}
+
+int cHouGeoSeqReader::get_cached_num() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	int num = 0;
+	for (auto const& pFrame : mCache) {
+		if (pFrame) { ++num; }
+	}
+	return num;
+}
+
+size_t cHouGeoSeqReader::get_cache_bytes() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mCacheBytes;
+}
+
+int cHouGeoSeqReader::wrap_frame(int frame) const {
+	const int count = mLast - mFirst + 1;
+	int i = (frame - mFirst) % count;
+	if (i < 0) { i += count; }
+	return mFirst + i;
+}
+
+// Frames kept from mWant on: the prefetch count limited by the budget, at least the wanted frame
+int cHouGeoSeqReader::get_window() const {
+	const int count = mLast - mFirst + 1;
+	// Until a frame is decoded assume all channels are present
+	size_t frameBytes = mFrameBytes ? mFrameBytes : mWelded.size() * 3 * sizeof(float) * E_CHANNEL_NUM;
+	size_t fit = frameBytes ? mMemBudget / frameBytes : (size_t)count;
+	int window = (int)std::min<size_t>(fit, (size_t)mPrefetch + 1);
+	return std::max(1, std::min(window, count));
+}
+
+int cHouGeoSeqReader::next_to_load() const {
+	if (mWant < 0) { return -1; }
+	const int count = mLast - mFirst + 1;
+	const int window = get_window();
+	for (int j = 0; j < window; ++j) {
+		int i = (mWant - mFirst + j) % count;
+		if (!mCache[i] && !mFailed[i]) { return mFirst + i; }
+	}
+	return -1;
+}
+
+void cHouGeoSeqReader::evict_outside_window() {
+	const int count = mLast - mFirst + 1;
+	const int window = get_window();
+	for (int i = 0; i < count; ++i) {
+		if (!mCache[i]) { continue; }
+		int dist = (i - (mWant - mFirst) + count) % count;
+		if (dist >= window) {
+			mCacheBytes -= mCache[i]->mBytes;
+			mCache[i].reset();
+		}
+	}
+}
+
+void cHouGeoSeqReader::reader_loop() {
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (true) {
+		int frame = -1;
+		mWakeCV.wait(lock, [&]() {
+			if (mQuit) { return true; }
+			frame = next_to_load();
+			return frame >= 0;
+		});
+		if (mQuit) { break; }
+
+		lock.unlock();
+		auto pFrame = load_frame(frame);
+		lock.lock();
+
+		const int i = frame - mFirst;
+		if (pFrame) {
+			mFrameBytes = std::max(mFrameBytes, pFrame->mBytes);
+			if (!mCache[i]) {
+				mCacheBytes += pFrame->mBytes;
+				mCache[i] = std::move(pFrame);
+			}
+			evict_outside_window();
+		} else {
+			mFailed[i] = true;
+		}
+		mReadyCV.notify_all();
+	}
+}
+
+cHouGeoSeqReader::FramePtr cHouGeoSeqReader::load_frame(int frame) const {
+	static const cstr names[E_CHANNEL_NUM] = { "P", "N", "Cd" };
+
+	std::string path = get_frame_path(mPattern.c_str(), frame);
+	cHouGeoLoader geo;
+	if (!geo.load_attribs(path.c_str(), names, E_CHANNEL_NUM)) {
+		return nullptr;
+	}
+	if (geo.mPointCount != mPointCount || geo.mVertexCount != mVertexCount || geo.mPrimitiveCount != mPrimitiveCount) {
+		dbg_msg("hou geo seq: topology of <%s> differs from the first frame\n", path.c_str());
+		return nullptr;
+	}
+
+	auto pFrame = std::make_shared<sFrame>();
+	pFrame->mFrame = frame;
+	const size_t vtxNum = mWelded.size();
+	for (int ch = 0; ch < E_CHANNEL_NUM; ++ch) {
+		cHouGeoLoader::eAttribClass cls;
+		auto pa = geo.find_attrib(names[ch], cHouGeoAttrib::E_TYPE_fpreal32, &cls);
+		if (!pa) { continue; }
+
+		auto pDst = std::make_unique<float[]>(vtxNum * 3);
+		const int comps = std::min(pa->mAttribSize, 3);
+		for (size_t i = 0; i < vtxNum; ++i) {
+			float* pVal = &pDst[i * 3];
+			pVal[0] = pVal[1] = pVal[2] = 0.0f;
+			int idx = cHouGeoLoader::get_elem_index(mWelded[i], cls);
+			if (idx < 0) { continue; }
+			float const* pSrc = pa->get_float_val(idx);
+			for (int c = 0; c < comps; ++c) {
+				pVal[c] = pSrc[c];
+			}
+		}
+		pFrame->mpChannels[ch] = std::move(pDst);
+		pFrame->mBytes += vtxNum * 3 * sizeof(float);
+	}
+	return pFrame;
+}
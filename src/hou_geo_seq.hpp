@@ -0,0 +1,85 @@
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Streams the per-frame channels of a Houdini geometry sequence with constant
+// topology. A background thread decodes the frames ahead of the requested one
+// into welded vertex order, as long as they fit into the memory budget.
+class cHouGeoSeqReader : noncopyable {
+public:
+	enum eChannel {
+		E_CHANNEL_POS,
+		E_CHANNEL_NRM,
+		E_CHANNEL_CLR,
+		E_CHANNEL_NUM,
+	};
+
+	struct sFrame {
+		int mFrame = -1;
+		// 3 floats per welded vertex, null if the frame has no such attribute
+		std::unique_ptr<float[]> mpChannels[E_CHANNEL_NUM];
+		size_t mBytes = 0;
+
+		float const* get(eChannel ch) const { return mpChannels[ch].get(); }
+	};
+	using FramePtr = std::shared_ptr<sFrame const>;
+
+private:
+	std::string mPattern;
+	int mFirst = 0;
+	int mLast = -1;
+	int mPointCount = 0;
+	int mVertexCount = 0;
+	int mPrimitiveCount = 0;
+	std::vector<sHouGeoWeldVtx> mWelded;
+
+	size_t mMemBudget = 0;
+	int mPrefetch = 0;
+	size_t mFrameBytes = 0;
+
+	std::thread mThread;
+	std::mutex mMutex;
+	std::condition_variable mWakeCV;
+	std::condition_variable mReadyCV;
+	// Indexed by frame - mFirst
+	std::vector<FramePtr> mCache;
+	std::vector<bool> mFailed;
+	size_t mCacheBytes = 0;
+	int mWant = -1;
+	bool mQuit = false;
+
+public:
+	cHouGeoSeqReader() = default;
+	~cHouGeoSeqReader() { close(); }
+
+	// $F in the pattern is replaced by the frame number, $F4 pads it with zeros to 4 digits
+	static std::string get_frame_path(cstr pattern, int frame);
+
+	// topo is the loaded first frame. Frames that don't fit into memBudget are not prefetched.
+	bool open(cstr pattern, int first, int last, cHouGeoLoader const& topo, size_t memBudget, int prefetch);
+	void close();
+	bool is_open() const { return mThread.joinable(); }
+
+	int get_first() const { return mFirst; }
+	int get_last() const { return mLast; }
+	uint32_t get_vtx_num() const { return (uint32_t)mWelded.size(); }
+
+	// Moves the prefetch window to start at the frame, frames outside of
+	// [first, last] wrap around. Returns the frame if it's decoded; with wait
+	// blocks until it is, null if it fails to load.
+	FramePtr get_frame(int frame, bool wait);
+
+	int get_cached_num();
+	size_t get_cache_bytes();
+
+private:
+	int wrap_frame(int frame) const;
+	int get_window() const;
+	int next_to_load() const;
+	void evict_outside_window();
+	void reader_loop();
+	FramePtr load_frame(int frame) const;
+};
@@ -1,5 +1,6 @@
 #include <memory>
 
+#include "vmath.hpp"
 #include "math.hpp"
 #include "common.hpp"
 #include "texture.hpp"
@@ -1,3 +1,4 @@
+#include "vmath.hpp"
 #include "math.hpp"
 #include "input.hpp"
 #include "common.hpp"
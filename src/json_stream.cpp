@@ -0,0 +1,854 @@
+#include <cstdlib>
+#include <algorithm>
+
+#include "common.hpp"
+#include "json_stream.hpp"
+#include "mapped_file.hpp"
+
+// Houdini binary JSON token ids
+enum eJid : uint8_t {
+	JID_NULL = 0x00,
+	JID_BOOL = 0x10,
+	JID_INT8 = 0x11,
+	JID_INT16 = 0x12,
+	JID_INT32 = 0x13,
+	JID_INT64 = 0x14,
+	JID_REAL16 = 0x18,
+	JID_REAL32 = 0x19,
+	JID_REAL64 = 0x1a,
+	JID_UINT8 = 0x21,
+	JID_UINT16 = 0x22,
+	JID_TOKENREF = 0x26,
+	JID_STRING = 0x27,
+	JID_TOKENDEF = 0x2b,
+	JID_VALUE_SEPARATOR = 0x2c,
+	JID_TOKENUNDEF = 0x2d,
+	JID_FALSE = 0x30,
+	JID_TRUE = 0x31,
+	JID_KEY_SEPARATOR = 0x3a,
+	JID_UNIFORM_ARRAY = 0x40,
+	JID_ARRAY_BEGIN = 0x5b,
+	JID_ARRAY_END = 0x5d,
+	JID_MAP_BEGIN = 0x7b,
+	JID_MAP_END = 0x7d,
+	JID_MAGIC = 0x7f,
+};
+
+static const uint32_t BINARY_MAGIC = 0x624a534e; // "NSJb"
+static const uint32_t BINARY_MAGIC_SWAP = 0x4e534a62;
+
+static size_t jid_size(uint8_t type) {
+	switch (type) {
+	case JID_INT8: case JID_UINT8: return 1;
+	case JID_INT16: case JID_UINT16: case JID_REAL16: return 2;
+	case JID_INT32: case JID_REAL32: return 4;
+	case JID_INT64: case JID_REAL64: return 8;
+	default: return 0;
+	}
+}
+
+static float half_to_float(uint16_t h) {
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exp = (h >> 10) & 0x1F;
+	uint32_t mant = h & 0x3FF;
+	uint32_t bits;
+	if (exp == 0x1F) {
+		bits = sign | 0x7F800000 | (mant << 13);
+	} else if (exp != 0) {
+		bits = sign | ((exp + 112) << 23) | (mant << 13);
+	} else if (mant == 0) {
+		bits = sign;
+	} else {
+		// Denormal half, normalize
+		exp = 113;
+		while (!(mant & 0x400)) {
+			mant <<= 1;
+			--exp;
+		}
+		bits = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+	}
+	float f;
+	::memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+// Character classes for the byte scans over whole sections
+enum eCharClass : uint8_t {
+	E_CHAR_WS = 1,
+	E_CHAR_NUM = 2,
+	E_CHAR_BRACKET = 4,
+	// Changes the nesting or string state of capture_value
+	E_CHAR_STRUCT = 8,
+};
+
+static const struct sCharClasses {
+	uint8_t cls[256];
+
+	sCharClasses() : cls() {
+		for (char c : { ' ', '\n', '\r', '\t', ',', ':' }) { cls[(uint8_t)c] |= E_CHAR_WS; }
+		for (char c : { '-', '+', '.', 'e', 'E' }) { cls[(uint8_t)c] |= E_CHAR_NUM; }
+		for (char c = '0'; c <= '9'; ++c) { cls[(uint8_t)c] |= E_CHAR_NUM; }
+		for (char c : { '[', ']' }) { cls[(uint8_t)c] |= E_CHAR_BRACKET; }
+		for (char c : { '[', ']', '{', '}', '"', '\\' }) { cls[(uint8_t)c] |= E_CHAR_STRUCT; }
+	}
+} sCharClasses;
+
+static bool is_char(char c, uint8_t mask) {
+	return (sCharClasses.cls[(uint8_t)c] & mask) != 0;
+}
+
+static bool is_ws(char c) {
+	return is_char(c, E_CHAR_WS);
+}
+
+static bool is_num_char(char c) {
+	return is_char(c, E_CHAR_NUM);
+}
+
+cJsonStream::cJsonStream() {}
+
+cJsonStream::~cJsonStream() {}
+
+bool cJsonStream::open(cstr filepath, bool inMemory) {
+	close();
+	if (inMemory) {
+		// Mapped pages are read on demand and belong to the file cache, not the heap
+		mpMap = std::make_unique<cMappedFile>();
+		if (!mpMap->open(filepath)) {
+			dbg_msg("json: can't map <%s>\n", filepath.p);
+			close();
+			return false;
+		}
+		mpData = (char const*)mpMap->get_data();
+		mBufSize = mpMap->get_size();
+		mEnd = mBufSize;
+		mMemory = true;
+	} else {
+		mFile.open(filepath, std::ios::binary);
+		if (!mFile.is_open()) { return false; }
+		mBufSize = CHUNK_SIZE;
+		mpBuf = std::make_unique<char[]>(mBufSize);
+		mpData = mpBuf.get();
+		mFileEnd = false;
+	}
+
+	if (need(1) && (uint8_t)mpData[0] == JID_MAGIC) {
+		++mPos;
+		uint32_t magic = 0;
+		if (!read_raw(magic) || (magic != BINARY_MAGIC && magic != BINARY_MAGIC_SWAP)) {
+			dbg_msg("json: bad binary magic in <%s>\n", filepath.p);
+			close();
+			return false;
+		}
+		mBinary = true;
+		mSwap = magic == BINARY_MAGIC_SWAP;
+	}
+	return true;
+}
+
+void cJsonStream::close() {
+	if (mFile.is_open()) {
+		mFile.close();
+	}
+	mFile.clear();
+	mpBuf.reset();
+	mpMap.reset();
+	mpData = nullptr;
+	mBufSize = 0;
+	mPos = 0;
+	mEnd = 0;
+	mConsumed = 0;
+	mFileEnd = true;
+	mToken = E_TOKEN_NONE;
+	mPeeked = false;
+	mMemory = false;
+	mBinary = false;
+	mSwap = false;
+	mUniformLeft = -1;
+	mStrTokens.clear();
+}
+
+// Keeps [mPos, mEnd) and appends the next chunk, mPos becomes 0.
+// The buffer only grows when a single token is larger than it.
+bool cJsonStream::fill() {
+	if (mFileEnd) { return false; }
+
+	size_t rest = mEnd - mPos;
+	if (mPos > 0) {
+		::memmove(mpBuf.get(), mpBuf.get() + mPos, rest);
+		mConsumed += mPos;
+		mPos = 0;
+		mEnd = rest;
+	}
+	if (mEnd == mBufSize) {
+		auto pBuf = std::make_unique<char[]>(mBufSize * 2);
+		::memcpy(pBuf.get(), mpBuf.get(), mEnd);
+		mpBuf = std::move(pBuf);
+		mpData = mpBuf.get();
+		mBufSize *= 2;
+	}
+
+	mFile.read(mpBuf.get() + mEnd, mBufSize - mEnd);
+	size_t readNum = (size_t)mFile.gcount();
+	if (!mFile) {
+		mFileEnd = true;
+	}
+	mEnd += readNum;
+	return readNum > 0;
+}
+
+bool cJsonStream::skip_ws() {
+	for (;;) {
+		char const* pBuf = mpData;
+		while (mPos < mEnd && is_ws(pBuf[mPos])) {
+			++mPos;
+		}
+		if (mPos < mEnd) { return true; }
+		if (!fill()) { return false; }
+	}
+}
+
+cJsonStream::eToken cJsonStream::next() {
+	if (mPeeked) {
+		mPeeked = false;
+		return mToken;
+	}
+	mToken = read_token();
+	return mToken;
+}
+
+cJsonStream::eToken cJsonStream::peek() {
+	if (!mPeeked) {
+		mToken = read_token();
+		mPeeked = true;
+	}
+	return mToken;
+}
+
+bool cJsonStream::expect(eToken tk) {
+	return next() == tk;
+}
+
+bool cJsonStream::skip_value() {
+	eToken tk = next();
+	if (tk != E_TOKEN_ARRAY_BEGIN && tk != E_TOKEN_OBJECT_BEGIN) {
+		return tk != E_TOKEN_ARRAY_END && tk != E_TOKEN_OBJECT_END && tk != E_TOKEN_EOF && tk != E_TOKEN_ERROR;
+	}
+	if (mUniformLeft >= 0) {
+		// Uniform arrays are skipped without decoding
+		size_t size = mUniformType == JID_BOOL
+			? (size_t)((mUniformLeft + 31) / 32) * 4
+			: (size_t)mUniformLeft * jid_size(mUniformType);
+		mUniformLeft = -1;
+		while (size > 0) {
+			if (mPos == mEnd && !fill()) { return false; }
+			size_t skipNum = std::min(size, mEnd - mPos);
+			mPos += skipNum;
+			size -= skipNum;
+		}
+		mToken = E_TOKEN_ARRAY_END;
+		return true;
+	}
+	int depth = 1;
+	while (depth > 0) {
+		tk = next();
+		switch (tk) {
+		case E_TOKEN_ARRAY_BEGIN:
+		case E_TOKEN_OBJECT_BEGIN:
+			++depth;
+			break;
+		case E_TOKEN_ARRAY_END:
+		case E_TOKEN_OBJECT_END:
+			--depth;
+			break;
+		case E_TOKEN_EOF:
+		case E_TOKEN_ERROR:
+			return false;
+		default:
+			break;
+		}
+	}
+	return true;
+}
+
+cJsonStream::eToken cJsonStream::read_token() {
+	if (mBinary) { return read_token_bin(); }
+	if (!skip_ws()) { return E_TOKEN_EOF; }
+
+	char c = mpData[mPos];
+	switch (c) {
+	case '[': ++mPos; return E_TOKEN_ARRAY_BEGIN;
+	case ']': ++mPos; return E_TOKEN_ARRAY_END;
+	case '{': ++mPos; return E_TOKEN_OBJECT_BEGIN;
+	case '}': ++mPos; return E_TOKEN_OBJECT_END;
+	case '"': return read_string() ? E_TOKEN_STRING : E_TOKEN_ERROR;
+	case 't': return read_literal("true", 4) ? E_TOKEN_TRUE : E_TOKEN_ERROR;
+	case 'f': return read_literal("false", 5) ? E_TOKEN_FALSE : E_TOKEN_ERROR;
+	case 'n': return read_literal("null", 4) ? E_TOKEN_NULL : E_TOKEN_ERROR;
+	default:
+		if (c == '-' || (c >= '0' && c <= '9')) {
+			return scan_number(mNum) ? E_TOKEN_NUMBER : E_TOKEN_ERROR;
+		}
+		dbg_msg("json: unexpected character '%c' at offset %u\n", c, (uint32_t)get_offset());
+		return E_TOKEN_ERROR;
+	}
+}
+
+bool cJsonStream::read_literal(char const* pLit, size_t len) {
+	while (mEnd - mPos < len) {
+		if (!fill()) { return false; }
+	}
+	if (::memcmp(mpData + mPos, pLit, len) != 0) { return false; }
+	mPos += len;
+	return true;
+}
+
+static void append_utf8(std::string& str, uint32_t cp) {
+	if (cp < 0x80) {
+		str += (char)cp;
+	} else if (cp < 0x800) {
+		str += (char)(0xC0 | (cp >> 6));
+		str += (char)(0x80 | (cp & 0x3F));
+	} else {
+		str += (char)(0xE0 | (cp >> 12));
+		str += (char)(0x80 | ((cp >> 6) & 0x3F));
+		str += (char)(0x80 | (cp & 0x3F));
+	}
+}
+
+bool cJsonStream::read_string() {
+	// Find the closing quote first, so the whole string is in the buffer
+	size_t i = mPos + 1;
+	bool escaped = false;
+	for (;;) {
+		if (i >= mEnd) {
+			size_t ofs = i - mPos;
+			if (!fill()) { return false; }
+			i = mPos + ofs;
+			continue;
+		}
+		char c = mpData[i];
+		if (c == '\\') {
+			escaped = true;
+			i += 2;
+			continue;
+		}
+		if (c == '"') { break; }
+		++i;
+	}
+
+	char const* pSrc = mpData + mPos + 1;
+	char const* pEnd = mpData + i;
+	mPos = i + 1;
+
+	if (!escaped) {
+		mStr.assign(pSrc, pEnd);
+		return true;
+	}
+
+	mStr.clear();
+	while (pSrc < pEnd) {
+		char c = *pSrc++;
+		if (c != '\\') {
+			mStr += c;
+			continue;
+		}
+		char e = *pSrc++;
+		switch (e) {
+		case 'n': mStr += '\n'; break;
+		case 'r': mStr += '\r'; break;
+		case 't': mStr += '\t'; break;
+		case 'b': mStr += '\b'; break;
+		case 'f': mStr += '\f'; break;
+		case 'u': {
+			if (pEnd - pSrc < 4) { return false; }
+			char hex[5] = { pSrc[0], pSrc[1], pSrc[2], pSrc[3], 0 };
+			append_utf8(mStr, (uint32_t)::strtoul(hex, nullptr, 16));
+			pSrc += 4;
+			break;
+		}
+		default: mStr += e; break;
+		}
+	}
+	return true;
+}
+
+bool cJsonStream::scan_number(double& num) {
+	for (;;) {
+		char const* pBuf = mpData;
+		size_t i = mPos;
+		while (i < mEnd && is_num_char(pBuf[i])) {
+			++i;
+		}
+		if (i == mEnd && !mFileEnd) {
+			// Rescan from the moved mPos, also when nothing more was read
+			fill();
+			continue;
+		}
+		bool res = parse_number(pBuf + mPos, pBuf + i, num);
+		if (!res) {
+			dbg_msg("json: bad number at offset %u\n", (uint32_t)get_offset());
+		}
+		mPos = i;
+		return res;
+	}
+}
+
+// Mantissa and decimal exponent are accumulated as integers and combined with
+// one multiply or divide by an exact power of 10; large exponents go through strtod.
+bool cJsonStream::parse_number(char const* pBeg, char const* pEnd, double& num) {
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	char const* p = pBeg;
+	bool negative = false;
+	if (p < pEnd && *p == '-') {
+		negative = true;
+		++p;
+	}
+
+	// Digits past 2^53 are dropped, that is well below double precision
+	uint64_t mant = 0;
+	int digits = 0;
+	int exp10 = 0;
+	for (; p < pEnd && *p >= '0' && *p <= '9'; ++p, ++digits) {
+		if (mant < (1ULL << 53) / 10) {
+			mant = mant * 10 + (*p - '0');
+		} else {
+			++exp10;
+		}
+	}
+	if (p < pEnd && *p == '.') {
+		++p;
+		for (; p < pEnd && *p >= '0' && *p <= '9'; ++p, ++digits) {
+			if (mant < (1ULL << 53) / 10) {
+				mant = mant * 10 + (*p - '0');
+				--exp10;
+			}
+		}
+	}
+	if (digits == 0) { return false; }
+
+	if (p < pEnd && (*p == 'e' || *p == 'E')) {
+		++p;
+		bool expNeg = false;
+		if (p < pEnd && (*p == '-' || *p == '+')) {
+			expNeg = *p == '-';
+			++p;
+		}
+		if (p == pEnd) { return false; }
+		int e = 0;
+		for (; p < pEnd && *p >= '0' && *p <= '9'; ++p) {
+			e = e < 10000 ? e * 10 + (*p - '0') : e;
+		}
+		exp10 += expNeg ? -e : e;
+	}
+	if (p != pEnd) { return false; }
+
+	if (exp10 >= -22 && exp10 <= 22) {
+		double d = (double)mant;
+		d = exp10 < 0 ? d / pow10[-exp10] : d * pow10[exp10];
+		num = negative ? -d : d;
+		return true;
+	}
+
+	char buf[128];
+	size_t len = (size_t)(pEnd - pBeg);
+	if (len >= sizeof(buf)) { return false; }
+	::memcpy(buf, pBeg, len);
+	buf[len] = 0;
+	num = ::strtod(buf, nullptr);
+	return true;
+}
+
+template <typename T, typename TStore>
+int cJsonStream::read_numbers_impl(TStore store) {
+	int count = 0;
+	if (mPeeked) {
+		mPeeked = false;
+		if (mToken == E_TOKEN_ARRAY_END) { return 0; }
+		if (mToken != E_TOKEN_NUMBER || !store(count++, (T)mNum)) { return -1; }
+	}
+
+	if (mBinary) {
+		for (;;) {
+			mToken = read_token_bin();
+			if (mToken == E_TOKEN_ARRAY_END) { return count; }
+			if (mToken != E_TOKEN_NUMBER || !store(count++, (T)mNum)) {
+				mToken = E_TOKEN_ERROR;
+				return -1;
+			}
+		}
+	}
+
+	for (;;) {
+		if (!skip_ws()) {
+			mToken = E_TOKEN_EOF;
+			return -1;
+		}
+		char c = mpData[mPos];
+		if (c == ']') {
+			++mPos;
+			mToken = E_TOKEN_ARRAY_END;
+			return count;
+		}
+		double num;
+		if (!(c == '-' || (c >= '0' && c <= '9')) || !scan_number(num)) {
+			mToken = E_TOKEN_ERROR;
+			return -1;
+		}
+		if (!store(count++, (T)num)) {
+			mToken = E_TOKEN_ERROR;
+			return -1;
+		}
+	}
+}
+
+int cJsonStream::read_numbers(float* pDst, int maxNum) {
+	if (mBinary && !mPeeked && mUniformLeft >= 0 && mUniformType == JID_REAL32 && !mSwap) {
+		return read_uniform_bulk(pDst, sizeof(float), maxNum);
+	}
+	return read_numbers_impl<float>([=](int idx, float val) {
+		if (idx >= maxNum) { return false; }
+		pDst[idx] = val;
+		return true;
+	});
+}
+
+int cJsonStream::read_numbers(int32_t* pDst, int maxNum) {
+	if (mBinary && !mPeeked && mUniformLeft >= 0 && mUniformType == JID_INT32 && !mSwap) {
+		return read_uniform_bulk(pDst, sizeof(int32_t), maxNum);
+	}
+	return read_numbers_impl<int32_t>([=](int idx, int32_t val) {
+		if (idx >= maxNum) { return false; }
+		pDst[idx] = val;
+		return true;
+	});
+}
+
+int cJsonStream::read_numbers(std::vector<int32_t>& dst) {
+	if (mBinary && !mPeeked && mUniformLeft >= 0 && mUniformType == JID_INT32 && !mSwap) {
+		size_t base = dst.size();
+		dst.resize(base + (size_t)mUniformLeft);
+		int n = read_uniform_bulk(dst.data() + base, sizeof(int32_t), (int)mUniformLeft);
+		if (n < 0) { dst.resize(base); }
+		return n;
+	}
+	return read_numbers_impl<int32_t>([&](int, int32_t val) {
+		dst.push_back(val);
+		return true;
+	});
+}
+
+bool cJsonStream::capture_value(cJsonStream& dst) {
+	if (mBinary || !mMemory) { return false; }
+
+	// A peeked '[' or '{' is already consumed
+	size_t beg = mPos;
+	int depth = 0;
+	if (mPeeked) {
+		if (mToken != E_TOKEN_ARRAY_BEGIN && mToken != E_TOKEN_OBJECT_BEGIN) { return false; }
+		mPeeked = false;
+		beg = mPos - 1;
+		depth = 1;
+	} else {
+		if (!skip_ws()) { return false; }
+		beg = mPos;
+		char c0 = mpData[mPos];
+		if (c0 != '[' && c0 != '{') { return false; }
+	}
+
+	char const* p = mpData;
+	bool inStr = false;
+	size_t i = mPos;
+	for (; i < mEnd; ++i) {
+		while (i < mEnd && !is_char(p[i], E_CHAR_STRUCT)) {
+			++i;
+		}
+		if (i == mEnd) { break; }
+		char c = p[i];
+		if (inStr) {
+			if (c == '\\') {
+				++i;
+			} else if (c == '"') {
+				inStr = false;
+			}
+			continue;
+		}
+		bool done = false;
+		switch (c) {
+		case '"': inStr = true; break;
+		case '[': case '{': ++depth; break;
+		case ']': case '}': done = --depth == 0; break;
+		default: break;
+		}
+		if (done) { break; }
+	}
+	if (i >= mEnd) { return false; }
+
+	dst.close();
+	dst.mpData = p + beg;
+	dst.mEnd = i + 1 - beg;
+	dst.mBufSize = dst.mEnd;
+	dst.mMemory = true;
+	// Offsets in the captured text's errors stay file offsets
+	dst.mConsumed = mConsumed + beg;
+	mPos = i + 1;
+	mToken = E_TOKEN_NONE;
+	return true;
+}
+
+bool cJsonStream::skip_numbers(char const*& pBeg, char const*& pEnd) {
+	if (!mMemory || mPeeked) { return false; }
+	char const* pBuf = mpData;
+	size_t i = mPos;
+	int depth = 1;
+	for (; i < mEnd; ++i) {
+		while (i < mEnd && !is_char(pBuf[i], E_CHAR_BRACKET)) {
+			++i;
+		}
+		if (i == mEnd) { break; }
+		if (pBuf[i] == '[') {
+			++depth;
+		} else if (pBuf[i] == ']' && --depth == 0) {
+			break;
+		}
+	}
+	if (i == mEnd) { return false; }
+	pBeg = pBuf + mPos;
+	pEnd = pBuf + i;
+	mPos = i + 1;
+	mToken = E_TOKEN_ARRAY_END;
+	return true;
+}
+
+size_t cJsonStream::count_numbers(char const* pBeg, char const* pEnd) {
+	size_t count = 0;
+	bool inNum = false;
+	for (char const* p = pBeg; p < pEnd; ++p) {
+		bool num = is_num_char(*p);
+		count += num && !inNum;
+		inNum = num;
+	}
+	return count;
+}
+
+char const* cJsonStream::find_split(char const* p, char const* pEnd) {
+	while (p < pEnd && is_num_char(*p)) {
+		++p;
+	}
+	return p;
+}
+
+template <typename T>
+int64_t cJsonStream::parse_numbers_impl(char const* pBeg, char const* pEnd, T* pDst, size_t maxNum) {
+	size_t count = 0;
+	char const* p = pBeg;
+	for (;;) {
+		while (p < pEnd && is_char(*p, E_CHAR_WS | E_CHAR_BRACKET)) {
+			++p;
+		}
+		if (p == pEnd) { return (int64_t)count; }
+		char const* pNumEnd = find_split(p, pEnd);
+		double num;
+		if (pNumEnd == p || count >= maxNum || !parse_number(p, pNumEnd, num)) { return -1; }
+		pDst[count++] = (T)num;
+		p = pNumEnd;
+	}
+}
+
+int64_t cJsonStream::parse_numbers(char const* pBeg, char const* pEnd, float* pDst, size_t maxNum) {
+	return parse_numbers_impl(pBeg, pEnd, pDst, maxNum);
+}
+
+int64_t cJsonStream::parse_numbers(char const* pBeg, char const* pEnd, int32_t* pDst, size_t maxNum) {
+	return parse_numbers_impl(pBeg, pEnd, pDst, maxNum);
+}
+
+
+// Binary mode
+
+bool cJsonStream::need(size_t size) {
+	while (mEnd - mPos < size) {
+		if (!fill()) { return false; }
+	}
+	return true;
+}
+
+template <typename T>
+bool cJsonStream::read_raw(T& val) {
+	if (!need(sizeof(T))) { return false; }
+	char bytes[sizeof(T)];
+	::memcpy(bytes, mpData + mPos, sizeof(T));
+	if (mSwap) {
+		for (size_t i = 0; i < sizeof(T) / 2; ++i) {
+			std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+		}
+	}
+	::memcpy(&val, bytes, sizeof(T));
+	mPos += sizeof(T);
+	return true;
+}
+
+bool cJsonStream::read_bin_length(int64_t& len) {
+	uint8_t n;
+	if (!read_raw(n)) { return false; }
+	if (n < 0xF1) {
+		len = n;
+		return true;
+	}
+	switch (n) {
+	case 0xF2: { uint16_t v; if (!read_raw(v)) { return false; } len = v; return true; }
+	case 0xF4: { uint32_t v; if (!read_raw(v)) { return false; } len = v; return true; }
+	case 0xF8: { int64_t v; if (!read_raw(v)) { return false; } len = v; return len >= 0; }
+	default: return false;
+	}
+}
+
+bool cJsonStream::read_bin_number(uint8_t type, double& num) {
+	switch (type) {
+	case JID_INT8: { int8_t v; if (!read_raw(v)) { return false; } num = v; return true; }
+	case JID_INT16: { int16_t v; if (!read_raw(v)) { return false; } num = v; return true; }
+	case JID_INT32: { int32_t v; if (!read_raw(v)) { return false; } num = v; return true; }
+	case JID_INT64: { int64_t v; if (!read_raw(v)) { return false; } num = (double)v; return true; }
+	case JID_UINT8: { uint8_t v; if (!read_raw(v)) { return false; } num = v; return true; }
+	case JID_UINT16: { uint16_t v; if (!read_raw(v)) { return false; } num = v; return true; }
+	case JID_REAL16: { uint16_t v; if (!read_raw(v)) { return false; } num = half_to_float(v); return true; }
+	case JID_REAL32: { float v; if (!read_raw(v)) { return false; } num = v; return true; }
+	case JID_REAL64: { double v; if (!read_raw(v)) { return false; } num = v; return true; }
+	default: return false;
+	}
+}
+
+bool cJsonStream::read_bin_string(std::string& str) {
+	int64_t len;
+	if (!read_bin_length(len)) { return false; }
+	if (!need((size_t)len)) { return false; }
+	str.assign(mpData + mPos, (size_t)len);
+	mPos += (size_t)len;
+	return true;
+}
+
+cJsonStream::eToken cJsonStream::read_token_bin() {
+	if (mUniformLeft >= 0) { return read_uniform_elem(); }
+
+	for (;;) {
+		uint8_t id;
+		if (!read_raw(id)) { return E_TOKEN_EOF; }
+
+		switch (id) {
+		case JID_KEY_SEPARATOR:
+		case JID_VALUE_SEPARATOR:
+			continue;
+		case JID_NULL: return E_TOKEN_NULL;
+		case JID_ARRAY_BEGIN: return E_TOKEN_ARRAY_BEGIN;
+		case JID_ARRAY_END: return E_TOKEN_ARRAY_END;
+		case JID_MAP_BEGIN: return E_TOKEN_OBJECT_BEGIN;
+		case JID_MAP_END: return E_TOKEN_OBJECT_END;
+		case JID_FALSE: return E_TOKEN_FALSE;
+		case JID_TRUE: return E_TOKEN_TRUE;
+		case JID_BOOL: {
+			uint8_t b;
+			if (!read_raw(b)) { return E_TOKEN_ERROR; }
+			return b ? E_TOKEN_TRUE : E_TOKEN_FALSE;
+		}
+		case JID_INT8:
+		case JID_INT16:
+		case JID_INT32:
+		case JID_INT64:
+		case JID_UINT8:
+		case JID_UINT16:
+		case JID_REAL16:
+		case JID_REAL32:
+		case JID_REAL64:
+			return read_bin_number(id, mNum) ? E_TOKEN_NUMBER : E_TOKEN_ERROR;
+		case JID_STRING:
+			return read_bin_string(mStr) ? E_TOKEN_STRING : E_TOKEN_ERROR;
+		case JID_TOKENDEF: {
+			// Shared string, defined once and referenced by id afterwards
+			int64_t tokId;
+			std::string str;
+			if (!read_bin_length(tokId) || !read_bin_string(str)) { return E_TOKEN_ERROR; }
+			if ((size_t)tokId >= mStrTokens.size()) {
+				mStrTokens.resize((size_t)tokId + 1);
+			}
+			mStrTokens[(size_t)tokId] = std::move(str);
+			continue;
+		}
+		case JID_TOKENREF: {
+			int64_t tokId;
+			if (!read_bin_length(tokId) || (size_t)tokId >= mStrTokens.size()) { return E_TOKEN_ERROR; }
+			mStr = mStrTokens[(size_t)tokId];
+			return E_TOKEN_STRING;
+		}
+		case JID_TOKENUNDEF: {
+			int64_t tokId;
+			if (!read_bin_length(tokId)) { return E_TOKEN_ERROR; }
+			continue;
+		}
+		case JID_UNIFORM_ARRAY: {
+			uint8_t type;
+			int64_t count;
+			if (!read_raw(type) || !read_bin_length(count)) { return E_TOKEN_ERROR; }
+			if (type != JID_BOOL && jid_size(type) == 0) {
+				dbg_msg("json: unsupported uniform array type 0x%x at offset %u\n", type, (uint32_t)get_offset());
+				return E_TOKEN_ERROR;
+			}
+			mUniformType = type;
+			mUniformLeft = count;
+			mBoolBit = 32;
+			return E_TOKEN_ARRAY_BEGIN;
+		}
+		default:
+			dbg_msg("json: unknown binary token 0x%x at offset %u\n", id, (uint32_t)get_offset());
+			return E_TOKEN_ERROR;
+		}
+	}
+}
+
+cJsonStream::eToken cJsonStream::read_uniform_elem() {
+	if (mUniformLeft == 0) {
+		mUniformLeft = -1;
+		return E_TOKEN_ARRAY_END;
+	}
+	--mUniformLeft;
+
+	if (mUniformType == JID_BOOL) {
+		// Bools are packed 32 per word, lowest bit first
+		if (mBoolBit == 32) {
+			if (!read_raw(mBoolWord)) { return E_TOKEN_ERROR; }
+			mBoolBit = 0;
+		}
+		bool b = ((mBoolWord >> mBoolBit++) & 1) != 0;
+		return b ? E_TOKEN_TRUE : E_TOKEN_FALSE;
+	}
+	return read_bin_number(mUniformType, mNum) ? E_TOKEN_NUMBER : E_TOKEN_ERROR;
+}
+
+// Uniform array whose elements already have the destination layout: plain copies
+// straight out of the read buffer, including the closing ']'.
+int cJsonStream::read_uniform_bulk(void* pDst, size_t elemSize, int maxNum) {
+	if (mUniformLeft > maxNum) {
+		mToken = E_TOKEN_ERROR;
+		return -1;
+	}
+	const int count = (int)mUniformLeft;
+	uint8_t* pOut = reinterpret_cast<uint8_t*>(pDst);
+	size_t size = (size_t)count * elemSize;
+	while (size > 0) {
+		if (mEnd - mPos < elemSize && !need(elemSize)) {
+			mToken = E_TOKEN_ERROR;
+			return -1;
+		}
+		size_t copyNum = std::min(size, (mEnd - mPos) / elemSize * elemSize);
+		::memcpy(pOut, mpData + mPos, copyNum);
+		pOut += copyNum;
+		mPos += copyNum;
+		size -= copyNum;
+	}
+	mUniformLeft = -1;
+	mToken = E_TOKEN_ARRAY_END;
+	return count;
+}
@@ -0,0 +1,137 @@
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+class cMappedFile;
+
+// Pull-style streaming JSON reader. The file is read in fixed-size chunks, or
+// memory-mapped when opened in memory, so the heap use does not depend on the
+// file size, and numeric arrays can be decoded straight into their destination
+// without per-element tokens.
+// ',' and ':' are treated as whitespace.
+// Files starting with the Houdini binary JSON magic (.bgeo) are read in binary
+// mode and produce the same tokens; uniform arrays are bulk-copied by read_numbers.
+class cJsonStream {
+public:
+	enum eToken {
+		E_TOKEN_NONE,
+		E_TOKEN_ARRAY_BEGIN,
+		E_TOKEN_ARRAY_END,
+		E_TOKEN_OBJECT_BEGIN,
+		E_TOKEN_OBJECT_END,
+		E_TOKEN_STRING,
+		E_TOKEN_NUMBER,
+		E_TOKEN_TRUE,
+		E_TOKEN_FALSE,
+		E_TOKEN_NULL,
+		E_TOKEN_EOF,
+		E_TOKEN_ERROR,
+	};
+
+protected:
+	static const size_t CHUNK_SIZE = 1024 * 1024;
+
+	std::ifstream mFile;
+	std::unique_ptr<char[]> mpBuf;
+	// The whole file in memory mode
+	std::unique_ptr<cMappedFile> mpMap;
+	// Read position base: mpBuf, the mapping, or the text of the parent stream for captured values
+	char const* mpData = nullptr;
+	size_t mBufSize = 0;
+	size_t mPos = 0;
+	size_t mEnd = 0;
+	size_t mConsumed = 0;
+	bool mFileEnd = true;
+
+	eToken mToken = E_TOKEN_NONE;
+	bool mPeeked = false;
+	std::string mStr;
+	double mNum = 0.0;
+
+	bool mMemory = false;
+	bool mBinary = false;
+	bool mSwap = false;
+	// Uniform array in progress: element type, elements left, bool bits
+	uint8_t mUniformType = 0;
+	int64_t mUniformLeft = -1;
+	uint32_t mBoolWord = 0;
+	int mBoolBit = 32;
+	std::vector<std::string> mStrTokens;
+
+public:
+	cJsonStream();
+	~cJsonStream();
+
+	// inMemory maps the whole file, needed by capture_value
+	bool open(cstr filepath, bool inMemory = false);
+	void close();
+	bool is_binary() const { return mBinary; }
+	bool is_memory() const { return mMemory; }
+
+	eToken next();
+	eToken peek();
+	eToken get_token() const { return mToken; }
+
+	// Current token values, the string is valid until the next call to next()
+	cstr get_str() const { return mStr.c_str(); }
+	double get_double() const { return mNum; }
+	float get_float() const { return (float)mNum; }
+	int get_int() const { return (int)mNum; }
+	bool get_bool() const { return mToken == E_TOKEN_TRUE; }
+	bool is_end() const { return mToken == E_TOKEN_ARRAY_END || mToken == E_TOKEN_OBJECT_END; }
+
+	// Byte offset of the read position, for error messages
+	size_t get_offset() const { return mConsumed + mPos; }
+
+	bool expect(eToken tk);
+	// Skips the value that starts with the next token, nested values included
+	bool skip_value();
+
+	// Reads a numeric array after its E_TOKEN_ARRAY_BEGIN was consumed, up to
+	// and including the closing ']'. Returns the count or -1 on a non-numeric
+	// value or more than maxNum values.
+	int read_numbers(float* pDst, int maxNum);
+	int read_numbers(int32_t* pDst, int maxNum);
+	// Same, appends to the vector
+	int read_numbers(std::vector<int32_t>& dst);
+
+	// Text in memory: points dst at the raw text of the next array or object, its
+	// opening bracket may have been peeked. dst reads this stream's buffer, which
+	// must outlive it. Lets sections of a file be decoded on other threads.
+	bool capture_value(cJsonStream& dst);
+	// Memory mode, after the E_TOKEN_ARRAY_BEGIN of a numeric array (nested arrays
+	// allowed): returns the text up to the closing ']' and skips past it
+	bool skip_numbers(char const*& pBeg, char const*& pEnd);
+
+	// Numbers in text from skip_numbers, brackets are skipped. A range may start
+	// anywhere and end at a separator, see find_split.
+	static size_t count_numbers(char const* pBeg, char const* pEnd);
+	// Returns the count or -1 on a bad number or more than maxNum numbers
+	static int64_t parse_numbers(char const* pBeg, char const* pEnd, float* pDst, size_t maxNum);
+	static int64_t parse_numbers(char const* pBeg, char const* pEnd, int32_t* pDst, size_t maxNum);
+	// First position at or after p that is not inside a number
+	static char const* find_split(char const* p, char const* pEnd);
+
+protected:
+	bool fill();
+	bool skip_ws();
+	eToken read_token();
+	bool read_string();
+	bool read_literal(char const* pLit, size_t len);
+	bool scan_number(double& num);
+	static bool parse_number(char const* pBeg, char const* pEnd, double& num);
+
+	template <typename T, typename TStore> int read_numbers_impl(TStore store);
+	template <typename T> static int64_t parse_numbers_impl(char const* pBeg, char const* pEnd, T* pDst, size_t maxNum);
+
+	bool need(size_t size);
+	template <typename T> bool read_raw(T& val);
+	bool read_bin_length(int64_t& len);
+	bool read_bin_number(uint8_t type, double& num);
+	bool read_bin_string(std::string& str);
+	eToken read_token_bin();
+	eToken read_uniform_elem();
+	int read_uniform_bulk(void* pDst, size_t elemSize, int maxNum);
+};
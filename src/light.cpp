@@ -1,4 +1,5 @@
 #include "common.hpp"
+#include "vmath.hpp"
 #include "math.hpp"
 #include "sh.hpp"
 #include "light.hpp"
@@ -7,12 +7,18 @@
 #include <SDL_syswm.h>
 
 #include "common.hpp"
+#include "vmath.hpp"
 #include "math.hpp"
 #include "gfx.hpp"
 #include "rdr.hpp"
+#include "range_alloc.hpp"
+#include "geom_arena.hpp"
 #include "texture.hpp"
+#include "mesh_opt.hpp"
 #include "model.hpp"
+#include "thread_pool.hpp"
 #include "rig.hpp"
+#include "spring.hpp"
 #include "anim.hpp"
 #include "input.hpp"
 #include "camera.hpp"
@@ -96,6 +102,8 @@ struct sGlobals {
 	GlobalSingleton<cBlendStates> blendStates;
 	GlobalSingleton<cRasterizerStates> rasterizeStates;
 	GlobalSingleton<cDepthStencilStates> depthStates;
+	GlobalSingleton<cGeomArena> geomArena;
+	GlobalSingleton<cThreadPool> threadPool;
 	GlobalSingleton<cImgui> imgui;
 	GlobalSingleton<cLightMgr> lightMgr;
 };
@@ -112,6 +120,8 @@ cSamplerStates& cSamplerStates::get() { return globals.samplerStates.get(); }
 cBlendStates& cBlendStates::get() { return globals.blendStates.get(); }
 cRasterizerStates& cRasterizerStates::get() { return globals.rasterizeStates.get(); }
 cDepthStencilStates& cDepthStencilStates::get() { return globals.depthStates.get(); }
+cGeomArena& cGeomArena::get() { return globals.geomArena.get(); }
+cThreadPool& cThreadPool::get() { return globals.threadPool.get(); }
 cImgui& cImgui::get() { return globals.imgui.get(); }
 cTextureStorage& cTextureStorage::get() { return globals.textureStorage.get(); }
 cLightMgr& cLightMgr::get() { return globals.lightMgr.get(); }
@@ -209,6 +219,12 @@ public:
 		mModel.dbg_ui();
 		mModel.disp();
 	}
+
+	// The geometry goes back to cGeomArena, which is gone by the static destructors
+	void deinit() {
+		mModel.deinit();
+		mMdlData.unload();
+	}
 };
 
 class cLightning : public cSolidModel {
@@ -225,6 +241,43 @@ public:
 	}
 };
 
+// Houdini geometry sequence played back through the cModelSeq prefetch reader
+class cGeoSequence {
+	cModelSeq mSeq;
+	cModelMaterial mMtl;
+	cModel mModel;
+	float mTime = 0.0f;
+	bool mLoaded = false;
+
+	enum { FIRST = 1, LAST = 100, FPS = 24 };
+
+public:
+	bool init() {
+		mLoaded = mSeq.load("../data/geo_seq/seq.$F4.geo", FIRST, LAST);
+		mLoaded = mLoaded && mMtl.load(get_gfx().get_dev(), mSeq.get_data(), "../data/geo_seq/seq.mtl");
+		mLoaded = mLoaded && mModel.init(mSeq.get_data(), mMtl);
+		return mLoaded;
+	}
+
+	void disp(float dt) {
+		if (!mLoaded) return;
+		mTime += dt;
+		int frame = FIRST + (int)(mTime * FPS) % (LAST - FIRST + 1);
+		// Keeps showing the last decoded frame while this one is read
+		mSeq.set_frame(frame);
+
+		mSeq.dbg_ui();
+		mModel.dbg_ui();
+		mModel.disp();
+	}
+
+	void deinit() {
+		mModel.deinit();
+		mSeq.unload();
+		mLoaded = false;
+	}
+};
+
 class cSkinnedModel {
 protected:
 	cModel mModel;
@@ -232,17 +285,57 @@ protected:
 	cModelMaterial mMtl;
 	cRigData mRigData;
 	cRig mRig;
+	cSpringSolver mSprings;
 
 	cAnimationDataList mAnimDataList;
 	cAnimationList mAnimList;
+
+	sAABB mWorldBox;
+	bool mCulled = false;
 public:
-	void disp() {
+	// Returns false if the skinned mesh is out of the view and needn't be drawn.
+	bool upload_skin(ID3D11DeviceContext* pCtx) {
+		auto& skinCBuf = cConstBufStorage::get().mSkinCBuf;
+		nVM::M44* pSkin = as_m44(skinCBuf.mData.skin);
+		int skinNum = mRig.calc_skin(pSkin, sSkinCBuf::MAX_SKIN_MTX);
+
+		if (mMdlData.mSkinBounds.calc_world(pSkin, skinNum, mWorldBox)) {
+			sFrustum frustum;
+			frustum.init(as_m44(get_camera().mView.mViewProj));
+			if (!frustum.overlaps(mWorldBox)) {
+				return false;
+			}
+		}
+
+		skinCBuf.update(pCtx);
+		skinCBuf.set_VS(pCtx);
+		return true;
+	}
+
+	// Call once the rig is placed, spring rest lengths are taken from the current pose.
+	void init_springs() {
+		mRig.calc_world();
+		cRig* pRig = &mRig;
+		mSprings.init(mRigData, &pRig, 1);
+	}
+
+	// dt is the real frame time, the solver splits it into its fixed steps
+	void disp(float dt) {
 		mRig.calc_local();
 		mRig.calc_world();
-		mRig.upload_skin(get_gfx().get_ctx());
+		mSprings.update(dt);
+		mCulled = !upload_skin(get_gfx().get_ctx());
 
 		mModel.dbg_ui();
-		mModel.disp();
+		if (!mCulled) {
+			mModel.disp();
+		}
+	}
+
+	// The geometry goes back to cGeomArena, which is gone by the static destructors
+	void deinit() {
+		mModel.deinit();
+		mMdlData.unload();
 	}
 };
 
@@ -255,7 +348,7 @@ protected:
 	float mSpeed = 1.0f;
 	int mCurAnim = 0;
 public:
-	void disp() {
+	void disp(float dt) {
 		int32_t animCount = mAnimList.get_count();
 		if (animCount > 0) {
 			auto& anim = mAnimList[mCurAnim];
@@ -273,7 +366,7 @@ public:
 			ImGui::SliderFloat("speed", &mSpeed, 0.0f, 3.0f);
 			ImGui::End();
 		}
-		cSkinnedModel::disp();
+		cSkinnedModel::disp(dt);
 	}
 };
 
@@ -303,8 +396,9 @@ public:
 
 		auto pRootJnt = mRig.get_joint(0);
 		if (pRootJnt) {
-			pRootJnt->set_parent_mtx(&mModel.mWmtx);
+			pRootJnt->set_parent_mtx(as_m44(&mModel.mWmtx));
 		}
+		init_springs();
 
 		return res;
 	}
@@ -330,8 +424,9 @@ public:
 
 		auto pRootJnt = mRig.get_joint(0);
 		if (pRootJnt) {
-			pRootJnt->set_parent_mtx(&mModel.mWmtx);
+			pRootJnt->set_parent_mtx(as_m44(&mModel.mWmtx));
 		}
+		init_springs();
 
 		return res;
 	}
@@ -372,8 +467,9 @@ public:
 
 		auto pRootJnt = mRig.get_joint(0);
 		if (pRootJnt) {
-			pRootJnt->set_parent_mtx(&mModel.mWmtx);
+			pRootJnt->set_parent_mtx(as_m44(&mModel.mWmtx));
 		}
+		init_springs();
 
 		return res;
 	}
@@ -384,10 +480,11 @@ cLightning lightning;
 cJumpingSphere sphere;
 cOwl owl;
 cUnrealPuppet upuppet;
+cGeoSequence geoSeq;
 
 cTrackballCam trackballCam;
 
-void do_frame() {
+void do_frame(float dt) {
 	auto& gfx = get_gfx();
 	gfx.begin_frame();
 	cImgui::get().update();
@@ -409,9 +506,10 @@ void do_frame() {
 	cLightMgr::get().update();
 
 	//lightning.disp();
-	//sphere.disp();
-	//owl.disp();
-	upuppet.disp();
+	//sphere.disp(dt);
+	//owl.disp(dt);
+	upuppet.disp(dt);
+	geoSeq.disp(dt);
 
 	gnomon.exec();
 	gnomon.disp();
@@ -424,8 +522,11 @@ void loop() {
 	bool quit = false;
 	SDL_Event ev;
 	auto& inputMgr = get_input_mgr();
+	Uint32 prevTicks = SDL_GetTicks();
 	while (!quit) {
 		Uint32 ticks = SDL_GetTicks();
+		float dt = (ticks - prevTicks) * 0.001f;
+		prevTicks = ticks;
 		inputMgr.preupdate();
 
 		while (SDL_PollEvent(&ev)) {
@@ -449,9 +550,14 @@ void loop() {
 		inputMgr.update();
 
 		if (!quit) {
-			do_frame();
+			do_frame(dt);
 		} else {
 			gnomon.deinit();
+			lightning.deinit();
+			sphere.deinit();
+			owl.deinit();
+			upuppet.deinit();
+			geoSeq.deinit();
 		}
 
 		Uint32 now = SDL_GetTicks();
@@ -478,6 +584,8 @@ int main(int argc, char* argv[]) {
 	auto blnds = globals.blendStates.ctor_scoped(get_gfx().get_dev());
 	auto rsst = globals.rasterizeStates.ctor_scoped(get_gfx().get_dev());
 	auto dpts = globals.depthStates.ctor_scoped(get_gfx().get_dev());
+	auto arena = globals.geomArena.ctor_scoped(get_gfx().get_dev());
+	auto pool = globals.threadPool.ctor_scoped();
 	auto imgui = globals.imgui.ctor_scoped(get_gfx());
 	auto lmgr = globals.lightMgr.ctor_scoped();
 	auto cam = globals.camera.ctor_scoped();
@@ -488,6 +596,7 @@ int main(int argc, char* argv[]) {
 	//sphere.init();
 	//owl.init();
 	upuppet.init();
+	geoSeq.init();
 
 	auto& l = cConstBufStorage::get().mLightCBuf; 
 	::memset(&l.mData, 0, sizeof(l.mData));
@@ -0,0 +1,69 @@
+#include "common.hpp"
+#include "mapped_file.hpp"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+bool cMappedFile::open(cstr filepath) {
+	close();
+#ifdef _WIN32
+	HANDLE hFile = ::CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE) { return false; }
+	mhFile = hFile;
+	LARGE_INTEGER size;
+	if (!::GetFileSizeEx(hFile, &size) || size.QuadPart == 0) {
+		close();
+		return false;
+	}
+	mhMapping = ::CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mhMapping) {
+		close();
+		return false;
+	}
+	mpData = ::MapViewOfFile(mhMapping, FILE_MAP_READ, 0, 0, 0);
+	if (!mpData) {
+		close();
+		return false;
+	}
+	mSize = (size_t)size.QuadPart;
+#else
+	int fd = ::open(filepath, O_RDONLY);
+	if (fd < 0) { return false; }
+	struct stat st;
+	if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void* p = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps the file referenced
+	::close(fd);
+	if (p == MAP_FAILED) { return false; }
+	mpData = p;
+	mSize = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+void cMappedFile::close() {
+#ifdef _WIN32
+	if (mpData) { ::UnmapViewOfFile(mpData); }
+	if (mhMapping) { ::CloseHandle(mhMapping); }
+	if (mhFile) { ::CloseHandle(mhFile); }
+	mhMapping = nullptr;
+	mhFile = nullptr;
+#else
+	if (mpData) { ::munmap(mpData, mSize); }
+#endif
+	mpData = nullptr;
+	mSize = 0;
+}
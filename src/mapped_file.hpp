@@ -0,0 +1,18 @@
+// Read-only memory mapping of a whole file.
+class cMappedFile : noncopyable {
+	void* mpData = nullptr;
+	size_t mSize = 0;
+#ifdef _WIN32
+	void* mhFile = nullptr;
+	void* mhMapping = nullptr;
+#endif
+
+public:
+	~cMappedFile() { close(); }
+
+	bool open(cstr filepath);
+	void close();
+
+	uint8_t const* get_data() const { return (uint8_t const*)mpData; }
+	size_t get_size() const { return mSize; }
+};
@@ -1,9 +1,13 @@
-#include "math.hpp"
+#include <cfloat>
+#include <cassert>
+#include <cstdint>
+#include <algorithm>
 
-namespace dx = DirectX;
+#include "vmath.hpp"
+#include "math.hpp"
 
 namespace nMtx {
-const DirectX::XMMATRIX g_Identity = DirectX::XMMatrixIdentity();
+const nVM::M44 g_Identity = nVM::identity();
 }
 
 // Hermite cubic spline
@@ -25,57 +29,273 @@ float hermite(float pos0, float tan0, float pos1, float tan1, float t) {
 	return a * pos0 + b * tan0 + c * pos1 + d * tan1;
 }
 
-DirectX::XMVECTOR XM_CALLCONV hermite(
-	DirectX::FXMVECTOR pos0, DirectX::FXMVECTOR tan0,
-	DirectX::FXMVECTOR pos1, DirectX::GXMVECTOR tan1,
-	DirectX::HXMVECTOR t
-	) {
-	dx::XMVECTOR tt = dx::XMVectorMultiply(t, t);
-	dx::XMVECTOR ttt = dx::XMVectorMultiply(tt, t);
-	dx::XMVECTOR ttt2 = dx::XMVectorScale(ttt, 2.0f);
-	dx::XMVECTOR tt3 = dx::XMVectorScale(tt, 3.0f);
-	dx::XMVECTOR tt2 = dx::XMVectorScale(tt, 2.0f);
+nVM::V4 hermite(nVM::V4 pos0, nVM::V4 tan0, nVM::V4 pos1, nVM::V4 const& tan1, nVM::V4 const& t) {
+	nVM::V4 tt = nVM::mul(t, t);
+	nVM::V4 ttt = nVM::mul(tt, t);
+	nVM::V4 ttt2 = nVM::scale(ttt, 2.0f);
+	nVM::V4 tt3 = nVM::scale(tt, 3.0f);
+	nVM::V4 tt2 = nVM::scale(tt, 2.0f);
 
-	dx::XMVECTOR a = dx::XMVectorSubtract(ttt2, tt3);
-	dx::XMVECTOR c = dx::XMVectorNegate(a);
-	a = dx::XMVectorAdd(a, dx::g_XMOne);
+	nVM::V4 a = nVM::sub(ttt2, tt3);
+	nVM::V4 c = nVM::neg(a);
+	a = nVM::add(a, nVM::splat(1.0f));
 
-	dx::XMVECTOR b = dx::XMVectorSubtract(ttt, tt2);
-	b = dx::XMVectorAdd(b, t);
+	nVM::V4 b = nVM::sub(ttt, tt2);
+	b = nVM::add(b, t);
 
-	dx::XMVECTOR d = dx::XMVectorSubtract(ttt, tt);
+	nVM::V4 d = nVM::sub(ttt, tt);
 
-	dx::XMVECTOR res = dx::XMVectorMultiply(a, pos0);
-	res = dx::XMVectorMultiplyAdd(b, tan0, res);
-	res = dx::XMVectorMultiplyAdd(c, pos1, res);
-	return dx::XMVectorMultiplyAdd(d, tan1, res);
+	nVM::V4 res = nVM::mul(a, pos0);
+	res = nVM::madd(b, tan0, res);
+	res = nVM::madd(c, pos1, res);
+	return nVM::madd(d, tan1, res);
 }
 
-DirectX::XMVECTOR XM_CALLCONV euler_xyz_to_quat(DirectX::FXMVECTOR xyz) {
+nVM::V4 euler_xyz_to_quat(nVM::V4 xyz) {
 	assert(false && "doesn't work");
 
-	dx::XMVECTOR qx = dx::XMQuaternionRotationNormal(dx::g_XMIdentityR0, xyz.m128_f32[0]);
-	dx::XMVECTOR qy = dx::XMQuaternionRotationNormal(dx::g_XMIdentityR1, xyz.m128_f32[1]);
-	dx::XMVECTOR qz = dx::XMQuaternionRotationNormal(dx::g_XMIdentityR2, xyz.m128_f32[2]);
+	nVM::V4 qx = nVM::quat_rotation_normal(nVM::set(1.0f, 0.0f, 0.0f, 0.0f), nVM::get_x(xyz));
+	nVM::V4 qy = nVM::quat_rotation_normal(nVM::set(0.0f, 1.0f, 0.0f, 0.0f), nVM::get_y(xyz));
+	nVM::V4 qz = nVM::quat_rotation_normal(nVM::set(0.0f, 0.0f, 1.0f, 0.0f), nVM::get_z(xyz));
+
+	nVM::V4 res = nVM::quat_mul(qx, qy);
+	return nVM::quat_mul(res, qz);
+}
+
+
+void sXform::init(nVM::M44 const& mtx) {
+	init(this, &mtx, 1);
+}
+
+nVM::M44 sXform::build_mtx() const {
+	return nVM::affine(mScale, mQuat, mPos);
+}
+
+// Matrix rows from 4 quaternions and scales in SoA form, no full 4x4 multiply.
+static void build_rot_soa(nVM::V4 const* q, nVM::V4 const* scl, nVM::V4 (&r)[3][3]) {
+	using namespace nVM;
+	V4 one = splat(1.0f);
+	V4 x2 = add(q[0], q[0]);
+	V4 y2 = add(q[1], q[1]);
+	V4 z2 = add(q[2], q[2]);
+	V4 xx = mul(q[0], x2);
+	V4 yy = mul(q[1], y2);
+	V4 zz = mul(q[2], z2);
+	V4 xy = mul(q[0], y2);
+	V4 xz = mul(q[0], z2);
+	V4 yz = mul(q[1], z2);
+	V4 wx = mul(q[3], x2);
+	V4 wy = mul(q[3], y2);
+	V4 wz = mul(q[3], z2);
+
+	r[0][0] = mul(sub(sub(one, yy), zz), scl[0]);
+	r[0][1] = mul(add(xy, wz), scl[0]);
+	r[0][2] = mul(sub(xz, wy), scl[0]);
+	r[1][0] = mul(sub(xy, wz), scl[1]);
+	r[1][1] = mul(sub(sub(one, xx), zz), scl[1]);
+	r[1][2] = mul(add(yz, wx), scl[1]);
+	r[2][0] = mul(add(xz, wy), scl[2]);
+	r[2][1] = mul(sub(yz, wx), scl[2]);
+	r[2][2] = mul(sub(sub(one, xx), yy), scl[2]);
+}
+
+// Branchless Shepperd's method: every lane divides by its largest quaternion component.
+static void rot_to_quat_soa(nVM::V4 const (&r)[3][3], nVM::V4 (&q)[4]) {
+	using namespace nVM;
+	V4 one = splat(1.0f);
+	V4 t0 = add(add(add(one, r[0][0]), r[1][1]), r[2][2]); // 4 w^2
+	V4 t1 = sub(sub(add(one, r[0][0]), r[1][1]), r[2][2]); // 4 x^2
+	V4 t2 = sub(add(sub(one, r[0][0]), r[1][1]), r[2][2]); // 4 y^2
+	V4 t3 = add(sub(sub(one, r[0][0]), r[1][1]), r[2][2]); // 4 z^2
+
+	V4 d12 = sub(r[1][2], r[2][1]);
+	V4 d20 = sub(r[2][0], r[0][2]);
+	V4 d01 = sub(r[0][1], r[1][0]);
+	V4 s01 = add(r[0][1], r[1][0]);
+	V4 s02 = add(r[0][2], r[2][0]);
+	V4 s12 = add(r[1][2], r[2][1]);
+
+	// Start from the w case and override lanes where another component is larger
+	V4 t = t0;
+	V4 qx = d12, qy = d20, qz = d01, qw = t0;
+
+	V4 m = greater(t1, t);
+	t = select(t, t1, m);
+	qx = select(qx, t1, m); qy = select(qy, s01, m); qz = select(qz, s02, m); qw = select(qw, d12, m);
+
+	m = greater(t2, t);
+	t = select(t, t2, m);
+	qx = select(qx, s01, m); qy = select(qy, t2, m); qz = select(qz, s12, m); qw = select(qw, d20, m);
+
+	m = greater(t3, t);
+	t = select(t, t3, m);
+	qx = select(qx, s02, m); qy = select(qy, s12, m); qz = select(qz, t3, m); qw = select(qw, d01, m);
 
-	dx::XMVECTOR res = dx::XMQuaternionMultiply(qx, qy);
-	return dx::XMQuaternionMultiply(res, qz);
+	V4 s = mul(splat(0.5f), rsqrt(max(t, splat(1.0e-30f))));
+	q[0] = mul(qx, s);
+	q[1] = mul(qy, s);
+	q[2] = mul(qz, s);
+	q[3] = mul(qw, s);
 }
 
+template <typename TFunc>
+static void for_each_group(int num, TFunc func) {
+	int i = 0;
+	for (; i + 4 <= num; i += 4) {
+		func(i, 4);
+	}
+	if (i < num) {
+		func(i, num - i);
+	}
+}
+
+void sXform::build_mtx(sXform const* pXforms, nVM::M44* pMtx, int num) {
+	using namespace nVM;
+	for_each_group(num, [pXforms, pMtx](int base, int cnt) {
+		// Tail lanes are padded with the last xform and not written back
+		sXform const* px[4];
+		for (int k = 0; k < 4; ++k) {
+			px[k] = &pXforms[base + std::min(k, cnt - 1)];
+		}
+
+		V4 q[4] = { px[0]->mQuat, px[1]->mQuat, px[2]->mQuat, px[3]->mQuat };
+		transpose4(q[0], q[1], q[2], q[3]);
+		V4 scl[4] = { px[0]->mScale, px[1]->mScale, px[2]->mScale, px[3]->mScale };
+		transpose4(scl[0], scl[1], scl[2], scl[3]);
+
+		V4 r[3][3];
+		build_rot_soa(q, scl, r);
+
+		V4 rows[3][4];
+		for (int i = 0; i < 3; ++i) {
+			rows[i][0] = r[i][0];
+			rows[i][1] = r[i][1];
+			rows[i][2] = r[i][2];
+			rows[i][3] = zero();
+			transpose4(rows[i][0], rows[i][1], rows[i][2], rows[i][3]);
+		}
+
+		for (int k = 0; k < cnt; ++k) {
+			auto& mtx = pMtx[base + k];
+			mtx.r[0] = rows[0][k];
+			mtx.r[1] = rows[1][k];
+			mtx.r[2] = rows[2][k];
+			mtx.r[3] = point(px[k]->mPos);
+		}
+	});
+}
+
+void sXform::init(sXform* pXforms, nVM::M44 const* pMtx, int num) {
+	using namespace nVM;
+	for_each_group(num, [pXforms, pMtx](int base, int cnt) {
+		M44 const* pm[4];
+		for (int k = 0; k < 4; ++k) {
+			pm[k] = &pMtx[base + std::min(k, cnt - 1)];
+		}
+
+		V4 r[3][3];
+		for (int i = 0; i < 3; ++i) {
+			V4 a = pm[0]->r[i], b = pm[1]->r[i], c = pm[2]->r[i], d = pm[3]->r[i];
+			transpose4(a, b, c, d);
+			r[i][0] = a;
+			r[i][1] = b;
+			r[i][2] = c;
+		}
+
+		V4 scl[4];
+		for (int i = 0; i < 3; ++i) {
+			scl[i] = sqrt(madd(r[i][0], r[i][0], madd(r[i][1], r[i][1], mul(r[i][2], r[i][2]))));
+		}
+		scl[3] = zero();
+
+		// Mirrored basis: flip x so the remaining rotation is proper
+		V4 cx = sub(mul(r[1][1], r[2][2]), mul(r[1][2], r[2][1]));
+		V4 cy = sub(mul(r[1][2], r[2][0]), mul(r[1][0], r[2][2]));
+		V4 cz = sub(mul(r[1][0], r[2][1]), mul(r[1][1], r[2][0]));
+		V4 det = madd(r[0][0], cx, madd(r[0][1], cy, mul(r[0][2], cz)));
+		scl[0] = select(scl[0], neg(scl[0]), less(det, zero()));
+
+		V4 eps = splat(1.0e-12f);
+		for (int i = 0; i < 3; ++i) {
+			V4 len = select(scl[i], splat(1.0f), less(abs(scl[i]), eps));
+			V4 inv = div(splat(1.0f), len);
+			r[i][0] = mul(r[i][0], inv);
+			r[i][1] = mul(r[i][1], inv);
+			r[i][2] = mul(r[i][2], inv);
+		}
+
+		V4 q[4];
+		rot_to_quat_soa(r, q);
+		transpose4(q[0], q[1], q[2], q[3]);
+		transpose4(scl[0], scl[1], scl[2], scl[3]);
+
+		for (int k = 0; k < cnt; ++k) {
+			auto& xform = pXforms[base + k];
+			xform.mPos = pm[k]->r[3];
+			xform.mQuat = quat_normalize(q[k]);
+			xform.mScale = scl[k];
+		}
+	});
+}
+
+
+void sAABB::set_empty() {
+	mMin = nVM::splat(FLT_MAX);
+	mMax = nVM::splat(-FLT_MAX);
+}
+
+bool sAABB::is_empty() const {
+	return (nVM::mask_bits(nVM::less_eq(mMin, mMax)) & 7) != 7;
+}
+
+void sAABB::add(nVM::V4 min, nVM::V4 max) {
+	mMin = nVM::min(mMin, min);
+	mMax = nVM::max(mMax, max);
+}
+
+nVM::V4 sAABB::get_center() const {
+	return nVM::scale(nVM::add(mMin, mMax), 0.5f);
+}
+
+nVM::V4 sAABB::get_extent() const {
+	return nVM::scale(nVM::sub(mMax, mMin), 0.5f);
+}
+
+
+void sFrustum::init(nVM::M44 const& viewProj) {
+	// Row vectors: clip = p * M, so the planes are built from the columns of M
+	nVM::M44 m = nVM::transpose(viewProj);
+	mPlanes[0] = nVM::add(m.r[3], m.r[0]); // left
+	mPlanes[1] = nVM::sub(m.r[3], m.r[0]); // right
+	mPlanes[2] = nVM::add(m.r[3], m.r[1]); // bottom
+	mPlanes[3] = nVM::sub(m.r[3], m.r[1]); // top
+	mPlanes[4] = m.r[2]; // near
+	mPlanes[5] = nVM::sub(m.r[3], m.r[2]); // far
+	for (int i = 0; i < 6; ++i) {
+		mPlanes[i] = nVM::div(mPlanes[i], nVM::length3(mPlanes[i]));
+	}
+}
 
-void XM_CALLCONV sXform::init(DirectX::FXMMATRIX mtx) {
-	// dx::XMMatrixDecompose(&mScale, &mQuat, &mPos, mtx) does, probably, too much.
-	mPos = mtx.r[3];
-	mQuat = dx::XMQuaternionRotationMatrix(mtx);
-	mScale = dx::g_XMOne3;
+bool sFrustum::overlaps(sAABB const& box) const {
+	if (box.is_empty()) { return false; }
+	nVM::V4 c = nVM::point(box.get_center());
+	nVM::V4 e = box.get_extent();
+	for (int i = 0; i < 6; ++i) {
+		nVM::V4 d = nVM::dot4(mPlanes[i], c);
+		nVM::V4 r = nVM::dot3(nVM::abs(mPlanes[i]), e);
+		if (nVM::get_x(nVM::add(d, r)) < 0.0f) {
+			return false;
+		}
+	}
+	return true;
 }
 
-DirectX::XMMATRIX XM_CALLCONV sXform::build_mtx() const {
-	// Simplified dx::XMMatrixAffineTransformation()
-	dx::XMMATRIX scale = dx::XMMatrixScalingFromVector(mScale);
-	dx::XMMATRIX rot = dx::XMMatrixRotationQuaternion(mQuat);
-	dx::XMMATRIX res = dx::XMMatrixMultiply(scale, rot);
-	//dx::XMMATRIX res = scale;
-	res.r[3] = mPos;
-	return res;
+bool sFrustum::overlaps(nVM::V4 center, float radius) const {
+	nVM::V4 c = nVM::point(center);
+	for (int i = 0; i < 6; ++i) {
+		if (nVM::get_x(nVM::dot4(mPlanes[i], c)) < -radius) {
+			return false;
+		}
+	}
+	return true;
 }
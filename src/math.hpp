@@ -1,13 +1,13 @@
+#ifdef _WIN32
 #include <DirectXMath.h>
+#endif
 
-#define constexpr
-
-inline constexpr float DEG2RAD(float deg) {
-	return deg * DirectX::XM_PI / 180.f;
+inline float DEG2RAD(float deg) {
+	return deg * nVM::PI / 180.f;
 }
 
-inline constexpr float RAD2DEG(float rad) {
-	return rad * 180.f / DirectX::XM_PI;
+inline float RAD2DEG(float rad) {
+	return rad * 180.f / nVM::PI;
 }
 
 
@@ -15,7 +15,7 @@ struct vec3 {
 	float x, y, z;
 };
 struct vec4 {
-	DirectX::XMFLOAT4 mVal;
+	nVM::F4 mVal;
 
 	float operator[](int idx) const {
 		return reinterpret_cast<float const*>(&mVal)[idx];
@@ -25,7 +25,7 @@ struct vec4 {
 	}
 };
 struct vec4i {
-	DirectX::XMINT4 mVal;
+	nVM::I4 mVal;
 
 	int32_t operator[](int idx) const {
 		return reinterpret_cast<int32_t const*>(&mVal)[idx];
@@ -119,26 +119,58 @@ T lerp(T a, T b, T t) {
 }
 
 float hermite(float pos0, float tan0, float pos1, float tan1, float t);
+nVM::V4 hermite(nVM::V4 pos0, nVM::V4 tan0, nVM::V4 pos1, nVM::V4 const& tan1, nVM::V4 const& t);
 
-DirectX::XMVECTOR XM_CALLCONV hermite(
-	DirectX::FXMVECTOR pos0, DirectX::FXMVECTOR tan0,
-	DirectX::FXMVECTOR pos1, DirectX::GXMVECTOR tan1,
-	DirectX::HXMVECTOR t
-);
-
-DirectX::XMVECTOR XM_CALLCONV euler_xyz_to_quat(DirectX::FXMVECTOR xyz);
+nVM::V4 euler_xyz_to_quat(nVM::V4 xyz);
 
 namespace nMtx {
-extern const DirectX::XMMATRIX g_Identity;
+extern const nVM::M44 g_Identity;
+}
+
+#ifdef _WIN32
+// The renderer stays on DirectXMath, XMMATRIX and nVM::M44 share the layout.
+inline nVM::M44 const& as_m44(DirectX::XMMATRIX const& m) {
+	return reinterpret_cast<nVM::M44 const&>(m);
+}
+inline nVM::M44* as_m44(DirectX::XMMATRIX* pM) {
+	return reinterpret_cast<nVM::M44*>(pM);
 }
+#endif
 
 
 struct sXform {
-	DirectX::XMVECTOR mPos;
-	DirectX::XMVECTOR mQuat;
-	DirectX::XMVECTOR mScale;
+	nVM::V4 mPos;
+	nVM::V4 mQuat;
+	nVM::V4 mScale;
+
+	// Full decomposition: translation, rotation and per-axis scale,
+	// a negative determinant goes into the x scale.
+	void init(nVM::M44 const& mtx);
+	nVM::M44 build_mtx() const;
+
+	// Array versions, xforms are processed 4 at a time in SoA form.
+	static void init(sXform* pXforms, nVM::M44 const* pMtx, int num);
+	static void build_mtx(sXform const* pXforms, nVM::M44* pMtx, int num);
+};
+
+
+struct sAABB {
+	nVM::V4 mMin;
+	nVM::V4 mMax;
 
-	void XM_CALLCONV init(DirectX::FXMMATRIX mtx);
-	DirectX::XMMATRIX XM_CALLCONV build_mtx() const;
+	void set_empty();
+	bool is_empty() const;
+	void add(nVM::V4 min, nVM::V4 max);
+	nVM::V4 get_center() const;
+	nVM::V4 get_extent() const;
 };
 
+// Clip-space frustum planes (D3D depth range), normals point inside.
+// The planes are normalized, in the space of the points viewProj takes.
+struct sFrustum {
+	nVM::V4 mPlanes[6];
+
+	void init(nVM::M44 const& viewProj);
+	bool overlaps(sAABB const& box) const;
+	bool overlaps(nVM::V4 center, float radius) const;
+};
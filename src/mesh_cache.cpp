@@ -0,0 +1,274 @@
+#include "common.hpp"
+#include "mapped_file.hpp"
+#include "mesh_cache.hpp"
+
+#include <fstream>
+#include <cstddef>
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+static const uint32_t MESH_CACHE_MAGIC = 0x4348434D; // MCHC
+static const uint32_t MESH_CACHE_VERSION = 6;
+static const uint64_t MESH_CACHE_ALIGN = 16;
+
+struct sMeshCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vtxSize;
+	uint32_t idxSize;
+	uint32_t grpSize;
+	uint32_t vtxNum;
+	uint32_t idxNum;
+	uint32_t grpNum;
+	uint32_t clusterSize;
+	uint32_t clusterNum;
+	uint32_t infoSize;
+	uint32_t pad0;
+	uint64_t srcSize;
+	uint64_t srcTime;
+	uint64_t srcHash;
+	uint64_t cookHash;
+	// Blob offsets from the start of the file, aligned to MESH_CACHE_ALIGN
+	uint64_t vtxOffset;
+	uint64_t idxOffset;
+	uint64_t grpOffset;
+	uint64_t clusterOffset;
+	uint64_t infoOffset;
+	// uint32 length and the chars of every name
+	uint64_t namesOffset;
+	uint64_t fileSize;
+	// The source path follows the header
+	uint32_t pathLen;
+	uint32_t pad;
+};
+
+static bool get_file_stamp(cstr filepath, uint64_t& size, uint64_t& time) {
+#ifdef _WIN32
+	struct _stat64 st;
+	if (::_stat64(filepath, &st) != 0) { return false; }
+#else
+	struct stat st;
+	if (::stat(filepath, &st) != 0) { return false; }
+#endif
+	size = (uint64_t)st.st_size;
+	time = (uint64_t)st.st_mtime;
+	return true;
+}
+
+// FNV-1a over 64-bit words, the tail bytewise
+static bool hash_file(cstr filepath, uint64_t& hash) {
+	const uint64_t prime = 1099511628211ULL;
+	hash = 14695981039346656037ULL;
+
+	cMappedFile file;
+	if (!file.open(filepath)) { return false; }
+	uint8_t const* p = file.get_data();
+	const size_t size = file.get_size();
+	const size_t wordsEnd = size & ~(size_t)7;
+	for (size_t i = 0; i < wordsEnd; i += 8) {
+		uint64_t w;
+		::memcpy(&w, p + i, 8);
+		hash ^= w;
+		hash *= prime;
+	}
+	for (size_t i = wordsEnd; i < size; ++i) {
+		hash ^= p[i];
+		hash *= prime;
+	}
+	return true;
+}
+
+// The source content is unchanged, so later opens can trust the new mtime
+static bool restamp(cstr cachePath, uint64_t srcTime) {
+	std::fstream io(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+	if (!io.is_open()) { return false; }
+	io.seekp(offsetof(sMeshCacheHeader, srcTime));
+	io.write((char const*)&srcTime, sizeof(srcTime));
+	return !!io;
+}
+
+static uint64_t align_offset(uint64_t offs) {
+	return (offs + MESH_CACHE_ALIGN - 1) & ~(MESH_CACHE_ALIGN - 1);
+}
+
+std::string cMeshCache::get_path(cstr srcPath) {
+	return std::string(srcPath.p) + ".mcache";
+}
+
+bool cMeshCache::write(cstr cachePath, cstr srcPath, sDesc const& desc) {
+	sMeshCacheHeader hdr = {};
+	hdr.version = MESH_CACHE_VERSION;
+	hdr.vtxSize = desc.vtxSize;
+	hdr.idxSize = desc.idxSize;
+	hdr.grpSize = desc.grpSize;
+	hdr.vtxNum = desc.vtxNum;
+	hdr.idxNum = desc.idxNum;
+	hdr.grpNum = desc.grpNum;
+	hdr.clusterSize = desc.clusterSize;
+	hdr.clusterNum = desc.clusterNum;
+	hdr.infoSize = desc.infoSize;
+	hdr.cookHash = desc.cookHash;
+	hdr.pathLen = (uint32_t)srcPath.length();
+	if (!get_file_stamp(srcPath, hdr.srcSize, hdr.srcTime) || !hash_file(srcPath, hdr.srcHash)) {
+		dbg_msg("mesh cache: can't read <%s>\n", srcPath.p);
+		return false;
+	}
+
+	hdr.vtxOffset = align_offset(sizeof(hdr) + hdr.pathLen);
+	hdr.idxOffset = align_offset(hdr.vtxOffset + (uint64_t)desc.vtxNum * desc.vtxSize);
+	hdr.grpOffset = align_offset(hdr.idxOffset + (uint64_t)desc.idxNum * desc.idxSize);
+	hdr.clusterOffset = align_offset(hdr.grpOffset + (uint64_t)desc.grpNum * desc.grpSize);
+	hdr.infoOffset = align_offset(hdr.clusterOffset + (uint64_t)desc.clusterNum * desc.clusterSize);
+	hdr.namesOffset = align_offset(hdr.infoOffset + desc.infoSize);
+	hdr.fileSize = hdr.namesOffset;
+	for (uint32_t i = 0; i < desc.grpNum; ++i) {
+		hdr.fileSize += sizeof(uint32_t) + (desc.pGrpNames ? desc.pGrpNames[i].length() : 0);
+	}
+
+	std::ofstream out(cachePath, std::ios::binary | std::ios::trunc);
+	if (!out.is_open()) {
+		dbg_msg("mesh cache: can't create <%s>\n", cachePath.p);
+		return false;
+	}
+
+	static const char zeros[MESH_CACHE_ALIGN] = {};
+	auto pad_to = [&](uint64_t offs) {
+		out.write(zeros, (std::streamsize)(offs - (uint64_t)out.tellp()));
+	};
+
+	// The magic is written last, an interrupted write leaves an invalid cache
+	out.write((char const*)&hdr, sizeof(hdr));
+	out.write(srcPath.p, hdr.pathLen);
+	pad_to(hdr.vtxOffset);
+	out.write((char const*)desc.pVtx, (std::streamsize)desc.vtxNum * desc.vtxSize);
+	pad_to(hdr.idxOffset);
+	out.write((char const*)desc.pIdx, (std::streamsize)desc.idxNum * desc.idxSize);
+	pad_to(hdr.grpOffset);
+	out.write((char const*)desc.pGroups, (std::streamsize)desc.grpNum * desc.grpSize);
+	pad_to(hdr.clusterOffset);
+	if (desc.clusterNum) {
+		out.write((char const*)desc.pClusters, (std::streamsize)desc.clusterNum * desc.clusterSize);
+	}
+	pad_to(hdr.infoOffset);
+	if (desc.infoSize) {
+		out.write((char const*)desc.pInfo, desc.infoSize);
+	}
+	pad_to(hdr.namesOffset);
+	for (uint32_t i = 0; i < desc.grpNum; ++i) {
+		std::string const* pName = desc.pGrpNames ? &desc.pGrpNames[i] : nullptr;
+		uint32_t len = pName ? (uint32_t)pName->length() : 0;
+		out.write((char const*)&len, sizeof(len));
+		if (len) {
+			out.write(pName->c_str(), len);
+		}
+	}
+	const uint32_t magic = MESH_CACHE_MAGIC;
+	out.seekp(0);
+	out.write((char const*)&magic, sizeof(magic));
+	out.close();
+
+	if (!out) {
+		dbg_msg("mesh cache: error writing <%s>\n", cachePath.p);
+		::remove(cachePath);
+		return false;
+	}
+	return true;
+}
+
+bool cMeshCache::open(cstr cachePath, cstr srcPath, uint32_t vtxSize, uint32_t grpSize, uint32_t clusterSize, uint32_t infoSize, uint64_t cookHash) {
+	close();
+	if (!mFile.open(cachePath)) { return false; }
+
+	uint8_t const* pData = mFile.get_data();
+	const uint64_t size = mFile.get_size();
+	sMeshCacheHeader hdr;
+	if (size < sizeof(hdr)) {
+		close();
+		return false;
+	}
+	::memcpy(&hdr, pData, sizeof(hdr));
+
+	bool ok = hdr.magic == MESH_CACHE_MAGIC && hdr.version == MESH_CACHE_VERSION
+		&& hdr.vtxSize == vtxSize && hdr.idxSize > 0 && hdr.grpSize == grpSize && hdr.clusterSize == clusterSize && hdr.infoSize == infoSize
+		&& hdr.cookHash == cookHash
+		&& hdr.fileSize == size
+		&& hdr.vtxOffset >= sizeof(hdr) + hdr.pathLen
+		&& hdr.vtxOffset + (uint64_t)hdr.vtxNum * vtxSize <= hdr.idxOffset
+		&& hdr.idxOffset + (uint64_t)hdr.idxNum * hdr.idxSize <= hdr.grpOffset
+		&& hdr.grpOffset + (uint64_t)hdr.grpNum * grpSize <= hdr.clusterOffset
+		&& hdr.clusterOffset + (uint64_t)hdr.clusterNum * clusterSize <= hdr.infoOffset
+		&& hdr.infoOffset + infoSize <= hdr.namesOffset
+		&& hdr.namesOffset <= size;
+	ok = ok && hdr.pathLen == srcPath.length() && ::memcmp(pData + sizeof(hdr), srcPath.p, hdr.pathLen) == 0;
+	if (!ok) {
+		dbg_msg("mesh cache: <%s> is invalid or outdated\n", cachePath.p);
+		close();
+		return false;
+	}
+
+	uint64_t srcSize, srcTime;
+	if (!get_file_stamp(srcPath, srcSize, srcTime) || srcSize != hdr.srcSize) {
+		close();
+		return false;
+	}
+	if (srcTime != hdr.srcTime) {
+		// Touched or copied, the content may still be the same
+		uint64_t srcHash;
+		if (!hash_file(srcPath, srcHash) || srcHash != hdr.srcHash) {
+			close();
+			return false;
+		}
+		// The mapping locks the file on Windows, it's remapped after the write
+		mFile.close();
+		if (!restamp(cachePath, srcTime)) {
+			dbg_msg("mesh cache: can't restamp <%s>\n", cachePath.p);
+		}
+		if (!mFile.open(cachePath) || mFile.get_size() != size) {
+			close();
+			return false;
+		}
+		pData = mFile.get_data();
+	}
+
+	mGrpNames.resize(hdr.grpNum);
+	uint64_t offs = hdr.namesOffset;
+	for (uint32_t i = 0; i < hdr.grpNum; ++i) {
+		uint32_t len;
+		if (offs + sizeof(len) > size) { ok = false; break; }
+		::memcpy(&len, pData + offs, sizeof(len));
+		offs += sizeof(len);
+		if (offs + len > size) { ok = false; break; }
+		mGrpNames[i].assign((char const*)pData + offs, len);
+		offs += len;
+	}
+	if (!ok) {
+		dbg_msg("mesh cache: <%s> has bad group names\n", cachePath.p);
+		close();
+		return false;
+	}
+
+	mDesc.pVtx = pData + hdr.vtxOffset;
+	mDesc.vtxNum = hdr.vtxNum;
+	mDesc.vtxSize = vtxSize;
+	mDesc.pIdx = pData + hdr.idxOffset;
+	mDesc.idxNum = hdr.idxNum;
+	mDesc.idxSize = hdr.idxSize;
+	mDesc.pGroups = pData + hdr.grpOffset;
+	mDesc.grpNum = hdr.grpNum;
+	mDesc.grpSize = grpSize;
+	mDesc.pGrpNames = mGrpNames.data();
+	mDesc.pClusters = pData + hdr.clusterOffset;
+	mDesc.clusterNum = hdr.clusterNum;
+	mDesc.clusterSize = clusterSize;
+	mDesc.pInfo = pData + hdr.infoOffset;
+	mDesc.infoSize = infoSize;
+	return true;
+}
+
+void cMeshCache::close() {
+	mFile.close();
+	mDesc = sDesc();
+	mGrpNames.clear();
+}
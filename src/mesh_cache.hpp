@@ -0,0 +1,51 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+// Cooked mesh: vertex, index, group and cluster blobs, a fixed-size info blob
+// and the group names, written after the first import of a source file and
+// memory-mapped on later loads. The layouts are opaque here, the vertex, group,
+// cluster and info sizes are checked on open so a changed format invalidates
+// old caches. The index size is per mesh.
+class cMeshCache : noncopyable {
+public:
+	struct sDesc {
+		void const* pVtx = nullptr;
+		uint32_t vtxNum = 0;
+		uint32_t vtxSize = 0;
+		void const* pIdx = nullptr;
+		uint32_t idxNum = 0;
+		uint32_t idxSize = 0;
+		void const* pGroups = nullptr;
+		uint32_t grpNum = 0;
+		uint32_t grpSize = 0;
+		std::string const* pGrpNames = nullptr;
+		void const* pClusters = nullptr;
+		uint32_t clusterNum = 0;
+		uint32_t clusterSize = 0;
+		void const* pInfo = nullptr;
+		uint32_t infoSize = 0;
+		// Of the settings the data was cooked with
+		uint64_t cookHash = 0;
+	};
+
+private:
+	cMappedFile mFile;
+	sDesc mDesc;
+	std::vector<std::string> mGrpNames;
+
+public:
+	// Cache file of a source, next to it
+	static std::string get_path(cstr srcPath);
+
+	// Stamps the cache with the source path, size, mtime and content hash
+	static bool write(cstr cachePath, cstr srcPath, sDesc const& desc);
+
+	// Fails if the cache is missing, broken, has other element sizes or cook hash,
+	// or is stale: the source size differs, or its mtime differs and so does its
+	// hash. The sDesc pointers stay valid until close().
+	bool open(cstr cachePath, cstr srcPath, uint32_t vtxSize, uint32_t grpSize, uint32_t clusterSize, uint32_t infoSize, uint64_t cookHash);
+	void close();
+
+	sDesc const& get() const { return mDesc; }
+};
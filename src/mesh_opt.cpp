@@ -0,0 +1,662 @@
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "common.hpp"
+#include "mesh_opt.hpp"
+
+namespace nMeshOpt {
+
+// Vertex v is in the cache if time - stamp[v] <= cacheSize, time advances on misses
+struct sFifoCache {
+	std::vector<uint32_t> stamp;
+	uint32_t time;
+	uint32_t size;
+
+	sFifoCache(uint32_t vtxNum, uint32_t cacheSize) : stamp(vtxNum, 0), time(cacheSize + 1), size(cacheSize) {}
+
+	bool access(uint32_t v) {
+		if (time - stamp[v] > size) {
+			stamp[v] = time++;
+			return false;
+		}
+		return true;
+	}
+};
+
+sVtxCacheStats analyze_vertex_cache(uint32_t const* pIdx, uint32_t idxNum, uint32_t vtxNum, uint32_t cacheSize) {
+	sVtxCacheStats stats;
+	if (idxNum < 3) { return stats; }
+
+	sFifoCache cache(vtxNum, cacheSize);
+	std::vector<bool> used(vtxNum, false);
+	uint32_t misses = 0;
+	uint32_t usedNum = 0;
+	for (uint32_t i = 0; i < idxNum; ++i) {
+		uint32_t v = pIdx[i];
+		if (!cache.access(v)) { ++misses; }
+		if (!used[v]) {
+			used[v] = true;
+			++usedNum;
+		}
+	}
+	stats.acmr = (float)misses / (float)(idxNum / 3);
+	stats.atvr = (float)misses / (float)usedNum;
+	return stats;
+}
+
+void optimize_vertex_cache(uint32_t* pIdx, uint32_t idxNum, uint32_t vtxNum, uint32_t cacheSize) {
+	const uint32_t triNum = idxNum / 3;
+	if (triNum == 0) { return; }
+
+	// Triangles of every vertex, live is the number not emitted yet
+	std::vector<uint32_t> live(vtxNum, 0);
+	for (uint32_t i = 0; i < triNum * 3; ++i) {
+		++live[pIdx[i]];
+	}
+	std::vector<uint32_t> adjStart(vtxNum + 1, 0);
+	for (uint32_t v = 0; v < vtxNum; ++v) {
+		adjStart[v + 1] = adjStart[v] + live[v];
+	}
+	std::vector<uint32_t> adj(adjStart[vtxNum]);
+	{
+		std::vector<uint32_t> fill(adjStart.begin(), adjStart.end() - 1);
+		for (uint32_t t = 0; t < triNum; ++t) {
+			for (int k = 0; k < 3; ++k) {
+				adj[fill[pIdx[t * 3 + k]]++] = t;
+			}
+		}
+	}
+
+	std::vector<uint32_t> out;
+	out.reserve(triNum * 3);
+	std::vector<uint32_t> stamp(vtxNum, 0);
+	std::vector<bool> emitted(triNum, false);
+	std::vector<uint32_t> deadEnd;
+	std::vector<uint32_t> cand;
+	uint32_t time = cacheSize + 1;
+	uint32_t cursor = 0;
+
+	int64_t fan = pIdx[0];
+	while (fan >= 0) {
+		cand.clear();
+		for (uint32_t a = adjStart[(uint32_t)fan]; a < adjStart[(uint32_t)fan + 1]; ++a) {
+			uint32_t t = adj[a];
+			if (emitted[t]) { continue; }
+			for (int k = 0; k < 3; ++k) {
+				uint32_t v = pIdx[t * 3 + k];
+				out.push_back(v);
+				deadEnd.push_back(v);
+				cand.push_back(v);
+				--live[v];
+				if (time - stamp[v] > cacheSize) {
+					stamp[v] = time++;
+				}
+			}
+			emitted[t] = true;
+		}
+
+		// The candidate that stays in the cache longest while its fan is done
+		fan = -1;
+		int64_t bestPriority = -1;
+		for (uint32_t v : cand) {
+			if (live[v] == 0) { continue; }
+			int64_t priority = 0;
+			if (time - stamp[v] + 2 * live[v] <= cacheSize) {
+				priority = time - stamp[v];
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				fan = v;
+			}
+		}
+		// Dead end: recently used vertices first, then the input order
+		while (fan < 0 && !deadEnd.empty()) {
+			uint32_t v = deadEnd.back();
+			deadEnd.pop_back();
+			if (live[v] > 0) { fan = v; }
+		}
+		while (fan < 0 && cursor < vtxNum) {
+			if (live[cursor] > 0) { fan = cursor; }
+			++cursor;
+		}
+	}
+
+	std::copy(out.begin(), out.end(), pIdx);
+}
+
+void optimize_overdraw(uint32_t* pIdx, uint32_t idxNum, float const* pPos, size_t posStride, uint32_t vtxNum,
+	uint32_t cacheSize, float threshold)
+{
+	const uint32_t triNum = idxNum / 3;
+	if (triNum < 2) { return; }
+
+	auto get_pos = [&](uint32_t v) {
+		return reinterpret_cast<float const*>(reinterpret_cast<uint8_t const*>(pPos) + v * posStride);
+	};
+
+	// Hard boundaries: triangles that miss the cache with all vertices
+	sFifoCache cache(vtxNum, cacheSize);
+	std::vector<uint32_t> triMisses(triNum);
+	std::vector<uint32_t> hard;
+	uint32_t totalMisses = 0;
+	for (uint32_t t = 0; t < triNum; ++t) {
+		uint32_t misses = 0;
+		for (int k = 0; k < 3; ++k) {
+			if (!cache.access(pIdx[t * 3 + k])) { ++misses; }
+		}
+		if (t == 0 || misses == 3) { hard.push_back(t); }
+		triMisses[t] = misses;
+		totalMisses += misses;
+	}
+	hard.push_back(triNum);
+	const float acmr = (float)totalMisses / (float)triNum;
+
+	// Soft boundaries inside the hard clusters
+	std::vector<uint32_t> clusters;
+	for (size_t c = 0; c + 1 < hard.size(); ++c) {
+		uint32_t start = hard[c];
+		uint32_t misses = 0;
+		clusters.push_back(start);
+		for (uint32_t t = hard[c]; t < hard[c + 1]; ++t) {
+			misses += triMisses[t];
+			if (t + 1 < hard[c + 1] && (float)misses <= threshold * acmr * (float)(t + 1 - start)) {
+				start = t + 1;
+				misses = 0;
+				clusters.push_back(start);
+			}
+		}
+	}
+	clusters.push_back(triNum);
+	const size_t clusterNum = clusters.size() - 1;
+
+	// Area-weighted centroids and normals
+	struct sCluster {
+		float centroid[3];
+		float normal[3];
+		float area;
+		float key;
+		uint32_t start;
+		uint32_t end;
+	};
+	std::vector<sCluster> info(clusterNum);
+	float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+	float meshArea = 0.0f;
+	for (size_t c = 0; c < clusterNum; ++c) {
+		sCluster& cl = info[c];
+		cl = sCluster();
+		cl.start = clusters[c];
+		cl.end = clusters[c + 1];
+		for (uint32_t t = cl.start; t < cl.end; ++t) {
+			float const* p0 = get_pos(pIdx[t * 3]);
+			float const* p1 = get_pos(pIdx[t * 3 + 1]);
+			float const* p2 = get_pos(pIdx[t * 3 + 2]);
+			float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			for (int i = 0; i < 3; ++i) {
+				cl.centroid[i] += (p0[i] + p1[i] + p2[i]) * (area / 3.0f);
+				cl.normal[i] += n[i];
+			}
+			cl.area += area;
+		}
+		for (int i = 0; i < 3; ++i) {
+			meshCentroid[i] += cl.centroid[i];
+		}
+		meshArea += cl.area;
+	}
+	if (meshArea <= 0.0f) { return; }
+	for (int i = 0; i < 3; ++i) {
+		meshCentroid[i] /= meshArea;
+	}
+
+	for (auto& cl : info) {
+		float nlen = std::sqrt(cl.normal[0] * cl.normal[0] + cl.normal[1] * cl.normal[1] + cl.normal[2] * cl.normal[2]);
+		float key = 0.0f;
+		if (cl.area > 0.0f && nlen > 0.0f) {
+			for (int i = 0; i < 3; ++i) {
+				key += (cl.centroid[i] / cl.area - meshCentroid[i]) * (cl.normal[i] / nlen);
+			}
+		}
+		cl.key = key;
+	}
+	std::stable_sort(info.begin(), info.end(), [](sCluster const& a, sCluster const& b) { return a.key > b.key; });
+
+	std::vector<uint32_t> out;
+	out.reserve(triNum * 3);
+	for (auto const& cl : info) {
+		out.insert(out.end(), pIdx + cl.start * 3, pIdx + cl.end * 3);
+	}
+	std::copy(out.begin(), out.end(), pIdx);
+}
+
+uint32_t optimize_vertex_fetch(uint32_t* pIdx, uint32_t idxNum, uint32_t vtxNum, uint32_t* pRemap) {
+	const uint32_t NONE = 0xFFFFFFFF;
+	std::fill(pRemap, pRemap + vtxNum, NONE);
+	uint32_t next = 0;
+	for (uint32_t i = 0; i < idxNum; ++i) {
+		uint32_t& r = pRemap[pIdx[i]];
+		if (r == NONE) { r = next++; }
+		pIdx[i] = r;
+	}
+	const uint32_t usedNum = next;
+	for (uint32_t v = 0; v < vtxNum; ++v) {
+		if (pRemap[v] == NONE) { pRemap[v] = next++; }
+	}
+	return usedNum;
+}
+
+// Sum of squared plane distances: p^T A p + 2 b.p + c, weighted by the triangle areas
+struct sQuadric {
+	double a00, a01, a02, a11, a12, a22;
+	double b0, b1, b2;
+	double c;
+	double w;
+
+	void add_plane(double const* n, double d, double weight) {
+		a00 += weight * n[0] * n[0];
+		a01 += weight * n[0] * n[1];
+		a02 += weight * n[0] * n[2];
+		a11 += weight * n[1] * n[1];
+		a12 += weight * n[1] * n[2];
+		a22 += weight * n[2] * n[2];
+		b0 += weight * n[0] * d;
+		b1 += weight * n[1] * d;
+		b2 += weight * n[2] * d;
+		c += weight * d * d;
+		w += weight;
+	}
+
+	void add(sQuadric const& q) {
+		a00 += q.a00; a01 += q.a01; a02 += q.a02;
+		a11 += q.a11; a12 += q.a12; a22 += q.a22;
+		b0 += q.b0; b1 += q.b1; b2 += q.b2;
+		c += q.c;
+		w += q.w;
+	}
+
+	// Mean squared distance
+	double eval(float const* p) const {
+		if (w <= 0.0) { return 0.0; }
+		double x = p[0], y = p[1], z = p[2];
+		double e = a00 * x * x + a11 * y * y + a22 * z * z
+			+ 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+			+ 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+		return std::max(e / w, 0.0);
+	}
+};
+
+static void tri_normal(float const* p0, float const* p1, float const* p2, float* n) {
+	float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+	float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+uint32_t simplify(uint32_t* pIdx, uint32_t idxNum, sSimplifyMesh const& mesh, uint32_t targetIdxNum,
+	float maxError, float& error)
+{
+	error = 0.0f;
+	const uint32_t vtxNum = mesh.vtxNum;
+	uint32_t triNum = idxNum / 3;
+	if (triNum == 0 || triNum * 3 <= targetIdxNum) { return triNum * 3; }
+
+	auto get_src_pos = [&](uint32_t v) {
+		return reinterpret_cast<float const*>(reinterpret_cast<uint8_t const*>(mesh.pPos) + v * mesh.posStride);
+	};
+
+	std::vector<bool> used(vtxNum, false);
+	std::vector<uint32_t> usedVtx;
+	for (uint32_t i = 0; i < triNum * 3; ++i) {
+		if (!used[pIdx[i]]) {
+			used[pIdx[i]] = true;
+			usedVtx.push_back(pIdx[i]);
+		}
+	}
+
+	// Positions scaled to the largest extent, so the errors are relative
+	float bmin[3], bmax[3];
+	for (int i = 0; i < 3; ++i) {
+		bmin[i] = bmax[i] = get_src_pos(usedVtx[0])[i];
+	}
+	for (uint32_t v : usedVtx) {
+		float const* p = get_src_pos(v);
+		for (int i = 0; i < 3; ++i) {
+			bmin[i] = std::min(bmin[i], p[i]);
+			bmax[i] = std::max(bmax[i], p[i]);
+		}
+	}
+	float extent = std::max(std::max(bmax[0] - bmin[0], bmax[1] - bmin[1]), bmax[2] - bmin[2]);
+	float scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+	std::vector<float> pos(vtxNum * 3, 0.0f);
+	for (uint32_t v : usedVtx) {
+		float const* p = get_src_pos(v);
+		for (int i = 0; i < 3; ++i) {
+			pos[v * 3 + i] = (p[i] - bmin[i]) * scale;
+		}
+	}
+
+	// Vertices at the same position share the first of them as the position id
+	std::vector<uint32_t> posId(vtxNum);
+	std::vector<uint32_t> wedges(vtxNum, 0);
+	{
+		std::vector<uint32_t> sorted(usedVtx);
+		auto less_pos = [&](uint32_t a, uint32_t b) {
+			float const* pa = &pos[a * 3];
+			float const* pb = &pos[b * 3];
+			if (pa[0] != pb[0]) { return pa[0] < pb[0]; }
+			if (pa[1] != pb[1]) { return pa[1] < pb[1]; }
+			return pa[2] < pb[2];
+		};
+		std::sort(sorted.begin(), sorted.end(), less_pos);
+		uint32_t id = sorted[0];
+		for (size_t i = 0; i < sorted.size(); ++i) {
+			if (i > 0 && less_pos(sorted[i - 1], sorted[i])) {
+				id = sorted[i];
+			}
+			posId[sorted[i]] = id;
+			++wedges[id];
+		}
+	}
+
+	std::vector<bool> locked(vtxNum, false);
+	for (uint32_t v : usedVtx) {
+		locked[v] = wedges[posId[v]] > 1;
+	}
+	// Edges used by one triangle are borders, more than two is non-manifold
+	{
+		std::vector<uint64_t> edges;
+		edges.reserve(triNum * 3);
+		for (uint32_t t = 0; t < triNum; ++t) {
+			for (int k = 0; k < 3; ++k) {
+				uint64_t a = posId[pIdx[t * 3 + k]];
+				uint64_t b = posId[pIdx[t * 3 + (k + 1) % 3]];
+				edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size();) {
+			size_t j = i + 1;
+			while (j < edges.size() && edges[j] == edges[i]) { ++j; }
+			if (j - i != 2) {
+				uint32_t a = (uint32_t)(edges[i] >> 32);
+				uint32_t b = (uint32_t)edges[i];
+				// Lock every wedge, they're locked already when there is more than one
+				locked[a] = true;
+				locked[b] = true;
+			}
+			i = j;
+		}
+	}
+
+	std::vector<sQuadric> quadrics(vtxNum, sQuadric());
+	for (uint32_t t = 0; t < triNum; ++t) {
+		float const* p0 = &pos[pIdx[t * 3] * 3];
+		float n[3];
+		tri_normal(p0, &pos[pIdx[t * 3 + 1] * 3], &pos[pIdx[t * 3 + 2] * 3], n);
+		double len = std::sqrt((double)n[0] * n[0] + (double)n[1] * n[1] + (double)n[2] * n[2]);
+		if (len <= 0.0) { continue; }
+		double dn[3] = { n[0] / len, n[1] / len, n[2] / len };
+		double d = -(dn[0] * p0[0] + dn[1] * p0[1] + dn[2] * p0[2]);
+		for (int k = 0; k < 3; ++k) {
+			quadrics[posId[pIdx[t * 3 + k]]].add_plane(dn, d, len * 0.5);
+		}
+	}
+
+	auto attr_dist = [&](uint32_t a, uint32_t b) {
+		float dist = 0.0f;
+		float const* pa = mesh.pAttr + (size_t)a * mesh.attrNum;
+		float const* pb = mesh.pAttr + (size_t)b * mesh.attrNum;
+		for (uint32_t i = 0; i < mesh.attrNum; ++i) {
+			dist += (pa[i] - pb[i]) * (pa[i] - pb[i]);
+		}
+		return dist * mesh.attrWeight;
+	};
+
+	struct sCollapse {
+		uint32_t v;
+		uint32_t u;
+		float geomErr;
+		float cost;
+	};
+	std::vector<sCollapse> cand;
+	std::vector<bool> dead(triNum, false);
+	std::vector<bool> touched(vtxNum, false);
+	std::vector<uint32_t> adjStart(vtxNum + 1);
+	std::vector<uint32_t> adj;
+	const float maxCost = maxError * maxError;
+
+	while (triNum * 3 > targetIdxNum) {
+		const uint32_t srcTriNum = idxNum / 3;
+
+		// Live triangles of every vertex
+		std::fill(adjStart.begin(), adjStart.end(), 0);
+		for (uint32_t t = 0; t < srcTriNum; ++t) {
+			if (dead[t]) { continue; }
+			for (int k = 0; k < 3; ++k) {
+				++adjStart[pIdx[t * 3 + k] + 1];
+			}
+		}
+		for (uint32_t v = 0; v < vtxNum; ++v) {
+			adjStart[v + 1] += adjStart[v];
+		}
+		adj.resize(adjStart[vtxNum]);
+		{
+			std::vector<uint32_t> fill(adjStart.begin(), adjStart.end() - 1);
+			for (uint32_t t = 0; t < srcTriNum; ++t) {
+				if (dead[t]) { continue; }
+				for (int k = 0; k < 3; ++k) {
+					adj[fill[pIdx[t * 3 + k]]++] = t;
+				}
+			}
+		}
+
+		cand.clear();
+		for (uint32_t t = 0; t < srcTriNum; ++t) {
+			if (dead[t]) { continue; }
+			for (int k = 0; k < 3; ++k) {
+				uint32_t v = pIdx[t * 3 + k];
+				if (locked[v]) { continue; }
+				for (int j = 1; j < 3; ++j) {
+					uint32_t u = pIdx[t * 3 + (k + j) % 3];
+					if (mesh.pClass && mesh.pClass[v] != mesh.pClass[u]) { continue; }
+					sQuadric q = quadrics[posId[v]];
+					q.add(quadrics[posId[u]]);
+					float geomErr = (float)q.eval(&pos[u * 3]);
+					float cost = geomErr + (mesh.pAttr ? attr_dist(v, u) : 0.0f);
+					if (cost > maxCost) { continue; }
+					cand.push_back({ v, u, geomErr, cost });
+				}
+			}
+		}
+		if (cand.empty()) { break; }
+		std::sort(cand.begin(), cand.end(), [](sCollapse const& a, sCollapse const& b) {
+			return a.cost < b.cost || (a.cost == b.cost && (a.v < b.v || (a.v == b.v && a.u < b.u)));
+		});
+
+		// Collapses that don't share triangles, the rest waits for the next pass
+		std::fill(touched.begin(), touched.end(), false);
+		uint32_t collapsed = 0;
+		for (auto const& c : cand) {
+			if (triNum * 3 <= targetIdxNum) { break; }
+			if (touched[c.v] || touched[c.u]) { continue; }
+
+			// Triangles that would flip or degenerate
+			bool flips = false;
+			for (uint32_t a = adjStart[c.v]; a < adjStart[c.v + 1] && !flips; ++a) {
+				uint32_t const* pTri = &pIdx[adj[a] * 3];
+				if (pTri[0] == c.u || pTri[1] == c.u || pTri[2] == c.u) { continue; }
+				float const* p[3];
+				float const* q[3];
+				for (int k = 0; k < 3; ++k) {
+					p[k] = &pos[pTri[k] * 3];
+					q[k] = pTri[k] == c.v ? &pos[c.u * 3] : p[k];
+				}
+				float n0[3], n1[3];
+				tri_normal(p[0], p[1], p[2], n0);
+				tri_normal(q[0], q[1], q[2], n1);
+				float d = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+				float l0 = n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2];
+				float l1 = n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2];
+				flips = d <= 0.0f || d * d < 0.05f * l0 * l1;
+			}
+			if (flips) { continue; }
+
+			for (uint32_t a = adjStart[c.v]; a < adjStart[c.v + 1]; ++a) {
+				uint32_t t = adj[a];
+				uint32_t* pTri = &pIdx[t * 3];
+				for (int k = 0; k < 3; ++k) {
+					touched[pTri[k]] = true;
+					if (pTri[k] == c.v) { pTri[k] = c.u; }
+				}
+				if (pTri[0] == pTri[1] || pTri[1] == pTri[2] || pTri[2] == pTri[0]) {
+					dead[t] = true;
+					--triNum;
+				}
+			}
+			touched[c.u] = true;
+			quadrics[posId[c.u]].add(quadrics[posId[c.v]]);
+			error = std::max(error, std::sqrt(c.geomErr));
+			++collapsed;
+		}
+		if (collapsed == 0) { break; }
+	}
+
+	uint32_t outNum = 0;
+	for (uint32_t t = 0; t < idxNum / 3; ++t) {
+		if (dead[t]) { continue; }
+		for (int k = 0; k < 3; ++k) {
+			pIdx[outNum++] = pIdx[t * 3 + k];
+		}
+	}
+	return outNum;
+}
+
+static void calc_cluster_bounds(uint32_t const* pIdx, uint32_t start, uint32_t end, float const* pTriNrm,
+	float const* pPos, size_t posStride, sCluster& cl)
+{
+	auto get_pos = [&](uint32_t v) {
+		return reinterpret_cast<float const*>(reinterpret_cast<uint8_t const*>(pPos) + v * posStride);
+	};
+
+	// Around the box center, a bit larger than the minimal sphere
+	float bmin[3], bmax[3];
+	for (int i = 0; i < 3; ++i) {
+		bmin[i] = bmax[i] = get_pos(pIdx[start * 3])[i];
+	}
+	for (uint32_t j = start * 3; j < end * 3; ++j) {
+		float const* p = get_pos(pIdx[j]);
+		for (int i = 0; i < 3; ++i) {
+			bmin[i] = std::min(bmin[i], p[i]);
+			bmax[i] = std::max(bmax[i], p[i]);
+		}
+	}
+	float radiusSq = 0.0f;
+	for (int i = 0; i < 3; ++i) {
+		cl.center[i] = (bmin[i] + bmax[i]) * 0.5f;
+	}
+	for (uint32_t j = start * 3; j < end * 3; ++j) {
+		float const* p = get_pos(pIdx[j]);
+		float d[3] = { p[0] - cl.center[0], p[1] - cl.center[1], p[2] - cl.center[2] };
+		radiusSq = std::max(radiusSq, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	}
+	cl.radius = std::sqrt(radiusSq);
+
+	float axis[3] = { 0.0f, 0.0f, 0.0f };
+	for (uint32_t t = start; t < end; ++t) {
+		for (int i = 0; i < 3; ++i) {
+			axis[i] += pTriNrm[t * 3 + i];
+		}
+	}
+	float len = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	float mindp = 1.0f;
+	for (int i = 0; i < 3; ++i) {
+		cl.axis[i] = len > 0.0f ? axis[i] / len : 0.0f;
+	}
+	for (uint32_t t = start; t < end; ++t) {
+		float const* n = &pTriNrm[t * 3];
+		if (n[0] == 0.0f && n[1] == 0.0f && n[2] == 0.0f) { continue; }
+		mindp = std::min(mindp, n[0] * cl.axis[0] + n[1] * cl.axis[1] + n[2] * cl.axis[2]);
+	}
+	// Wider than ~84 degrees is hardly ever backfacing
+	cl.cutoff = len > 0.0f && mindp > 0.1f ? std::sqrt(1.0f - mindp * mindp) : 1.0f;
+	cl.idxOffset = start * 3;
+	cl.idxCount = (end - start) * 3;
+}
+
+void build_clusters(uint32_t const* pIdx, uint32_t idxNum, float const* pPos, size_t posStride,
+	float const* pNrm, size_t nrmStride, uint32_t vtxNum, uint32_t minTris, uint32_t maxTris,
+	std::vector<sCluster>& clusters)
+{
+	const uint32_t triNum = idxNum / 3;
+	if (triNum == 0) { return; }
+	maxTris = std::max(maxTris, 1U);
+	minTris = std::min(minTris, maxTris);
+
+	auto get = [](float const* p, size_t stride, uint32_t v) {
+		return reinterpret_cast<float const*>(reinterpret_cast<uint8_t const*>(p) + v * stride);
+	};
+
+	// Unit normals, 0 for the degenerate triangles
+	std::vector<float> triNrm(triNum * 3);
+	for (uint32_t t = 0; t < triNum; ++t) {
+		uint32_t const* pTri = &pIdx[t * 3];
+		float* n = &triNrm[t * 3];
+		tri_normal(get(pPos, posStride, pTri[0]), get(pPos, posStride, pTri[1]), get(pPos, posStride, pTri[2]), n);
+		float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (pNrm) {
+			float dp = 0.0f;
+			for (int k = 0; k < 3; ++k) {
+				float const* vn = get(pNrm, nrmStride, pTri[k]);
+				dp += n[0] * vn[0] + n[1] * vn[1] + n[2] * vn[2];
+			}
+			if (dp < 0.0f) { len = -len; }
+		}
+		for (int i = 0; i < 3; ++i) {
+			n[i] = len != 0.0f ? n[i] / len : 0.0f;
+		}
+	}
+
+	// stamp[v] is the number of the last cluster using v, from 1
+	std::vector<uint32_t> stamp(vtxNum, 0);
+	uint32_t cur = 1;
+	uint32_t start = 0;
+	float axis[3] = { 0.0f, 0.0f, 0.0f };
+	for (uint32_t t = 0; t < triNum; ++t) {
+		uint32_t const* pTri = &pIdx[t * 3];
+		float const* n = &triNrm[t * 3];
+		const uint32_t count = t - start;
+		bool split = count >= maxTris;
+		if (!split && count >= minTris) {
+			bool shared = stamp[pTri[0]] == cur || stamp[pTri[1]] == cur || stamp[pTri[2]] == cur;
+			float len = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+			float dp = n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2];
+			split = !shared || dp < 0.5f * len;
+		}
+		if (split) {
+			clusters.emplace_back();
+			calc_cluster_bounds(pIdx, start, t, triNrm.data(), pPos, posStride, clusters.back());
+			start = t;
+			axis[0] = axis[1] = axis[2] = 0.0f;
+			++cur;
+		}
+		for (int k = 0; k < 3; ++k) {
+			stamp[pTri[k]] = cur;
+			axis[k] += n[k];
+		}
+	}
+	clusters.emplace_back();
+	calc_cluster_bounds(pIdx, start, triNum, triNrm.data(), pPos, posStride, clusters.back());
+}
+
+bool is_cluster_backfacing(sCluster const& cluster, float const* pEye) {
+	if (cluster.cutoff >= 1.0f) { return false; }
+	float d[3] = { cluster.center[0] - pEye[0], cluster.center[1] - pEye[1], cluster.center[2] - pEye[2] };
+	float dist = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	float dp = d[0] * cluster.axis[0] + d[1] * cluster.axis[1] + d[2] * cluster.axis[2];
+	return dp >= cluster.cutoff * dist + cluster.radius;
+}
+
+}
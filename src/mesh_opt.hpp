@@ -0,0 +1,75 @@
+#include <cstddef>
+#include <vector>
+
+// Triangle list optimizations, all indices are in [0, vtxNum).
+namespace nMeshOpt {
+
+struct sVtxCacheStats {
+	// Transformed vertices per triangle and per referenced vertex, 0.5 and 1 are ideal
+	float acmr = 0.0f;
+	float atvr = 0.0f;
+};
+
+// FIFO post-transform cache simulation
+sVtxCacheStats analyze_vertex_cache(uint32_t const* pIdx, uint32_t idxNum, uint32_t vtxNum, uint32_t cacheSize);
+
+// Reorders the triangles for the vertex cache, Tipsify: Sander et al., Fast Triangle
+// Reordering for Vertex Locality and Reduced Overdraw, 2007.
+void optimize_vertex_cache(uint32_t* pIdx, uint32_t idxNum, uint32_t vtxNum, uint32_t cacheSize);
+
+// Splits a cache-optimized list into clusters at the cache flushes and wherever the
+// cluster ACMR drops below threshold * the list ACMR, then sorts the clusters so
+// the outward-facing ones are drawn first. pPos is 3 floats at posStride bytes.
+void optimize_overdraw(uint32_t* pIdx, uint32_t idxNum, float const* pPos, size_t posStride, uint32_t vtxNum,
+	uint32_t cacheSize, float threshold = 1.05f);
+
+// Numbers the vertices in the order of first use, unreferenced ones go last.
+// Rewrites the indices and fills pRemap[old] = new, returns the referenced count.
+uint32_t optimize_vertex_fetch(uint32_t* pIdx, uint32_t idxNum, uint32_t vtxNum, uint32_t* pRemap);
+
+struct sSimplifyMesh {
+	// 3 floats at posStride bytes
+	float const* pPos = nullptr;
+	size_t posStride = 0;
+	uint32_t vtxNum = 0;
+	// Optional attrNum floats per vertex, their squared differences times attrWeight add to the cost
+	float const* pAttr = nullptr;
+	uint32_t attrNum = 0;
+	float attrWeight = 1.0f;
+	// Optional, vertices only collapse into ones of the same class
+	uint32_t const* pClass = nullptr;
+};
+
+// Quadric error simplification: Garland, Heckbert, Surface Simplification Using
+// Quadric Error Metrics, 1997. Vertices collapse into a neighbor, so no vertices or
+// attributes are made, until idxNum is down to targetIdxNum or the next collapse costs
+// more than maxError. Vertices on open borders and seams (other vertices at the same
+// position) stay. Errors are distances relative to the largest extent of the mesh.
+// Rewrites pIdx, returns the new index count and the largest collapse error in error.
+uint32_t simplify(uint32_t* pIdx, uint32_t idxNum, sSimplifyMesh const& mesh, uint32_t targetIdxNum,
+	float maxError, float& error);
+
+struct sCluster {
+	// Bounding sphere
+	float center[3];
+	float radius;
+	// Normal cone, every triangle faces away from the eye when
+	// dot(center - eye, axis) >= cutoff * |center - eye| + radius. No cone if cutoff >= 1.
+	float axis[3];
+	float cutoff;
+	// Triangles of the list
+	uint32_t idxOffset;
+	uint32_t idxCount;
+};
+
+// Splits a cache-optimized list into runs of consecutive triangles, up to maxTris
+// each. After minTris a run also ends at a triangle that shares no vertex with it
+// or bends away from its normal. Triangle normals are oriented by the vertex
+// normals pNrm if given, otherwise by the winding (counterclockwise is front).
+void build_clusters(uint32_t const* pIdx, uint32_t idxNum, float const* pPos, size_t posStride,
+	float const* pNrm, size_t nrmStride, uint32_t vtxNum, uint32_t minTris, uint32_t maxTris,
+	std::vector<sCluster>& clusters);
+
+bool is_cluster_backfacing(sCluster const& cluster, float const* pEye);
+
+}
@@ -1,10 +1,20 @@
+#define NOMINMAX
+
 #include "common.hpp"
+#include "vmath.hpp"
 #include "math.hpp"
 #include "rdr.hpp"
 #include "gfx.hpp"
+#include "range_alloc.hpp"
+#include "geom_arena.hpp"
 #include "texture.hpp"
+#include "mesh_opt.hpp"
 #include "model.hpp"
 #include "hou_geo.hpp"
+#include "hou_geo_seq.hpp"
+#include "thread_pool.hpp"
+#include "mapped_file.hpp"
+#include "mesh_cache.hpp"
 #include "assimp_loader.hpp"
 #include "imgui.hpp"
 
@@ -12,365 +22,394 @@
 #include <assimp/scene.h>
 
 #include <cassert>
+#include <cmath>
+#include <limits>
 
 
 
-static vec4 as_vec4_1(aiVector3D const& v) {
-	return { { v.x, v.y, v.z, 1.0f } };
-}
-static vec3 as_vec3(aiVector3D const& v) {
-	return { v.x, v.y, v.z };
-}
-static vec2f as_vec2f(aiVector3D const& v) {
-	return {v.x, v.y};
-}
-static vec3 as_vec3(aiColor4D const& v) {
-	return { v.r, v.g, v.b };
+static bool build_hou_geo(cstr filepath, cModelGeom& geom) {
+	auto& pool = cThreadPool::get();
+	cHouGeoLoader geo;
+	if (!geo.load(filepath, &pool))
+		return false;
+	return geom.build(geo, &pool);
 }
 
-
-static vec4 as_vec4(cHouGeoAttrib const* pa, int idx) {
-	float tmp[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-	if (pa) {
-		float const* val = pa->get_float_val(idx);
-		for (int i = 0; i < 4 && i < pa->mAttribCount; ++i) {
-			tmp[i] = val[i];
-		}
-	}
-	return { { tmp[0], tmp[1], tmp[2], tmp[3] } };
+static bool build_assimp(cstr filepath, cModelGeom& geom) {
+	cAssimpLoader loader;
+	if (!loader.load(filepath))
+		return false;
+	return geom.build(loader, &cThreadPool::get());
 }
 
-static vec4i as_vec4i(cHouGeoAttrib const* pa, int idx) {
-	int32_t tmp[4] = { 0, 0, 0, 0 };
-	if (pa) {
-		int32_t const* val = pa->get_int32_val(idx);
-		for (int i = 0; i < 4 && i < pa->mAttribCount; ++i) {
-			tmp[i] = val[i];
-		}
+bool cModelData::load(cstr filepath) {
+	std::string cachePath = cMeshCache::get_path(filepath);
+	cModelGeom geom;
+	const uint64_t cookHash = geom.get_cook_hash();
+	{
+		cMeshCache cache;
+		if (cache.open(cachePath.c_str(), filepath, sizeof(sModelVtxPacked), sizeof(sGroup), sizeof(nMeshOpt::sCluster), sizeof(sVtxPosQuant), cookHash))
+			return init(cache);
 	}
-	return{ { tmp[0], tmp[1], tmp[2], tmp[3] } };
-}
 
+	bool isHou = filepath.ends_with(".geo") || filepath.ends_with(".bgeo");
+	if (!(isHou ? build_hou_geo(filepath, geom) : build_assimp(filepath, geom)))
+		return false;
+	if (!geom.mpVtx || !geom.mpIdx || !geom.mpGroups)
+		return false;
 
-static vec3 as_vec3(cHouGeoAttrib const* pa, int idx) {
-	float tmp[3] = { 0.0f, 0.0f, 0.0f };
-	if (pa) {
-		float const* val = pa->get_float_val(idx);
-		for (int i = 0; i < 3 && i < pa->mAttribCount; ++i) {
-			tmp[i] = val[i];
-		}
-	}
-	return { tmp[0], tmp[1], tmp[2] };
+	// The cache holds the GPU vertices, so a hit uploads it as is
+	auto pPacked = std::make_unique<sModelVtxPacked[]>(geom.mVtxNum);
+	sVtxPosQuant quant;
+	cModelGeom::pack_vtx(geom.mpVtx.get(), geom.mVtxNum, pPacked.get(), quant);
+
+	cMeshCache::sDesc desc;
+	desc.pVtx = pPacked.get();
+	desc.vtxNum = geom.mVtxNum;
+	desc.vtxSize = sizeof(sModelVtxPacked);
+	desc.pIdx = geom.mpIdx.get();
+	desc.idxNum = geom.mIdxNum;
+	desc.idxSize = geom.mIdxSize;
+	desc.pGroups = geom.mpGroups.get();
+	desc.grpNum = geom.mGrpNum;
+	desc.grpSize = sizeof(sGroup);
+	desc.pGrpNames = geom.mpGrpNames.get();
+	desc.pClusters = geom.mpClusters.get();
+	desc.clusterNum = geom.mClusterNum;
+	desc.clusterSize = sizeof(nMeshOpt::sCluster);
+	desc.pInfo = &quant;
+	desc.infoSize = sizeof(quant);
+	desc.cookHash = cookHash;
+	cMeshCache::write(cachePath.c_str(), filepath, desc);
+
+	return init(std::move(geom), pPacked.get(), quant);
 }
 
-static vec2f as_vec2f(cHouGeoAttrib const* pa, int idx) {
-	float tmp[] = { 0.0f, 0.0f };
-	if (pa) {
-		float const* val = pa->get_float_val(idx);
-		for (int i = 0; i < 2 && i < pa->mAttribCount; ++i) {
-			tmp[i] = val[i];
-		}
-	}
-	return { tmp[0], tmp[1] };
+bool cModelData::load_hou_geo(cstr filepath) {
+	cModelGeom geom;
+	if (!build_hou_geo(filepath, geom))
+		return false;
+
+	return init(std::move(geom));
 }
 
-bool cModelData::load(cstr filepath) {
-	if (filepath.ends_with(".geo")) {
-		return load_hou_geo(filepath);
-	} else {
-		return load_assimp(filepath);
+bool cModelData::load_assimp(cstr filepath) {
+	cAssimpLoader loader;
+	if (loader.load(filepath)) {
+		return load_assimp(loader);
 	}
+	return false;
 }
 
-bool cModelData::load_hou_geo(cstr filepath) {
-	cHouGeoLoader geo;
-	if (!geo.load(filepath))
+bool cModelData::load_assimp(cAssimpLoader& loader) {
+	cModelGeom geom;
+	if (!geom.build(loader, &cThreadPool::get()))
 		return false;
 
-	int numVtx = geo.mPointCount;
-	int numIdx = geo.mVertexCount;
-	int numGrp = geo.mNonemptyGroups;
-
-	auto pGroups = std::make_unique<sGroup[]>(numGrp);
-	auto pVtx = std::make_unique<sModelVtx[]>(numVtx);
-	auto pIdx = std::make_unique<uint16_t[]>(numIdx);
-	auto pNames = std::make_unique<std::string[]>(numGrp);
-
-	const uint32_t vtxSize = sizeof(sModelVtx);
-	const DXGI_FORMAT idxFormat = DXGI_FORMAT_R16_UINT;
-
-	auto pVtxItr = pVtx.get();
-	auto pIdxItr = pIdx.get();
-	auto pGrpItr = pGroups.get();
-	auto pNamesItr = pNames.get();
-
-	cHouGeoAttrib const* pPosAttr = nullptr;
-	cHouGeoAttrib const* pNrmAttr = nullptr;
-	cHouGeoAttrib const* pUVAttr = nullptr;
-	cHouGeoAttrib const* pTngUAttr = nullptr;
-	cHouGeoAttrib const* pTngVAttr = nullptr;
-	cHouGeoAttrib const* pUV1Attr = nullptr;
-	cHouGeoAttrib const* pCdAttr = nullptr;
-	cHouGeoAttrib const* pJIdxAttr = nullptr;
-	cHouGeoAttrib const* pJWgtAttr = nullptr;
-
-	for (int i = 0; i < geo.mPointAttribCount; ++i) {
-		auto const& attr = geo.mpPointAttribs[i];
-		if (attr.mName == "P" && attr.mType == cHouGeoAttrib::E_TYPE_fpreal32) {
-			pPosAttr = &attr;
-		}
-		else if (attr.mName == "N" && attr.mType == cHouGeoAttrib::E_TYPE_fpreal32) {
-			pNrmAttr = &attr;
-		}
-		else if (attr.mName == "uv" && attr.mType == cHouGeoAttrib::E_TYPE_fpreal32) {
-			pUVAttr = &attr;
-		}
-		else if (attr.mName == "tangentu" && attr.mType == cHouGeoAttrib::E_TYPE_fpreal32) {
-			pTngUAttr = &attr;
-		}
-		else if (attr.mName == "tangentv" && attr.mType == cHouGeoAttrib::E_TYPE_fpreal32) {
-			pTngVAttr = &attr;
-		}
-		else if (attr.mName == "uv1" && attr.mType == cHouGeoAttrib::E_TYPE_fpreal32) {
-			pUV1Attr = &attr;
-		}
-		else if (attr.mName == "Cd" && attr.mType == cHouGeoAttrib::E_TYPE_fpreal32) {
-			pCdAttr = &attr;
-		}
-		else if (attr.mName == "jidx" && attr.mType == cHouGeoAttrib::E_TYPE_int32) {
-			pJIdxAttr = &attr;
-		}
-		else if (attr.mName == "jwgt" && attr.mType == cHouGeoAttrib::E_TYPE_fpreal32) {
-			pJWgtAttr = &attr;
-		}
-	}
+	return init(std::move(geom));
+}
 
-	for (int vtx = 0; vtx < numVtx; ++vtx) {
-		pVtxItr->pos = as_vec3(pPosAttr, vtx);
-		pVtxItr->nrm = as_vec3(pNrmAttr, vtx);
-		pVtxItr->uv = as_vec2f(pUVAttr, vtx);
-		pVtxItr->uv.y = -pVtxItr->uv.y;
-		pVtxItr->tgt = as_vec4(pTngUAttr, vtx);
-		pVtxItr->bitgt = as_vec3(pTngVAttr, vtx);
-		pVtxItr->uv1 = as_vec2f(pUV1Attr, vtx);
-		pVtxItr->uv1.y = -pVtxItr->uv1.y;
-		pVtxItr->clr = as_vec3(pCdAttr, vtx);
-		pVtxItr->jidx = as_vec4i(pJIdxAttr, vtx);
-		pVtxItr->jwgt = as_vec4(pJWgtAttr, vtx);
-		++pVtxItr;
-	}
+bool cModelData::init(cModelGeom&& geom) {
+	if (!geom.mpVtx || !geom.mpIdx || !geom.mpGroups)
+		return false;
 
-	auto const& poly = geo.mPoly;
-	auto const vmap = geo.mpVertexMap.get();
+	auto pPacked = std::make_unique<sModelVtxPacked[]>(geom.mVtxNum);
+	sVtxPosQuant quant;
+	cModelGeom::pack_vtx(geom.mpVtx.get(), geom.mVtxNum, pPacked.get(), quant);
+	return init(std::move(geom), pPacked.get(), quant);
+}
 
-	for (int igrp = 0; igrp < geo.mGroupsCount; ++igrp) {
-		auto const& grp = geo.mpGroups[igrp];
-		if (grp.mEmpty) { continue; }
+bool cModelData::init(cModelGeom&& geom, sModelVtxPacked const* pPacked, sVtxPosQuant const& quant) {
+	unload();
+	mGrpNum = geom.mGrpNum;
+	mpGroups = std::move(geom.mpGroups);
+	mpGrpNames = std::move(geom.mpGrpNames);
+	mClusterNum = geom.mClusterNum;
+	mpClusters = std::move(geom.mpClusters);
 
-		auto pIdxGrpStart = pIdxItr;
+	init_buffers(pPacked, geom.mVtxNum, quant, geom.mpIdx.get(), geom.mIdxNum, geom.mIdxSize);
 
-		for (int i = 0; i < grp.mIntervalsCount; ++i) {
-			auto const& iv = grp.mpIntervals[i];
-			for (int j = iv.start; j < iv.end; ++j) {
-				if (!poly[j].valid) continue;
-				for (int k = 0; k < 3; ++k) {
-					int pidx = poly[j].v[k];
-					*pIdxItr = (uint16_t)vmap[pidx];
-					pIdxItr++;
-				}
-			}
-		}
+	return true;
+}
 
-		pGrpItr->mPolyType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		pGrpItr->mVtxOffset = 0;
-		pGrpItr->mIdxCount = static_cast<uint32_t>((pIdxItr - pIdxGrpStart));
-		pGrpItr->mIdxOffset = static_cast<uint32_t>((pIdxGrpStart - pIdx.get()) * sizeof(pIdxGrpStart[0]));
-		
-		*pNamesItr = grp.mName;
+// The buffers are created straight from the mapped cache
+bool cModelData::init(cMeshCache const& cache) {
+	auto const& desc = cache.get();
+	if (desc.vtxNum == 0 || desc.idxNum == 0 || desc.grpNum == 0)
+		return false;
+	if (desc.idxSize != sizeof(uint16_t) && desc.idxSize != sizeof(uint32_t))
+		return false;
 
-		++pGrpItr;
-		++pNamesItr;
+	unload();
+	mGrpNum = desc.grpNum;
+	mpGroups = std::make_unique<sGroup[]>(desc.grpNum);
+	::memcpy(mpGroups.get(), desc.pGroups, desc.grpNum * sizeof(sGroup));
+	mpGrpNames = std::make_unique<std::string[]>(desc.grpNum);
+	for (uint32_t i = 0; i < desc.grpNum; ++i) {
+		mpGrpNames[i] = desc.pGrpNames[i];
 	}
+	mClusterNum = desc.clusterNum;
+	mpClusters = std::make_unique<nMeshOpt::sCluster[]>(desc.clusterNum);
+	::memcpy(mpClusters.get(), desc.pClusters, desc.clusterNum * sizeof(nMeshOpt::sCluster));
 
-	auto pDev = get_gfx().get_dev();
-	mVtx.init(pDev, pVtx.get(), numVtx, vtxSize);
-	mIdx.init(pDev, pIdx.get(), numIdx, idxFormat);
-
-	mGrpNum = numGrp;
-	mpGroups = std::move(pGroups);
-	mpGrpNames = std::move(pNames);
+	sVtxPosQuant quant;
+	::memcpy(&quant, desc.pInfo, sizeof(quant));
+	init_buffers((sModelVtxPacked const*)desc.pVtx, desc.vtxNum, quant, desc.pIdx, desc.idxNum, desc.idxSize);
 
 	return true;
 }
 
-template <typename T>
-struct sReadItr {
-	T const* mpItr;
-	int mStep;
+// Bounding sphere around the center of the quantization box, for the LOD selection.
+// get_pos(i) is the model space position of vertex i.
+template <typename TGetPos>
+static void calc_bounds(sVtxPosQuant const& quant, uint32_t vtxNum, TGetPos get_pos, vec3& center, float& radius) {
+	center = { quant.bias.x + quant.scale.x * 0.5f, quant.bias.y + quant.scale.y * 0.5f, quant.bias.z + quant.scale.z * 0.5f };
+	float radiusSq = 0.0f;
+	for (uint32_t i = 0; i < vtxNum; ++i) {
+		vec3 pos = get_pos(i);
+		float x = pos.x - center.x;
+		float y = pos.y - center.y;
+		float z = pos.z - center.z;
+		radiusSq = std::max(radiusSq, x * x + y * y + z * z);
+	}
+	radius = ::sqrtf(radiusSq);
+}
 
-	sReadItr(T const* p, T const* pDef) {
-		if (p) {
-			mpItr = p;
-			mStep = 1;
-		} else {
-			mpItr = pDef;
-			mStep = 0;
+void cModelData::init_buffers(sModelVtxPacked const* pPacked, uint32_t vtxNum, sVtxPosQuant const& quant,
+	void const* pIdx, uint32_t idxNum, uint32_t idxSize) {
+	const uint32_t vtxSize = sizeof(sModelVtxPacked);
+	const DXGI_FORMAT idxFormat = idxSize == sizeof(uint32_t) ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
+
+	mPosQuant = quant;
+
+	mVtxNum = vtxNum;
+	mIdxNum = idxNum;
+	mIdxSize = idxSize;
+	mInArena = false;
+	if (mUseArena) {
+		auto& arena = cGeomArena::get();
+		auto pCtx = get_gfx().get_ctx();
+		if (arena.alloc_vtx(pCtx, pPacked, vtxNum, vtxSize, mArenaVtx)) {
+			mInArena = arena.alloc_idx(pCtx, pIdx, idxNum, idxSize, mArenaIdx);
+			if (!mInArena) {
+				arena.free_vtx(mArenaVtx, vtxNum, vtxSize);
+			}
+		}
+		if (!mInArena) {
+			// The model still draws, from buffers of its own
+			mArenaVtx = mArenaIdx = 0;
 		}
 	}
-
-	T const& read() {
-		T const& res = *mpItr;
-		mpItr += mStep;
-		return res;
+	if (mInArena) {
+		for (uint32_t i = 0; i < mGrpNum; ++i) {
+			sGroup& grp = mpGroups[i];
+			grp.mVtxOffset += mArenaVtx;
+			grp.mIdxOffset += mArenaIdx;
+			for (uint32_t j = 0; j < grp.mLodNum; ++j) {
+				grp.mLods[j].mIdxOffset += mArenaIdx;
+			}
+		}
+		for (uint32_t i = 0; i < mClusterNum; ++i) {
+			mpClusters[i].idxOffset += mArenaIdx;
+		}
+	} else {
+		auto pDev = get_gfx().get_dev();
+		mVtx.init(pDev, pPacked, vtxNum, vtxSize);
+		mIdx.init(pDev, pIdx, idxNum, idxFormat);
+	}
+	// From the quantized vertices, as the GPU sees them
+	mSkinBounds.build(pPacked, vtxNum, quant);
+	if (mDepthStream) {
+		init_depth_vtx(pPacked, vtxNum);
 	}
-};
 
-bool cModelData::load_assimp(cstr filepath) {
-	cAssimpLoader loader;
-	if (loader.load(filepath)) {
-		return load_assimp(loader);
+	// From the quantized positions too
+	calc_bounds(quant, vtxNum, [&](uint32_t i) { return cModelGeom::unpack_pos(pPacked[i], quant); }, mCenter, mRadius);
+}
+
+void cModelData::init_depth_vtx(sModelVtxPacked const* pVtx, uint32_t vtxNum) {
+	auto pDev = get_gfx().get_dev();
+	auto init_stream = [&](void const* pDepth) {
+		if (mInArena) {
+			// The depth draws share the main stream's index buffer and base vertex,
+			// so the model goes without the depth stream if it doesn't fit the arena
+			if (!cGeomArena::get().alloc_vtx(get_gfx().get_ctx(), pDepth, vtxNum, mDepthVtxSize, mArenaDepthVtx)) {
+				mDepthVtxSize = 0;
+				mArenaDepthVtx = 0;
+			}
+		} else {
+			mDepthVtx.init(pDev, pDepth, vtxNum, mDepthVtxSize);
+		}
+	};
+	if (mSkinBounds.get_box_num() > 0) {
+		auto pDepth = std::make_unique<sModelVtxDepthSkin[]>(vtxNum);
+		for (uint32_t i = 0; i < vtxNum; ++i) {
+			::memcpy(pDepth[i].pos, pVtx[i].pos, sizeof(pDepth[i].pos));
+			::memcpy(pDepth[i].jidx, pVtx[i].jidx, sizeof(pDepth[i].jidx));
+			::memcpy(pDepth[i].jwgt, pVtx[i].jwgt, sizeof(pDepth[i].jwgt));
+		}
+		mDepthVtxSize = sizeof(sModelVtxDepthSkin);
+		init_stream(pDepth.get());
+	} else {
+		auto pDepth = std::make_unique<sModelVtxDepth[]>(vtxNum);
+		for (uint32_t i = 0; i < vtxNum; ++i) {
+			::memcpy(pDepth[i].pos, pVtx[i].pos, sizeof(pDepth[i].pos));
+		}
+		mDepthVtxSize = sizeof(sModelVtxDepth);
+		init_stream(pDepth.get());
 	}
-	return false;
 }
 
-bool cModelData::load_assimp(cAssimpLoader& loader) {
-	auto& meshes = loader.get_mesh_info();
+void cModelData::unload() {
+	if (mInArena) {
+		auto& arena = cGeomArena::get();
+		arena.free_vtx(mArenaVtx, mVtxNum, sizeof(sModelVtxPacked));
+		if (mDepthVtxSize > 0) {
+			arena.free_vtx(mArenaDepthVtx, mVtxNum, mDepthVtxSize);
+		}
+		arena.free_idx(mArenaIdx, mIdxNum, mIdxSize);
+	}
+	clear_arena();
+	mRadius = 0.0f;
+	mVtx.deinit();
+	mDepthVtx.deinit();
+	mDepthVtxSize = 0;
+	mIdx.deinit();
+	mGrpNum = 0;
+	mpGroups.reset();
+	mpGrpNames.reset();
+	mpClusters.reset();
+	mClusterNum = 0;
+	mSkinBounds.reset();
+}
 
-	int numGrp = (int)meshes.size();
-	if (numGrp == 0) { return false; }
+void cModelData::set_buffers(ID3D11DeviceContext* pCtx) const {
+	if (mInArena) {
+		auto const& arena = cGeomArena::get();
+		arena.set_vtx(pCtx, 0, sizeof(sModelVtxPacked));
+		arena.set_idx(pCtx, mIdxSize);
+	} else {
+		mVtx.set(pCtx, 0, 0);
+		mIdx.set(pCtx, 0);
+	}
+}
 
-	int numVtx = 0;
-	int numIdx = 0;
+void cModelData::set_depth_buffers(ID3D11DeviceContext* pCtx) const {
+	if (mInArena) {
+		auto const& arena = cGeomArena::get();
+		arena.set_vtx(pCtx, 0, mDepthVtxSize);
+		arena.set_idx(pCtx, mIdxSize);
+	} else {
+		mDepthVtx.set(pCtx, 0, 0);
+		mIdx.set(pCtx, 0);
+	}
+}
 
-	for (auto& mi : meshes) {
-		aiMesh* pMesh = mi.mpMesh;
 
-		numVtx += pMesh->mNumVertices;
+cModelSeq::cModelSeq() : mpReader(std::make_unique<cHouGeoSeqReader>()) {}
 
-		int idx = pMesh->mNumFaces;
-		numIdx += idx * 3;
-	}
-	
-	auto bonesMap = loader.get_bones_map();
-
-	auto pGroups = std::make_unique<sGroup[]>(numGrp);
-	auto pVtx = std::make_unique<sModelVtx[]>(numVtx);
-	auto pIdx = std::make_unique<uint16_t[]>(numIdx);
-	auto pNames = std::make_unique<std::string[]>(numGrp);
-
-	const uint32_t vtxSize = sizeof(sModelVtx);
-	const DXGI_FORMAT idxFormat = DXGI_FORMAT_R16_UINT;
-
-	auto pVtxItr = pVtx.get();
-	auto pIdxItr = pIdx.get();
-	auto pGrpItr = pGroups.get();
-	auto pNamesItr = pNames.get();
-
-	const aiColor4D defColor = { 1.0f, 1.0f, 1.0f, 1.0f };
-	const aiVector3D defV3Zero = { 0.0f, 0.0f, 0.0f };
-	const aiVector3D defTgt = { 1.0f, 0.0f, 0.0f };
-	const aiVector3D defBitgt = { 0.0f, 1.0f, 0.0f };
-	const aiVector3D defNrm = { 0.0f, 0.0f, 1.0f };
-
-	for (auto& mi : meshes) {
-		aiMesh* pMesh = mi.mpMesh;
-
-		auto pVtxGrpStart = pVtxItr;
-		auto pIdxGrpStart = pIdxItr;
-
-		const int meshVtx = pMesh->mNumVertices;
-
-		sReadItr<aiVector3D> posItr(pMesh->mVertices, &defV3Zero);
-		sReadItr<aiVector3D> nrmItr(pMesh->mNormals, &defNrm);
-		sReadItr<aiVector3D> uvItr(pMesh->mTextureCoords[0], &defV3Zero);
-		sReadItr<aiVector3D> tgtItr(nullptr, &defTgt);
-		sReadItr<aiVector3D> bitgtItr(nullptr, &defBitgt);
-		sReadItr<aiVector3D> uv1Itr(nullptr, &defV3Zero);
-		sReadItr<aiColor4D> clrItr(pMesh->mColors[0], &defColor);
-
-		for (int vtx = 0; vtx < meshVtx; ++vtx) {
-			pVtxItr->pos = as_vec3(posItr.read());
-			pVtxItr->nrm = as_vec3(nrmItr.read());
-			pVtxItr->uv = as_vec2f(uvItr.read());
-			pVtxItr->uv.y = -pVtxItr->uv.y;
-			pVtxItr->tgt = as_vec4_1(tgtItr.read());
-			pVtxItr->bitgt = as_vec3(bitgtItr.read());
-			pVtxItr->uv1 = as_vec2f(uv1Itr.read());
-			pVtxItr->clr = as_vec3(clrItr.read());
-			::memset(&pVtxItr->jidx, 0, sizeof(pVtxItr->jidx));
-			::memset(&pVtxItr->jwgt, 0, sizeof(pVtxItr->jwgt));
-			++pVtxItr;
-		}
+cModelSeq::~cModelSeq() {
+	unload();
+}
 
-		const int meshFace = pMesh->mNumFaces;
-		aiFace const* pFace = pMesh->mFaces;
-		for (int face = 0; face < meshFace; ++face) {
-			assert(pFace->mNumIndices == 3);
-			pIdxItr[0] = pFace->mIndices[0];
-			pIdxItr[1] = pFace->mIndices[1];
-			pIdxItr[2] = pFace->mIndices[2];
+bool cModelSeq::load(cstr pattern, int first, int last, size_t memBudget, int prefetch) {
+	unload();
 
-			pIdxItr += 3;
-			++pFace;
-		}
+	cHouGeoLoader geo;
+	if (!geo.load(cHouGeoSeqReader::get_frame_path(pattern, first).c_str()))
+		return false;
 
-		
-		for (uint32_t bone = 0; bone < pMesh->mNumBones; ++bone) {
-			auto pBone = pMesh->mBones[bone];
-			auto bIt = bonesMap.find(pBone->mName.C_Str());
-			if (bIt == bonesMap.end()) { continue; }
-
-			int32_t boneIdx = bIt->second;
-
-			auto w = pBone->mWeights;
-			for (uint32_t i = 0; i < pBone->mNumWeights; ++i) {
-				auto vidx = w[i].mVertexId;
-				auto jwgt = w[i].mWeight;
-				
-				auto& vtx = pVtxGrpStart[vidx];
-				for (int j = 0; j < 4; ++j) {
-					if (vtx.jwgt[j] == 0.0f) {
-						vtx.jwgt[j] = jwgt;
-						vtx.jidx[j] = boneIdx;
-						break;
-					}
-				}
-			}
-		}
+	// Frames are streamed per welded vertex of the loader
+	cModelGeom geom;
+	geom.mWeld.enabled = false;
+	// The LOD errors and cluster bounds would only hold for the first frame
+	geom.mLod.num = 0;
+	geom.mCluster.enabled = false;
+	if (!geom.build(geo))
+		return false;
+	if (!geom.mpVtx || !geom.mpIdx || !geom.mpGroups)
+		return false;
 
+	if (!mpReader->open(pattern, first, last, geo, memBudget, prefetch))
+		return false;
+	assert(mpReader->get_vtx_num() == geom.mVtxNum);
 
-		pGrpItr->mVtxOffset = static_cast<uint32_t>((pVtxGrpStart - pVtx.get()) * sizeof(pVtxGrpStart[0]));
-		pGrpItr->mIdxCount = static_cast<uint32_t>((pIdxItr - pIdxGrpStart));
-		pGrpItr->mIdxOffset = static_cast<uint32_t>((pIdxGrpStart - pIdx.get()) * sizeof(pIdxGrpStart[0]));
-		pGrpItr->mPolyType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	auto pDev = get_gfx().get_dev();
+	mVtxNum = geom.mVtxNum;
+	mpVtx = std::move(geom.mpVtx);
+	// The vertex buffers are rewritten every frame, so they're the model's own,
+	// and there's no depth stream to keep up to date
+	mData.mUseArena = false;
+	mData.mDepthStream = false;
+	mData.mVtxNum = mVtxNum;
+	mData.mIdxNum = geom.mIdxNum;
+	mData.mIdxSize = geom.mIdxSize;
+	mpVtxSrc = std::move(geom.mpVtxSrc);
+	mData.mVtx.init_write_only(pDev, mVtxNum, sizeof(sModelVtxPacked));
+	mBackVtx.init_write_only(pDev, mVtxNum, sizeof(sModelVtxPacked));
+	const DXGI_FORMAT idxFormat = geom.mIdxSize == sizeof(uint32_t) ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
+	mData.mIdx.init(pDev, geom.mpIdx.get(), geom.mIdxNum, idxFormat);
+
+	mData.mGrpNum = geom.mGrpNum;
+	mData.mpGroups = std::move(geom.mpGroups);
+	mData.mpGrpNames = std::move(geom.mpGrpNames);
+
+	mFrame = -1;
+	return set_frame(first, true);
+}
 
-		if (mi.mName.starts_with("g ")) {
-			*pNamesItr = &mi.mName.p[2];
-		} else {
-			*pNamesItr = mi.mName;
-		}
-		
+void cModelSeq::unload() {
+	mpReader->close();
+	mData.unload();
+	mBackVtx.deinit();
+	mpVtx.reset();
+	mpVtxSrc.reset();
+	mVtxNum = 0;
+	mFrame = -1;
+}
 
-		++pGrpItr;
-		++pNamesItr;
+bool cModelSeq::set_frame(int frame, bool wait) {
+	auto pFrame = mpReader->get_frame(frame, wait);
+	if (!pFrame) return false;
+	if (pFrame->mFrame == mFrame) return true;
+
+	float const* pPos = pFrame->get(cHouGeoSeqReader::E_CHANNEL_POS);
+	float const* pNrm = pFrame->get(cHouGeoSeqReader::E_CHANNEL_NRM);
+	float const* pClr = pFrame->get(cHouGeoSeqReader::E_CHANNEL_CLR);
+	for (uint32_t i = 0; i < mVtxNum; ++i) {
+		auto& vtx = mpVtx[i];
+		// Frames are in the welded order, the vertices were reordered after welding
+		const size_t s = mpVtxSrc ? mpVtxSrc[i] : i;
+		if (pPos) { vtx.pos = { pPos[s * 3], pPos[s * 3 + 1], pPos[s * 3 + 2] }; }
+		if (pNrm) { vtx.nrm = { pNrm[s * 3], pNrm[s * 3 + 1], pNrm[s * 3 + 2] }; }
+		if (pClr) { vtx.clr = { pClr[s * 3], pClr[s * 3 + 1], pClr[s * 3 + 2] }; }
 	}
 
-	auto pDev = get_gfx().get_dev();
-	mVtx.init(pDev, pVtx.get(), numVtx, vtxSize);
-	mIdx.init(pDev, pIdx.get(), numIdx, idxFormat);
-
-	mGrpNum = numGrp;
-	mpGroups = std::move(pGroups);
-	mpGrpNames = std::move(pNames);
+	// Fill the buffer that is not bound, then flip. The positions are
+	// quantized to the bounds of this frame.
+	sVtxPosQuant quant;
+	{
+		auto map = mBackVtx.map(get_gfx().get_ctx());
+		if (!map.is_mapped()) return false;
+		cModelGeom::pack_vtx(mpVtx.get(), mVtxNum, (sModelVtxPacked*)map.data(), quant);
+	}
+	std::swap(mData.mVtx, mBackVtx);
+	mData.mPosQuant = quant;
+	calc_bounds(quant, mVtxNum, [this](uint32_t i) { return mpVtx[i].pos; }, mData.mCenter, mData.mRadius);
 
+	mFrame = pFrame->mFrame;
 	return true;
 }
 
-void cModelData::unload() {
-	mVtx.deinit();
-	mIdx.deinit();
-	mpGroups.release();
-	mpGrpNames.release();
+void cModelSeq::dbg_ui() {
+	if (!mpReader->is_open()) return;
+	ImGui::Begin("geo seq");
+	int frame = mFrame;
+	if (ImGui::SliderInt("frame", &frame, mpReader->get_first(), mpReader->get_last())) {
+		set_frame(frame);
+	}
+	ImGui::Text("cached: %d frames, %.1f MB", mpReader->get_cached_num(), mpReader->get_cache_bytes() / (1024.0f * 1024.0f));
+	ImGui::End();
 }
 
 
@@ -382,21 +421,35 @@ bool cModel::init(cModelData const& mdlData, cModelMaterial& mtl) {
 	auto pVS = ss.load_VS("model_solid.vs.cso");
 
 	D3D11_INPUT_ELEMENT_DESC vdsc[] = {
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(sModelVtx, pos), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(sModelVtx, nrm), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, offsetof(sModelVtx, uv), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "TANGENT", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, offsetof(sModelVtx, tgt), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "BITANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(sModelVtx, bitgt), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 1, DXGI_FORMAT_R32G32_FLOAT, 0, offsetof(sModelVtx, uv1), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "COLOR", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(sModelVtx, clr), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "BLENDINDEX", 0, DXGI_FORMAT_R32G32B32A32_SINT, 0, offsetof(sModelVtx, jidx), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "BLENDWEIGHT", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, offsetof(sModelVtx, jwgt), D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, offsetof(sModelVtxPacked, pos), D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, offsetof(sModelVtxPacked, nrm), D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, offsetof(sModelVtxPacked, uv), D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TANGENT", 0, DXGI_FORMAT_R16G16_SNORM, 0, offsetof(sModelVtxPacked, tgt), D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 1, DXGI_FORMAT_R16G16_FLOAT, 0, offsetof(sModelVtxPacked, uv1), D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, offsetof(sModelVtxPacked, clr), D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "BLENDINDEX", 0, DXGI_FORMAT_R8G8B8A8_UINT, 0, offsetof(sModelVtxPacked, jidx), D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "BLENDWEIGHT", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, offsetof(sModelVtxPacked, jwgt), D3D11_INPUT_PER_VERTEX_DATA, 0 },
 	};
 	auto pDev = get_gfx().get_dev();
 	auto& code = pVS->get_code();
 	HRESULT hr = pDev->CreateInputLayout(vdsc, LENGTHOF_ARRAY(vdsc), code.get_code(), code.get_size(), mpIL.pp());
 	if (!SUCCEEDED(hr)) throw sD3DException(hr, "CreateInputLayout failed");
 
+	// Without the depth stream the depth pass reads the positions and joints of mVtx through mpIL
+	const bool isSkinned = mdlData.mSkinBounds.get_box_num() > 0;
+	mpDepthVS = ss.load_VS(isSkinned ? "model_depth_skin.vs.cso" : "model_depth.vs.cso");
+	if (mdlData.mDepthVtxSize > 0) {
+		// The static layout is the first element, at the same offset in sModelVtxDepth
+		D3D11_INPUT_ELEMENT_DESC ddsc[] = {
+			{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, offsetof(sModelVtxDepthSkin, pos), D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "BLENDINDEX", 0, DXGI_FORMAT_R8G8B8A8_UINT, 0, offsetof(sModelVtxDepthSkin, jidx), D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "BLENDWEIGHT", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, offsetof(sModelVtxDepthSkin, jwgt), D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		};
+		auto& depthCode = mpDepthVS->get_code();
+		hr = pDev->CreateInputLayout(ddsc, isSkinned ? 3 : 1, depthCode.get_code(), depthCode.get_size(), mpDepthIL.pp());
+		if (!SUCCEEDED(hr)) throw sD3DException(hr, "CreateInputLayout failed");
+	}
+
 	mWmtx = DirectX::XMMatrixIdentity();
 
 	return true;
@@ -408,48 +461,177 @@ void cModel::deinit() {
 		mpIL->Release();
 		mpIL = nullptr;
 	}
+	mpDepthIL.reset();
+	mpDepthVS = nullptr;
 }
 
-void cModel::disp() {
-	if (!mpData) return;
-
-	auto pCtx = get_gfx().get_ctx();
-
+void cModel::begin_draw(ID3D11DeviceContext* pCtx, sDrawCtx& dc) {
 	auto& meshCBuf = cConstBufStorage::get().mMeshCBuf;
 	//meshCBuf.mData.wmtx = dx::XMMatrixIdentity();
 	//meshCBuf.mData.wmtx = DirectX::XMMatrixTranslation(0, 0, 0);
 	//meshCBuf.mData.wmtx = DirectX::XMMatrixRotationY(DEG2RAD(180));
 	//meshCBuf.mData.wmtx = DirectX::XMMatrixScaling(0.3f, 0.3f, 0.3f);
 	meshCBuf.mData.wmtx = mWmtx;
+	auto const& quant = mpData->mPosQuant;
+	meshCBuf.mData.posScale = DirectX::XMVectorSet(quant.scale.x, quant.scale.y, quant.scale.z, 0.0f);
+	meshCBuf.mData.posBias = DirectX::XMVectorSet(quant.bias.x, quant.bias.y, quant.bias.z, 0.0f);
 	meshCBuf.update(pCtx);
 	meshCBuf.set_VS(pCtx);
 
+	dc.pixelScale = calc_lod_pixel_scale();
+
+	// Clusters are culled in model space, skinned vertices leave their bind-space bounds
+	dc.cullClusters = mClusterCull && mpData->mClusterNum > 0 && mpData->mSkinBounds.get_box_num() == 0;
+	if (dc.cullClusters) {
+		auto const& cam = cConstBufStorage::get().mCameraCBuf.mData;
+		dc.frustum.init(as_m44(DirectX::XMMatrixMultiply(mWmtx, cam.viewProj)));
+		auto eyeMdl = DirectX::XMVector3TransformCoord(cam.camPos, DirectX::XMMatrixInverse(nullptr, mWmtx));
+		DirectX::XMStoreFloat3(reinterpret_cast<DirectX::XMFLOAT3*>(dc.eye), eyeMdl);
+	}
+	mDrawnClusters = 0;
+	mCulledClusters = 0;
+}
+
+void cModel::draw_group(ID3D11DeviceContext* pCtx, sDrawCtx const& dc, uint32_t grpIdx, bool cullBack, int32_t vtxBias) {
+	sGroup const& grp = mpData->mpGroups[grpIdx];
+	const INT baseVtx = (INT)grp.mVtxOffset + vtxBias;
+
+	// The coarsest level whose error projects under mLodPixelError
+	uint32_t idxOffset = grp.mIdxOffset;
+	uint32_t idxCount = grp.mIdxCount;
+	for (uint32_t j = 0; j < grp.mLodNum; ++j) {
+		bool fits = mForceLod >= 0 ? (int)j < mForceLod : grp.mLods[j].mError * dc.pixelScale <= mLodPixelError;
+		if (!fits) break;
+		idxOffset = grp.mLods[j].mIdxOffset;
+		idxCount = grp.mLods[j].mIdxCount;
+	}
+
+	pCtx->IASetPrimitiveTopology((D3D11_PRIMITIVE_TOPOLOGY)grp.mPolyType);
+	//pCtx->Draw(grp.mIdxCount, 0);
+	if (!dc.cullClusters || grp.mClusterNum == 0 || idxOffset != grp.mIdxOffset) {
+		pCtx->DrawIndexed(idxCount, idxOffset, baseVtx);
+		return;
+	}
+
+	// The clusters are consecutive, adjacent visible ones go in one draw
+	uint32_t runOffset = 0;
+	uint32_t runCount = 0;
+	for (uint32_t j = 0; j < grp.mClusterNum; ++j) {
+		auto const& cl = mpData->mpClusters[grp.mClusterOffset + j];
+		bool visible = dc.frustum.overlaps(nVM::set(cl.center[0], cl.center[1], cl.center[2], 1.0f), cl.radius)
+			&& !(cullBack && nMeshOpt::is_cluster_backfacing(cl, dc.eye));
+		if (!visible) {
+			++mCulledClusters;
+			continue;
+		}
+		++mDrawnClusters;
+		if (runCount > 0 && runOffset + runCount == cl.idxOffset) {
+			runCount += cl.idxCount;
+			continue;
+		}
+		if (runCount > 0) {
+			pCtx->DrawIndexed(runCount, runOffset, baseVtx);
+		}
+		runOffset = cl.idxOffset;
+		runCount = cl.idxCount;
+	}
+	if (runCount > 0) {
+		pCtx->DrawIndexed(runCount, runOffset, baseVtx);
+	}
+}
+
+void cModel::disp() {
+	if (!mpData) return;
+
+	auto pCtx = get_gfx().get_ctx();
+
+	sDrawCtx dc;
+	begin_draw(pCtx, dc);
+
 	pCtx->IASetInputLayout(mpIL);
 
 	cBlendStates::get().set_opaque(pCtx);
 
+	mpData->set_buffers(pCtx);
+
 	auto grpNum = mpData->mGrpNum;
 	for (uint32_t i = 0; i < grpNum; ++i) {
-		sGroup const& grp = mpData->mpGroups[i];
-
 		mpMtl->apply(pCtx, i);
+		draw_group(pCtx, dc, i, !mpMtl->mpGrpMtl[i].twosided, 0);
+	}
+
+}
 
-		mpData->mVtx.set(pCtx, 0, grp.mVtxOffset);
-		mpData->mIdx.set(pCtx, grp.mIdxOffset);
-		pCtx->IASetPrimitiveTopology((D3D11_PRIMITIVE_TOPOLOGY)grp.mPolyType);
-		//pCtx->Draw(grp.mIdxCount, 0);
-		pCtx->DrawIndexed(grp.mIdxCount, 0, 0);
+void cModel::disp_depth() {
+	if (!mpData || !mpDepthVS) return;
 
+	auto pCtx = get_gfx().get_ctx();
+
+	sDrawCtx dc;
+	begin_draw(pCtx, dc);
+
+	int32_t vtxBias = 0;
+	if (mpDepthIL) {
+		pCtx->IASetInputLayout(mpDepthIL);
+		mpData->set_depth_buffers(pCtx);
+		vtxBias = mpData->get_depth_vtx_bias();
+	} else {
+		pCtx->IASetInputLayout(mpIL);
+		mpData->set_buffers(pCtx);
 	}
 
+	cBlendStates::get().set_opaque(pCtx);
+	pCtx->VSSetShader(mpDepthVS->asVS(), nullptr, 0);
+	pCtx->PSSetShader(nullptr, nullptr, 0);
+
+	auto grpNum = mpData->mGrpNum;
+	for (uint32_t i = 0; i < grpNum; ++i) {
+		auto const& res = mpMtl->mpGrpRes[i];
+		// Cut out by the mask texture in the pixel shader
+		if (res.mpTexMask) continue;
+		cRasterizerStates::set(pCtx, res.mpRSState);
+		draw_group(pCtx, dc, i, !mpMtl->mpGrpMtl[i].twosided, vtxBias);
+	}
 }
 
 
+// Pixels per model unit at the nearest point of the bounding sphere, unbounded when
+// the camera is inside so only full detail fits
+float cModel::calc_lod_pixel_scale() const {
+	const float inside = std::numeric_limits<float>::max();
+	if (mpData->mRadius <= 0.0f) return inside;
+
+	auto pCtx = get_gfx().get_ctx();
+	D3D11_VIEWPORT vp;
+	UINT vpNum = 1;
+	pCtx->RSGetViewports(&vpNum, &vp);
+	if (vpNum == 0) return inside;
+
+	auto const& cam = cConstBufStorage::get().mCameraCBuf.mData;
+	auto const& c = mpData->mCenter;
+	auto center = DirectX::XMVector3TransformCoord(DirectX::XMVectorSet(c.x, c.y, c.z, 1.0f), mWmtx);
+	float dist = DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMVectorSubtract(center, cam.camPos)));
+	float scale = 0.0f;
+	for (int i = 0; i < 3; ++i) {
+		scale = std::max(scale, DirectX::XMVectorGetX(DirectX::XMVector3Length(mWmtx.r[i])));
+	}
+	dist -= mpData->mRadius * scale;
+	if (dist <= 0.0f) return inside;
+
+	// proj._22 is cot(fovY / 2)
+	float focal = DirectX::XMVectorGetY(cam.proj.r[1]) * vp.Height * 0.5f;
+	return scale * focal / dist;
+}
+
 void cModel::dbg_ui() {
 	if (!mpData) return;
 	auto grpNum = mpData->mGrpNum;
 	char buf[64];
 	ImGui::Begin("model");
+	ImGui::SliderFloat("LOD pixel error", &mLodPixelError, 0.0f, 16.0f);
+	ImGui::SliderInt("force LOD", &mForceLod, -1, sGroup::LOD_MAX);
+	ImGui::Checkbox("cull clusters", &mClusterCull);
+	ImGui::Text("clusters: %u drawn, %u culled", mDrawnClusters, mCulledClusters);
 	for (uint32_t i = 0; i < grpNum; ++i) {
 		sGroup const& grp = mpData->mpGroups[i];
 		auto const& name = mpData->mpGrpNames[i];
@@ -1,50 +1,314 @@
 #include <memory>
 #include <string>
+#include <vector>
 
 struct sModelVtx;
+struct sModelVtxPacked;
 class cShader;
+class cTexture;
 class cAssimpLoader;
+class cHouGeoLoader;
+class cHouGeoSeqReader;
+class cMeshCache;
+class cThreadPool;
+
+struct sGroupLod {
+	uint32_t mIdxOffset;
+	uint32_t mIdxCount;
+	// Largest distance from the full detail surface in model units
+	float mError;
+};
 
 struct sGroup {
+	enum { LOD_MAX = 4 };
+
+	// Base vertex and first index
 	uint32_t mVtxOffset;
 	uint32_t mIdxOffset;
 	uint32_t mIdxCount;
 	uint32_t mPolyType;
+	// Simplified levels after the full detail one, coarser with each, on the same vertices
+	uint32_t mLodNum;
+	sGroupLod mLods[LOD_MAX];
+	// Clusters of the full detail triangles, in the model cluster array
+	uint32_t mClusterOffset;
+	uint32_t mClusterNum;
+};
+
+// sModelVtxPacked::pos * scale + bias is the model space position
+struct sVtxPosQuant {
+	vec3 scale;
+	vec3 bias;
+};
+
+// CPU-side model geometry, built by the loaders before it goes to the GPU.
+class cModelGeom : noncopyable {
+public:
+	struct sWeldParams {
+		bool enabled = true;
+		// 0 merges equal values only, otherwise vertices are merged when their values
+		// round to the same multiple of eps. nrmEps is used for the tangents too.
+		float posEps = 0.0f;
+		float nrmEps = 0.0f;
+		float uvEps = 0.0f;
+	};
+
+	struct sLodParams {
+		// Simplified levels made per group, up to sGroup::LOD_MAX
+		uint32_t num = sGroup::LOD_MAX;
+		// Triangle count of each level relative to the previous one
+		float ratio = 0.5f;
+		// Per level, relative to the largest extent of the group
+		float maxError = 0.05f;
+		// Cost of the normal, UV and skin weight differences against the squared error
+		float attrWeight = 0.01f;
+	};
+
+	struct sClusterParams {
+		bool enabled = true;
+		// Clusters end early after minTris, see nMeshOpt::build_clusters
+		uint32_t minTris = 64;
+		uint32_t maxTris = 128;
+	};
+
+	// Post-transform cache entries optimize() tunes for
+	enum { VTX_CACHE_SIZE = 16 };
+
+	// Set before build
+	sWeldParams mWeld;
+	sLodParams mLod;
+	sClusterParams mCluster;
+
+	uint32_t mVtxNum = 0;
+	uint32_t mIdxNum = 0;
+	uint32_t mGrpNum = 0;
+	// 2 or 4, 16-bit indices are used when every group fits into 64K vertices
+	uint32_t mIdxSize = sizeof(uint16_t);
+	std::unique_ptr<sModelVtx[]> mpVtx;
+	// uint16_t or uint32_t by mIdxSize, relative to the group mVtxOffset
+	std::unique_ptr<uint8_t[]> mpIdx;
+	std::unique_ptr<sGroup[]> mpGroups;
+	std::unique_ptr<std::string[]> mpGrpNames;
+	// Vertex before the fetch reordering of every vertex, the loader one if not welded
+	std::unique_ptr<uint32_t[]> mpVtxSrc;
+	uint32_t mClusterNum = 0;
+	// Model space, the index offsets are absolute
+	std::unique_ptr<nMeshOpt::sCluster[]> mpClusters;
+
+public:
+	bool build(cHouGeoLoader const& geo, cThreadPool* pPool = nullptr);
+	bool build(cAssimpLoader const& loader, cThreadPool* pPool = nullptr);
+
+	// Converts to the GPU format, positions are quantized to the bounds of pSrc
+	static void pack_vtx(sModelVtx const* pSrc, uint32_t vtxNum, sModelVtxPacked* pDst, sVtxPosQuant& quant);
+	static vec3 unpack_pos(sModelVtxPacked const& vtx, sVtxPosQuant const& quant);
+	// Of the build settings and COOK_REVISION, a cached build of other settings is stale
+	uint64_t get_cook_hash() const;
+
+protected:
+	// Merges the equal vertices of all groups, the indices must be absolute
+	void weld(uint32_t* pIdx, uint32_t idxNum, cThreadPool* pPool);
+	// Vertex counts of every group before and after weld(), pRemap maps to the welded vertices
+	void log_weld_stats(uint32_t const* pIdx, uint32_t const* pRemap, uint32_t vtxNum, uint32_t weldNum) const;
+	// Appends the simplified levels of every group to idx, see nMeshOpt::simplify.
+	// UV seams and borders stay, vertices of different dominant joints don't merge.
+	void build_lods(std::vector<uint32_t>& idx);
+	// Reorders the triangles of every group and level for the vertex cache and
+	// overdraw, then the vertices by first use. Reports ACMR/ATVR before and after.
+	void optimize(uint32_t* pIdx, uint32_t idxNum);
+	// Splits the full detail triangles of every group for culling, the indices must be absolute
+	void build_clusters(uint32_t const* pIdx);
+	// Welds, makes the LODs, optimizes, clusters, rebases every group to its lowest vertex and picks the index width
+	void set_indices(uint32_t* pIdx, uint32_t idxNum, cThreadPool* pPool);
+};
+
+// Bind-space boxes of the vertices influenced by each skin joint.
+// Transformed by the skin palette they bound the skinned mesh in world space.
+class cSkinBounds {
+	struct sJointBox {
+		nVM::V4 mCenter;
+		nVM::V4 mExtent;
+	};
+
+	std::unique_ptr<sJointBox[]> mpBoxes;
+	std::unique_ptr<int32_t[]> mpSkinIdx;
+	int32_t mBoxNum = 0;
+	int32_t mMaxSkinIdx = -1;
+
+public:
+	void build(cModelGeom const& geom);
+	void build(sModelVtx const* pVtx, uint32_t vtxNum);
+	// Quantized positions and weights, matches what the GPU skins
+	void build(sModelVtxPacked const* pVtx, uint32_t vtxNum, sVtxPosQuant const& quant);
+	void reset();
+
+	int32_t get_box_num() const { return mBoxNum; }
+
+	// pSkin is the palette from cRig::calc_skin(), fails if it doesn't cover all joints.
+	bool calc_world(nVM::M44 const* pSkin, int skinNum, sAABB& box) const;
+
+protected:
+	// Keeps the non-empty boxes, indexed by joint
+	void set_boxes(std::vector<sAABB> const& boxes);
 };
 
 class cModelData : noncopyable {
 public:
-	uint32_t mGrpNum;
+	uint32_t mGrpNum = 0;
 	std::unique_ptr<sGroup[]> mpGroups;
 	std::unique_ptr<std::string[]> mpGrpNames;
 
+	// mVtx holds sModelVtxPacked
 	cVertexBuffer mVtx;
+	// sModelVtxDepthSkin for the skinned models, sModelVtxDepth otherwise
+	cVertexBuffer mDepthVtx;
+	// 0 without the depth stream
+	uint32_t mDepthVtxSize = 0;
+	// Set before loading for models drawn by disp_depth(), it costs a second copy of
+	// the positions and joints. disp_depth() reads them from mVtx otherwise.
+	bool mDepthStream = false;
+	// Set before loading, the vertices and indices go to cGeomArena instead of mVtx,
+	// mDepthVtx and mIdx. The arena offsets are added to the groups and clusters.
+	bool mUseArena = true;
+	bool mInArena = false;
+	uint32_t mVtxNum = 0;
+	uint32_t mIdxNum = 0;
+	uint32_t mIdxSize = 0;
+	uint32_t mArenaVtx = 0;
+	uint32_t mArenaDepthVtx = 0;
+	uint32_t mArenaIdx = 0;
+	sVtxPosQuant mPosQuant = { { 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f, 0.0f } };
 	cIndexBuffer mIdx;
+	// Model space bounding sphere of the vertices
+	vec3 mCenter = { 0.0f, 0.0f, 0.0f };
+	float mRadius = 0.0f;
+	uint32_t mClusterNum = 0;
+	std::unique_ptr<nMeshOpt::sCluster[]> mpClusters;
+	cSkinBounds mSkinBounds;
 
 public:
 	cModelData() {}
+	~cModelData() { unload(); }
 	cModelData(cModelData&& o) : 
+		mGrpNum(o.mGrpNum),
 		mpGroups(std::move(o.mpGroups)),
 		mpGrpNames(std::move(o.mpGrpNames)),
 		mVtx(std::move(o.mVtx)),
-		mIdx(std::move(o.mIdx))
-	{}
+		mDepthVtx(std::move(o.mDepthVtx)),
+		mDepthVtxSize(o.mDepthVtxSize),
+		mDepthStream(o.mDepthStream),
+		mUseArena(o.mUseArena),
+		mInArena(o.mInArena),
+		mVtxNum(o.mVtxNum),
+		mIdxNum(o.mIdxNum),
+		mIdxSize(o.mIdxSize),
+		mArenaVtx(o.mArenaVtx),
+		mArenaDepthVtx(o.mArenaDepthVtx),
+		mArenaIdx(o.mArenaIdx),
+		mIdx(std::move(o.mIdx)),
+		mPosQuant(o.mPosQuant),
+		mCenter(o.mCenter),
+		mRadius(o.mRadius),
+		mClusterNum(o.mClusterNum),
+		mpClusters(std::move(o.mpClusters)),
+		mSkinBounds(std::move(o.mSkinBounds))
+	{
+		o.mGrpNum = 0;
+		o.mClusterNum = 0;
+		o.clear_arena();
+	}
 	cModelData& operator=(cModelData&& o) {
+		unload();
+		mGrpNum = o.mGrpNum;
+		o.mGrpNum = 0;
 		mpGroups = std::move(o.mpGroups);
 		mpGrpNames = std::move(o.mpGrpNames);
 		mVtx = std::move(o.mVtx);
+		mDepthVtx = std::move(o.mDepthVtx);
+		mDepthVtxSize = o.mDepthVtxSize;
+		mDepthStream = o.mDepthStream;
+		mUseArena = o.mUseArena;
+		mInArena = o.mInArena;
+		mVtxNum = o.mVtxNum;
+		mIdxNum = o.mIdxNum;
+		mIdxSize = o.mIdxSize;
+		mArenaVtx = o.mArenaVtx;
+		mArenaDepthVtx = o.mArenaDepthVtx;
+		mArenaIdx = o.mArenaIdx;
+		o.clear_arena();
 		mIdx = std::move(o.mIdx);
+		mPosQuant = o.mPosQuant;
+		mCenter = o.mCenter;
+		mRadius = o.mRadius;
+		mClusterNum = o.mClusterNum;
+		o.mClusterNum = 0;
+		mpClusters = std::move(o.mpClusters);
+		mSkinBounds = std::move(o.mSkinBounds);
 		return *this;
 	}
 
 	//cModelData& operator=(cModelData&) = delete;
 
+	// Loads the cooked cache of the file if it's up to date, otherwise imports
+	// the file and writes the cache
 	bool load(cstr filepath);
+	bool init(cModelGeom&& geom);
+	// The cache vertices are packed, they are uploaded as they are mapped
+	bool init(cMeshCache const& cache);
 	void unload();
 
 	bool load_assimp(cstr filepath);
 	bool load_assimp(cAssimpLoader& loader);
 	bool load_hou_geo(cstr filepath);
+
+	// Sets the index buffer and mVtx or mDepthVtx, from the arena if the model is in it
+	void set_buffers(ID3D11DeviceContext* pCtx) const;
+	void set_depth_buffers(ID3D11DeviceContext* pCtx) const;
+	// Added to the group base vertex when drawing the depth stream
+	int32_t get_depth_vtx_bias() const { return mInArena ? (int32_t)mArenaDepthVtx - (int32_t)mArenaVtx : 0; }
+
+protected:
+	// Forgets the arena ranges without freeing them, they have moved to another model
+	void clear_arena() {
+		mInArena = false;
+		mVtxNum = mIdxNum = mIdxSize = 0;
+		mArenaVtx = mArenaDepthVtx = mArenaIdx = 0;
+	}
+	bool init(cModelGeom&& geom, sModelVtxPacked const* pPacked, sVtxPosQuant const& quant);
+	// After the groups and clusters are set
+	void init_buffers(sModelVtxPacked const* pPacked, uint32_t vtxNum, sVtxPosQuant const& quant,
+		void const* pIdx, uint32_t idxNum, uint32_t idxSize);
+	void init_depth_vtx(sModelVtxPacked const* pVtx, uint32_t vtxNum);
+};
+
+// Houdini geometry sequence with constant topology. Groups, indices and the
+// static channels come from the first frame; P, N and Cd of each frame are
+// streamed by cHouGeoSeqReader into double-buffered dynamic vertex buffers.
+class cModelSeq : noncopyable {
+	cModelData mData;
+	cVertexBuffer mBackVtx;
+	std::unique_ptr<sModelVtx[]> mpVtx;
+	std::unique_ptr<uint32_t[]> mpVtxSrc;
+	uint32_t mVtxNum = 0;
+	std::unique_ptr<cHouGeoSeqReader> mpReader;
+	int mFrame = -1;
+
+public:
+	cModelSeq();
+	~cModelSeq();
+
+	// See cHouGeoSeqReader::get_frame_path for the pattern
+	bool load(cstr pattern, int first, int last, size_t memBudget = 256 * 1024 * 1024, int prefetch = 8);
+	void unload();
+
+	// Shows the frame once it's decoded, until then the current one stays unless wait is set.
+	// Channels missing in a frame keep their previous values.
+	bool set_frame(int frame, bool wait = false);
+	int get_frame() const { return mFrame; }
+
+	cModelData const& get_data() const { return mData; }
+
+	void dbg_ui();
 };
 
 
@@ -114,13 +378,31 @@ protected:
 };
 
 class cModel {
+	// Per draw state shared by the groups
+	struct sDrawCtx {
+		float pixelScale;
+		bool cullClusters;
+		sFrustum frustum;
+		float eye[3];
+	};
+
 	cModelData const* mpData = nullptr;
 	cModelMaterial* mpMtl = nullptr;
 
 	com_ptr<ID3D11InputLayout> mpIL;
+	com_ptr<ID3D11InputLayout> mpDepthIL;
+	cShader* mpDepthVS = nullptr;
 
 public:
 	DirectX::XMMATRIX mWmtx;
+	// Screen space error allowed for the group LODs
+	float mLodPixelError = 1.0f;
+	// -1 picks by mLodPixelError, 0 is full detail
+	int mForceLod = -1;
+	// Frustum and normal cone culling of the clusters of static models, counted per draw
+	bool mClusterCull = true;
+	uint32_t mDrawnClusters = 0;
+	uint32_t mCulledClusters = 0;
 	
 	cModel() {}
 	~cModel() {}
@@ -129,6 +411,16 @@ public:
 	void deinit();
 
 	void disp();
+	// Depth only, for the depth pre-pass and the shadow maps of the bound camera.
+	// Uses the depth stream if there is one, alpha-masked groups are skipped.
+	void disp_depth();
 
 	void dbg_ui();
+
+protected:
+	float calc_lod_pixel_scale() const;
+	// Sets the mesh constants, picks the LOD scale and sets up the cluster culling
+	void begin_draw(ID3D11DeviceContext* pCtx, sDrawCtx& dc);
+	// Draws the LOD of the group or its visible clusters, vtxBias is added to the group base vertex
+	void draw_group(ID3D11DeviceContext* pCtx, sDrawCtx const& dc, uint32_t grpIdx, bool cullBack, int32_t vtxBias);
 };
@@ -0,0 +1,1048 @@
+#define NOMINMAX
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "vmath.hpp"
+#include "math.hpp"
+#include "rdr.hpp"
+#include "mesh_opt.hpp"
+#include "model.hpp"
+#include "thread_pool.hpp"
+#include "hou_geo.hpp"
+#include "assimp_loader.hpp"
+
+#include <assimp/scene.h>
+
+#include <cassert>
+#include <cmath>
+
+
+// Bump when the build output changes for the same settings
+static const uint32_t COOK_REVISION = 1;
+
+static void for_range(cThreadPool* pPool, uint32_t count, uint32_t grain, cThreadPool::RangeFunc const& func) {
+	if (pPool && count > grain) {
+		pPool->parallel_for(count, grain, func);
+	} else {
+		func(0, count);
+	}
+}
+
+// sModelVtxPacked keeps 8-bit joint indices
+static bool check_joints(sModelVtx const* pVtx, uint32_t vtxNum) {
+	for (uint32_t i = 0; i < vtxNum; ++i) {
+		for (int k = 0; k < 4; ++k) {
+			if (pVtx[i].jwgt[k] > 0.0f && pVtx[i].jidx[k] > 255) {
+				dbg_msg("model: joint index %d is over 255, the skin can't be packed\n", pVtx[i].jidx[k]);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static vec4 as_vec4_1(aiVector3D const& v) {
+	return { { v.x, v.y, v.z, 1.0f } };
+}
+static vec3 as_vec3(aiVector3D const& v) {
+	return { v.x, v.y, v.z };
+}
+static vec2f as_vec2f(aiVector3D const& v) {
+	return {v.x, v.y};
+}
+static vec3 as_vec3(aiColor4D const& v) {
+	return { v.r, v.g, v.b };
+}
+
+
+static vec4 as_vec4(cHouGeoAttrib const* pa, int idx) {
+	float tmp[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	if (pa) {
+		float const* val = pa->get_float_val(idx);
+		for (int i = 0; i < 4 && i < pa->mAttribSize; ++i) {
+			tmp[i] = val[i];
+		}
+	}
+	return { { tmp[0], tmp[1], tmp[2], tmp[3] } };
+}
+
+static vec4i as_vec4i(cHouGeoAttrib const* pa, int idx) {
+	int32_t tmp[4] = { 0, 0, 0, 0 };
+	if (pa) {
+		int32_t const* val = pa->get_int32_val(idx);
+		for (int i = 0; i < 4 && i < pa->mAttribSize; ++i) {
+			tmp[i] = val[i];
+		}
+	}
+	return{ { tmp[0], tmp[1], tmp[2], tmp[3] } };
+}
+
+
+static vec3 as_vec3(cHouGeoAttrib const* pa, int idx) {
+	float tmp[3] = { 0.0f, 0.0f, 0.0f };
+	if (pa) {
+		float const* val = pa->get_float_val(idx);
+		for (int i = 0; i < 3 && i < pa->mAttribSize; ++i) {
+			tmp[i] = val[i];
+		}
+	}
+	return { tmp[0], tmp[1], tmp[2] };
+}
+
+static vec2f as_vec2f(cHouGeoAttrib const* pa, int idx) {
+	float tmp[] = { 0.0f, 0.0f };
+	if (pa) {
+		float const* val = pa->get_float_val(idx);
+		for (int i = 0; i < 2 && i < pa->mAttribSize; ++i) {
+			tmp[i] = val[i];
+		}
+	}
+	return { tmp[0], tmp[1] };
+}
+
+// Attribute looked up through the Houdini class precedence, read per welded vertex
+struct sHouAttrRef {
+	cHouGeoAttrib const* mpAttr;
+	cHouGeoLoader::eAttribClass mClass = cHouGeoLoader::E_CLASS_POINT;
+
+	sHouAttrRef(cHouGeoLoader const& geo, cstr name, cHouGeoAttrib::eType type) {
+		mpAttr = geo.find_attrib(name, type, &mClass);
+	}
+
+	// nullptr when the element has no value, e.g. no primitive
+	cHouGeoAttrib const* get(sHouGeoWeldVtx const& w, int& idx) const {
+		idx = cHouGeoLoader::get_elem_index(w, mClass);
+		return idx >= 0 ? mpAttr : nullptr;
+	}
+};
+
+static vec4 as_vec4(sHouAttrRef const& ref, sHouGeoWeldVtx const& w) {
+	int idx;
+	auto pa = ref.get(w, idx);
+	return as_vec4(pa, idx);
+}
+static vec4i as_vec4i(sHouAttrRef const& ref, sHouGeoWeldVtx const& w) {
+	int idx;
+	auto pa = ref.get(w, idx);
+	return as_vec4i(pa, idx);
+}
+static vec3 as_vec3(sHouAttrRef const& ref, sHouGeoWeldVtx const& w) {
+	int idx;
+	auto pa = ref.get(w, idx);
+	return as_vec3(pa, idx);
+}
+static vec2f as_vec2f(sHouAttrRef const& ref, sHouGeoWeldVtx const& w) {
+	int idx;
+	auto pa = ref.get(w, idx);
+	return as_vec2f(pa, idx);
+}
+
+template <typename T>
+struct sReadItr {
+	T const* mpItr;
+	int mStep;
+
+	sReadItr(T const* p, T const* pDef) {
+		if (p) {
+			mpItr = p;
+			mStep = 1;
+		} else {
+			mpItr = pDef;
+			mStep = 0;
+		}
+	}
+
+	T const& read() {
+		T const& res = *mpItr;
+		mpItr += mStep;
+		return res;
+	}
+};
+
+bool cModelGeom::build(cHouGeoLoader const& geo, cThreadPool* pPool) {
+	std::vector<int32_t> vtxToWeld;
+	std::vector<sHouGeoWeldVtx> welded;
+	geo.weld(vtxToWeld, welded);
+
+	int numVtx = (int)welded.size();
+	int numIdx = (int)geo.mTriVtx.size();
+	int numGrp = geo.mNonemptyGroups;
+
+	auto pGroups = std::make_unique<sGroup[]>(numGrp);
+	auto pVtx = std::make_unique<sModelVtx[]>(numVtx);
+	auto pIdx = std::make_unique<uint32_t[]>(numIdx);
+	auto pNames = std::make_unique<std::string[]>(numGrp);
+
+	auto pVtxItr = pVtx.get();
+	auto pIdxItr = pIdx.get();
+	auto pGrpItr = pGroups.get();
+	auto pNamesItr = pNames.get();
+
+	const auto F32 = cHouGeoAttrib::E_TYPE_fpreal32;
+	sHouAttrRef posAttr(geo, "P", F32);
+	sHouAttrRef nrmAttr(geo, "N", F32);
+	sHouAttrRef uvAttr(geo, "uv", F32);
+	sHouAttrRef tngUAttr(geo, "tangentu", F32);
+	sHouAttrRef tngVAttr(geo, "tangentv", F32);
+	sHouAttrRef uv1Attr(geo, "uv1", F32);
+	sHouAttrRef cdAttr(geo, "Cd", F32);
+	sHouAttrRef jidxAttr(geo, "jidx", cHouGeoAttrib::E_TYPE_int32);
+	sHouAttrRef jwgtAttr(geo, "jwgt", F32);
+
+	for (auto const& w : welded) {
+		pVtxItr->pos = as_vec3(posAttr, w);
+		pVtxItr->nrm = as_vec3(nrmAttr, w);
+		pVtxItr->uv = as_vec2f(uvAttr, w);
+		pVtxItr->uv.y = -pVtxItr->uv.y;
+		pVtxItr->tgt = as_vec4(tngUAttr, w);
+		pVtxItr->bitgt = as_vec3(tngVAttr, w);
+		pVtxItr->uv1 = as_vec2f(uv1Attr, w);
+		pVtxItr->uv1.y = -pVtxItr->uv1.y;
+		pVtxItr->clr = as_vec3(cdAttr, w);
+		pVtxItr->jidx = as_vec4i(jidxAttr, w);
+		pVtxItr->jwgt = as_vec4(jwgtAttr, w);
+		++pVtxItr;
+	}
+
+	auto const& poly = geo.mPoly;
+	auto const* tris = geo.mTriVtx.data();
+	auto const* weldMap = vtxToWeld.data();
+
+	for (int igrp = 0; igrp < geo.mGroupsCount; ++igrp) {
+		auto const& grp = geo.mpGroups[igrp];
+		if (grp.mEmpty) { continue; }
+
+		auto pIdxGrpStart = pIdxItr;
+
+		for (int i = 0; i < grp.mIntervalsCount; ++i) {
+			auto const& iv = grp.mpIntervals[i];
+			for (int j = iv.start; j < iv.end; ++j) {
+				if (!poly[j].valid) continue;
+				auto const* pTri = &tris[poly[j].triStart * 3];
+				for (int k = 0; k < poly[j].triCount * 3; ++k) {
+					int pidx = pTri[k];
+					*pIdxItr = (uint32_t)weldMap[pidx];
+					pIdxItr++;
+				}
+			}
+		}
+
+		pGrpItr->mPolyType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+		pGrpItr->mVtxOffset = 0;
+		pGrpItr->mIdxCount = static_cast<uint32_t>((pIdxItr - pIdxGrpStart));
+		pGrpItr->mIdxOffset = static_cast<uint32_t>(pIdxGrpStart - pIdx.get());
+		
+		*pNamesItr = grp.mName;
+
+		++pGrpItr;
+		++pNamesItr;
+	}
+
+	if (!check_joints(pVtx.get(), numVtx))
+		return false;
+
+	mVtxNum = numVtx;
+	mGrpNum = numGrp;
+	mpVtx = std::move(pVtx);
+	mpGroups = std::move(pGroups);
+	mpGrpNames = std::move(pNames);
+	set_indices(pIdx.get(), numIdx, pPool);
+
+	return true;
+}
+
+bool cModelGeom::build(cAssimpLoader const& loader, cThreadPool* pPool) {
+	auto& meshes = loader.get_mesh_info();
+
+	int numGrp = (int)meshes.size();
+	if (numGrp == 0) { return false; }
+
+	// Every mesh writes its own vertex and index ranges, so the meshes convert in parallel
+	std::vector<uint32_t> vtxOffsets(numGrp + 1);
+	std::vector<uint32_t> idxOffsets(numGrp + 1);
+	for (int i = 0; i < numGrp; ++i) {
+		aiMesh* pMesh = meshes[i].mpMesh;
+		vtxOffsets[i + 1] = vtxOffsets[i] + pMesh->mNumVertices;
+		idxOffsets[i + 1] = idxOffsets[i] + pMesh->mNumFaces * 3;
+	}
+	int numVtx = (int)vtxOffsets[numGrp];
+	int numIdx = (int)idxOffsets[numGrp];
+	
+	auto const& bonesMap = loader.get_bones_map();
+
+	auto pGroups = std::make_unique<sGroup[]>(numGrp);
+	auto pVtx = std::make_unique<sModelVtx[]>(numVtx);
+	auto pIdx = std::make_unique<uint32_t[]>(numIdx);
+	auto pNames = std::make_unique<std::string[]>(numGrp);
+
+	const aiColor4D defColor = { 1.0f, 1.0f, 1.0f, 1.0f };
+	const aiVector3D defV3Zero = { 0.0f, 0.0f, 0.0f };
+	const aiVector3D defTgt = { 1.0f, 0.0f, 0.0f };
+	const aiVector3D defBitgt = { 0.0f, 1.0f, 0.0f };
+	const aiVector3D defNrm = { 0.0f, 0.0f, 1.0f };
+
+	auto convert_mesh = [&](int igrp, std::vector<uint8_t>& wgtNum) {
+		auto const& mi = meshes[igrp];
+		aiMesh* pMesh = mi.mpMesh;
+
+		auto pVtxGrpStart = pVtx.get() + vtxOffsets[igrp];
+		auto pVtxItr = pVtxGrpStart;
+		auto pIdxItr = pIdx.get() + idxOffsets[igrp];
+
+		const int meshVtx = pMesh->mNumVertices;
+
+		sReadItr<aiVector3D> posItr(pMesh->mVertices, &defV3Zero);
+		sReadItr<aiVector3D> nrmItr(pMesh->mNormals, &defNrm);
+		sReadItr<aiVector3D> uvItr(pMesh->mTextureCoords[0], &defV3Zero);
+		sReadItr<aiVector3D> tgtItr(nullptr, &defTgt);
+		sReadItr<aiVector3D> bitgtItr(nullptr, &defBitgt);
+		sReadItr<aiVector3D> uv1Itr(nullptr, &defV3Zero);
+		sReadItr<aiColor4D> clrItr(pMesh->mColors[0], &defColor);
+
+		for (int vtx = 0; vtx < meshVtx; ++vtx) {
+			pVtxItr->pos = as_vec3(posItr.read());
+			pVtxItr->nrm = as_vec3(nrmItr.read());
+			pVtxItr->uv = as_vec2f(uvItr.read());
+			pVtxItr->uv.y = -pVtxItr->uv.y;
+			pVtxItr->tgt = as_vec4_1(tgtItr.read());
+			pVtxItr->bitgt = as_vec3(bitgtItr.read());
+			pVtxItr->uv1 = as_vec2f(uv1Itr.read());
+			pVtxItr->clr = as_vec3(clrItr.read());
+			::memset(&pVtxItr->jidx, 0, sizeof(pVtxItr->jidx));
+			::memset(&pVtxItr->jwgt, 0, sizeof(pVtxItr->jwgt));
+			++pVtxItr;
+		}
+
+		const int meshFace = pMesh->mNumFaces;
+		aiFace const* pFace = pMesh->mFaces;
+		for (int face = 0; face < meshFace; ++face) {
+			assert(pFace->mNumIndices == 3);
+			pIdxItr[0] = pFace->mIndices[0];
+			pIdxItr[1] = pFace->mIndices[1];
+			pIdxItr[2] = pFace->mIndices[2];
+
+			pIdxItr += 3;
+			++pFace;
+		}
+
+		// Weights taken per vertex instead of looking for a free slot, zero weights take none
+		if (pMesh->mNumBones > 0) {
+			wgtNum.assign(meshVtx, 0);
+		}
+		for (uint32_t bone = 0; bone < pMesh->mNumBones; ++bone) {
+			auto pBone = pMesh->mBones[bone];
+			auto bIt = bonesMap.find(pBone->mName.C_Str());
+			if (bIt == bonesMap.end()) { continue; }
+
+			int32_t boneIdx = bIt->second;
+
+			auto w = pBone->mWeights;
+			for (uint32_t i = 0; i < pBone->mNumWeights; ++i) {
+				auto vidx = w[i].mVertexId;
+				auto jwgt = w[i].mWeight;
+				if (jwgt == 0.0f || wgtNum[vidx] >= 4) { continue; }
+
+				auto& vtx = pVtxGrpStart[vidx];
+				int j = wgtNum[vidx]++;
+				vtx.jwgt[j] = jwgt;
+				vtx.jidx[j] = boneIdx;
+			}
+		}
+
+		sGroup& grp = pGroups[igrp];
+		grp.mVtxOffset = vtxOffsets[igrp];
+		grp.mIdxCount = idxOffsets[igrp + 1] - idxOffsets[igrp];
+		grp.mIdxOffset = idxOffsets[igrp];
+		grp.mPolyType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+
+		if (mi.mName.starts_with("g ")) {
+			pNames[igrp] = &mi.mName.p[2];
+		} else {
+			pNames[igrp] = mi.mName;
+		}
+	};
+
+	// One mesh per task, pulled as the workers free up
+	for_range(pPool, (uint32_t)numGrp, 1, [&](uint32_t begin, uint32_t end) {
+		std::vector<uint8_t> wgtNum;
+		for (uint32_t i = begin; i < end; ++i) {
+			convert_mesh((int)i, wgtNum);
+		}
+	});
+
+	if (!check_joints(pVtx.get(), numVtx))
+		return false;
+
+	mVtxNum = numVtx;
+	mGrpNum = numGrp;
+	mpVtx = std::move(pVtx);
+	mpGroups = std::move(pGroups);
+	mpGrpNames = std::move(pNames);
+	set_indices(pIdx.get(), numIdx, pPool);
+
+	return true;
+}
+
+
+// Values closer than eps can still round to neighboring multiples and stay apart,
+// the welding is by grid cell and doesn't look into the adjacent cells
+static uint32_t weld_key(float val, float eps) {
+	if (eps > 0.0f) {
+		return (uint32_t)(int32_t)::llroundf(val / eps);
+	}
+	// -0 and 0 are the same vertex
+	uint32_t bits = 0;
+	if (val != 0.0f) {
+		::memcpy(&bits, &val, sizeof(bits));
+	}
+	return bits;
+}
+
+void cModelGeom::weld(uint32_t* pIdx, uint32_t idxNum, cThreadPool* pPool) {
+	const uint32_t KEY_SIZE = 28;
+	const uint32_t GRAIN = 16 * 1024;
+	const uint32_t vtxNum = mVtxNum;
+	if (vtxNum < 2) { return; }
+
+	std::vector<uint32_t> keys((size_t)vtxNum * KEY_SIZE);
+	std::vector<uint32_t> hashes(vtxNum);
+	for_range(pPool, vtxNum, GRAIN, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t v = begin; v < end; ++v) {
+			sModelVtx const& vtx = mpVtx[v];
+			uint32_t* pKey = &keys[(size_t)v * KEY_SIZE];
+			int n = 0;
+			for (float x : { vtx.pos.x, vtx.pos.y, vtx.pos.z }) { pKey[n++] = weld_key(x, mWeld.posEps); }
+			for (float x : { vtx.nrm.x, vtx.nrm.y, vtx.nrm.z }) { pKey[n++] = weld_key(x, mWeld.nrmEps); }
+			for (int c = 0; c < 4; ++c) { pKey[n++] = weld_key(vtx.tgt[c], mWeld.nrmEps); }
+			for (float x : { vtx.bitgt.x, vtx.bitgt.y, vtx.bitgt.z }) { pKey[n++] = weld_key(x, mWeld.nrmEps); }
+			for (float x : { vtx.uv.x, vtx.uv.y, vtx.uv1.x, vtx.uv1.y }) { pKey[n++] = weld_key(x, mWeld.uvEps); }
+			for (float x : { vtx.clr.x, vtx.clr.y, vtx.clr.z }) { pKey[n++] = weld_key(x, 0.0f); }
+			for (int c = 0; c < 4; ++c) { pKey[n++] = (uint32_t)vtx.jidx[c]; }
+			for (int c = 0; c < 4; ++c) { pKey[n++] = weld_key(vtx.jwgt[c], 0.0f); }
+			assert((uint32_t)n == KEY_SIZE);
+
+			uint32_t hash = 2166136261U;
+			for (uint32_t i = 0; i < KEY_SIZE; ++i) {
+				hash = (hash ^ pKey[i]) * 16777619U;
+			}
+			hashes[v] = hash;
+		}
+	});
+
+	// Equal vertices have equal hashes, so the buckets by the top hash bits are welded
+	// independently. Every vertex keeps the first one of its kind.
+	const uint32_t BUCKET_BITS = 6;
+	const uint32_t bucketNum = 1 << BUCKET_BITS;
+	std::vector<uint32_t> bucketStart(bucketNum + 1, 0);
+	for (uint32_t v = 0; v < vtxNum; ++v) {
+		++bucketStart[(hashes[v] >> (32 - BUCKET_BITS)) + 1];
+	}
+	for (uint32_t b = 0; b < bucketNum; ++b) {
+		bucketStart[b + 1] += bucketStart[b];
+	}
+	std::vector<uint32_t> order(vtxNum);
+	{
+		std::vector<uint32_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+		for (uint32_t v = 0; v < vtxNum; ++v) {
+			order[fill[hashes[v] >> (32 - BUCKET_BITS)]++] = v;
+		}
+	}
+
+	std::vector<uint32_t> first(vtxNum);
+	for_range(pPool, bucketNum, 1, [&](uint32_t begin, uint32_t end) {
+		const uint32_t EMPTY = 0xFFFFFFFF;
+		std::vector<uint32_t> table;
+		for (uint32_t b = begin; b < end; ++b) {
+			const uint32_t num = bucketStart[b + 1] - bucketStart[b];
+			uint32_t tableSize = 16;
+			while (tableSize < num * 2) { tableSize *= 2; }
+			table.assign(tableSize, EMPTY);
+			for (uint32_t i = bucketStart[b]; i < bucketStart[b + 1]; ++i) {
+				const uint32_t v = order[i];
+				uint32_t slot = hashes[v] & (tableSize - 1);
+				for (;;) {
+					uint32_t u = table[slot];
+					if (u == EMPTY) {
+						table[slot] = v;
+						first[v] = v;
+						break;
+					}
+					if (hashes[u] == hashes[v] && ::memcmp(&keys[(size_t)u * KEY_SIZE], &keys[(size_t)v * KEY_SIZE], KEY_SIZE * sizeof(uint32_t)) == 0) {
+						first[v] = u;
+						break;
+					}
+					slot = (slot + 1) & (tableSize - 1);
+				}
+			}
+		}
+	});
+
+	// first[v] <= v, so the kept vertices are numbered in order
+	std::vector<uint32_t> remap(vtxNum);
+	uint32_t weldNum = 0;
+	for (uint32_t v = 0; v < vtxNum; ++v) {
+		remap[v] = first[v] == v ? weldNum++ : remap[first[v]];
+	}
+	dbg_msg("model geom: welded %u -> %u vertices\n", vtxNum, weldNum);
+	log_weld_stats(pIdx, remap.data(), vtxNum, weldNum);
+	if (weldNum == vtxNum) { return; }
+
+	auto pVtx = std::make_unique<sModelVtx[]>(weldNum);
+	for (uint32_t v = 0; v < vtxNum; ++v) {
+		if (first[v] == v) {
+			pVtx[remap[v]] = mpVtx[v];
+		}
+	}
+	for_range(pPool, idxNum, GRAIN * 4, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			pIdx[i] = remap[pIdx[i]];
+		}
+	});
+	mpVtx = std::move(pVtx);
+	mVtxNum = weldNum;
+}
+
+void cModelGeom::log_weld_stats(uint32_t const* pIdx, uint32_t const* pRemap, uint32_t vtxNum, uint32_t weldNum) const {
+	// Vertices used by each group, a vertex shared by groups counts in each of them
+	const uint32_t NONE = 0xFFFFFFFF;
+	std::vector<uint32_t> srcMark(vtxNum, NONE);
+	std::vector<uint32_t> weldMark(weldNum, NONE);
+	for (uint32_t g = 0; g < mGrpNum; ++g) {
+		sGroup const& grp = mpGroups[g];
+		uint32_t srcNum = 0;
+		uint32_t dstNum = 0;
+		for (uint32_t i = grp.mIdxOffset; i < grp.mIdxOffset + grp.mIdxCount; ++i) {
+			const uint32_t v = pIdx[i];
+			if (srcMark[v] != g) {
+				srcMark[v] = g;
+				++srcNum;
+			}
+			if (weldMark[pRemap[v]] != g) {
+				weldMark[pRemap[v]] = g;
+				++dstNum;
+			}
+		}
+		dbg_msg("model geom: group %u <%s> welded %u -> %u vertices\n", g,
+			mpGrpNames ? mpGrpNames[g].c_str() : "", srcNum, dstNum);
+	}
+}
+
+void cModelGeom::build_lods(std::vector<uint32_t>& idx) {
+	const uint32_t lodNum = std::min(mLod.num, (uint32_t)sGroup::LOD_MAX);
+	if (lodNum == 0) { return; }
+
+	// Normal, UV and the dominant joint weight
+	const uint32_t ATTR_NUM = 6;
+	std::vector<int32_t> toLocal(mVtxNum, -1);
+	std::vector<uint32_t> toGlobal;
+	std::vector<uint32_t> local;
+	std::vector<vec3> localPos;
+	std::vector<float> localAttr;
+	std::vector<uint32_t> localClass;
+	uint32_t srcTris = 0;
+	uint32_t lodTris = 0;
+	for (uint32_t i = 0; i < mGrpNum; ++i) {
+		auto& grp = mpGroups[i];
+		grp.mLodNum = 0;
+		if (grp.mIdxCount < 3) { continue; }
+		toGlobal.clear();
+		local.resize(grp.mIdxCount);
+		for (uint32_t j = 0; j < grp.mIdxCount; ++j) {
+			uint32_t v = idx[grp.mIdxOffset + j];
+			if (toLocal[v] < 0) {
+				toLocal[v] = (int32_t)toGlobal.size();
+				toGlobal.push_back(v);
+			}
+			local[j] = (uint32_t)toLocal[v];
+		}
+		const uint32_t localNum = (uint32_t)toGlobal.size();
+		localPos.resize(localNum);
+		localAttr.resize(localNum * ATTR_NUM);
+		localClass.resize(localNum);
+		vec3 bmin = mpVtx[toGlobal[0]].pos;
+		vec3 bmax = bmin;
+		for (uint32_t j = 0; j < localNum; ++j) {
+			sModelVtx const& vtx = mpVtx[toGlobal[j]];
+			toLocal[toGlobal[j]] = -1;
+			localPos[j] = vtx.pos;
+			bmin = { std::min(bmin.x, vtx.pos.x), std::min(bmin.y, vtx.pos.y), std::min(bmin.z, vtx.pos.z) };
+			bmax = { std::max(bmax.x, vtx.pos.x), std::max(bmax.y, vtx.pos.y), std::max(bmax.z, vtx.pos.z) };
+			int dom = 0;
+			for (int k = 1; k < 4; ++k) {
+				if (vtx.jwgt[k] > vtx.jwgt[dom]) { dom = k; }
+			}
+			float* pAttr = &localAttr[j * ATTR_NUM];
+			pAttr[0] = vtx.nrm.x;
+			pAttr[1] = vtx.nrm.y;
+			pAttr[2] = vtx.nrm.z;
+			pAttr[3] = vtx.uv.x;
+			pAttr[4] = vtx.uv.y;
+			pAttr[5] = vtx.jwgt[dom];
+			localClass[j] = vtx.jwgt[dom] > 0.0f ? (uint32_t)vtx.jidx[dom] + 1 : 0;
+		}
+		const float extent = std::max(std::max(bmax.x - bmin.x, bmax.y - bmin.y), bmax.z - bmin.z);
+
+		nMeshOpt::sSimplifyMesh mesh;
+		mesh.pPos = &localPos[0].x;
+		mesh.posStride = sizeof(vec3);
+		mesh.vtxNum = localNum;
+		mesh.pAttr = localAttr.data();
+		mesh.attrNum = ATTR_NUM;
+		mesh.attrWeight = mLod.attrWeight;
+		mesh.pClass = localClass.data();
+
+		// Every level is simplified from the previous one, so the errors add up
+		float lodError = 0.0f;
+		for (uint32_t j = 0; j < lodNum; ++j) {
+			const uint32_t prevNum = (uint32_t)local.size();
+			const uint32_t target = (uint32_t)((float)(prevNum / 3) * mLod.ratio) * 3;
+			float error;
+			uint32_t num = nMeshOpt::simplify(local.data(), prevNum, mesh, target, mLod.maxError, error);
+			// Not worth a level
+			if (num == 0 || num > prevNum - prevNum / 10) { break; }
+			local.resize(num);
+			lodError += error * extent;
+
+			sGroupLod& lod = grp.mLods[grp.mLodNum++];
+			lod.mIdxOffset = (uint32_t)idx.size();
+			lod.mIdxCount = num;
+			lod.mError = lodError;
+			for (uint32_t k = 0; k < num; ++k) {
+				idx.push_back(toGlobal[local[k]]);
+			}
+		}
+		srcTris += grp.mIdxCount / 3;
+		if (grp.mLodNum > 0) {
+			lodTris += grp.mLods[grp.mLodNum - 1].mIdxCount / 3;
+		} else {
+			lodTris += grp.mIdxCount / 3;
+		}
+	}
+	dbg_msg("model geom: LODs %u -> %u tris\n", srcTris, lodTris);
+}
+
+void cModelGeom::optimize(uint32_t* pIdx, uint32_t idxNum) {
+	const uint32_t CACHE_SIZE = VTX_CACHE_SIZE;
+
+	// The stats are of the full detail indices, the levels follow them
+	uint32_t fullNum = 0;
+	for (uint32_t i = 0; i < mGrpNum; ++i) {
+		fullNum = std::max(fullNum, mpGroups[i].mIdxOffset + mpGroups[i].mIdxCount);
+	}
+	auto before = nMeshOpt::analyze_vertex_cache(pIdx, fullNum, mVtxNum, CACHE_SIZE);
+
+	// Optimized in local numbering, the buffers stay proportional to the group
+	std::vector<int32_t> toLocal(mVtxNum, -1);
+	std::vector<uint32_t> toGlobal;
+	std::vector<uint32_t> local;
+	std::vector<vec3> localPos;
+	auto optimize_range = [&](uint32_t idxOffset, uint32_t idxCount) {
+		if (idxCount == 0) { return; }
+		uint32_t* pGrpIdx = &pIdx[idxOffset];
+		toGlobal.clear();
+		local.resize(idxCount);
+		for (uint32_t j = 0; j < idxCount; ++j) {
+			uint32_t v = pGrpIdx[j];
+			if (toLocal[v] < 0) {
+				toLocal[v] = (int32_t)toGlobal.size();
+				toGlobal.push_back(v);
+			}
+			local[j] = (uint32_t)toLocal[v];
+		}
+		localPos.resize(toGlobal.size());
+		for (size_t j = 0; j < toGlobal.size(); ++j) {
+			localPos[j] = mpVtx[toGlobal[j]].pos;
+			toLocal[toGlobal[j]] = -1;
+		}
+
+		const uint32_t localNum = (uint32_t)toGlobal.size();
+		nMeshOpt::optimize_vertex_cache(local.data(), idxCount, localNum, CACHE_SIZE);
+		nMeshOpt::optimize_overdraw(local.data(), idxCount, &localPos[0].x, sizeof(vec3), localNum, CACHE_SIZE);
+		for (uint32_t j = 0; j < idxCount; ++j) {
+			pGrpIdx[j] = toGlobal[local[j]];
+		}
+	};
+	for (uint32_t i = 0; i < mGrpNum; ++i) {
+		auto const& grp = mpGroups[i];
+		optimize_range(grp.mIdxOffset, grp.mIdxCount);
+		for (uint32_t j = 0; j < grp.mLodNum; ++j) {
+			optimize_range(grp.mLods[j].mIdxOffset, grp.mLods[j].mIdxCount);
+		}
+	}
+	auto after = nMeshOpt::analyze_vertex_cache(pIdx, fullNum, mVtxNum, CACHE_SIZE);
+
+	// Vertices in the order of the draws
+	std::vector<uint32_t> remap(mVtxNum);
+	nMeshOpt::optimize_vertex_fetch(pIdx, idxNum, mVtxNum, remap.data());
+	auto pVtx = std::make_unique<sModelVtx[]>(mVtxNum);
+	mpVtxSrc = std::make_unique<uint32_t[]>(mVtxNum);
+	for (uint32_t v = 0; v < mVtxNum; ++v) {
+		pVtx[remap[v]] = mpVtx[v];
+		mpVtxSrc[remap[v]] = v;
+	}
+	mpVtx = std::move(pVtx);
+
+	dbg_msg("model geom: %u tris, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", fullNum / 3,
+		before.acmr, after.acmr, before.atvr, after.atvr);
+}
+
+void cModelGeom::build_clusters(uint32_t const* pIdx) {
+	std::vector<nMeshOpt::sCluster> clusters;
+	for (uint32_t i = 0; i < mGrpNum; ++i) {
+		auto& grp = mpGroups[i];
+		grp.mClusterOffset = (uint32_t)clusters.size();
+		nMeshOpt::build_clusters(&pIdx[grp.mIdxOffset], grp.mIdxCount, &mpVtx[0].pos.x, sizeof(sModelVtx),
+			&mpVtx[0].nrm.x, sizeof(sModelVtx), mVtxNum, mCluster.minTris, mCluster.maxTris, clusters);
+		grp.mClusterNum = (uint32_t)clusters.size() - grp.mClusterOffset;
+		for (uint32_t j = grp.mClusterOffset; j < clusters.size(); ++j) {
+			clusters[j].idxOffset += grp.mIdxOffset;
+		}
+	}
+	mClusterNum = (uint32_t)clusters.size();
+	mpClusters = std::make_unique<nMeshOpt::sCluster[]>(mClusterNum);
+	std::copy(clusters.begin(), clusters.end(), mpClusters.get());
+	dbg_msg("model geom: %u clusters\n", mClusterNum);
+}
+
+void cModelGeom::set_indices(uint32_t* pIdx, uint32_t idxNum, cThreadPool* pPool) {
+	// Groups of the Houdini loader share the vertices, so they're made absolute
+	for (uint32_t i = 0; i < mGrpNum; ++i) {
+		auto& grp = mpGroups[i];
+		for (uint32_t j = 0; j < grp.mIdxCount; ++j) {
+			pIdx[grp.mIdxOffset + j] += grp.mVtxOffset;
+		}
+		grp.mVtxOffset = 0;
+	}
+
+	if (mWeld.enabled) {
+		weld(pIdx, idxNum, pPool);
+	}
+
+	// The levels go after the full detail indices
+	std::vector<uint32_t> idx(pIdx, pIdx + idxNum);
+	build_lods(idx);
+	pIdx = idx.data();
+	idxNum = (uint32_t)idx.size();
+	optimize(pIdx, idxNum);
+	if (mCluster.enabled) {
+		build_clusters(pIdx);
+	}
+
+	bool wide = false;
+	for (uint32_t i = 0; i < mGrpNum; ++i) {
+		auto& grp = mpGroups[i];
+		if (grp.mIdxCount == 0) { continue; }
+		// The levels use a subset of the full detail vertices
+		uint32_t* pGrpIdx = &pIdx[grp.mIdxOffset];
+		uint32_t vmin = pGrpIdx[0];
+		uint32_t vmax = pGrpIdx[0];
+		for (uint32_t j = 1; j < grp.mIdxCount; ++j) {
+			vmin = std::min(vmin, pGrpIdx[j]);
+			vmax = std::max(vmax, pGrpIdx[j]);
+		}
+		if (vmin > 0) {
+			for (uint32_t j = 0; j < grp.mIdxCount; ++j) {
+				pGrpIdx[j] -= vmin;
+			}
+			for (uint32_t j = 0; j < grp.mLodNum; ++j) {
+				uint32_t* pLodIdx = &pIdx[grp.mLods[j].mIdxOffset];
+				for (uint32_t k = 0; k < grp.mLods[j].mIdxCount; ++k) {
+					pLodIdx[k] -= vmin;
+				}
+			}
+			grp.mVtxOffset += vmin;
+		}
+		wide = wide || vmax - vmin > 0xFFFF;
+	}
+
+	mIdxNum = idxNum;
+	mIdxSize = wide ? sizeof(uint32_t) : sizeof(uint16_t);
+	mpIdx = std::make_unique<uint8_t[]>(idxNum * mIdxSize);
+	if (wide) {
+		::memcpy(mpIdx.get(), pIdx, idxNum * sizeof(uint32_t));
+	} else {
+		uint16_t* pDst = reinterpret_cast<uint16_t*>(mpIdx.get());
+		for (uint32_t i = 0; i < idxNum; ++i) {
+			pDst[i] = (uint16_t)pIdx[i];
+		}
+	}
+}
+
+// Round to nearest even, overflow goes to inf
+static uint16_t float_to_half(float f) {
+	uint32_t x;
+	::memcpy(&x, &f, sizeof(x));
+	const uint32_t sign = (x >> 16) & 0x8000;
+	const uint32_t fexp = (x >> 23) & 0xFF;
+	uint32_t mant = x & 0x7FFFFF;
+	if (fexp == 0xFF) {
+		return (uint16_t)(sign | 0x7C00 | (mant ? 0x200 : 0));
+	}
+	const int32_t exp = (int32_t)fexp - 127 + 15;
+	if (exp >= 31) {
+		return (uint16_t)(sign | 0x7C00);
+	}
+	uint32_t shift = 13;
+	uint32_t h;
+	if (exp <= 0) {
+		if (exp < -10) { return (uint16_t)sign; }
+		// Denormal
+		mant |= 0x800000;
+		shift = (uint32_t)(14 - exp);
+		h = mant >> shift;
+	} else {
+		h = ((uint32_t)exp << 10) | (mant >> shift);
+	}
+	const uint32_t rem = mant & ((1u << shift) - 1);
+	const uint32_t halfway = 1u << (shift - 1);
+	if (rem > halfway || (rem == halfway && (h & 1))) {
+		// A carry into the exponent is still the right result
+		++h;
+	}
+	return (uint16_t)(sign | h);
+}
+
+static int16_t to_snorm16(float v) {
+	v = std::min(std::max(v, -1.0f), 1.0f);
+	return (int16_t)::lroundf(v * 32767.0f);
+}
+
+static uint8_t to_unorm8(float v) {
+	v = std::min(std::max(v, 0.0f), 1.0f);
+	return (uint8_t)::lroundf(v * 255.0f);
+}
+
+// Octahedral mapping of a direction to [-1, 1]^2, see oct_decode in shader.hlsli
+static void oct_encode(float x, float y, float z, int16_t* pDst) {
+	float len = std::abs(x) + std::abs(y) + std::abs(z);
+	if (len <= 0.0f) {
+		pDst[0] = pDst[1] = 0;
+		return;
+	}
+	x /= len;
+	y /= len;
+	if (z < 0.0f) {
+		float ox = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float oy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = ox;
+		y = oy;
+	}
+	pDst[0] = to_snorm16(x);
+	pDst[1] = to_snorm16(y);
+}
+
+// Weights are normalized to sum up to exactly 255, the indices are checked by check_joints
+static void pack_weights(vec4i const& jidx, vec4 const& jwgt, uint8_t* pIdx, uint8_t* pWgt) {
+	float sum = 0.0f;
+	for (int k = 0; k < 4; ++k) {
+		bool used = jwgt[k] > 0.0f && jidx[k] >= 0;
+		pIdx[k] = used ? (uint8_t)std::min(jidx[k], 255) : 0;
+		sum += used ? jwgt[k] : 0.0f;
+	}
+	int total = 0;
+	int maxK = 0;
+	for (int k = 0; k < 4; ++k) {
+		bool used = sum > 0.0f && jwgt[k] > 0.0f && jidx[k] >= 0;
+		pWgt[k] = used ? to_unorm8(jwgt[k] / sum) : 0;
+		total += pWgt[k];
+		if (pWgt[k] > pWgt[maxK]) { maxK = k; }
+	}
+	if (total > 0) {
+		pWgt[maxK] = (uint8_t)(pWgt[maxK] + 255 - total);
+	}
+}
+
+vec3 cModelGeom::unpack_pos(sModelVtxPacked const& vtx, sVtxPosQuant const& quant) {
+	const float s = 1.0f / 65535.0f;
+	return {
+		quant.bias.x + quant.scale.x * (vtx.pos[0] * s),
+		quant.bias.y + quant.scale.y * (vtx.pos[1] * s),
+		quant.bias.z + quant.scale.z * (vtx.pos[2] * s)
+	};
+}
+
+void cModelGeom::pack_vtx(sModelVtx const* pSrc, uint32_t vtxNum, sModelVtxPacked* pDst, sVtxPosQuant& quant) {
+	float bmin[3] = { 0.0f, 0.0f, 0.0f };
+	float bmax[3] = { 0.0f, 0.0f, 0.0f };
+	for (uint32_t i = 0; i < vtxNum; ++i) {
+		float const* pPos = &pSrc[i].pos.x;
+		for (int c = 0; c < 3; ++c) {
+			bmin[c] = i ? std::min(bmin[c], pPos[c]) : pPos[c];
+			bmax[c] = i ? std::max(bmax[c], pPos[c]) : pPos[c];
+		}
+	}
+	float scale[3];
+	float invScale[3];
+	for (int c = 0; c < 3; ++c) {
+		float ext = bmax[c] - bmin[c];
+		scale[c] = ext > 0.0f ? ext : 1.0f;
+		invScale[c] = 1.0f / scale[c];
+	}
+	quant.scale = { scale[0], scale[1], scale[2] };
+	quant.bias = { bmin[0], bmin[1], bmin[2] };
+
+	for (uint32_t i = 0; i < vtxNum; ++i) {
+		sModelVtx const& src = pSrc[i];
+		sModelVtxPacked& dst = pDst[i];
+
+		float const* pPos = &src.pos.x;
+		for (int c = 0; c < 3; ++c) {
+			float t = (pPos[c] - bmin[c]) * invScale[c];
+			dst.pos[c] = (uint16_t)::lroundf(std::min(std::max(t, 0.0f), 1.0f) * 65535.0f);
+		}
+
+		// The bitangent is rebuilt as cross(nrm, tgt) * sign in the shader
+		vec3 const& n = src.nrm;
+		float tx = src.tgt[0];
+		float ty = src.tgt[1];
+		float tz = src.tgt[2];
+		vec3 const& b = src.bitgt;
+		float handedness = (n.y * tz - n.z * ty) * b.x + (n.z * tx - n.x * tz) * b.y + (n.x * ty - n.y * tx) * b.z;
+		if (handedness == 0.0f) {
+			handedness = src.tgt[3];
+		}
+		dst.pos[3] = handedness < 0.0f ? 0 : 0xFFFF;
+
+		oct_encode(n.x, n.y, n.z, dst.nrm);
+		oct_encode(tx, ty, tz, dst.tgt);
+
+		dst.uv[0] = float_to_half(src.uv.x);
+		dst.uv[1] = float_to_half(src.uv.y);
+		dst.uv1[0] = float_to_half(src.uv1.x);
+		dst.uv1[1] = float_to_half(src.uv1.y);
+
+		dst.clr[0] = to_unorm8(src.clr.x);
+		dst.clr[1] = to_unorm8(src.clr.y);
+		dst.clr[2] = to_unorm8(src.clr.z);
+		dst.clr[3] = 0xFF;
+
+		pack_weights(src.jidx, src.jwgt, dst.jidx, dst.jwgt);
+	}
+}
+
+void cSkinBounds::build(cModelGeom const& geom) {
+	build(geom.mpVtx.get(), geom.mVtxNum);
+}
+
+static void add_joint_box(std::vector<sAABB>& boxes, int32_t idx, nVM::V4 pos) {
+	if (idx >= (int32_t)boxes.size()) {
+		sAABB empty;
+		empty.set_empty();
+		boxes.resize(idx + 1, empty);
+	}
+	boxes[idx].add(pos, pos);
+}
+
+void cSkinBounds::build(sModelVtx const* pVtx, uint32_t vtxNum) {
+	reset();
+	if (!pVtx) { return; }
+
+	std::vector<sAABB> boxes;
+	for (uint32_t i = 0; i < vtxNum; ++i) {
+		auto const& vtx = pVtx[i];
+		nVM::V4 pos = nVM::load3(&vtx.pos.x);
+		for (int k = 0; k < 4; ++k) {
+			int32_t idx = vtx.jidx[k];
+			if (vtx.jwgt[k] <= 0.0f || idx < 0) { continue; }
+			add_joint_box(boxes, idx, pos);
+		}
+	}
+	set_boxes(boxes);
+}
+
+void cSkinBounds::build(sModelVtxPacked const* pVtx, uint32_t vtxNum, sVtxPosQuant const& quant) {
+	reset();
+	if (!pVtx) { return; }
+
+	std::vector<sAABB> boxes;
+	for (uint32_t i = 0; i < vtxNum; ++i) {
+		auto const& vtx = pVtx[i];
+		vec3 p = cModelGeom::unpack_pos(vtx, quant);
+		nVM::V4 pos = nVM::load3(&p.x);
+		for (int k = 0; k < 4; ++k) {
+			if (vtx.jwgt[k] == 0) { continue; }
+			add_joint_box(boxes, vtx.jidx[k], pos);
+		}
+	}
+	set_boxes(boxes);
+}
+
+void cSkinBounds::set_boxes(std::vector<sAABB> const& boxes) {
+	int32_t boxNum = 0;
+	for (auto const& box : boxes) {
+		if (!box.is_empty()) { ++boxNum; }
+	}
+	if (boxNum == 0) { return; }
+
+	auto pBoxes = std::make_unique<sJointBox[]>(boxNum);
+	auto pSkinIdx = std::make_unique<int32_t[]>(boxNum);
+	int32_t boxIdx = 0;
+	for (int32_t i = 0; i < (int32_t)boxes.size(); ++i) {
+		if (boxes[i].is_empty()) { continue; }
+		pBoxes[boxIdx].mCenter = nVM::point(boxes[i].get_center());
+		pBoxes[boxIdx].mExtent = nVM::vector(boxes[i].get_extent());
+		pSkinIdx[boxIdx] = i;
+		++boxIdx;
+	}
+
+	mpBoxes = std::move(pBoxes);
+	mpSkinIdx = std::move(pSkinIdx);
+	mBoxNum = boxNum;
+	mMaxSkinIdx = (int32_t)boxes.size() - 1;
+}
+
+void cSkinBounds::reset() {
+	mpBoxes.reset();
+	mpSkinIdx.reset();
+	mBoxNum = 0;
+	mMaxSkinIdx = -1;
+}
+
+bool cSkinBounds::calc_world(nVM::M44 const* pSkin, int skinNum, sAABB& box) const {
+	if (mBoxNum == 0 || !pSkin || mMaxSkinIdx >= skinNum) { return false; }
+
+	box.set_empty();
+	for (int32_t i = 0; i < mBoxNum; ++i) {
+		auto const& jbox = mpBoxes[i];
+		auto const& m = pSkin[mpSkinIdx[i]];
+
+		// Box center goes through the full matrix, extent through |rotation * scale|
+		nVM::V4 c = nVM::transform4(jbox.mCenter, m);
+		nVM::V4 e = nVM::mul(nVM::splat_x(jbox.mExtent), nVM::abs(m.r[0]));
+		e = nVM::madd(nVM::splat_y(jbox.mExtent), nVM::abs(m.r[1]), e);
+		e = nVM::madd(nVM::splat_z(jbox.mExtent), nVM::abs(m.r[2]), e);
+
+		box.add(nVM::sub(c, e), nVM::add(c, e));
+	}
+	return true;
+}
+
+uint64_t cModelGeom::get_cook_hash() const {
+	// FNV-1a, field by field so the struct padding stays out
+	uint64_t hash = 14695981039346656037ULL;
+	auto add = [&hash](auto const& val) {
+		uint8_t bytes[sizeof(val)];
+		::memcpy(bytes, &val, sizeof(val));
+		for (uint8_t b : bytes) {
+			hash ^= b;
+			hash *= 1099511628211ULL;
+		}
+	};
+	add(COOK_REVISION);
+	add((uint32_t)VTX_CACHE_SIZE);
+	add(mWeld.enabled);
+	add(mWeld.posEps);
+	add(mWeld.nrmEps);
+	add(mWeld.uvEps);
+	add(mLod.num);
+	add(mLod.ratio);
+	add(mLod.maxError);
+	add(mLod.attrWeight);
+	add(mCluster.enabled);
+	add(mCluster.minTris);
+	add(mCluster.maxTris);
+	return hash;
+}
@@ -0,0 +1,60 @@
+#include <algorithm>
+
+#include "common.hpp"
+#include "range_alloc.hpp"
+
+void cRangeAlloc::reset(uint32_t size) {
+	mFree.clear();
+	if (size > 0) {
+		mFree.push_back({ 0, size });
+	}
+	mSize = size;
+	mUsed = 0;
+}
+
+void cRangeAlloc::grow(uint32_t newSize) {
+	if (newSize <= mSize) return;
+	if (!mFree.empty() && mFree.back().offset + mFree.back().count == mSize) {
+		mFree.back().count += newSize - mSize;
+	} else {
+		mFree.push_back({ mSize, newSize - mSize });
+	}
+	mSize = newSize;
+}
+
+bool cRangeAlloc::alloc(uint32_t count, uint32_t& offset) {
+	if (count == 0) return false;
+	for (size_t i = 0; i < mFree.size(); ++i) {
+		sRange& r = mFree[i];
+		if (r.count < count) continue;
+		offset = r.offset;
+		r.offset += count;
+		r.count -= count;
+		if (r.count == 0) {
+			mFree.erase(mFree.begin() + i);
+		}
+		mUsed += count;
+		return true;
+	}
+	return false;
+}
+
+void cRangeAlloc::free(uint32_t offset, uint32_t count) {
+	if (count == 0) return;
+	auto next = std::lower_bound(mFree.begin(), mFree.end(), offset,
+		[](sRange const& r, uint32_t offs) { return r.offset < offs; });
+	bool mergePrev = next != mFree.begin() && (next - 1)->offset + (next - 1)->count == offset;
+	bool mergeNext = next != mFree.end() && offset + count == next->offset;
+	if (mergePrev && mergeNext) {
+		(next - 1)->count += count + next->count;
+		mFree.erase(next);
+	} else if (mergePrev) {
+		(next - 1)->count += count;
+	} else if (mergeNext) {
+		next->offset = offset;
+		next->count += count;
+	} else {
+		mFree.insert(next, { offset, count });
+	}
+	mUsed -= count;
+}
@@ -0,0 +1,28 @@
+#include <vector>
+
+// First-fit allocator of element ranges in [0, size). Freed ranges merge with
+// the free neighbors, so a freed allocation can be reused by a larger one.
+class cRangeAlloc {
+	struct sRange {
+		uint32_t offset;
+		uint32_t count;
+	};
+
+	// Sorted by offset, never adjacent
+	std::vector<sRange> mFree;
+	uint32_t mSize = 0;
+	uint32_t mUsed = 0;
+
+public:
+	void reset(uint32_t size);
+	// Appends [size, newSize) to the free space, existing ranges stay
+	void grow(uint32_t newSize);
+
+	// Fails if no free range is large enough
+	bool alloc(uint32_t count, uint32_t& offset);
+	void free(uint32_t offset, uint32_t count);
+
+	uint32_t get_size() const { return mSize; }
+	uint32_t get_used() const { return mUsed; }
+	uint32_t get_free_ranges() const { return (uint32_t)mFree.size(); }
+};
@@ -1,6 +1,7 @@
 #include <d3d11.h>
 
 #include "common.hpp"
+#include "vmath.hpp"
 #include "math.hpp"
 #include "rdr.hpp"
 #include "gfx.hpp"
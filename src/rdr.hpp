@@ -13,6 +13,34 @@ struct sModelVtx {
 	vec4 jwgt;
 };
 
+// GPU vertex format packed from sModelVtx by cModelGeom::pack_vtx, 36 bytes.
+// The shaders decode it in decode_vtx.
+struct sModelVtxPacked {
+	// unorm16 in the mesh bounds, w is the bitangent sign (0 is negative)
+	uint16_t pos[4];
+	// Octahedral snorm16
+	int16_t nrm[2];
+	int16_t tgt[2];
+	// half
+	uint16_t uv[2];
+	uint16_t uv1[2];
+	uint8_t clr[4];
+	uint8_t jidx[4];
+	uint8_t jwgt[4];
+};
+
+// Position-only streams of the depth and shadow passes, 8 and 16 bytes.
+// The fields are copied from sModelVtxPacked.
+struct sModelVtxDepth {
+	uint16_t pos[4];
+};
+
+struct sModelVtxDepthSkin {
+	uint16_t pos[4];
+	uint8_t jidx[4];
+	uint8_t jwgt[4];
+};
+
 struct sCameraCBuf {
 	DirectX::XMMATRIX viewProj;
 	DirectX::XMMATRIX view;
@@ -22,6 +50,9 @@ struct sCameraCBuf {
 
 struct sMeshCBuf {
 	DirectX::XMMATRIX wmtx;
+	// Dequantization of sModelVtxPacked::pos
+	DirectX::XMVECTOR posScale;
+	DirectX::XMVECTOR posBias;
 };
 
 struct sImguiCameraCBuf {
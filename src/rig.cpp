@@ -1,101 +1,13 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <new>
+#include <malloc.h>
 
-#include "math.hpp"
 #include "common.hpp"
+#include "vmath.hpp"
+#include "math.hpp"
 #include "rig.hpp"
-#include "rdr.hpp"
-#include "assimp_loader.hpp"
-
-#include <assimp/scene.h>
-
-#include "json_helpers.hpp"
-
-using nJsonHelpers::Document;
-using nJsonHelpers::Value;
-using nJsonHelpers::Size;
-
-class cJsonLoaderImpl {
-	cRigData& mRigData;
-public:
-	cJsonLoaderImpl(cRigData& rig) : mRigData(rig) {}
-
-	bool operator()(Value const& doc) {
-		CHECK_SCHEMA(doc.IsObject(), "doc is not an object\n");
-		CHECK_SCHEMA(doc.HasMember("joints"), "no joints in doc\n");
-		CHECK_SCHEMA(doc.HasMember("mtx"), "no mtx in doc\n");
-		CHECK_SCHEMA(doc.HasMember("imtx"), "no imtx in doc\n");
-		auto& joints = doc["joints"];
-		auto& mtx = doc["mtx"];
-		auto& imtx = doc["imtx"];
-
-		auto jointsNum = joints.Size();
-		auto imtxNum = imtx.Size();
-		CHECK_SCHEMA(mtx.Size() == jointsNum, "joints and mtx num differ\n");
-
-		auto pJoints = std::make_unique<sJointData[]>(jointsNum);
-		auto pMtx = std::make_unique<DirectX::XMMATRIX[]>(jointsNum);
-		auto pImtx = std::make_unique<DirectX::XMMATRIX[]>(imtxNum);
-		auto pNames = std::make_unique<std::string[]>(jointsNum);
-
-		for (auto pj = joints.Begin(); pj != joints.End(); ++pj) {
-			auto const& j = *pj;
-			CHECK_SCHEMA(j.IsObject(), "joint definition is not an object\n");
-
-			CHECK_SCHEMA(j.HasMember("name"), "no joint's name\n");
-			auto& jname = j["name"];
-			CHECK_SCHEMA(j.HasMember("idx"), "no joint's idx\n");
-			int idx = j["idx"].GetInt();
-			CHECK_SCHEMA(j.HasMember("parIdx"), "no joint's parIdx\n");
-			int parIdx = j["parIdx"].GetInt();
-			CHECK_SCHEMA(j.HasMember("skinIdx"), "no joint's skinIdx\n");
-			int skinIdx = j["skinIdx"].GetInt();
-			
-			auto name = jname.GetString();
-			auto nameLen = jname.GetStringLength();
-
-			pNames[idx] = std::string(name, nameLen);
-			pJoints[idx] = { idx, parIdx, skinIdx };
-		}
-
-		auto readMtx = [](DirectX::XMMATRIX* pMtx, Value const& m) {
-			CHECK_SCHEMA(m.IsArray(), "matrix is not an array\n");
-			CHECK_SCHEMA(m.Size() == 16, "wrong matrix size\n");
-
-			float tmp[16];
-			for (int i = 0; i < 16; ++i) {
-				tmp[i] = (float)m[i].GetDouble();
-			}
-			*pMtx = DirectX::XMMATRIX(tmp);
-			return true;
-		};
-
-		for (Size i = 0; i < jointsNum; ++i) {
-			auto const& m = mtx[i];
-			if (!readMtx(&pMtx[i], m)) {
-				return false;
-			}
-		}
-
-		for (Size i = 0; i < imtxNum; ++i) {
-			auto const& m = imtx[i];
-			if (!readMtx(&pImtx[i], m)) {
-				return false;
-			}
-		}
-
-		mRigData.mJointsNum = jointsNum;
-		mRigData.mIMtxNum = imtxNum;
-		mRigData.mpJoints = pJoints.release();
-		mRigData.mpLMtx = pMtx.release();
-		mRigData.mpIMtx = pImtx.release();
-		mRigData.mpNames = pNames.release();
-		mRigData.mAllocatedArrays = true;
-
-		return true;
-	}
-};
 
 cRigData::~cRigData() {
 	if (mAllocatedArrays) {
@@ -106,18 +18,44 @@ cRigData::~cRigData() {
 	}
 }
 
-bool cRigData::load(cstr filepath) {
-	if (filepath.ends_with(".rig")) {
-		return load_json(filepath);
+bool cRigData::init(int jointsNum, sJointData const* pJoints, nVM::M44 const* pLMtx,
+	int imtxNum, nVM::M44 const* pIMtx, std::string const* pNames) {
+	if (jointsNum <= 0 || !pJoints || !pLMtx || (imtxNum > 0 && !pIMtx)) { return false; }
+
+	for (int i = 0; i < jointsNum; ++i) {
+		auto const& jdata = pJoints[i];
+		if (jdata.idx != i || jdata.parIdx >= i || jdata.skinIdx >= imtxNum) {
+			dbg_msg("cRigData::init(): joint %d is out of order\n", i);
+			return false;
+		}
 	}
 
-	dbg_msg("cRigData::load(): Unknown file extension in <%s>", filepath.p);
-	return false;
-}
+	auto pJointsCopy = std::make_unique<sJointData[]>(jointsNum);
+	auto pLMtxCopy = std::make_unique<nVM::M44[]>(jointsNum);
+	auto pIMtxCopy = std::make_unique<nVM::M44[]>(std::max(imtxNum, 1));
+	auto pNamesCopy = std::make_unique<std::string[]>(jointsNum);
+	for (int i = 0; i < jointsNum; ++i) {
+		pJointsCopy[i] = pJoints[i];
+		pLMtxCopy[i] = pLMtx[i];
+		if (pNames) {
+			pNamesCopy[i] = pNames[i];
+		}
+	}
+	for (int i = 0; i < imtxNum; ++i) {
+		pIMtxCopy[i] = pIMtx[i];
+	}
+
+	mJointsNum = jointsNum;
+	mIMtxNum = imtxNum;
+	mpJoints = pJointsCopy.release();
+	mpLMtx = pLMtxCopy.release();
+	mpIMtx = pIMtxCopy.release();
+	mpNames = pNamesCopy.release();
+	mAllocatedArrays = true;
+	mSpringChains.clear();
+	mSpringColliders.clear();
 
-bool cRigData::load_json(cstr filepath) {
-	cJsonLoaderImpl loader(*this);
-	return nJsonHelpers::load_file(filepath, loader);
+	return true;
 }
 
 int cRigData::find_joint_idx(cstr name) const {
@@ -130,114 +68,108 @@ int cRigData::find_joint_idx(cstr name) const {
 }
 
 
-struct sNodeHie {
-	aiNode const* mpNode;
-	int32_t mJntIdx;
-	int32_t mParentIdx;
-	int32_t mBoneIdx;
-	bool mRequired;
+static size_t align_up(size_t size, size_t align) {
+	return (size + align - 1) & ~(align - 1);
+}
+
+struct sRigLayout {
+	size_t lmtxOffs;
+	size_t wmtxOffs;
+	size_t xformOffs;
+	size_t jointOffs;
+	size_t size;
+
+	sRigLayout(int jointsNum) {
+		const size_t n = (size_t)jointsNum;
+		lmtxOffs = 0;
+		wmtxOffs = lmtxOffs + sizeof(nVM::M44) * n;
+		xformOffs = wmtxOffs + sizeof(nVM::M44) * n;
+		jointOffs = align_up(xformOffs + sizeof(sXform) * n, 16);
+		// Whole cache lines, so instances updated from different threads don't share them
+		size = align_up(jointOffs + sizeof(cJoint) * n, cRig::BLOCK_ALIGN);
+	}
 };
 
-static void list_nodes(aiScene const* pScene, aiNode const* pNode, int32_t parentIdx, std::vector<sNodeHie>& nodeHie) {
-	int32_t nodeIdx = (int32_t)nodeHie.size();
-	nodeHie.emplace_back(sNodeHie{pNode, -1, parentIdx, -1, false});
 
-	for (uint32_t i = 0; i < pNode->mNumChildren; ++i) {
-		list_nodes(pScene, pNode->mChildren[i], nodeIdx, nodeHie);
-	}
+cRigPool::cRigPool(cRigData const& rigData, uint32_t blocksPerPage) {
+	mJointsNum = rigData.get_joints_num();
+	mBlockSize = cRig::calc_block_size(mJointsNum);
+	mBlocksPerPage = std::max(blocksPerPage, 1U);
 }
 
-static void mark_required(std::vector<sNodeHie>& nodeHie, int idx) {
-	auto& nh = nodeHie[idx];
-	if (nh.mRequired) { return; }
-	nh.mRequired = true;
-	if (nh.mParentIdx >= 0) {
-		mark_required(nodeHie, nh.mParentIdx);
+cRigPool::~cRigPool() {
+	assert(mUsedNum == 0);
+	for (auto pPage : mPages) {
+		::_aligned_free(pPage);
 	}
 }
 
-bool cRigData::load(cAssimpLoader& loader) {
-	auto pScene = loader.get_scene();
-	if (!pScene) { return false; }
-	auto& bones = loader.get_bones_info();
-	if (bones.size() == 0) { return false; }
-	auto& bonesMap = loader.get_bones_map();
-
-	std::vector<sNodeHie> nodeHie;
-	list_nodes(pScene, pScene->mRootNode, -1, nodeHie);
-
-	for (int i = 0; i < nodeHie.size(); ++i) {
-		auto& nh = nodeHie[i];
-		auto bit = bonesMap.find(nh.mpNode->mName.C_Str());
-		if (bit != bonesMap.end()) {
-			nh.mBoneIdx = bit->second;
-			mark_required(nodeHie, i);
-		}
+bool cRigPool::add_page() {
+	auto pPage = reinterpret_cast<uint8_t*>(::_aligned_malloc(mBlockSize * mBlocksPerPage, cRig::BLOCK_ALIGN));
+	if (!pPage) {
+		dbg_msg("cRigPool::add_page(): unable to allocate %u blocks of %u bytes\n", mBlocksPerPage, (uint32_t)mBlockSize);
+		return false;
 	}
+	mPages.push_back(pPage);
 
-	int32_t jointsNum = 0;
-	for (auto& nh : nodeHie) {
-		if (nh.mRequired) {
-			nh.mJntIdx = jointsNum;
-			++jointsNum;
-		}
+	// Link in reverse so blocks are handed out in address order
+	for (uint32_t i = mBlocksPerPage; i-- > 0;) {
+		auto pFree = reinterpret_cast<sFreeBlock*>(pPage + mBlockSize * i);
+		pFree->mpNext = mpFree;
+		mpFree = pFree;
 	}
+	return true;
+}
 
-	size_t imtxNum = bones.size();
-
-	auto pJoints = std::make_unique<sJointData[]>(jointsNum);
-	auto pMtx = std::make_unique<DirectX::XMMATRIX[]>(jointsNum);
-	auto pImtx = std::make_unique<DirectX::XMMATRIX[]>(imtxNum);
-	auto pNames = std::make_unique<std::string[]>(jointsNum);
-
-	int idx = 0;
-	for (auto const& nh : nodeHie) {
-		if (!nh.mRequired) { continue; }
-		assert(idx < jointsNum);
-		int parIdx = -1;
-		if (nh.mParentIdx >= 0) {
-			parIdx = nodeHie[nh.mParentIdx].mJntIdx;
-		}
-		pJoints[idx] = sJointData{ idx, parIdx, nh.mBoneIdx };
-
-		::memcpy(&pMtx[idx], &nh.mpNode->mTransformation, sizeof(pMtx[idx]));
-		pMtx[idx] = DirectX::XMMatrixTranspose(pMtx[idx]);
-
-		pNames[idx] = std::string(nh.mpNode->mName.C_Str(), nh.mpNode->mName.length);
-
-		if (nh.mBoneIdx >= 0) {
-			auto const& bone = bones[nh.mBoneIdx];
-			auto& imtx = pImtx[nh.mBoneIdx];
-
-			::memcpy(&imtx, &bone.mpBone->mOffsetMatrix, sizeof(imtx));
-			imtx = DirectX::XMMatrixTranspose(imtx);
-		}
-
-		++idx;
+void* cRigPool::alloc() {
+	if (!mpFree && !add_page()) {
+		return nullptr;
 	}
+	auto pBlock = mpFree;
+	mpFree = pBlock->mpNext;
+	++mUsedNum;
+	return pBlock;
+}
 
-	mJointsNum = jointsNum;
-	mIMtxNum = (int32_t)imtxNum;
-	mpJoints = pJoints.release();
-	mpLMtx = pMtx.release();
-	mpIMtx = pImtx.release();
-	mpNames = pNames.release();
-	mAllocatedArrays = true;
-
-	return true;
+void cRigPool::release(void* pBlock) {
+	if (!pBlock) { return; }
+	assert(mUsedNum > 0);
+	auto pFree = reinterpret_cast<sFreeBlock*>(pBlock);
+	pFree->mpNext = mpFree;
+	mpFree = pFree;
+	--mUsedNum;
 }
 
 
-void cRig::init(cRigData const* pRigData) {
-	if (!pRigData) { return; }
+size_t cRig::calc_block_size(int jointsNum) {
+	return sRigLayout(jointsNum).size;
+}
+
+bool cRig::init(cRigData const* pRigData, cRigPool* pPool) {
+	deinit();
+	if (!pRigData) { return false; }
 	
 	const int jointsNum = pRigData->mJointsNum;
-	auto pLMtx = std::make_unique<DirectX::XMMATRIX[]>(jointsNum);
-	auto pWMtx = std::make_unique<DirectX::XMMATRIX[]>(jointsNum);
-	auto pJoints = std::make_unique<cJoint[]>(jointsNum);
-	auto pXforms = std::make_unique<sXform[]>(jointsNum);
+	if (pPool && pPool->get_joints_num() != jointsNum) {
+		dbg_msg("cRig::init(): pool is made for %d joints, rig has %d\n", pPool->get_joints_num(), jointsNum);
+		return false;
+	}
+
+	const sRigLayout layout(jointsNum);
+	void* pBlock = pPool ? pPool->alloc() : ::_aligned_malloc(layout.size, BLOCK_ALIGN);
+	if (!pBlock) { return false; }
+
+	auto pMem = reinterpret_cast<uint8_t*>(pBlock);
+	auto pLMtx = reinterpret_cast<nVM::M44*>(pMem + layout.lmtxOffs);
+	auto pWMtx = reinterpret_cast<nVM::M44*>(pMem + layout.wmtxOffs);
+	auto pXforms = reinterpret_cast<sXform*>(pMem + layout.xformOffs);
+	auto pJoints = reinterpret_cast<cJoint*>(pMem + layout.jointOffs);
+	for (int i = 0; i < jointsNum; ++i) {
+		::new(&pJoints[i]) cJoint();
+	}
 
-	::memcpy(pLMtx.get(), pRigData->mpLMtx, sizeof(pRigData->mpLMtx[0]) * jointsNum);
+	::memcpy(pLMtx, pRigData->mpLMtx, sizeof(pRigData->mpLMtx[0]) * jointsNum);
+	sXform::init(pXforms, pLMtx, jointsNum);
 
 	for (int i = 0; i < jointsNum; ++i) {
 		auto const& jdata = pRigData->mpJoints[i];
@@ -249,8 +181,6 @@ void cRig::init(cRigData const* pRigData) {
 		jnt.mpXform = &pXforms[i];
 		jnt.mpLMtx = &pLMtx[i];
 		jnt.mpWMtx = &pWMtx[i];
-		
-		jnt.mpXform->init(*jnt.mpLMtx);
 
 		if (jdata.skinIdx >= 0) {
 			jnt.mpIMtx = &pRigData->mpIMtx[jdata.skinIdx];
@@ -266,18 +196,39 @@ void cRig::init(cRigData const* pRigData) {
 	
 	mJointsNum = jointsNum;
 	mpRigData = pRigData;
-	mpJoints = pJoints.release();
-	mpLMtx = pLMtx.release();
-	mpWmtx = pWMtx.release();
-	mpXforms = pXforms.release();
+	mpJoints = pJoints;
+	mpLMtx = pLMtx;
+	mpWmtx = pWMtx;
+	mpXforms = pXforms;
+	mpBlock = pBlock;
+	mpPool = pPool;
 
 	calc_world();
+	return true;
 }
 
-void cRig::calc_local() {
-	for (int i = 0; i < mJointsNum; ++i) {
-		mpJoints[i].calc_local();
+void cRig::deinit() {
+	if (!mpBlock) { return; }
+
+	if (mpPool) {
+		mpPool->release(mpBlock);
+	} else {
+		::_aligned_free(mpBlock);
 	}
+
+	mJointsNum = 0;
+	mpJoints = nullptr;
+	mpRigData = nullptr;
+	mpLMtx = nullptr;
+	mpWmtx = nullptr;
+	mpXforms = nullptr;
+	mpBlock = nullptr;
+	mpPool = nullptr;
+}
+
+void cRig::calc_local() {
+	// Xforms and local matrices are contiguous per rig, so convert them in one batch
+	sXform::build_mtx(mpXforms, mpLMtx, mJointsNum);
 }
 
 void cRig::calc_world() {
@@ -286,23 +237,20 @@ void cRig::calc_world() {
 	}
 }
 
-void cRig::upload_skin(ID3D11DeviceContext* pCtx) {
-	auto& skinCBuf = cConstBufStorage::get().mSkinCBuf;
-
-	auto* pSkin = skinCBuf.mData.skin;
-
+int cRig::calc_skin(nVM::M44* pSkin, int maxNum) const {
+	int skinNum = 0;
 	for (int i = 0; i < mJointsNum; ++i) {
 		auto pImtx = mpJoints[i].get_inv_mtx();
 		if (!pImtx) { continue; }
 		int skinIdx = mpRigData->mpJoints[i].skinIdx;
+		if (skinIdx >= maxNum) { continue; }
 
-		auto const& pWmtx = mpJoints[i].get_world_mtx();
+		auto const& wmtx = mpJoints[i].get_world_mtx();
 
-		pSkin[skinIdx] = (*pImtx) * pWmtx;
+		pSkin[skinIdx] = nVM::mul(*pImtx, wmtx);
+		skinNum = std::max(skinNum, skinIdx + 1);
 	}
-
-	skinCBuf.update(pCtx);
-	skinCBuf.set_VS(pCtx);
+	return skinNum;
 }
 
 cJoint* cRig::get_joint(int idx) const {
@@ -324,7 +272,7 @@ cJoint* cRig::find_joint(cstr name) const {
 
 
 void cJoint::calc_world() {
-	(*mpWMtx) = (*mpLMtx) * (*mpParentMtx);
+	(*mpWMtx) = nVM::mul(*mpLMtx, *mpParentMtx);
 }
 
 void cJoint::calc_local() {
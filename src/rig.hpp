@@ -1,4 +1,6 @@
-struct ID3D11DeviceContext;
+#include <vector>
+#include <string>
+
 class cAssimpLoader;
 
 struct sJointData {
@@ -7,14 +9,31 @@ struct sJointData {
 	int skinIdx;
 };
 
+// Joint chain driven by the spring solver, joints go from the animated root to the tip.
+struct sSpringChainData {
+	std::vector<int> joints;
+	float stiffness;
+	float damping;
+	float radius;
+	vec3 gravity;
+};
+
+struct sSpringColliderData {
+	int jointIdx;
+	float radius;
+	vec3 offset;
+};
+
 class cRigData : public noncopyable {
 	int mJointsNum = 0;
 	int mIMtxNum = 0;
 	sJointData* mpJoints = nullptr;
-	DirectX::XMMATRIX* mpLMtx = nullptr;
-	DirectX::XMMATRIX* mpIMtx = nullptr;
+	nVM::M44* mpLMtx = nullptr;
+	nVM::M44* mpIMtx = nullptr;
 	std::string* mpNames = nullptr;
 	bool mAllocatedArrays = false;
+	std::vector<sSpringChainData> mSpringChains;
+	std::vector<sSpringColliderData> mSpringColliders;
 
 public:
 	//cRigData() {}
@@ -22,32 +41,42 @@ public:
 
 	bool load(cstr filepath);
 	bool load(cAssimpLoader& loader);
+	// Builds the rig from memory, joints must be sorted so that parents go first.
+	bool init(int jointsNum, sJointData const* pJoints, nVM::M44 const* pLMtx,
+		int imtxNum, nVM::M44 const* pIMtx, std::string const* pNames);
 	
 	int find_joint_idx(cstr name) const;
+	int get_joints_num() const { return mJointsNum; }
+	int get_parent_idx(int idx) const { return mpJoints[idx].parIdx; }
+
+	std::vector<sSpringChainData> const& get_spring_chains() const { return mSpringChains; }
+	std::vector<sSpringColliderData> const& get_spring_colliders() const { return mSpringColliders; }
 private:
 
 	bool load_json(cstr filepath);
 
 	friend class cJsonLoaderImpl;
 	friend class cRig;
+	friend class cRigBatch;
 };
 
 
 
 class cJoint {
 	sXform* mpXform = nullptr;
-	DirectX::XMMATRIX* mpLMtx = nullptr;
-	DirectX::XMMATRIX* mpWMtx = nullptr;
-	DirectX::XMMATRIX const* mpIMtx = nullptr;
-	DirectX::XMMATRIX const* mpParentMtx = nullptr;
+	nVM::M44* mpLMtx = nullptr;
+	nVM::M44* mpWMtx = nullptr;
+	nVM::M44 const* mpIMtx = nullptr;
+	nVM::M44 const* mpParentMtx = nullptr;
 	//cJoint* mpParent = nullptr;
 public:
 
-	DirectX::XMMATRIX& get_local_mtx() { return *mpLMtx; }
-	DirectX::XMMATRIX& get_world_mtx() { return *mpWMtx; }
-	DirectX::XMMATRIX const* get_inv_mtx() { return mpIMtx; }
-	//void set_inv_mtx(DirectX::XMMATRIX* pMtx) { mpIMtx = pMtx; }
-	void set_parent_mtx(DirectX::XMMATRIX* pMtx) { mpParentMtx = pMtx; }
+	nVM::M44& get_local_mtx() { return *mpLMtx; }
+	nVM::M44& get_world_mtx() { return *mpWMtx; }
+	nVM::M44 const* get_inv_mtx() { return mpIMtx; }
+	nVM::M44 const& get_parent_mtx() const { return *mpParentMtx; }
+	//void set_inv_mtx(nVM::M44* pMtx) { mpIMtx = pMtx; }
+	void set_parent_mtx(nVM::M44* pMtx) { mpParentMtx = pMtx; }
 
 	sXform& get_xform() { return *mpXform; }
 
@@ -58,24 +87,63 @@ private:
 	friend class cRig;
 };
 
-class cRig {
-	int mJointsNum;
-	cJoint* mpJoints;
-	cRigData const* mpRigData;
-	DirectX::XMMATRIX* mpLMtx;
-	DirectX::XMMATRIX* mpWmtx;
-	sXform* mpXforms;
+// Fixed-size block allocator for rig instances of one cRigData.
+// Blocks are carved out of larger pages and recycled through a free list.
+class cRigPool : noncopyable {
+	struct sFreeBlock {
+		sFreeBlock* mpNext;
+	};
+
+	std::vector<void*> mPages;
+	sFreeBlock* mpFree = nullptr;
+	size_t mBlockSize = 0;
+	int mJointsNum = 0;
+	uint32_t mBlocksPerPage = 0;
+	uint32_t mUsedNum = 0;
 public:
+	cRigPool(cRigData const& rigData, uint32_t blocksPerPage = 64);
+	~cRigPool();
+
+	void* alloc();
+	void release(void* pBlock);
+
+	size_t get_block_size() const { return mBlockSize; }
+	int get_joints_num() const { return mJointsNum; }
+	uint32_t get_used_num() const { return mUsedNum; }
+	uint32_t get_capacity() const { return (uint32_t)mPages.size() * mBlocksPerPage; }
+
+private:
+	bool add_page();
+};
+
+class cRig : noncopyable {
+	int mJointsNum = 0;
+	cJoint* mpJoints = nullptr;
+	cRigData const* mpRigData = nullptr;
+	nVM::M44* mpLMtx = nullptr;
+	nVM::M44* mpWmtx = nullptr;
+	sXform* mpXforms = nullptr;
+	void* mpBlock = nullptr;
+	cRigPool* mpPool = nullptr;
+public:
+	enum { BLOCK_ALIGN = 64 };
+
+	~cRig() { deinit(); }
 
-	void init(cRigData const* pRigData);
+	// All per-instance data lives in a single block, taken from pPool if given.
+	bool init(cRigData const* pRigData, cRigPool* pPool = nullptr);
+	void deinit();
 
 	void calc_local();
 	void calc_world();
 
-	void upload_skin(ID3D11DeviceContext* pCtx);
+	// Fills skin palette (inverse bind * world) indexed by skinIdx, returns palette size.
+	int calc_skin(nVM::M44* pSkin, int maxNum) const;
 
 	cJoint* get_joint(int idx) const;
 	cJoint* find_joint(cstr name) const;
+	cRigData const* get_rig_data() const { return mpRigData; }
 
+	static size_t calc_block_size(int jointsNum);
 };
 
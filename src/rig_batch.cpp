@@ -0,0 +1,149 @@
+#include <memory>
+
+#include "common.hpp"
+#include "vmath.hpp"
+#include "math.hpp"
+#include "rig.hpp"
+#include "rig_batch.hpp"
+
+using nVM::V4;
+using nVM::M44;
+
+static void scatter_mtx(V4* pSoa, int ln, M44 const& mtx) {
+	float m[16];
+	nVM::store_m44(m, mtx);
+	for (int i = 0; i < 16; ++i) {
+		nVM::set_lane(pSoa[i], ln, m[i]);
+	}
+}
+
+static M44 gather_mtx(V4 const* pSoa, int ln) {
+	float m[16];
+	for (int i = 0; i < 16; ++i) {
+		m[i] = nVM::get(pSoa[i], ln);
+	}
+	return nVM::load_m44(m);
+}
+
+static void broadcast_mtx(V4* pSoa, M44 const& mtx) {
+	float m[16];
+	nVM::store_m44(m, mtx);
+	for (int i = 0; i < 16; ++i) {
+		pSoa[i] = nVM::splat(m[i]);
+	}
+}
+
+// res = a * b for 4 matrices at once, row vectors as everywhere else
+static void mul_mtx_soa(V4* pRes, V4 const* pA, V4 const* pB) {
+	for (int r = 0; r < 4; ++r) {
+		V4 a0 = pA[r * 4 + 0];
+		V4 a1 = pA[r * 4 + 1];
+		V4 a2 = pA[r * 4 + 2];
+		V4 a3 = pA[r * 4 + 3];
+		for (int c = 0; c < 4; ++c) {
+			V4 v = nVM::mul(a0, pB[c]);
+			v = nVM::madd(a1, pB[4 + c], v);
+			v = nVM::madd(a2, pB[8 + c], v);
+			v = nVM::madd(a3, pB[12 + c], v);
+			pRes[r * 4 + c] = v;
+		}
+	}
+}
+
+
+bool cRigBatch::init(cRigData const* pRigData, int instNum) {
+	if (!pRigData || instNum <= 0) { return false; }
+
+	const int jointsNum = pRigData->mJointsNum;
+	const int groupNum = (instNum + LANES - 1) / LANES;
+	const size_t soaNum = (size_t)jointsNum * groupNum * 16;
+
+	auto pLMtx = std::make_unique<V4[]>(soaNum);
+	auto pWMtx = std::make_unique<V4[]>(soaNum);
+	auto pRootMtx = std::make_unique<V4[]>((size_t)groupNum * 16);
+	auto pParIdx = std::make_unique<int[]>(jointsNum);
+
+	mpRigData = pRigData;
+	mJointsNum = jointsNum;
+	mInstNum = instNum;
+	mGroupNum = groupNum;
+
+	for (int g = 0; g < groupNum; ++g) {
+		broadcast_mtx(&pRootMtx[g * 16], nMtx::g_Identity);
+	}
+	for (int i = 0; i < jointsNum; ++i) {
+		auto const& jdata = pRigData->mpJoints[i];
+		assert(jdata.idx == i);
+		assert(jdata.parIdx < i);
+		pParIdx[i] = jdata.parIdx;
+		for (int g = 0; g < groupNum; ++g) {
+			broadcast_mtx(get_soa(pLMtx.get(), i, g), pRigData->mpLMtx[i]);
+		}
+	}
+
+	mpLMtx = std::move(pLMtx);
+	mpWMtx = std::move(pWMtx);
+	mpRootMtx = std::move(pRootMtx);
+	mpParIdx = std::move(pParIdx);
+
+	calc_world();
+	return true;
+}
+
+void cRigBatch::set_local_mtx(int inst, int jnt, M44 const& mtx) {
+	assert(inst < mInstNum && jnt < mJointsNum);
+	scatter_mtx(get_soa(mpLMtx.get(), jnt, inst / LANES), inst % LANES, mtx);
+}
+
+void cRigBatch::set_xform(int inst, int jnt, sXform const& xform) {
+	set_local_mtx(inst, jnt, xform.build_mtx());
+}
+
+void cRigBatch::set_root_mtx(int inst, M44 const& mtx) {
+	assert(inst < mInstNum);
+	scatter_mtx(&mpRootMtx[(inst / LANES) * 16], inst % LANES, mtx);
+}
+
+M44 cRigBatch::get_local_mtx(int inst, int jnt) const {
+	assert(inst < mInstNum && jnt < mJointsNum);
+	return gather_mtx(get_soa(mpLMtx.get(), jnt, inst / LANES), inst % LANES);
+}
+
+M44 cRigBatch::get_world_mtx(int inst, int jnt) const {
+	assert(inst < mInstNum && jnt < mJointsNum);
+	return gather_mtx(get_soa(mpWMtx.get(), jnt, inst / LANES), inst % LANES);
+}
+
+void cRigBatch::calc_world() {
+	calc_world(0, mGroupNum);
+}
+
+void cRigBatch::calc_world(int groupBegin, int groupEnd) {
+	groupEnd = std::min(groupEnd, mGroupNum);
+	V4 const* pLMtx = mpLMtx.get();
+	V4* pWMtx = mpWMtx.get();
+
+	// Joint-major walk: parents are always done before children, and for one
+	// joint the matrices of all groups are contiguous in memory.
+	for (int i = 0; i < mJointsNum; ++i) {
+		const int parIdx = mpParIdx[i];
+		for (int g = groupBegin; g < groupEnd; ++g) {
+			V4 const* pPar = parIdx >= 0 ? get_soa(pWMtx, parIdx, g) : &mpRootMtx[g * 16];
+			mul_mtx_soa(get_soa(pWMtx, i, g), get_soa(pLMtx, i, g), pPar);
+		}
+	}
+}
+
+int cRigBatch::calc_skin(int inst, M44* pSkin, int maxNum) const {
+	if (!mpRigData || inst >= mInstNum) { return 0; }
+
+	int skinNum = 0;
+	for (int i = 0; i < mJointsNum; ++i) {
+		int skinIdx = mpRigData->mpJoints[i].skinIdx;
+		if (skinIdx < 0 || skinIdx >= maxNum) { continue; }
+
+		pSkin[skinIdx] = nVM::mul(mpRigData->mpIMtx[skinIdx], get_world_mtx(inst, i));
+		skinNum = std::max(skinNum, skinIdx + 1);
+	}
+	return skinNum;
+}
@@ -0,0 +1,48 @@
+class cRigData;
+
+// Evaluates world matrices of many instances sharing one cRigData.
+// Matrices are stored joint-major, instance-minor: each matrix element is a
+// vector holding 4 instances, so the hierarchy is walked once per group of 4.
+class cRigBatch : noncopyable {
+public:
+	enum { LANES = 4 };
+
+private:
+	cRigData const* mpRigData = nullptr;
+	int mJointsNum = 0;
+	int mInstNum = 0;
+	int mGroupNum = 0;
+	std::unique_ptr<nVM::V4[]> mpLMtx;
+	std::unique_ptr<nVM::V4[]> mpWMtx;
+	std::unique_ptr<nVM::V4[]> mpRootMtx;
+	std::unique_ptr<int[]> mpParIdx;
+
+public:
+	bool init(cRigData const* pRigData, int instNum);
+
+	int get_inst_num() const { return mInstNum; }
+	int get_joints_num() const { return mJointsNum; }
+
+	void set_local_mtx(int inst, int jnt, nVM::M44 const& mtx);
+	void set_xform(int inst, int jnt, sXform const& xform);
+	// Parent of the root joints, identity by default.
+	void set_root_mtx(int inst, nVM::M44 const& mtx);
+
+	nVM::M44 get_local_mtx(int inst, int jnt) const;
+	nVM::M44 get_world_mtx(int inst, int jnt) const;
+
+	void calc_world();
+	void calc_world(int groupBegin, int groupEnd);
+	int get_group_num() const { return mGroupNum; }
+
+	// Same as cRig::calc_skin() for one instance.
+	int calc_skin(int inst, nVM::M44* pSkin, int maxNum) const;
+
+private:
+	nVM::V4* get_soa(nVM::V4* pBase, int jnt, int group) const {
+		return pBase + ((size_t)jnt * mGroupNum + group) * 16;
+	}
+	nVM::V4 const* get_soa(nVM::V4 const* pBase, int jnt, int group) const {
+		return pBase + ((size_t)jnt * mGroupNum + group) * 16;
+	}
+};
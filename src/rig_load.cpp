@@ -0,0 +1,281 @@
+#include <string>
+#include <memory>
+#include <vector>
+
+#include "common.hpp"
+#include "vmath.hpp"
+#include "math.hpp"
+#include "rig.hpp"
+#include "assimp_loader.hpp"
+
+#include <assimp/scene.h>
+
+#include "json_helpers.hpp"
+
+using nJsonHelpers::Document;
+using nJsonHelpers::Value;
+using nJsonHelpers::Size;
+
+class cJsonLoaderImpl {
+	cRigData& mRigData;
+public:
+	cJsonLoaderImpl(cRigData& rig) : mRigData(rig) {}
+
+	bool operator()(Value const& doc) {
+		CHECK_SCHEMA(doc.IsObject(), "doc is not an object\n");
+		CHECK_SCHEMA(doc.HasMember("joints"), "no joints in doc\n");
+		CHECK_SCHEMA(doc.HasMember("mtx"), "no mtx in doc\n");
+		CHECK_SCHEMA(doc.HasMember("imtx"), "no imtx in doc\n");
+		auto& joints = doc["joints"];
+		auto& mtx = doc["mtx"];
+		auto& imtx = doc["imtx"];
+
+		auto jointsNum = joints.Size();
+		auto imtxNum = imtx.Size();
+		CHECK_SCHEMA(mtx.Size() == jointsNum, "joints and mtx num differ\n");
+
+		auto pJoints = std::make_unique<sJointData[]>(jointsNum);
+		auto pMtx = std::make_unique<nVM::M44[]>(jointsNum);
+		auto pImtx = std::make_unique<nVM::M44[]>(imtxNum);
+		auto pNames = std::make_unique<std::string[]>(jointsNum);
+
+		for (auto pj = joints.Begin(); pj != joints.End(); ++pj) {
+			auto const& j = *pj;
+			CHECK_SCHEMA(j.IsObject(), "joint definition is not an object\n");
+
+			CHECK_SCHEMA(j.HasMember("name"), "no joint's name\n");
+			auto& jname = j["name"];
+			CHECK_SCHEMA(j.HasMember("idx"), "no joint's idx\n");
+			int idx = j["idx"].GetInt();
+			CHECK_SCHEMA(j.HasMember("parIdx"), "no joint's parIdx\n");
+			int parIdx = j["parIdx"].GetInt();
+			CHECK_SCHEMA(j.HasMember("skinIdx"), "no joint's skinIdx\n");
+			int skinIdx = j["skinIdx"].GetInt();
+			
+			auto name = jname.GetString();
+			auto nameLen = jname.GetStringLength();
+
+			pNames[idx] = std::string(name, nameLen);
+			pJoints[idx] = { idx, parIdx, skinIdx };
+		}
+
+		auto readMtx = [](nVM::M44* pMtx, Value const& m) {
+			CHECK_SCHEMA(m.IsArray(), "matrix is not an array\n");
+			CHECK_SCHEMA(m.Size() == 16, "wrong matrix size\n");
+
+			float tmp[16];
+			for (int i = 0; i < 16; ++i) {
+				tmp[i] = (float)m[i].GetDouble();
+			}
+			*pMtx = nVM::load_m44(tmp);
+			return true;
+		};
+
+		for (Size i = 0; i < jointsNum; ++i) {
+			auto const& m = mtx[i];
+			if (!readMtx(&pMtx[i], m)) {
+				return false;
+			}
+		}
+
+		for (Size i = 0; i < imtxNum; ++i) {
+			auto const& m = imtx[i];
+			if (!readMtx(&pImtx[i], m)) {
+				return false;
+			}
+		}
+
+		auto findJoint = [&](Value const& name) {
+			for (Size i = 0; i < jointsNum; ++i) {
+				if (0 == pNames[i].compare(0, std::string::npos, name.GetString(), name.GetStringLength())) {
+					return (int)i;
+				}
+			}
+			return -1;
+		};
+
+		auto readVec3 = [](vec3& vec, Value const& v) {
+			CHECK_SCHEMA(v.IsArray() && v.Size() == 3, "vector is not an array of 3\n");
+			vec = vec3{ (float)v[0u].GetDouble(), (float)v[1u].GetDouble(), (float)v[2u].GetDouble() };
+			return true;
+		};
+
+		std::vector<sSpringChainData> springChains;
+		if (doc.HasMember("springs")) {
+			auto& springs = doc["springs"];
+			CHECK_SCHEMA(springs.IsArray(), "springs is not an array\n");
+			for (auto ps = springs.Begin(); ps != springs.End(); ++ps) {
+				auto const& sp = *ps;
+				CHECK_SCHEMA(sp.IsObject(), "spring definition is not an object\n");
+				CHECK_SCHEMA(sp.HasMember("joints"), "no spring's joints\n");
+				auto& sjoints = sp["joints"];
+				CHECK_SCHEMA(sjoints.IsArray() && sjoints.Size() >= 2, "spring chain needs at least 2 joints\n");
+
+				sSpringChainData chain;
+				chain.stiffness = sp.HasMember("stiffness") ? (float)sp["stiffness"].GetDouble() : 0.1f;
+				chain.damping = sp.HasMember("damping") ? (float)sp["damping"].GetDouble() : 0.05f;
+				chain.radius = sp.HasMember("radius") ? (float)sp["radius"].GetDouble() : 0.0f;
+				chain.gravity = vec3{ 0.0f, -9.8f, 0.0f };
+				if (sp.HasMember("gravity") && !readVec3(chain.gravity, sp["gravity"])) {
+					return false;
+				}
+
+				for (auto pj = sjoints.Begin(); pj != sjoints.End(); ++pj) {
+					CHECK_SCHEMA(pj->IsString(), "spring joint is not a name\n");
+					int idx = findJoint(*pj);
+					CHECK_SCHEMA(idx >= 0, "unknown spring joint %s\n", pj->GetString());
+					if (!chain.joints.empty()) {
+						CHECK_SCHEMA(pJoints[idx].parIdx == chain.joints.back(), "spring joint %s is not a child of the previous one\n", pj->GetString());
+					}
+					chain.joints.push_back(idx);
+				}
+				springChains.push_back(std::move(chain));
+			}
+		}
+
+		std::vector<sSpringColliderData> springColliders;
+		if (doc.HasMember("colliders")) {
+			auto& colliders = doc["colliders"];
+			CHECK_SCHEMA(colliders.IsArray(), "colliders is not an array\n");
+			for (auto pc = colliders.Begin(); pc != colliders.End(); ++pc) {
+				auto const& c = *pc;
+				CHECK_SCHEMA(c.IsObject(), "collider definition is not an object\n");
+				CHECK_SCHEMA(c.HasMember("joint"), "no collider's joint\n");
+				CHECK_SCHEMA(c.HasMember("radius"), "no collider's radius\n");
+
+				sSpringColliderData col;
+				col.jointIdx = findJoint(c["joint"]);
+				CHECK_SCHEMA(col.jointIdx >= 0, "unknown collider joint %s\n", c["joint"].GetString());
+				col.radius = (float)c["radius"].GetDouble();
+				col.offset = vec3{ 0.0f, 0.0f, 0.0f };
+				if (c.HasMember("offset") && !readVec3(col.offset, c["offset"])) {
+					return false;
+				}
+				springColliders.push_back(col);
+			}
+		}
+
+		mRigData.mJointsNum = jointsNum;
+		mRigData.mIMtxNum = imtxNum;
+		mRigData.mpJoints = pJoints.release();
+		mRigData.mpLMtx = pMtx.release();
+		mRigData.mpIMtx = pImtx.release();
+		mRigData.mpNames = pNames.release();
+		mRigData.mAllocatedArrays = true;
+		mRigData.mSpringChains = std::move(springChains);
+		mRigData.mSpringColliders = std::move(springColliders);
+
+		return true;
+	}
+};
+
+bool cRigData::load(cstr filepath) {
+	if (filepath.ends_with(".rig")) {
+		return load_json(filepath);
+	}
+
+	dbg_msg("cRigData::load(): Unknown file extension in <%s>", filepath.p);
+	return false;
+}
+
+bool cRigData::load_json(cstr filepath) {
+	cJsonLoaderImpl loader(*this);
+	return nJsonHelpers::load_file(filepath, loader);
+}
+
+struct sNodeHie {
+	aiNode const* mpNode;
+	int32_t mJntIdx;
+	int32_t mParentIdx;
+	int32_t mBoneIdx;
+	bool mRequired;
+};
+
+static void list_nodes(aiScene const* pScene, aiNode const* pNode, int32_t parentIdx, std::vector<sNodeHie>& nodeHie) {
+	int32_t nodeIdx = (int32_t)nodeHie.size();
+	nodeHie.emplace_back(sNodeHie{pNode, -1, parentIdx, -1, false});
+
+	for (uint32_t i = 0; i < pNode->mNumChildren; ++i) {
+		list_nodes(pScene, pNode->mChildren[i], nodeIdx, nodeHie);
+	}
+}
+
+static void mark_required(std::vector<sNodeHie>& nodeHie, int idx) {
+	auto& nh = nodeHie[idx];
+	if (nh.mRequired) { return; }
+	nh.mRequired = true;
+	if (nh.mParentIdx >= 0) {
+		mark_required(nodeHie, nh.mParentIdx);
+	}
+}
+
+bool cRigData::load(cAssimpLoader& loader) {
+	auto pScene = loader.get_scene();
+	if (!pScene) { return false; }
+	auto& bones = loader.get_bones_info();
+	if (bones.size() == 0) { return false; }
+	auto& bonesMap = loader.get_bones_map();
+
+	std::vector<sNodeHie> nodeHie;
+	list_nodes(pScene, pScene->mRootNode, -1, nodeHie);
+
+	for (int i = 0; i < nodeHie.size(); ++i) {
+		auto& nh = nodeHie[i];
+		auto bit = bonesMap.find(nh.mpNode->mName.C_Str());
+		if (bit != bonesMap.end()) {
+			nh.mBoneIdx = bit->second;
+			mark_required(nodeHie, i);
+		}
+	}
+
+	int32_t jointsNum = 0;
+	for (auto& nh : nodeHie) {
+		if (nh.mRequired) {
+			nh.mJntIdx = jointsNum;
+			++jointsNum;
+		}
+	}
+
+	size_t imtxNum = bones.size();
+
+	auto pJoints = std::make_unique<sJointData[]>(jointsNum);
+	auto pMtx = std::make_unique<nVM::M44[]>(jointsNum);
+	auto pImtx = std::make_unique<nVM::M44[]>(imtxNum);
+	auto pNames = std::make_unique<std::string[]>(jointsNum);
+
+	int idx = 0;
+	for (auto const& nh : nodeHie) {
+		if (!nh.mRequired) { continue; }
+		assert(idx < jointsNum);
+		int parIdx = -1;
+		if (nh.mParentIdx >= 0) {
+			parIdx = nodeHie[nh.mParentIdx].mJntIdx;
+		}
+		pJoints[idx] = sJointData{ idx, parIdx, nh.mBoneIdx };
+
+		::memcpy(&pMtx[idx], &nh.mpNode->mTransformation, sizeof(pMtx[idx]));
+		pMtx[idx] = nVM::transpose(pMtx[idx]);
+
+		pNames[idx] = std::string(nh.mpNode->mName.C_Str(), nh.mpNode->mName.length);
+
+		if (nh.mBoneIdx >= 0) {
+			auto const& bone = bones[nh.mBoneIdx];
+			auto& imtx = pImtx[nh.mBoneIdx];
+
+			::memcpy(&imtx, &bone.mpBone->mOffsetMatrix, sizeof(imtx));
+			imtx = nVM::transpose(imtx);
+		}
+
+		++idx;
+	}
+
+	mJointsNum = jointsNum;
+	mIMtxNum = (int32_t)imtxNum;
+	mpJoints = pJoints.release();
+	mpLMtx = pMtx.release();
+	mpIMtx = pImtx.release();
+	mpNames = pNames.release();
+	mAllocatedArrays = true;
+
+	return true;
+}
@@ -1,9 +1,11 @@
 #include <memory>
 
+#include "vmath.hpp"
 #include "math.hpp"
 #include "common.hpp"
 #include "rdr.hpp"
 #include "texture.hpp"
+#include "mesh_opt.hpp"
 #include "model.hpp"
 #include "camera.hpp"
 #include "sh.hpp"
@@ -0,0 +1,253 @@
+#include <memory>
+
+#include "common.hpp"
+#include "vmath.hpp"
+#include "math.hpp"
+#include "skin_cpu.hpp"
+#include "thread_pool.hpp"
+
+#include <immintrin.h>
+#ifdef _MSC_VER
+#	include <intrin.h>
+#	define AVX2_TARGET
+
+static void cpuid(int info[4], int leaf, int subleaf) {
+	__cpuidex(info, leaf, subleaf);
+}
+
+static uint64_t xgetbv(uint32_t idx) {
+	return _xgetbv(idx);
+}
+#else
+#	include <cpuid.h>
+#	define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+static void cpuid(int info[4], int leaf, int subleaf) {
+	__cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]);
+}
+
+static uint64_t xgetbv(uint32_t idx) {
+	uint32_t lo, hi;
+	__asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(idx));
+	return ((uint64_t)hi << 32) | lo;
+}
+#endif
+
+struct sSkinJob {
+	sSkinSrc const* pSrc;
+	cSkinCPU::sInfluence const* pInfl;
+	float const* pMtx;
+	vec3* pPos;
+	vec3* pNrm;
+	vec4* pTgt;
+};
+
+static bool detect_avx2() {
+	int info[4];
+	cpuid(info, 0, 0);
+	if (info[0] < 7) { return false; }
+
+	cpuid(info, 1, 0);
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!(fma && osxsave && avx)) { return false; }
+
+	// OS must save YMM state
+	if ((xgetbv(0) & 6) != 6) { return false; }
+
+	cpuid(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+}
+
+static const bool s_hasAVX2 = detect_avx2();
+
+
+// Matrices are row-major with row vectors, as in the shader: p' = p * M
+static void skin_scalar(sSkinJob const& job, uint32_t begin, uint32_t end) {
+	for (uint32_t i = begin; i < end; ++i) {
+		auto const& inf = job.pInfl[i];
+		float m[12];
+		::memset(m, 0, sizeof(m));
+		for (int k = 0; k < 4; ++k) {
+			float w = inf.wgt[k];
+			if (w == 0.0f) { continue; }
+			float const* s = job.pMtx + inf.idx[k] * 16;
+			for (int r = 0; r < 4; ++r) {
+				m[r * 3 + 0] += w * s[r * 4 + 0];
+				m[r * 3 + 1] += w * s[r * 4 + 1];
+				m[r * 3 + 2] += w * s[r * 4 + 2];
+			}
+		}
+
+		float const* p = job.pSrc->pos(i);
+		float const* n = job.pSrc->nrm(i);
+		float const* t = job.pSrc->tgt(i);
+
+		auto& op = job.pPos[i];
+		op.x = p[0] * m[0] + p[1] * m[3] + p[2] * m[6] + m[9];
+		op.y = p[0] * m[1] + p[1] * m[4] + p[2] * m[7] + m[10];
+		op.z = p[0] * m[2] + p[1] * m[5] + p[2] * m[8] + m[11];
+
+		auto& on = job.pNrm[i];
+		on.x = n[0] * m[0] + n[1] * m[3] + n[2] * m[6];
+		on.y = n[0] * m[1] + n[1] * m[4] + n[2] * m[7];
+		on.z = n[0] * m[2] + n[1] * m[5] + n[2] * m[8];
+
+		auto& ot = job.pTgt[i];
+		ot[0] = t[0] * m[0] + t[1] * m[3] + t[2] * m[6];
+		ot[1] = t[0] * m[1] + t[1] * m[4] + t[2] * m[7];
+		ot[2] = t[0] * m[2] + t[1] * m[5] + t[2] * m[8];
+		ot[3] = t[3];
+	}
+}
+
+AVX2_TARGET static inline __m256 avx_pair(__m128 lo, __m128 hi) {
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+
+AVX2_TARGET static inline __m128 avx_fold(__m256 v) {
+	return _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+}
+
+static inline void store_vec3(float* pDst, __m128 v) {
+	_mm_storel_pi(reinterpret_cast<__m64*>(pDst), v);
+	_mm_store_ss(pDst + 2, _mm_movehl_ps(v, v));
+}
+
+// Blended matrix is kept as two 256-bit halves: (row0|row1) and (row2|row3),
+// so blending 4 influences costs 8 FMAs and each transform is 2 multiplies and a fold.
+AVX2_TARGET static void skin_avx2(sSkinJob const& job, uint32_t begin, uint32_t end) {
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (uint32_t i = begin; i < end; ++i) {
+		auto const& inf = job.pInfl[i];
+
+		__m256 m01 = _mm256_setzero_ps();
+		__m256 m23 = _mm256_setzero_ps();
+		for (int k = 0; k < 4; ++k) {
+			__m256 w = _mm256_broadcast_ss(&inf.wgt[k]);
+			float const* s = job.pMtx + inf.idx[k] * 16;
+			m01 = _mm256_fmadd_ps(w, _mm256_loadu_ps(s), m01);
+			m23 = _mm256_fmadd_ps(w, _mm256_loadu_ps(s + 8), m23);
+		}
+
+		float const* p = job.pSrc->pos(i);
+		float const* n = job.pSrc->nrm(i);
+		float const* t = job.pSrc->tgt(i);
+
+		__m256 pxy = avx_pair(_mm_set1_ps(p[0]), _mm_set1_ps(p[1]));
+		__m256 pz1 = avx_pair(_mm_set1_ps(p[2]), one);
+		__m128 op = avx_fold(_mm256_fmadd_ps(m01, pxy, _mm256_mul_ps(m23, pz1)));
+
+		__m256 nxy = avx_pair(_mm_set1_ps(n[0]), _mm_set1_ps(n[1]));
+		__m256 nz0 = avx_pair(_mm_set1_ps(n[2]), zero);
+		__m128 on = avx_fold(_mm256_fmadd_ps(m01, nxy, _mm256_mul_ps(m23, nz0)));
+
+		__m256 txy = avx_pair(_mm_set1_ps(t[0]), _mm_set1_ps(t[1]));
+		__m256 tz0 = avx_pair(_mm_set1_ps(t[2]), zero);
+		__m128 ot = avx_fold(_mm256_fmadd_ps(m01, txy, _mm256_mul_ps(m23, tz0)));
+
+		store_vec3(&job.pPos[i].x, op);
+		store_vec3(&job.pNrm[i].x, on);
+		store_vec3(&job.pTgt[i][0], ot);
+		job.pTgt[i][3] = t[3];
+	}
+
+	_mm256_zeroupper();
+}
+
+
+void cSkinCPU::init(sSkinSrc const& src) {
+	const uint32_t vtxNum = src.mVtxNum;
+
+	auto pInfl = std::make_unique<sInfluence[]>(vtxNum);
+	int maxJidx = -1;
+	for (uint32_t i = 0; i < vtxNum; ++i) {
+		int32_t const* jidx = src.jidx(i);
+		float const* jwgt = src.jwgt(i);
+		auto& inf = pInfl[i];
+		for (int k = 0; k < 4; ++k) {
+			int32_t idx = jidx[k];
+			float wgt = jwgt[k];
+			if (idx < 0 || idx > 0xFFFF) {
+				idx = 0;
+				wgt = 0.0f;
+			}
+			inf.idx[k] = (uint16_t)idx;
+			inf.wgt[k] = wgt;
+			if (wgt != 0.0f) {
+				maxJidx = std::max(maxJidx, idx);
+			}
+		}
+	}
+
+	mSrc = src;
+	mpInfl = std::move(pInfl);
+	mpPos = std::make_unique<vec3[]>(vtxNum);
+	mpNrm = std::make_unique<vec3[]>(vtxNum);
+	mpTgt = std::make_unique<vec4[]>(vtxNum);
+	mVtxNum = vtxNum;
+	mMaxJidx = maxJidx;
+}
+
+bool cSkinCPU::skin(nVM::M44 const* pSkin, int skinNum, cThreadPool* pPool, eKernel kernel) {
+	if (!mpInfl || !pSkin || skinNum <= 0) { return false; }
+	if (mMaxJidx >= skinNum) {
+		dbg_msg("cSkinCPU::skin(): joint index %d is out of skin palette size %d\n", mMaxJidx, skinNum);
+		return false;
+	}
+
+	kernel = resolve_kernel(kernel);
+
+	const uint32_t grain = 1024;
+	if (pPool && mVtxNum > grain) {
+		pPool->parallel_for(mVtxNum, grain, [this, pSkin, kernel](uint32_t begin, uint32_t end) {
+			skin_range(pSkin, begin, end, kernel);
+		});
+	} else {
+		skin_range(pSkin, 0, mVtxNum, kernel);
+	}
+	return true;
+}
+
+void cSkinCPU::skin_range(nVM::M44 const* pSkin, uint32_t begin, uint32_t end, eKernel kernel) {
+	sSkinJob job;
+	job.pSrc = &mSrc;
+	job.pInfl = mpInfl.get();
+	job.pMtx = reinterpret_cast<float const*>(pSkin);
+	job.pPos = mpPos.get();
+	job.pNrm = mpNrm.get();
+	job.pTgt = mpTgt.get();
+
+	end = std::min(end, mVtxNum);
+	if (resolve_kernel(kernel) == E_KERNEL_AVX2) {
+		skin_avx2(job, begin, end);
+	} else {
+		skin_scalar(job, begin, end);
+	}
+}
+
+bool cSkinCPU::has_avx2() {
+	return s_hasAVX2;
+}
+
+cSkinCPU::eKernel cSkinCPU::resolve_kernel(eKernel kernel) {
+	if (kernel == E_KERNEL_AUTO) {
+		kernel = has_avx2() ? E_KERNEL_AVX2 : E_KERNEL_SCALAR;
+	}
+	if (kernel == E_KERNEL_AVX2 && !has_avx2()) {
+		kernel = E_KERNEL_SCALAR;
+	}
+	return kernel;
+}
+
+cstr cSkinCPU::get_kernel_name(eKernel kernel) {
+	switch (kernel) {
+	case E_KERNEL_AUTO: return "auto";
+	case E_KERNEL_SCALAR: return "scalar";
+	case E_KERNEL_AVX2: return "avx2";
+	}
+	return "unknown";
+}
@@ -0,0 +1,84 @@
+#include <memory>
+#include <cstddef>
+
+class cThreadPool;
+
+// Strided view of the skinning inputs inside an interleaved vertex array.
+struct sSkinSrc {
+	uint8_t const* mpBase = nullptr;
+	uint32_t mStride = 0;
+	uint32_t mVtxNum = 0;
+	uint32_t mPosOffs = 0;
+	uint32_t mNrmOffs = 0;
+	uint32_t mTgtOffs = 0;
+	uint32_t mJidxOffs = 0;
+	uint32_t mJwgtOffs = 0;
+
+	template <typename TVtx>
+	static sSkinSrc from_vtx(TVtx const* pVtx, uint32_t vtxNum) {
+		sSkinSrc src;
+		src.mpBase = reinterpret_cast<uint8_t const*>(pVtx);
+		src.mStride = sizeof(TVtx);
+		src.mVtxNum = vtxNum;
+		src.mPosOffs = offsetof(TVtx, pos);
+		src.mNrmOffs = offsetof(TVtx, nrm);
+		src.mTgtOffs = offsetof(TVtx, tgt);
+		src.mJidxOffs = offsetof(TVtx, jidx);
+		src.mJwgtOffs = offsetof(TVtx, jwgt);
+		return src;
+	}
+
+	float const* pos(uint32_t i) const { return get<float>(i, mPosOffs); }
+	float const* nrm(uint32_t i) const { return get<float>(i, mNrmOffs); }
+	float const* tgt(uint32_t i) const { return get<float>(i, mTgtOffs); }
+	int32_t const* jidx(uint32_t i) const { return get<int32_t>(i, mJidxOffs); }
+	float const* jwgt(uint32_t i) const { return get<float>(i, mJwgtOffs); }
+
+private:
+	template <typename T>
+	T const* get(uint32_t i, uint32_t offs) const {
+		return reinterpret_cast<T const*>(mpBase + (size_t)i * mStride + offs);
+	}
+};
+
+// CPU implementation of model_skin.vs: linear blend skinning of positions,
+// normals and tangents with up to 4 influences per vertex.
+// Output streams are tightly packed and match the GPU result.
+class cSkinCPU : noncopyable {
+public:
+	enum eKernel {
+		E_KERNEL_AUTO,
+		E_KERNEL_SCALAR,
+		E_KERNEL_AVX2,
+	};
+
+	struct sInfluence {
+		uint16_t idx[4];
+		float wgt[4];
+	};
+
+private:
+	sSkinSrc mSrc;
+	std::unique_ptr<sInfluence[]> mpInfl;
+	std::unique_ptr<vec3[]> mpPos;
+	std::unique_ptr<vec3[]> mpNrm;
+	std::unique_ptr<vec4[]> mpTgt;
+	uint32_t mVtxNum = 0;
+	int mMaxJidx = -1;
+
+public:
+	void init(sSkinSrc const& src);
+
+	// pSkin is the skin palette as produced by cRig::calc_skin().
+	bool skin(nVM::M44 const* pSkin, int skinNum, cThreadPool* pPool = nullptr, eKernel kernel = E_KERNEL_AUTO);
+	void skin_range(nVM::M44 const* pSkin, uint32_t begin, uint32_t end, eKernel kernel);
+
+	uint32_t get_vtx_num() const { return mVtxNum; }
+	vec3 const* get_pos() const { return mpPos.get(); }
+	vec3 const* get_nrm() const { return mpNrm.get(); }
+	vec4 const* get_tgt() const { return mpTgt.get(); }
+
+	static bool has_avx2();
+	static eKernel resolve_kernel(eKernel kernel);
+	static cstr get_kernel_name(eKernel kernel);
+};
@@ -0,0 +1,266 @@
+#include <memory>
+#include <vector>
+
+#include "common.hpp"
+#include "vmath.hpp"
+#include "math.hpp"
+#include "rig.hpp"
+#include "spring.hpp"
+
+using nVM::V4;
+using nVM::M44;
+
+static void set_lane3(V4* pSoa, int ln, V4 v) {
+	nVM::set_lane(pSoa[0], ln, nVM::get_x(v));
+	nVM::set_lane(pSoa[1], ln, nVM::get_y(v));
+	nVM::set_lane(pSoa[2], ln, nVM::get_z(v));
+}
+
+static V4 get_lane3(V4 const* pSoa, int ln) {
+	return nVM::set(nVM::get(pSoa[0], ln), nVM::get(pSoa[1], ln), nVM::get(pSoa[2], ln), 0.0f);
+}
+
+static V4 joint_pos(cRig const& rig, int jointIdx) {
+	return rig.get_joint(jointIdx)->get_world_mtx().r[3];
+}
+
+static V4 dot3_soa(V4 const* pA, V4 const* pB) {
+	V4 res = nVM::mul(pA[0], pB[0]);
+	res = nVM::madd(pA[1], pB[1], res);
+	return nVM::madd(pA[2], pB[2], res);
+}
+
+
+bool cSpringSolver::init(cRigData const& rigData, cRig* const* ppRigs, int rigNum) {
+	reset();
+
+	auto const& chains = rigData.get_spring_chains();
+	if (chains.empty() || rigNum <= 0) { return false; }
+
+	int32_t levelNum = 0;
+	for (auto const& chain : chains) {
+		levelNum = std::max(levelNum, (int32_t)chain.joints.size() - 1);
+	}
+
+	std::vector<sChainRef> chainRefs;
+	for (int r = 0; r < rigNum; ++r) {
+		if (ppRigs[r]->get_rig_data() != &rigData) {
+			dbg_msg("cSpringSolver::init(): rig %d is made from a different cRigData\n", r);
+			return false;
+		}
+		for (int c = 0; c < (int)chains.size(); ++c) {
+			chainRefs.push_back({ r, c });
+		}
+	}
+
+	const int32_t groupNum = ((int32_t)chainRefs.size() + LANES - 1) / LANES;
+	const int32_t colliderNum = (int32_t)rigData.get_spring_colliders().size();
+
+	// Unused lanes stay zeroed and inactive
+	auto pLevels = std::make_unique<sLevel[]>(levelNum * groupNum);
+	auto pParams = std::make_unique<sLaneParams[]>(groupNum);
+	auto pColliders = std::make_unique<sColliderLanes[]>(std::max(colliderNum * groupNum, 1));
+	::memset(pLevels.get(), 0, sizeof(sLevel) * levelNum * groupNum);
+	::memset(pParams.get(), 0, sizeof(sLaneParams) * groupNum);
+	::memset(pColliders.get(), 0, sizeof(sColliderLanes) * std::max(colliderNum * groupNum, 1));
+
+	mpRigData = &rigData;
+	mRigs.assign(ppRigs, ppRigs + rigNum);
+	mChains = std::move(chainRefs);
+	mpLevels = std::move(pLevels);
+	mpParams = std::move(pParams);
+	mpColliders = std::move(pColliders);
+	mGroupNum = groupNum;
+	mLevelNum = levelNum;
+	mColliderNum = colliderNum;
+
+	for (int32_t i = 0; i < (int32_t)mChains.size(); ++i) {
+		auto const& ref = mChains[i];
+		auto const& chain = chains[ref.chainIdx];
+		auto const& rig = *mRigs[ref.rigIdx];
+		const int g = i / LANES;
+		const int ln = i % LANES;
+
+		auto& params = mpParams[g];
+		set_lane3(params.gravity, ln, nVM::load3(&chain.gravity.x));
+		nVM::set_lane(params.stiffness, ln, chain.stiffness);
+		nVM::set_lane(params.damping, ln, chain.damping);
+		nVM::set_lane(params.radius, ln, chain.radius);
+
+		// Rest lengths are taken from the current pose, normally the bind pose after cRig::init()
+		for (int d = 0; d < (int)chain.joints.size() - 1; ++d) {
+			auto& level = get_level(d, g);
+			V4 parPos = joint_pos(rig, chain.joints[d]);
+			V4 pos = joint_pos(rig, chain.joints[d + 1]);
+			set_lane3(level.pos, ln, pos);
+			set_lane3(level.prev, ln, pos);
+			set_lane3(level.target, ln, pos);
+			nVM::set_lane(level.restLen, ln, nVM::get_x(nVM::length3(nVM::sub(pos, parPos))));
+			reinterpret_cast<uint32_t*>(&level.active)[ln] = 0xFFFFFFFF;
+		}
+	}
+
+	gather();
+	return true;
+}
+
+void cSpringSolver::reset() {
+	mpRigData = nullptr;
+	mRigs.clear();
+	mChains.clear();
+	mpLevels.reset();
+	mpParams.reset();
+	mpColliders.reset();
+	mGroupNum = 0;
+	mLevelNum = 0;
+	mColliderNum = 0;
+	mTimeAcc = 0.0f;
+}
+
+void cSpringSolver::update(float dt) {
+	if (!mpRigData) { return; }
+
+	mTimeAcc += dt;
+	int steps = (int)(mTimeAcc / mStep);
+	if (steps > mMaxSubsteps) {
+		// Too far behind, drop the time instead of spiralling
+		steps = mMaxSubsteps;
+		mTimeAcc = 0.0f;
+	} else {
+		mTimeAcc -= steps * mStep;
+	}
+
+	gather();
+	for (int i = 0; i < steps; ++i) {
+		solve(mStep);
+	}
+	apply();
+}
+
+void cSpringSolver::gather() {
+	auto const& chains = mpRigData->get_spring_chains();
+	auto const& colliders = mpRigData->get_spring_colliders();
+
+	for (int32_t i = 0; i < (int32_t)mChains.size(); ++i) {
+		auto const& ref = mChains[i];
+		auto const& chain = chains[ref.chainIdx];
+		auto const& rig = *mRigs[ref.rigIdx];
+		const int g = i / LANES;
+		const int ln = i % LANES;
+
+		set_lane3(mpParams[g].anchor, ln, joint_pos(rig, chain.joints[0]));
+		for (int d = 0; d < (int)chain.joints.size() - 1; ++d) {
+			set_lane3(get_level(d, g).target, ln, joint_pos(rig, chain.joints[d + 1]));
+		}
+
+		for (int32_t c = 0; c < mColliderNum; ++c) {
+			auto const& col = colliders[c];
+			auto& lanes = get_collider(c, g);
+			auto const& wmtx = rig.get_joint(col.jointIdx)->get_world_mtx();
+			V4 center = nVM::transform_point(nVM::load3(&col.offset.x), wmtx);
+			set_lane3(lanes.center, ln, center);
+			nVM::set_lane(lanes.radius, ln, col.radius);
+		}
+	}
+}
+
+void cSpringSolver::solve(float dt) {
+	const V4 dt2 = nVM::splat(dt * dt);
+	const V4 eps = nVM::splat(1.0e-12f);
+
+	for (int32_t g = 0; g < mGroupNum; ++g) {
+		auto const& params = mpParams[g];
+		const V4 keep = nVM::sub(nVM::splat(1.0f), params.damping);
+		V4 par[3] = { params.anchor[0], params.anchor[1], params.anchor[2] };
+
+		for (int32_t d = 0; d < mLevelNum; ++d) {
+			auto& level = get_level(d, g);
+			V4 pos[3];
+
+			// Verlet integration with damping, gravity and a pull towards the animated pose
+			for (int a = 0; a < 3; ++a) {
+				V4 vel = nVM::mul(nVM::sub(level.pos[a], level.prev[a]), keep);
+				V4 pull = nVM::sub(level.target[a], level.pos[a]);
+				pos[a] = nVM::add(level.pos[a], vel);
+				pos[a] = nVM::madd(params.gravity[a], dt2, pos[a]);
+				pos[a] = nVM::madd(pull, params.stiffness, pos[a]);
+			}
+
+			// Keep the bone length
+			V4 dir[3];
+			for (int a = 0; a < 3; ++a) {
+				dir[a] = nVM::sub(pos[a], par[a]);
+			}
+			V4 len2 = nVM::max(dot3_soa(dir, dir), eps);
+			V4 scl = nVM::mul(level.restLen, nVM::rsqrt(len2));
+			for (int a = 0; a < 3; ++a) {
+				pos[a] = nVM::madd(dir[a], scl, par[a]);
+			}
+
+			// Push out of the collision spheres
+			for (int32_t c = 0; c < mColliderNum; ++c) {
+				auto const& col = get_collider(c, g);
+				V4 offs[3];
+				for (int a = 0; a < 3; ++a) {
+					offs[a] = nVM::sub(pos[a], col.center[a]);
+				}
+				V4 minDist = nVM::add(col.radius, params.radius);
+				V4 dist2 = nVM::max(dot3_soa(offs, offs), eps);
+				V4 inside = nVM::less(dist2, nVM::mul(minDist, minDist));
+				V4 push = nVM::mul(minDist, nVM::rsqrt(dist2));
+				for (int a = 0; a < 3; ++a) {
+					V4 pushed = nVM::madd(offs[a], push, col.center[a]);
+					pos[a] = nVM::select(pos[a], pushed, inside);
+				}
+			}
+
+			for (int a = 0; a < 3; ++a) {
+				level.prev[a] = nVM::select(level.prev[a], level.pos[a], level.active);
+				level.pos[a] = nVM::select(level.pos[a], pos[a], level.active);
+				par[a] = level.pos[a];
+			}
+		}
+	}
+}
+
+void cSpringSolver::apply() {
+	auto const& chains = mpRigData->get_spring_chains();
+
+	for (int32_t i = 0; i < (int32_t)mChains.size(); ++i) {
+		auto const& ref = mChains[i];
+		auto const& chain = chains[ref.chainIdx];
+		auto& rig = *mRigs[ref.rigIdx];
+		const int g = i / LANES;
+		const int ln = i % LANES;
+
+		// Rotate each joint so that its child lands on the simulated position
+		for (int d = 0; d < (int)chain.joints.size() - 1; ++d) {
+			auto& parJnt = *rig.get_joint(chain.joints[d]);
+			auto& jnt = *rig.get_joint(chain.joints[d + 1]);
+			M44 parWmtx = parJnt.get_world_mtx();
+			V4 parPos = parWmtx.r[3];
+
+			jnt.calc_world();
+			V4 cur = nVM::sub(jnt.get_world_mtx().r[3], parPos);
+			V4 sim = nVM::sub(get_lane3(get_level(d, g).pos, ln), parPos);
+			V4 axis = nVM::cross3(cur, sim);
+			if (nVM::get_x(nVM::length_sq3(axis)) < 1.0e-12f) { continue; }
+
+			float cosAngle = nVM::get_x(nVM::mul(nVM::dot3(cur, sim), nVM::rsqrt(nVM::mul(nVM::length_sq3(cur), nVM::length_sq3(sim)))));
+			float angle = mFastAcos ? nVM::get_x(nVM::acos_fast(nVM::splat(cosAngle))) : ::acosf(clamp(cosAngle, -1.0f, 1.0f));
+			M44 rot = nVM::rotation_axis(axis, angle);
+			for (int r = 0; r < 3; ++r) {
+				parWmtx.r[r] = nVM::transform_dir(parWmtx.r[r], rot);
+			}
+
+			M44 invParent = nVM::inverse(parJnt.get_parent_mtx());
+			parJnt.get_world_mtx() = parWmtx;
+			parJnt.get_local_mtx() = nVM::mul(parWmtx, invParent);
+			jnt.calc_world();
+		}
+	}
+
+	for (auto pRig : mRigs) {
+		pRig->calc_world();
+	}
+}
@@ -0,0 +1,71 @@
+class cRig;
+class cRigData;
+
+// Verlet solver for the spring chains of cRigData, runs after cRig::calc_world().
+// Particles of all chains of all instances are stored by chain depth, 4 chains per
+// vector, so every level is solved with one SIMD pass over the whole crowd.
+class cSpringSolver : noncopyable {
+public:
+	enum { LANES = 4 };
+
+private:
+	struct sChainRef {
+		int32_t rigIdx;
+		int32_t chainIdx;
+	};
+
+	struct sLevel {
+		nVM::V4 pos[3];
+		nVM::V4 prev[3];
+		nVM::V4 target[3];
+		nVM::V4 restLen;
+		nVM::V4 active;
+	};
+
+	struct sLaneParams {
+		nVM::V4 anchor[3];
+		nVM::V4 gravity[3];
+		nVM::V4 stiffness;
+		nVM::V4 damping;
+		nVM::V4 radius;
+	};
+
+	struct sColliderLanes {
+		nVM::V4 center[3];
+		nVM::V4 radius;
+	};
+
+	cRigData const* mpRigData = nullptr;
+	std::vector<cRig*> mRigs;
+	std::vector<sChainRef> mChains;
+	std::unique_ptr<sLevel[]> mpLevels;
+	std::unique_ptr<sLaneParams[]> mpParams;
+	std::unique_ptr<sColliderLanes[]> mpColliders;
+	int32_t mGroupNum = 0;
+	int32_t mLevelNum = 0;
+	int32_t mColliderNum = 0;
+	float mStep = 1.0f / 60.0f;
+	float mTimeAcc = 0.0f;
+	int32_t mMaxSubsteps = 4;
+	// nVM::acos_fast or acosf for the joint angles of apply()
+	bool mFastAcos = true;
+
+public:
+	bool init(cRigData const& rigData, cRig* const* ppRigs, int rigNum);
+	void reset();
+
+	void set_step(float step) { mStep = step; }
+	void set_fast_acos(bool fast) { mFastAcos = fast; }
+	int32_t get_chain_num() const { return (int32_t)mChains.size(); }
+
+	// Advances by dt in fixed steps and writes the result back to the rigs.
+	void update(float dt);
+
+private:
+	void gather();
+	void solve(float dt);
+	void apply();
+
+	sLevel& get_level(int level, int group) const { return mpLevels[level * mGroupNum + group]; }
+	sColliderLanes& get_collider(int col, int group) const { return mpColliders[col * mGroupNum + group]; }
+};
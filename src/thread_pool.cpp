@@ -0,0 +1,89 @@
+#include "common.hpp"
+#include "thread_pool.hpp"
+
+cThreadPool::cThreadPool(int threadsNum) : mNext(0) {
+	if (threadsNum < 0) {
+		threadsNum = (int)std::thread::hardware_concurrency() - 1;
+	}
+	threadsNum = std::max(threadsNum, 0);
+
+	mThreads.reserve(threadsNum);
+	for (int i = 0; i < threadsNum; ++i) {
+		mThreads.emplace_back([this]() { worker_loop(); });
+	}
+}
+
+cThreadPool::~cThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mWakeCV.notify_all();
+	for (auto& t : mThreads) {
+		t.join();
+	}
+}
+
+void cThreadPool::parallel_for(uint32_t count, uint32_t grain, RangeFunc const& func) {
+	if (count == 0) { return; }
+	grain = std::max(grain, 1U);
+
+	const uint32_t threadsNum = (uint32_t)get_threads_num();
+	if (threadsNum == 1 || count <= grain) {
+		func(0, count);
+		return;
+	}
+
+	// A few chunks per thread to balance uneven ranges
+	uint32_t chunk = std::max(grain, (count + threadsNum * 4 - 1) / (threadsNum * 4));
+
+	std::lock_guard<std::mutex> batchLock(mBatchMutex);
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mpFunc = &func;
+		mCount = count;
+		mChunk = chunk;
+		mNext = 0;
+		mWorkersDone = 0;
+		++mGeneration;
+	}
+	mWakeCV.notify_all();
+
+	run_chunks();
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	mDoneCV.wait(lock, [this]() { return mWorkersDone == get_workers_num(); });
+	mpFunc = nullptr;
+}
+
+void cThreadPool::worker_loop() {
+	uint32_t generation = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWakeCV.wait(lock, [this, generation]() { return mQuit || mGeneration != generation; });
+			if (mQuit) { return; }
+			generation = mGeneration;
+		}
+
+		run_chunks();
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			++mWorkersDone;
+		}
+		mDoneCV.notify_one();
+	}
+}
+
+void cThreadPool::run_chunks() {
+	auto const& func = *mpFunc;
+	const uint32_t count = mCount;
+	const uint32_t chunk = mChunk;
+	for (;;) {
+		uint32_t begin = mNext.fetch_add(chunk);
+		if (begin >= count) { break; }
+		uint32_t end = std::min(begin + chunk, count);
+		func(begin, end);
+	}
+}
@@ -0,0 +1,47 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <vector>
+
+class cThreadPool : noncopyable {
+public:
+	using RangeFunc = std::function<void(uint32_t begin, uint32_t end)>;
+
+private:
+	std::vector<std::thread> mThreads;
+	std::mutex mMutex;
+	std::mutex mBatchMutex;
+	std::condition_variable mWakeCV;
+	std::condition_variable mDoneCV;
+
+	RangeFunc const* mpFunc = nullptr;
+	uint32_t mCount = 0;
+	uint32_t mChunk = 1;
+	std::atomic<uint32_t> mNext;
+
+	uint32_t mGeneration = 0;
+	int mWorkersDone = 0;
+	bool mQuit = false;
+
+public:
+	// threadsNum is the number of additional worker threads,
+	// -1 means (hardware threads - 1). Caller thread always participates.
+	cThreadPool(int threadsNum = -1);
+	~cThreadPool();
+
+	// Shared by the app loaders, defined by the app
+	static cThreadPool& get();
+
+	int get_workers_num() const { return (int)mThreads.size(); }
+	int get_threads_num() const { return get_workers_num() + 1; }
+
+	// Splits [0, count) into chunks of at least grain items and calls func(begin, end)
+	// for each chunk on the pool threads. Blocks until all chunks are done.
+	void parallel_for(uint32_t count, uint32_t grain, RangeFunc const& func);
+
+private:
+	void worker_loop();
+	void run_chunks();
+};
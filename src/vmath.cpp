@@ -0,0 +1,135 @@
+#include "vmath.hpp"
+
+namespace nVM {
+
+V4 quat_slerp(V4 a, V4 b, float t) {
+	const float oneMinusEps = 1.0f - 0.00001f;
+
+	float cosOmega = get_x(dot4(a, b));
+	float sign = 1.0f;
+	if (cosOmega < 0.0f) {
+		cosOmega = -cosOmega;
+		sign = -1.0f;
+	}
+
+	float s0, s1;
+	if (cosOmega < oneMinusEps) {
+		float sinOmega = ::sqrtf(1.0f - cosOmega * cosOmega);
+		float omega = ::atan2f(sinOmega, cosOmega);
+		float invSin = 1.0f / sinOmega;
+		s0 = ::sinf((1.0f - t) * omega) * invSin;
+		s1 = ::sinf(t * omega) * invSin;
+	} else {
+		s0 = 1.0f - t;
+		s1 = t;
+	}
+
+	return madd(a, splat(s0), scale(b, s1 * sign));
+}
+
+// Both weights come from one sin_cos_fast call: lanes hold (1 - t) * omega and t * omega.
+V4 quat_slerp_fast(V4 a, V4 b, float t) {
+	const float oneMinusEps = 1.0f - 0.00001f;
+
+	float cosOmega = get_x(dot4(a, b));
+	float sign = 1.0f;
+	if (cosOmega < 0.0f) {
+		cosOmega = -cosOmega;
+		sign = -1.0f;
+	}
+
+	if (cosOmega >= oneMinusEps) {
+		return madd(a, splat(1.0f - t), scale(b, t * sign));
+	}
+
+	V4 sc = set(1.0f - cosOmega * cosOmega, cosOmega, 0.0f, 0.0f);
+	V4 sinOmega = sqrt(splat_x(sc));
+	V4 omega = atan2_fast(sinOmega, splat_y(sc));
+	V4 s, c;
+	sin_cos_fast(mul(omega, set(1.0f - t, t, 0.0f, 0.0f)), &s, &c);
+	s = div(s, sinOmega);
+	return madd(a, splat_x(s), scale(b, get_y(s) * sign));
+}
+
+// Shepperd's method, picks the largest of |x|, |y|, |z|, |w| to divide by.
+// Same result as XMQuaternionRotationMatrix for row-vector matrices.
+V4 quat_from_mtx(M44 const& m) {
+	float r00 = get_x(m.r[0]), r01 = get_y(m.r[0]), r02 = get_z(m.r[0]);
+	float r10 = get_x(m.r[1]), r11 = get_y(m.r[1]), r12 = get_z(m.r[1]);
+	float r20 = get_x(m.r[2]), r21 = get_y(m.r[2]), r22 = get_z(m.r[2]);
+
+	if (r22 <= 0.0f) {
+		float dif10 = r11 - r00;
+		float omr22 = 1.0f - r22;
+		if (dif10 <= 0.0f) {
+			float fourXSqr = omr22 - dif10;
+			float inv4x = 0.5f / ::sqrtf(fourXSqr);
+			return set(fourXSqr * inv4x, (r01 + r10) * inv4x, (r02 + r20) * inv4x, (r12 - r21) * inv4x);
+		} else {
+			float fourYSqr = omr22 + dif10;
+			float inv4y = 0.5f / ::sqrtf(fourYSqr);
+			return set((r01 + r10) * inv4y, fourYSqr * inv4y, (r12 + r21) * inv4y, (r20 - r02) * inv4y);
+		}
+	} else {
+		float sum10 = r11 + r00;
+		float opr22 = 1.0f + r22;
+		if (sum10 <= 0.0f) {
+			float fourZSqr = opr22 - sum10;
+			float inv4z = 0.5f / ::sqrtf(fourZSqr);
+			return set((r02 + r20) * inv4z, (r12 + r21) * inv4z, fourZSqr * inv4z, (r01 - r10) * inv4z);
+		} else {
+			float fourWSqr = opr22 + sum10;
+			float inv4w = 0.5f / ::sqrtf(fourWSqr);
+			return set((r12 - r21) * inv4w, (r20 - r02) * inv4w, (r01 - r10) * inv4w, fourWSqr * inv4w);
+		}
+	}
+}
+
+// Cofactor expansion via 2x2 sub-determinants. Singular matrices give
+// non-finite values, as XMMatrixInverse does.
+M44 inverse(M44 const& mtx) {
+	float m[16];
+	store_m44(m, mtx);
+
+	float s0 = m[0] * m[5] - m[4] * m[1];
+	float s1 = m[0] * m[6] - m[4] * m[2];
+	float s2 = m[0] * m[7] - m[4] * m[3];
+	float s3 = m[1] * m[6] - m[5] * m[2];
+	float s4 = m[1] * m[7] - m[5] * m[3];
+	float s5 = m[2] * m[7] - m[6] * m[3];
+
+	float c5 = m[10] * m[15] - m[14] * m[11];
+	float c4 = m[9] * m[15] - m[13] * m[11];
+	float c3 = m[9] * m[14] - m[13] * m[10];
+	float c2 = m[8] * m[15] - m[12] * m[11];
+	float c1 = m[8] * m[14] - m[12] * m[10];
+	float c0 = m[8] * m[13] - m[12] * m[9];
+
+	float det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+	float invDet = 1.0f / det;
+
+	float r[16];
+	r[0] = (m[5] * c5 - m[6] * c4 + m[7] * c3) * invDet;
+	r[1] = (-m[1] * c5 + m[2] * c4 - m[3] * c3) * invDet;
+	r[2] = (m[13] * s5 - m[14] * s4 + m[15] * s3) * invDet;
+	r[3] = (-m[9] * s5 + m[10] * s4 - m[11] * s3) * invDet;
+
+	r[4] = (-m[4] * c5 + m[6] * c2 - m[7] * c1) * invDet;
+	r[5] = (m[0] * c5 - m[2] * c2 + m[3] * c1) * invDet;
+	r[6] = (-m[12] * s5 + m[14] * s2 - m[15] * s1) * invDet;
+	r[7] = (m[8] * s5 - m[10] * s2 + m[11] * s1) * invDet;
+
+	r[8] = (m[4] * c4 - m[5] * c2 + m[7] * c0) * invDet;
+	r[9] = (-m[0] * c4 + m[1] * c2 - m[3] * c0) * invDet;
+	r[10] = (m[12] * s4 - m[13] * s2 + m[15] * s0) * invDet;
+	r[11] = (-m[8] * s4 + m[9] * s2 - m[11] * s0) * invDet;
+
+	r[12] = (-m[4] * c3 + m[5] * c1 - m[6] * c0) * invDet;
+	r[13] = (m[0] * c3 - m[1] * c1 + m[2] * c0) * invDet;
+	r[14] = (-m[12] * s3 + m[13] * s1 - m[14] * s0) * invDet;
+	r[15] = (m[8] * s3 - m[9] * s1 + m[10] * s0) * invDet;
+
+	return load_m44(r);
+}
+
+} // namespace nVM
@@ -0,0 +1,531 @@
+// Thin vector/matrix/quaternion layer for the CPU-side animation code.
+// Backend is selected at compile time:
+//   MTB_VMATH_SCALAR defined -> plain C++
+//   __AVX2__                 -> SSE4.1 + FMA
+//   __SSE4_1__ or __AVX__    -> SSE4.1
+//   x64 or __SSE2__          -> SSE2
+// Conventions follow DirectXMath: row vectors (p' = p * M), row-major matrices,
+// quaternions as (x, y, z, w).
+
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+#if defined(MTB_VMATH_SCALAR)
+#	define VM_SCALAR 1
+#	define VM_BACKEND_NAME "scalar"
+#elif defined(__AVX2__)
+#	define VM_SSE 1
+#	define VM_SSE4 1
+#	define VM_FMA 1
+#	define VM_BACKEND_NAME "avx2"
+#elif defined(__SSE4_1__) || defined(__AVX__)
+#	define VM_SSE 1
+#	define VM_SSE4 1
+#	define VM_BACKEND_NAME "sse4"
+#elif defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define VM_SSE 1
+#	define VM_BACKEND_NAME "sse2"
+#else
+#	define VM_SCALAR 1
+#	define VM_BACKEND_NAME "scalar"
+#endif
+
+#if VM_SSE
+#	include <emmintrin.h>
+#	if VM_SSE4
+#		include <smmintrin.h>
+#	endif
+#	if VM_FMA
+#		include <immintrin.h>
+#	endif
+#endif
+
+namespace nVM {
+
+const float PI = 3.14159265358979323846f;
+
+// Plain storage types, layout-compatible with XMFLOAT4/XMINT4
+struct F4 { float x, y, z, w; };
+struct I4 { int32_t x, y, z, w; };
+
+#if VM_SSE
+typedef __m128 V4;
+#else
+struct V4 {
+	float f[4];
+};
+#endif
+
+// Same layout as XMMATRIX
+struct M44 {
+	V4 r[4];
+};
+
+inline float get(V4 const& v, int idx) { return reinterpret_cast<float const*>(&v)[idx]; }
+inline void set_lane(V4& v, int idx, float f) { reinterpret_cast<float*>(&v)[idx] = f; }
+
+#if VM_SSE
+
+inline V4 set(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+inline V4 splat(float f) { return _mm_set1_ps(f); }
+inline V4 zero() { return _mm_setzero_ps(); }
+inline V4 load4(float const* p) { return _mm_loadu_ps(p); }
+inline void store4(float* p, V4 v) { _mm_storeu_ps(p, v); }
+inline V4 load3(float const* p) {
+	return _mm_movelh_ps(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<double const*>(p))), _mm_load_ss(p + 2));
+}
+inline void store3(float* p, V4 v) {
+	_mm_store_sd(reinterpret_cast<double*>(p), _mm_castps_pd(v));
+	_mm_store_ss(p + 2, _mm_movehl_ps(v, v));
+}
+
+inline float get_x(V4 v) { return _mm_cvtss_f32(v); }
+inline float get_y(V4 v) { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))); }
+inline float get_z(V4 v) { return _mm_cvtss_f32(_mm_movehl_ps(v, v)); }
+inline float get_w(V4 v) { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))); }
+
+inline V4 splat_x(V4 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)); }
+inline V4 splat_y(V4 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)); }
+inline V4 splat_z(V4 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2)); }
+inline V4 splat_w(V4 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)); }
+
+inline V4 add(V4 a, V4 b) { return _mm_add_ps(a, b); }
+inline V4 sub(V4 a, V4 b) { return _mm_sub_ps(a, b); }
+inline V4 mul(V4 a, V4 b) { return _mm_mul_ps(a, b); }
+inline V4 div(V4 a, V4 b) { return _mm_div_ps(a, b); }
+// a * b + c
+#if VM_FMA
+inline V4 madd(V4 a, V4 b, V4 c) { return _mm_fmadd_ps(a, b, c); }
+#else
+inline V4 madd(V4 a, V4 b, V4 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+#endif
+inline V4 scale(V4 a, float s) { return _mm_mul_ps(a, _mm_set1_ps(s)); }
+inline V4 neg(V4 a) { return _mm_sub_ps(_mm_setzero_ps(), a); }
+inline V4 abs(V4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+inline V4 min(V4 a, V4 b) { return _mm_min_ps(a, b); }
+inline V4 max(V4 a, V4 b) { return _mm_max_ps(a, b); }
+inline V4 sqrt(V4 a) { return _mm_sqrt_ps(a); }
+inline V4 rsqrt(V4 a) { return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(a)); }
+// Estimate refined by one Newton step, rel. error < 2.5e-7 (exact rsqrt: ~1e-7).
+// Shorter latency than sqrt + div, throughput is about the same
+inline V4 rsqrt_fast(V4 a) {
+	V4 r = _mm_rsqrt_ps(a);
+	V4 rr = _mm_mul_ps(_mm_mul_ps(a, r), r);
+	return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), r), _mm_sub_ps(_mm_set1_ps(3.0f), rr));
+}
+#if VM_SSE4
+inline V4 floor(V4 a) { return _mm_floor_ps(a); }
+#else
+// Valid for |a| < 2^31
+inline V4 floor(V4 a) {
+	V4 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+}
+#endif
+
+inline V4 less(V4 a, V4 b) { return _mm_cmplt_ps(a, b); }
+inline V4 less_eq(V4 a, V4 b) { return _mm_cmple_ps(a, b); }
+inline V4 greater(V4 a, V4 b) { return _mm_cmpgt_ps(a, b); }
+inline V4 greater_eq(V4 a, V4 b) { return _mm_cmpge_ps(a, b); }
+inline V4 mask_and(V4 a, V4 b) { return _mm_and_ps(a, b); }
+inline V4 mask_or(V4 a, V4 b) { return _mm_or_ps(a, b); }
+inline V4 mask_true() { return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+// Per-lane mask (sign bits) as 4 bits
+inline int mask_bits(V4 m) { return _mm_movemask_ps(m); }
+// Takes b where mask is set, a otherwise
+#if VM_SSE4
+inline V4 select(V4 a, V4 b, V4 mask) { return _mm_blendv_ps(a, b, mask); }
+#else
+inline V4 select(V4 a, V4 b, V4 mask) { return _mm_or_ps(_mm_andnot_ps(mask, a), _mm_and_ps(mask, b)); }
+#endif
+
+#if VM_SSE4
+inline V4 dot3(V4 a, V4 b) { return _mm_dp_ps(a, b, 0x7F); }
+inline V4 dot4(V4 a, V4 b) { return _mm_dp_ps(a, b, 0xFF); }
+#else
+inline V4 dot3(V4 a, V4 b) {
+	V4 m = _mm_mul_ps(a, b);
+	V4 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+	s = _mm_add_ss(s, _mm_movehl_ps(m, m));
+	return _mm_shuffle_ps(s, s, _MM_SHUFFLE(0, 0, 0, 0));
+}
+inline V4 dot4(V4 a, V4 b) {
+	V4 m = _mm_mul_ps(a, b);
+	V4 s = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+#endif
+
+inline V4 cross3(V4 a, V4 b) {
+	V4 a1 = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	V4 b1 = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+	V4 c = _mm_sub_ps(_mm_mul_ps(a, b1), _mm_mul_ps(a1, b));
+	return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+inline V4 set_w(V4 v, float w) {
+	V4 t = _mm_unpacklo_ps(_mm_movehl_ps(v, v), _mm_set_ss(w)); // z, w, ?, ?
+	return _mm_movelh_ps(v, t);
+}
+
+// 4x4 transpose in registers, turns 4 AoS vectors into SoA and back
+inline void transpose4(V4& a, V4& b, V4& c, V4& d) {
+	_MM_TRANSPOSE4_PS(a, b, c, d);
+}
+
+#else // VM_SCALAR
+
+inline V4 set(float x, float y, float z, float w) { V4 r = { { x, y, z, w } }; return r; }
+inline V4 splat(float f) { return set(f, f, f, f); }
+inline V4 zero() { return splat(0.0f); }
+inline V4 load4(float const* p) { return set(p[0], p[1], p[2], p[3]); }
+inline void store4(float* p, V4 v) { ::memcpy(p, v.f, sizeof(v.f)); }
+inline V4 load3(float const* p) { return set(p[0], p[1], p[2], 0.0f); }
+inline void store3(float* p, V4 v) { ::memcpy(p, v.f, sizeof(float) * 3); }
+
+inline float get_x(V4 v) { return v.f[0]; }
+inline float get_y(V4 v) { return v.f[1]; }
+inline float get_z(V4 v) { return v.f[2]; }
+inline float get_w(V4 v) { return v.f[3]; }
+
+inline V4 splat_x(V4 v) { return splat(v.f[0]); }
+inline V4 splat_y(V4 v) { return splat(v.f[1]); }
+inline V4 splat_z(V4 v) { return splat(v.f[2]); }
+inline V4 splat_w(V4 v) { return splat(v.f[3]); }
+
+#define VM_SCALAR_OP2(name, expr) \
+	inline V4 name(V4 a, V4 b) { V4 r; for (int i = 0; i < 4; ++i) { float x = a.f[i]; float y = b.f[i]; r.f[i] = (expr); } return r; }
+#define VM_SCALAR_OP1(name, expr) \
+	inline V4 name(V4 a) { V4 r; for (int i = 0; i < 4; ++i) { float x = a.f[i]; r.f[i] = (expr); } return r; }
+
+inline float mask_val(bool b) {
+	uint32_t m = b ? 0xFFFFFFFFU : 0U;
+	float f;
+	::memcpy(&f, &m, sizeof(f));
+	return f;
+}
+inline uint32_t mask_u32(float f) {
+	uint32_t m;
+	::memcpy(&m, &f, sizeof(m));
+	return m;
+}
+inline float mask_f32(uint32_t m) {
+	float f;
+	::memcpy(&f, &m, sizeof(f));
+	return f;
+}
+
+VM_SCALAR_OP2(add, x + y)
+VM_SCALAR_OP2(sub, x - y)
+VM_SCALAR_OP2(mul, x * y)
+VM_SCALAR_OP2(div, x / y)
+VM_SCALAR_OP2(min, x < y ? x : y)
+VM_SCALAR_OP2(max, x > y ? x : y)
+VM_SCALAR_OP2(less, mask_val(x < y))
+VM_SCALAR_OP2(less_eq, mask_val(x <= y))
+VM_SCALAR_OP2(greater, mask_val(x > y))
+VM_SCALAR_OP2(greater_eq, mask_val(x >= y))
+VM_SCALAR_OP2(mask_and, mask_f32(mask_u32(x) & mask_u32(y)))
+VM_SCALAR_OP2(mask_or, mask_f32(mask_u32(x) | mask_u32(y)))
+VM_SCALAR_OP1(neg, -x)
+VM_SCALAR_OP1(abs, ::fabsf(x))
+VM_SCALAR_OP1(sqrt, ::sqrtf(x))
+VM_SCALAR_OP1(rsqrt, 1.0f / ::sqrtf(x))
+VM_SCALAR_OP1(rsqrt_fast, 1.0f / ::sqrtf(x))
+VM_SCALAR_OP1(floor, ::floorf(x))
+
+#undef VM_SCALAR_OP1
+#undef VM_SCALAR_OP2
+
+inline V4 madd(V4 a, V4 b, V4 c) { return add(mul(a, b), c); }
+inline V4 scale(V4 a, float s) { return mul(a, splat(s)); }
+inline V4 mask_true() { return splat(mask_val(true)); }
+inline int mask_bits(V4 m) {
+	int bits = 0;
+	for (int i = 0; i < 4; ++i) {
+		bits |= (int)(mask_u32(m.f[i]) >> 31) << i;
+	}
+	return bits;
+}
+inline V4 select(V4 a, V4 b, V4 mask) {
+	V4 r;
+	for (int i = 0; i < 4; ++i) {
+		r.f[i] = (mask_u32(mask.f[i]) & 0x80000000U) ? b.f[i] : a.f[i];
+	}
+	return r;
+}
+
+inline V4 dot3(V4 a, V4 b) { return splat(a.f[0] * b.f[0] + a.f[1] * b.f[1] + a.f[2] * b.f[2]); }
+inline V4 dot4(V4 a, V4 b) { return splat(a.f[0] * b.f[0] + a.f[1] * b.f[1] + a.f[2] * b.f[2] + a.f[3] * b.f[3]); }
+
+inline V4 cross3(V4 a, V4 b) {
+	return set(
+		a.f[1] * b.f[2] - a.f[2] * b.f[1],
+		a.f[2] * b.f[0] - a.f[0] * b.f[2],
+		a.f[0] * b.f[1] - a.f[1] * b.f[0],
+		0.0f);
+}
+
+inline V4 set_w(V4 v, float w) { v.f[3] = w; return v; }
+
+inline void transpose4(V4& a, V4& b, V4& c, V4& d) {
+	V4 r[4] = { a, b, c, d };
+	a = set(r[0].f[0], r[1].f[0], r[2].f[0], r[3].f[0]);
+	b = set(r[0].f[1], r[1].f[1], r[2].f[1], r[3].f[1]);
+	c = set(r[0].f[2], r[1].f[2], r[2].f[2], r[3].f[2]);
+	d = set(r[0].f[3], r[1].f[3], r[2].f[3], r[3].f[3]);
+}
+
+#endif
+
+
+inline V4 lerp(V4 a, V4 b, V4 t) { return madd(sub(b, a), t, a); }
+inline V4 lerp(V4 a, V4 b, float t) { return lerp(a, b, splat(t)); }
+
+inline V4 length_sq3(V4 v) { return dot3(v, v); }
+inline V4 length3(V4 v) { return sqrt(dot3(v, v)); }
+inline V4 normalize3(V4 v) { return mul(v, rsqrt(dot3(v, v))); }
+
+inline V4 point(V4 v) { return set_w(v, 1.0f); }
+inline V4 vector(V4 v) { return set_w(v, 0.0f); }
+
+
+// Fast approximations of the transcendental functions, 4 lanes at a time.
+// Max abs errors below are measured against double precision libm over the
+// stated input range (core_bench prints them). Call sites that need the
+// exact result keep using the libm versions: sin_cos, acos, atan2.
+
+// Cody-Waite reduction to [-pi/4, pi/4] with minimax polynomials (cephes sinf/cosf).
+// |x| <= 8192: abs error < 1e-7
+inline void sin_cos_fast(V4 x, V4* pSin, V4* pCos) {
+	V4 j = floor(madd(x, splat(2.0f / PI), splat(0.5f)));
+	V4 r = madd(j, splat(-1.5703125f), x);
+	r = madd(j, splat(-4.837512969970703125e-4f), r);
+	r = madd(j, splat(-7.54978995489188216e-8f), r);
+	V4 z = mul(r, r);
+
+	V4 ps = madd(splat(-1.9515295891e-4f), z, splat(8.3321608736e-3f));
+	ps = madd(ps, z, splat(-1.6666654611e-1f));
+	V4 s = madd(mul(ps, z), r, r);
+
+	V4 pc = madd(splat(2.443315711809948e-5f), z, splat(-1.388731625493765e-3f));
+	pc = madd(pc, z, splat(4.166664568298827e-2f));
+	V4 c = madd(mul(pc, z), z, madd(z, splat(-0.5f), splat(1.0f)));
+
+	// Quadrant q = j mod 4: (s, c) -> (c, -s) -> (-s, -c) -> (-c, s)
+	V4 q = sub(j, mul(floor(mul(j, splat(0.25f))), splat(4.0f)));
+	V4 odd = mask_or(less(abs(sub(q, splat(1.0f))), splat(0.5f)), greater(q, splat(2.5f)));
+	V4 sinNeg = greater(q, splat(1.5f));
+	V4 cosNeg = mask_and(greater(q, splat(0.5f)), less(q, splat(2.5f)));
+	V4 rs = select(s, c, odd);
+	V4 rc = select(c, s, odd);
+	*pSin = select(rs, neg(rs), sinNeg);
+	*pCos = select(rc, neg(rc), cosNeg);
+}
+
+// Cephes asinf polynomial, x is clamped to [-1, 1]. Abs error < 3.5e-7
+inline V4 acos_fast(V4 x) {
+	x = min(max(x, splat(-1.0f)), splat(1.0f));
+	V4 a = abs(x);
+	V4 big = greater(a, splat(0.5f));
+	V4 z = select(mul(a, a), mul(sub(splat(1.0f), a), splat(0.5f)), big);
+	V4 t = select(a, sqrt(z), big);
+	V4 p = madd(splat(4.2163199048e-2f), z, splat(2.4181311049e-2f));
+	p = madd(p, z, splat(4.5470025998e-2f));
+	p = madd(p, z, splat(7.4953002686e-2f));
+	p = madd(p, z, splat(1.6666752422e-1f));
+	V4 as = madd(mul(p, z), t, t);
+	// acos(|x|): 2 * asin(sqrt((1 - |x|) / 2)) or pi/2 - asin(|x|)
+	V4 r = select(sub(splat(0.5f * PI), as), add(as, as), big);
+	return select(r, sub(splat(PI), r), less(x, zero()));
+}
+
+// Cephes atanf with tan(pi/8), tan(3pi/8) reduction, then quadrant fixup.
+// atan2(0, 0) is 0 and y = -0 is treated as +0. Abs error < 3e-7
+inline V4 atan2_fast(V4 y, V4 x) {
+	V4 t = div(y, x);
+	V4 a = abs(t);
+	V4 hi = greater(a, splat(2.414213562373095f));
+	V4 mid = mask_and(greater(a, splat(0.4142135623730950f)), less_eq(a, splat(2.414213562373095f)));
+	V4 ra = select(select(a, div(sub(a, splat(1.0f)), add(a, splat(1.0f))), mid), div(splat(-1.0f), a), hi);
+	V4 y0 = select(select(zero(), splat(0.25f * PI), mid), splat(0.5f * PI), hi);
+	V4 z = mul(ra, ra);
+	V4 p = madd(splat(8.05374449538e-2f), z, splat(-1.38776856032e-1f));
+	p = madd(p, z, splat(1.99777106478e-1f));
+	p = madd(p, z, splat(-3.33329491539e-1f));
+	V4 r = add(y0, madd(mul(p, z), ra, ra));
+	r = select(r, neg(r), less(t, zero()));
+	// x < 0: shift by pi towards the sign of y
+	V4 yNeg = less(y, zero());
+	V4 shift = select(splat(PI), splat(-PI), yNeg);
+	r = select(r, add(r, shift), less(x, zero()));
+	V4 both0 = mask_and(mask_and(greater_eq(x, zero()), less_eq(x, zero())), mask_and(greater_eq(y, zero()), less_eq(y, zero())));
+	return select(r, zero(), both0);
+}
+
+// Per-lane libm versions with the same signatures
+inline void sin_cos(V4 x, V4* pSin, V4* pCos) {
+	float s[4], c[4];
+	for (int i = 0; i < 4; ++i) {
+		s[i] = ::sinf(get(x, i));
+		c[i] = ::cosf(get(x, i));
+	}
+	*pSin = load4(s);
+	*pCos = load4(c);
+}
+
+inline V4 acos(V4 x) {
+	return set(::acosf(get_x(x)), ::acosf(get_y(x)), ::acosf(get_z(x)), ::acosf(get_w(x)));
+}
+
+inline V4 atan2(V4 y, V4 x) {
+	return set(::atan2f(get_x(y), get_x(x)), ::atan2f(get_y(y), get_y(x)),
+		::atan2f(get_z(y), get_z(x)), ::atan2f(get_w(y), get_w(x)));
+}
+
+
+// Quaternions
+
+// Rotation by a followed by rotation by b, same as XMQuaternionMultiply(a, b)
+inline V4 quat_mul(V4 a, V4 b) {
+	float ax = get_x(a), ay = get_y(a), az = get_z(a), aw = get_w(a);
+	float bx = get_x(b), by = get_y(b), bz = get_z(b), bw = get_w(b);
+	return set(
+		bw * ax + bx * aw + by * az - bz * ay,
+		bw * ay - bx * az + by * aw + bz * ax,
+		bw * az + bx * ay - by * ax + bz * aw,
+		bw * aw - bx * ax - by * ay - bz * az);
+}
+
+inline V4 quat_identity() { return set(0.0f, 0.0f, 0.0f, 1.0f); }
+inline V4 quat_normalize(V4 q) { return mul(q, rsqrt(dot4(q, q))); }
+inline V4 quat_conjugate(V4 q) { return mul(q, set(-1.0f, -1.0f, -1.0f, 1.0f)); }
+
+// axis must be normalized
+inline V4 quat_rotation_normal(V4 axis, float angle) {
+	float s = ::sinf(angle * 0.5f);
+	float c = ::cosf(angle * 0.5f);
+	return set_w(scale(axis, s), c);
+}
+
+inline V4 quat_rotation_axis(V4 axis, float angle) {
+	return quat_rotation_normal(normalize3(vector(axis)), angle);
+}
+
+V4 quat_slerp(V4 a, V4 b, float t);
+// quat_slerp on atan2_fast/sin_cos_fast, abs error vs quat_slerp < 5e-7 for unit quaternions
+V4 quat_slerp_fast(V4 a, V4 b, float t);
+V4 quat_from_mtx(M44 const& m);
+
+
+// Matrices
+
+inline M44 identity() {
+	M44 m;
+	m.r[0] = set(1.0f, 0.0f, 0.0f, 0.0f);
+	m.r[1] = set(0.0f, 1.0f, 0.0f, 0.0f);
+	m.r[2] = set(0.0f, 0.0f, 1.0f, 0.0f);
+	m.r[3] = set(0.0f, 0.0f, 0.0f, 1.0f);
+	return m;
+}
+
+inline M44 load_m44(float const* p) {
+	M44 m;
+	for (int i = 0; i < 4; ++i) {
+		m.r[i] = load4(p + i * 4);
+	}
+	return m;
+}
+
+inline void store_m44(float* p, M44 const& m) {
+	for (int i = 0; i < 4; ++i) {
+		store4(p + i * 4, m.r[i]);
+	}
+}
+
+// v * m with full 4 components
+inline V4 transform4(V4 v, M44 const& m) {
+	V4 r = mul(splat_x(v), m.r[0]);
+	r = madd(splat_y(v), m.r[1], r);
+	r = madd(splat_z(v), m.r[2], r);
+	return madd(splat_w(v), m.r[3], r);
+}
+
+// Point: w is taken as 1
+inline V4 transform_point(V4 v, M44 const& m) {
+	V4 r = madd(splat_x(v), m.r[0], m.r[3]);
+	r = madd(splat_y(v), m.r[1], r);
+	return madd(splat_z(v), m.r[2], r);
+}
+
+// Direction: w is taken as 0
+inline V4 transform_dir(V4 v, M44 const& m) {
+	V4 r = mul(splat_x(v), m.r[0]);
+	r = madd(splat_y(v), m.r[1], r);
+	return madd(splat_z(v), m.r[2], r);
+}
+
+// a then b, as XMMatrixMultiply(a, b)
+inline M44 mul(M44 const& a, M44 const& b) {
+	M44 m;
+	for (int i = 0; i < 4; ++i) {
+		m.r[i] = transform4(a.r[i], b);
+	}
+	return m;
+}
+
+inline M44 transpose(M44 const& m) {
+	M44 t;
+	for (int i = 0; i < 4; ++i) {
+		t.r[i] = set(get(m.r[0], i), get(m.r[1], i), get(m.r[2], i), get(m.r[3], i));
+	}
+	return t;
+}
+
+inline M44 scaling(V4 s) {
+	M44 m;
+	m.r[0] = set(get_x(s), 0.0f, 0.0f, 0.0f);
+	m.r[1] = set(0.0f, get_y(s), 0.0f, 0.0f);
+	m.r[2] = set(0.0f, 0.0f, get_z(s), 0.0f);
+	m.r[3] = set(0.0f, 0.0f, 0.0f, 1.0f);
+	return m;
+}
+
+inline M44 translation(V4 t) {
+	M44 m = identity();
+	m.r[3] = point(t);
+	return m;
+}
+
+// Same as XMMatrixRotationQuaternion
+inline M44 rotation_quat(V4 q) {
+	float x = get_x(q), y = get_y(q), z = get_z(q), w = get_w(q);
+	float xx = x * x * 2.0f, yy = y * y * 2.0f, zz = z * z * 2.0f;
+	float xy = x * y * 2.0f, xz = x * z * 2.0f, yz = y * z * 2.0f;
+	float wx = w * x * 2.0f, wy = w * y * 2.0f, wz = w * z * 2.0f;
+	M44 m;
+	m.r[0] = set(1.0f - yy - zz, xy + wz, xz - wy, 0.0f);
+	m.r[1] = set(xy - wz, 1.0f - xx - zz, yz + wx, 0.0f);
+	m.r[2] = set(xz + wy, yz - wx, 1.0f - xx - yy, 0.0f);
+	m.r[3] = set(0.0f, 0.0f, 0.0f, 1.0f);
+	return m;
+}
+
+inline M44 rotation_axis(V4 axis, float angle) {
+	return rotation_quat(quat_rotation_axis(axis, angle));
+}
+
+// scale, then rotate, then translate
+inline M44 affine(V4 scl, V4 quat, V4 pos) {
+	M44 m = rotation_quat(quat);
+	m.r[0] = mul(m.r[0], splat_x(scl));
+	m.r[1] = mul(m.r[1], splat_y(scl));
+	m.r[2] = mul(m.r[2], splat_z(scl));
+	m.r[3] = point(pos);
+	return m;
+}
+
+M44 inverse(M44 const& m);
+
+} // namespace nVM
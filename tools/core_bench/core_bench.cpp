@@ -0,0 +1,316 @@
+#include <memory>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+
+#include "../../src/common.hpp"
+#include "../../src/vmath.hpp"
+#include "../../src/math.hpp"
+#include "../../src/rig.hpp"
+#include "../../src/rig_batch.hpp"
+#include "../../src/anim.hpp"
+#include "../../src/skin_cpu.hpp"
+#include "../../src/thread_pool.hpp"
+
+// Headless benchmark of the CPU animation paths on a procedural rig,
+// needs no assets and no renderer, so it runs on any build machine.
+
+class cTimer {
+	std::chrono::high_resolution_clock::time_point mStart;
+public:
+	cTimer() : mStart(std::chrono::high_resolution_clock::now()) {}
+
+	double elapsed_sec() const {
+		auto now = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double>(now - mStart).count();
+	}
+};
+
+struct sBenchVtx {
+	vec3 pos;
+	vec3 nrm;
+	vec4 tgt;
+	vec4i jidx;
+	vec4 jwgt;
+};
+
+static void print_result(cstr name, double sec, double items, int iterations, cstr unit) {
+	std::cout << std::left << std::setw(16) << name.p << std::right << std::fixed
+		<< std::setw(10) << std::setprecision(3) << sec * 1000.0 / iterations << " ms/iter"
+		<< std::setw(12) << std::setprecision(1) << items * iterations / sec / 1000.0 << " K" << unit.p << "/s" << std::endl;
+}
+
+// Spine of chainLen joints with 4 limbs of chainLen joints hanging off every other spine joint.
+static bool build_rig(cRigData& rigData, int chainLen) {
+	std::vector<sJointData> joints;
+	std::vector<nVM::M44> lmtx;
+	std::vector<std::string> names;
+
+	auto addJoint = [&](int parIdx, float x, float y, float z) {
+		int idx = (int)joints.size();
+		joints.push_back({ idx, parIdx, idx });
+		nVM::V4 q = nVM::quat_rotation_axis(nVM::set(0.3f, 1.0f, 0.2f, 0.0f), 0.05f * idx);
+		lmtx.push_back(nVM::affine(nVM::splat(1.0f), q, nVM::set(x, y, z, 1.0f)));
+		names.push_back("jnt" + std::to_string(idx));
+		return idx;
+	};
+
+	int par = addJoint(-1, 0.0f, 1.0f, 0.0f);
+	for (int i = 1; i < chainLen; ++i) {
+		par = addJoint(par, 0.0f, 0.1f, 0.0f);
+		if (i % 2) { continue; }
+		for (int limb = 0; limb < 4; ++limb) {
+			int lpar = par;
+			for (int j = 0; j < chainLen; ++j) {
+				lpar = addJoint(lpar, limb < 2 ? 0.1f : -0.1f, 0.0f, limb % 2 ? 0.1f : -0.1f);
+			}
+		}
+	}
+
+	// Inverse bind matrices from the rest pose
+	const int jointsNum = (int)joints.size();
+	std::vector<nVM::M44> wmtx(jointsNum);
+	std::vector<nVM::M44> imtx(jointsNum);
+	for (int i = 0; i < jointsNum; ++i) {
+		int parIdx = joints[i].parIdx;
+		wmtx[i] = parIdx >= 0 ? nVM::mul(lmtx[i], wmtx[parIdx]) : lmtx[i];
+		imtx[i] = nVM::inverse(wmtx[i]);
+	}
+
+	return rigData.init(jointsNum, joints.data(), lmtx.data(), jointsNum, imtx.data(), names.data());
+}
+
+// Linear translation and quaternion channels for every joint.
+static void build_anim(cAnimationData& animData, cRigData const& rigData, int keysNum) {
+	const int jointsNum = rigData.get_joints_num();
+	const int channelsNum = jointsNum * 2;
+	animData.mpChannels = new cChannel[channelsNum];
+	animData.mChannelsNum = channelsNum;
+	animData.mLastFrame = (float)(keysNum - 1);
+	animData.mName = "bench";
+
+	for (int i = 0; i < channelsNum; ++i) {
+		auto& ch = animData.mpChannels[i];
+		const bool isRot = (i % 2) != 0;
+		const int compNum = isRot ? 4 : 3;
+
+		ch.mName = "jnt" + std::to_string(i / 2);
+		ch.mSubname = isRot ? "r" : "t";
+		ch.mType = isRot ? cChannel::E_CH_QUATERNION : cChannel::E_CH_COMMON;
+		ch.mExpr = isRot ? cChannel::E_EXPR_QLINEAR : cChannel::E_EXPR_LINEAR;
+		ch.mComponentsNum = compNum;
+		ch.mpKeyframesNum = new int[compNum];
+		ch.mpComponents = new sKeyframe*[compNum];
+
+		sKeyframe* pKfr = new sKeyframe[compNum * keysNum];
+		for (int c = 0; c < compNum; ++c) {
+			ch.mpKeyframesNum[c] = keysNum;
+			ch.mpComponents[c] = pKfr + c * keysNum;
+		}
+
+		for (int k = 0; k < keysNum; ++k) {
+			nVM::V4 val = isRot
+				? nVM::quat_rotation_axis(nVM::set(1.0f, 0.5f, 0.25f, 0.0f), 0.1f * k)
+				: nVM::set(0.0f, 0.1f, 0.01f * k, 0.0f);
+			for (int c = 0; c < compNum; ++c) {
+				ch.mpComponents[c][k] = { (float)k, nVM::get(val, c), 0.0f, 0.0f };
+			}
+		}
+	}
+}
+
+static void build_mesh(std::vector<sBenchVtx>& vtx, int vtxNum, int jointsNum) {
+	vtx.resize(vtxNum);
+	for (int i = 0; i < vtxNum; ++i) {
+		auto& v = vtx[i];
+		float f = (float)i / vtxNum;
+		v.pos = { f, 1.0f - f, 0.5f * f };
+		v.nrm = { 0.0f, 1.0f, 0.0f };
+		v.tgt = { { 1.0f, 0.0f, 0.0f, 1.0f } };
+		v.jidx = { { i % jointsNum, (i + 1) % jointsNum, (i + 7) % jointsNum, (i + 13) % jointsNum } };
+		v.jwgt = { { 0.4f, 0.3f, 0.2f, 0.1f } };
+	}
+}
+
+// Fast nVM approximations against per-lane libm: max abs error vs double and throughput.
+struct sMathCase {
+	cstr name;
+	float lo, hi;
+	void (*fast)(nVM::V4 x, nVM::V4 y, nVM::V4* pRes0, nVM::V4* pRes1);
+	void (*exact)(nVM::V4 x, nVM::V4 y, nVM::V4* pRes0, nVM::V4* pRes1);
+	double (*ref0)(double x, double y);
+	double (*ref1)(double x, double y);
+};
+
+static void print_math_result(cstr name, double fastSec, double exactSec, double err, double items) {
+	std::cout << std::left << std::setw(16) << name.p << std::right << std::fixed
+		<< std::setw(10) << std::setprecision(1) << items / fastSec * 1.0e-6 << " M/s fast"
+		<< std::setw(10) << std::setprecision(1) << items / exactSec * 1.0e-6 << " M/s libm"
+		<< std::setw(8) << std::setprecision(2) << exactSec / fastSec << "x"
+		<< "  max err " << std::scientific << std::setprecision(2) << err << std::fixed << std::endl;
+}
+
+static void run_math_bench(int iterations) {
+	static const sMathCase cases[] = {
+		{ "sin_cos", -8192.0f, 8192.0f,
+			[](nVM::V4 x, nVM::V4, nVM::V4* r0, nVM::V4* r1) { nVM::sin_cos_fast(x, r0, r1); },
+			[](nVM::V4 x, nVM::V4, nVM::V4* r0, nVM::V4* r1) { nVM::sin_cos(x, r0, r1); },
+			[](double x, double) { return ::sin(x); },
+			[](double x, double) { return ::cos(x); } },
+		{ "acos", -1.0f, 1.0f,
+			[](nVM::V4 x, nVM::V4, nVM::V4* r0, nVM::V4* r1) { *r0 = *r1 = nVM::acos_fast(x); },
+			[](nVM::V4 x, nVM::V4, nVM::V4* r0, nVM::V4* r1) { *r0 = *r1 = nVM::acos(x); },
+			[](double x, double) { return ::acos(x); },
+			[](double x, double) { return ::acos(x); } },
+		{ "atan2", -100.0f, 100.0f,
+			[](nVM::V4 x, nVM::V4 y, nVM::V4* r0, nVM::V4* r1) { *r0 = *r1 = nVM::atan2_fast(y, x); },
+			[](nVM::V4 x, nVM::V4 y, nVM::V4* r0, nVM::V4* r1) { *r0 = *r1 = nVM::atan2(y, x); },
+			[](double x, double y) { return ::atan2(y, x); },
+			[](double x, double y) { return ::atan2(y, x); } },
+		{ "rsqrt", 1.0e-3f, 1.0e3f,
+			[](nVM::V4 x, nVM::V4, nVM::V4* r0, nVM::V4* r1) { *r0 = *r1 = nVM::rsqrt_fast(x); },
+			[](nVM::V4 x, nVM::V4, nVM::V4* r0, nVM::V4* r1) { *r0 = *r1 = nVM::rsqrt(x); },
+			// relative error for rsqrt, the result spans 6 orders of magnitude
+			[](double x, double) { return 1.0 / ::sqrt(x); },
+			[](double x, double) { return 1.0 / ::sqrt(x); } },
+	};
+
+	const int valNum = 64 * 1024;
+	std::vector<float> xs(valNum);
+	std::vector<float> ys(valNum);
+	std::vector<float> res(valNum * 2);
+
+	for (auto const& mc : cases) {
+		::srand(1);
+		for (int i = 0; i < valNum; ++i) {
+			xs[i] = mc.lo + (mc.hi - mc.lo) * ((float)::rand() / RAND_MAX);
+			ys[i] = mc.lo + (mc.hi - mc.lo) * ((float)::rand() / RAND_MAX);
+		}
+
+		auto run = [&](void (*func)(nVM::V4, nVM::V4, nVM::V4*, nVM::V4*)) {
+			cTimer timer;
+			for (int it = 0; it < iterations; ++it) {
+				for (int i = 0; i < valNum; i += 4) {
+					nVM::V4 r0, r1;
+					func(nVM::load4(&xs[i]), nVM::load4(&ys[i]), &r0, &r1);
+					nVM::store4(&res[i], r0);
+					nVM::store4(&res[valNum + i], r1);
+				}
+			}
+			return timer.elapsed_sec();
+		};
+
+		double exactSec = run(mc.exact);
+		double fastSec = run(mc.fast);
+		const bool rel = mc.lo > 0.0f;
+		double err = 0.0;
+		for (int i = 0; i < valNum; ++i) {
+			double r0 = mc.ref0(xs[i], ys[i]);
+			double r1 = mc.ref1(xs[i], ys[i]);
+			double e0 = ::fabs(res[i] - r0);
+			double e1 = ::fabs(res[valNum + i] - r1);
+			if (rel) {
+				e0 /= r0;
+				e1 /= r1;
+			}
+			err = std::max(err, std::max(e0, e1));
+		}
+		print_math_result(mc.name, fastSec, exactSec, err, (double)valNum * iterations);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	int iterations = 200;
+	if (argc > 1) {
+		iterations = std::max(::atoi(argv[1]), 1);
+	}
+	const int instNum = 256;
+	const int vtxNum = 64 * 1024;
+
+	cRigData rigData;
+	if (!build_rig(rigData, 6)) {
+		std::cerr << "Unable to build rig" << std::endl;
+		return 1;
+	}
+	const int jointsNum = rigData.get_joints_num();
+
+	cAnimationData animData;
+	build_anim(animData, rigData, 32);
+	cAnimation anim;
+	anim.init(animData, rigData);
+
+	cRigPool rigPool(rigData);
+	std::unique_ptr<cRig[]> pRigs(new cRig[instNum]);
+	for (int i = 0; i < instNum; ++i) {
+		pRigs[i].init(&rigData, &rigPool);
+	}
+
+	cRigBatch batch;
+	batch.init(&rigData, instNum);
+
+	std::cout << "nVM backend: " << VM_BACKEND_NAME << ", rig instances: " << instNum
+		<< ", joints: " << jointsNum << ", iterations: " << iterations << std::endl;
+
+	cTimer animTimer;
+	for (int it = 0; it < iterations; ++it) {
+		float frame = (float)(it % 31) + 0.5f;
+		for (int i = 0; i < instNum; ++i) {
+			anim.eval(pRigs[i], frame);
+		}
+	}
+	print_result("anim eval", animTimer.elapsed_sec(), instNum, iterations, "inst");
+
+	cTimer localTimer;
+	for (int it = 0; it < iterations; ++it) {
+		for (int i = 0; i < instNum; ++i) {
+			pRigs[i].calc_local();
+		}
+	}
+	print_result("rig local", localTimer.elapsed_sec(), instNum, iterations, "inst");
+
+	cTimer worldTimer;
+	for (int it = 0; it < iterations; ++it) {
+		for (int i = 0; i < instNum; ++i) {
+			pRigs[i].calc_world();
+		}
+	}
+	print_result("rig world", worldTimer.elapsed_sec(), instNum, iterations, "inst");
+
+	cTimer batchTimer;
+	for (int it = 0; it < iterations; ++it) {
+		batch.calc_world();
+	}
+	print_result("rig batch", batchTimer.elapsed_sec(), instNum, iterations, "inst");
+
+	std::vector<nVM::M44> skinMtx(jointsNum);
+	int skinNum = pRigs[0].calc_skin(skinMtx.data(), jointsNum);
+
+	std::vector<sBenchVtx> vtx;
+	build_mesh(vtx, vtxNum, skinNum);
+	cSkinCPU skin;
+	skin.init(sSkinSrc::from_vtx(vtx.data(), (uint32_t)vtx.size()));
+
+	cThreadPool threadPool;
+	std::cout << "vertices: " << vtxNum << ", threads: " << threadPool.get_threads_num()
+		<< ", avx2: " << (cSkinCPU::has_avx2() ? "yes" : "no") << std::endl;
+
+	const int skinIterations = std::max(iterations / 4, 1);
+	cTimer skinTimer;
+	for (int it = 0; it < skinIterations; ++it) {
+		skin.skin(skinMtx.data(), skinNum, nullptr, cSkinCPU::E_KERNEL_SCALAR);
+	}
+	print_result("skin scalar", skinTimer.elapsed_sec(), vtxNum, skinIterations, "vtx");
+
+	cTimer skinMtTimer;
+	for (int it = 0; it < skinIterations; ++it) {
+		skin.skin(skinMtx.data(), skinNum, &threadPool, cSkinCPU::E_KERNEL_AUTO);
+	}
+	print_result("skin auto mt", skinMtTimer.elapsed_sec(), vtxNum, skinIterations, "vtx");
+
+	run_math_bench(std::max(iterations / 10, 1));
+
+	return 0;
+}
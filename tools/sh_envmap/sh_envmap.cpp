@@ -8,6 +8,7 @@
 
 #include "hdritools\RgbeIO.h"
 
+#include "../../src/vmath.hpp"
 #include "../../src/math.hpp"
 #include "../../src/common.hpp"
 #include "../../src/sh.hpp"
@@ -86,32 +87,37 @@ sSHCoef calc_sh_coef(pcg::Image<pcg::Rgb32F, pcg::TopDown> const& angular) {
 	float W = (float)w;
 	float H = (float)h;
 
-	auto sinc = [](float x) {
-		if (::fabs(x) < 1e-4) { return 1.0f; }
-		return ::sinf(x) / x;
-	};
+	const float dOmegaBase = (2 * PI / W) * (2 * PI / H);
 
+	// get_angular_polar/get_angular_world/sinc for 4 columns at a time
 	for (int row = 0; row < h; ++row) {
-		for (int col = 0; col < w; ++col) {
-			float u = (col - wHalf) / wHalf;
-			float v = (row - hHalf) / hHalf;
+		nVM::V4 v = nVM::splat((row - hHalf) / hHalf);
+		for (int col = 0; col < w; col += 4) {
+			nVM::V4 u = nVM::div(nVM::sub(nVM::set((float)col, (float)col + 1, (float)col + 2, (float)col + 3), nVM::splat(wHalf)), nVM::splat(wHalf));
+			nVM::V4 uvLenSq = nVM::madd(u, u, nVM::mul(v, v));
+			int inside = nVM::mask_bits(nVM::less_eq(uvLenSq, nVM::splat(1.0f)));
+			if (!inside) { continue; }
 
-			if (u*u + v*v > 1.0f) { continue; }
+			nVM::V4 theta = nVM::atan2_fast(nVM::neg(v), u);
+			nVM::V4 phi = nVM::scale(nVM::sqrt(uvLenSq), PI);
+			nVM::V4 sinPhi, cosPhi, sinTheta, cosTheta;
+			nVM::sin_cos_fast(phi, &sinPhi, &cosPhi);
+			nVM::sin_cos_fast(theta, &sinTheta, &cosTheta);
+			nVM::V4 sincPhi = nVM::select(nVM::div(sinPhi, phi), nVM::splat(1.0f), nVM::less(phi, nVM::splat(1e-4f)));
 
-			polar p = get_angular_polar(uv_11{ u, v });
-			vec3 world = get_angular_world(p);
+			for (int i = 0; i < 4 && col + i < w; ++i) {
+				if (!(inside & (1 << i))) { continue; }
 
-			//Rgb32F c = { (world.x + 1) * 0.5f, (world.y + 1) * 0.5f, (world.z + 1) * 0.5f };
-			//Rgb32F c = { world.x + 10, world.y + 10, world.z + 10 };
-			//angular.ElementAt(col, row) = c;
+				float sPhi = nVM::get(sinPhi, i);
+				// z is already flipped: -(-cosPhi)
+				vec3 world = { sPhi * nVM::get(cosTheta, i), sPhi * nVM::get(sinTheta, i), nVM::get(cosPhi, i) };
 
-			world.z = -world.z;
+				Rgb32F c = angular.ElementAt(col + i, row);
 
-			Rgb32F c = angular.ElementAt(col, row);
+				float dOmega = dOmegaBase * nVM::get(sincPhi, i);
 
-			float dOmega = (2 * PI / W) * (2 * PI / H) * sinc(p.phi);
-			
-			sh.addProbeSample(world, c.r, c.g, c.b, dOmega);
+				sh.addProbeSample(world, c.r, c.g, c.b, dOmega);
+			}
 		}
 	}
 
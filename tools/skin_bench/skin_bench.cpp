@@ -0,0 +1,139 @@
+#include <memory>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+#include "../../src/common.hpp"
+#include "../../src/vmath.hpp"
+#include "../../src/math.hpp"
+#include "../../src/rdr.hpp"
+#include "../../src/model.hpp"
+#include "../../src/rig.hpp"
+#include "../../src/rig_batch.hpp"
+#include "../../src/assimp_loader.hpp"
+#include "../../src/skin_cpu.hpp"
+#include "../../src/thread_pool.hpp"
+
+#define OBJPATH "../data/unreal_puppet/"
+
+class cTimer {
+	LARGE_INTEGER mFreq;
+	LARGE_INTEGER mStart;
+public:
+	cTimer() {
+		::QueryPerformanceFrequency(&mFreq);
+		::QueryPerformanceCounter(&mStart);
+	}
+
+	double elapsed_sec() const {
+		LARGE_INTEGER now;
+		::QueryPerformanceCounter(&now);
+		return (double)(now.QuadPart - mStart.QuadPart) / (double)mFreq.QuadPart;
+	}
+};
+
+static void run_bench(cstr name, cSkinCPU& skin, nVM::M44 const* pSkin, int skinNum,
+	cThreadPool* pPool, cSkinCPU::eKernel kernel, int iterations)
+{
+	// Warm up caches and pool threads
+	skin.skin(pSkin, skinNum, pPool, kernel);
+
+	cTimer timer;
+	for (int i = 0; i < iterations; ++i) {
+		skin.skin(pSkin, skinNum, pPool, kernel);
+	}
+	double sec = timer.elapsed_sec();
+
+	double skinsPerSec = iterations / sec;
+	double mvtxPerSec = skinsPerSec * skin.get_vtx_num() / 1.0e6;
+	std::cout << std::left << std::setw(16) << name.p << std::right << std::fixed
+		<< std::setw(10) << std::setprecision(3) << sec * 1000.0 / iterations << " ms/skin"
+		<< std::setw(12) << std::setprecision(1) << skinsPerSec << " skins/s"
+		<< std::setw(10) << std::setprecision(1) << mvtxPerSec << " Mvtx/s" << std::endl;
+}
+
+static void print_rig_result(cstr name, double sec, int instNum, int iterations) {
+	std::cout << std::left << std::setw(16) << name.p << std::right << std::fixed
+		<< std::setw(10) << std::setprecision(3) << sec * 1000.0 / iterations << " ms/update"
+		<< std::setw(12) << std::setprecision(1) << (double)instNum * iterations / sec / 1000.0 << " Kinst/s" << std::endl;
+}
+
+static void run_rig_bench(cRigData const& rigData, int instNum, int iterations) {
+	cRigPool pool(rigData);
+	std::unique_ptr<cRig[]> pRigs(new cRig[instNum]);
+	for (int i = 0; i < instNum; ++i) {
+		pRigs[i].init(&rigData, &pool);
+	}
+
+	cRigBatch batch;
+	batch.init(&rigData, instNum);
+
+	std::cout << "rig instances: " << instNum << ", joints: " << rigData.get_joints_num() << std::endl;
+
+	cTimer rigTimer;
+	for (int it = 0; it < iterations; ++it) {
+		for (int i = 0; i < instNum; ++i) {
+			pRigs[i].calc_world();
+		}
+	}
+	print_rig_result("rig", rigTimer.elapsed_sec(), instNum, iterations);
+
+	cTimer batchTimer;
+	for (int it = 0; it < iterations; ++it) {
+		batch.calc_world();
+	}
+	print_rig_result("rig batch", batchTimer.elapsed_sec(), instNum, iterations);
+}
+
+int main(int argc, char* argv[]) {
+	int iterations = 1000;
+	if (argc > 1) {
+		iterations = std::max(::atoi(argv[1]), 1);
+	}
+
+	cAssimpLoader loader;
+	if (!loader.load_unreal_fbx(OBJPATH "SideScrollerSkeletalMesh.FBX")) {
+		std::cerr << "Unable to load mesh" << std::endl;
+		return 1;
+	}
+
+	cModelGeom geom;
+	cRigData rigData;
+	if (!geom.build(loader) || !rigData.load(loader)) {
+		std::cerr << "Unable to build mesh or rig" << std::endl;
+		return 2;
+	}
+
+	cRig rig;
+	rig.init(&rigData);
+
+	nVM::M44 skinMtx[sSkinCBuf::MAX_SKIN_MTX];
+	int skinNum = rig.calc_skin(skinMtx, LENGTHOF_ARRAY(skinMtx));
+
+	cSkinCPU skin;
+	skin.init(sSkinSrc::from_vtx(geom.mpVtx.get(), geom.mVtxNum));
+
+	cThreadPool pool;
+
+	std::cout << "vertices: " << geom.mVtxNum << ", joints: " << skinNum
+		<< ", threads: " << pool.get_threads_num()
+		<< ", avx2: " << (cSkinCPU::has_avx2() ? "yes" : "no")
+		<< ", iterations: " << iterations << std::endl;
+
+	run_bench("scalar", skin, skinMtx, skinNum, nullptr, cSkinCPU::E_KERNEL_SCALAR, iterations);
+	run_bench("scalar mt", skin, skinMtx, skinNum, &pool, cSkinCPU::E_KERNEL_SCALAR, iterations);
+	if (cSkinCPU::has_avx2()) {
+		run_bench("avx2", skin, skinMtx, skinNum, nullptr, cSkinCPU::E_KERNEL_AVX2, iterations);
+		run_bench("avx2 mt", skin, skinMtx, skinNum, &pool, cSkinCPU::E_KERNEL_AVX2, iterations);
+	}
+
+	run_rig_bench(rigData, 256, std::max(iterations / 10, 1));
+
+	return 0;
+}